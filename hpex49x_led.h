@@ -49,12 +49,20 @@ void setsystemled( int led_type, int state );
 size_t init_hpex49x_led(void);
 void set_acer_led( int led_type, int state, size_t led );
 void set_hpex_led( int led_type, int state, size_t led );
+size_t set_hpex_blink( size_t led, int state );
 size_t init_acer_altos_led(void);
 size_t init_h340_led(void);
 size_t init_h341_led(void);
 int ioledblue( size_t led_idx );
 int ioledred( size_t led_idx );
+struct hpled;
+void led_bay_bits( struct hpled *bay );
+void led_bays_off( void (*set_led)( int led_type, int state, size_t led ), int blink );
 void setgpioselinput( int bits1, int bits2 );
+void gpio_shadow_init(void);
+void gpio_queue( size_t reg, unsigned int bits, int state );
+void gpio_flush(void);
+void gpio_report(void);
 
 /* some constants and globals */
 unsigned int gpiobase; ///< I/O offset to LPC GPIO on the IHR9
@@ -109,6 +117,46 @@ enum {
 	// = 0x3C, ///< reserved
 };
 
+//////////////////////////////////////////////////////////////////////////
+//// LED bits a bay map may use on each platform
+enum {
+	ICH9_LED_MIN = 0,	///< GP_LVL bit 0
+	ICH9_LED_MAX = 60,	///< GP_LVL2 bit 28 - GPIO 60
+	SCH5127_LED_MIN = 0x10,	///< GP1 bit 0
+	SCH5127_LED_MAX = 0x67,	///< GP6 bit 7 - see setgpregslvl()
+};
+
+//////////////////////////////////////////////////////////////////////////
+//// shadow registers - cached image of every LED output register
+enum shadow_regs {
+	SHADOW_GP_LVL = 0,	///< ICH9 GP_LVL [31:0]
+	SHADOW_GP_LVL2,		///< ICH9 GP_LVL2 [60:32]
+	SHADOW_GPO_BLINK,	///< ICH9 GPO_BLINK [31:0]
+	SHADOW_GP1,		///< SCH5127 GP1 - GP6 (8 bit)
+	SHADOW_GP2,
+	SHADOW_GP3,
+	SHADOW_GP4,
+	SHADOW_GP5,
+	SHADOW_GP6,
+	SHADOW_REGS,
+};
+
+struct gpio_shadow {
+	unsigned int port;	///< I/O port of the register
+	unsigned int val;	///< value the hardware holds
+	unsigned int set;	///< bits queued to be set
+	unsigned int clr;	///< bits queued to be cleared
+	int wide;		///< 1 = 32 bit outl(), 0 = 8 bit outb()
+};
+
+struct gpio_counters {
+	u_int64_t requests;	///< LED bit changes queued
+	u_int64_t flushes;	///< gpio_flush() calls
+	u_int64_t port_reads;	///< inl()/inb() issued against LED registers
+	u_int64_t port_writes;	///< outl()/outb() issued against LED registers
+	u_int64_t legacy_ops;	///< reads + writes the per-change read-modify-write path would have issued
+};
+
 //////////////////////////////////////////////////////////////////////////
 //// bit mappings for HP EX48x EX49x LEDs
 enum led_colors {
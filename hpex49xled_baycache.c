@@ -0,0 +1,241 @@
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_baycache.c
+///////
+/////// Bay cache - the disk to bay assignment of the last run, kept on disk so a
+/////// restart can light the LEDs without discovering the bays again
+///////
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+/////////////////////////////////////////////////////////////////////////////////
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+#if defined(__FreeBSD__)
+#include <sys/sysctl.h>
+#endif
+
+#include "hpex49xled_baycache.h"
+#include "hpex49xled_match.h"
+#include "hpex49xled_timer.h"
+
+struct baycache_counters baycache_stats;
+char baycache_errbuf[256];
+
+/////////////////////////////////////////////////////////////////////////
+/// the boot the device list generation belongs to - it starts over with every boot
+long long baycache_boot(void)
+{
+#if defined(__FreeBSD__)
+	struct timeval tv;
+	size_t len = sizeof(tv);
+
+	if ( sysctlbyname("kern.boottime", &tv, &len, NULL, 0) != 0 )
+		return -1;
+	return tv.tv_sec;
+#else
+	char line[128];
+	long long boot = -1;
+	FILE *f = fopen("/proc/stat", "r");
+
+	if ( f == NULL )
+		return -1;
+	while ( fgets(line, sizeof(line), f) != NULL )
+		if ( sscanf(line, "btime %lld", &boot) == 1 )
+			break;
+	fclose(f);
+	return boot;
+#endif
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// read dir/bays into c - see hpex49xled_baycache.h for the format. only checks the file
+/// itself, baycache_current() says whether it still describes the system
+int baycache_load( const char *dir, struct baycache *c )
+{
+	char path[1024], line[256];
+	int version = 0, lineno = 0, have = 0;
+	struct timespec t0, t1;
+	FILE *f;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	++baycache_stats.loads;
+	snprintf(path, sizeof(path), "%s/%s", dir, BAYCACHE_FILE);
+	memset(c, 0, sizeof(*c));
+	c->boot = c->generation = -1;
+
+	if ( (f = fopen(path, "r")) == NULL ) {
+		snprintf(baycache_errbuf, sizeof(baycache_errbuf), "%.160s: %s", path, strerror(errno));
+		return -1;
+	}
+	while ( fgets(line, sizeof(line), f) != NULL ) {
+		struct baycache_ent e;
+		char *hash = strchr(line, '#');
+
+		++lineno;
+		if ( hash ) *hash = '\0';
+		line[strcspn(line, "\r\n")] = '\0';
+		if ( line[strspn(line, " \t")] == '\0' )
+			continue;
+
+		memset(&e, 0, sizeof(e));
+		if ( !version ) {
+			if ( sscanf(line, "hpex49xled-bays %d", &version) != 1 || version != BAYCACHE_VERSION )
+				break;
+		}
+		else if ( sscanf(line, "boot %lld", &c->boot) == 1 )
+			have |= 1;
+		else if ( sscanf(line, "generation %ld", &c->generation) == 1 )
+			have |= 2;
+		else if ( sscanf(line, "map %zu %31[^\n]", &c->nbays, c->map) == 2 )
+			have |= 4;
+		else if ( sscanf(line, "bay %d %31s %15s %d %d %40[^\n]", &e.bay, e.dev, e.sim, &e.path_id, &e.target_id, e.ident) == 6 &&
+			e.bay >= 1 && e.bay <= BAYMAP_MAX_BAYS && c->nent < BAYMAP_MAX_BAYS ) {
+			if ( strcmp(e.ident, "-") == 0 )
+				e.ident[0] = '\0';
+			c->ent[c->nent++] = e;
+		}
+		else {
+			version = 0;
+			break;
+		}
+	}
+	fclose(f);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	baycache_stats.load_ns = timespec_diff_ns(&t1, &t0);
+
+	if ( version != BAYCACHE_VERSION || have != 7 ) {
+		snprintf(baycache_errbuf, sizeof(baycache_errbuf), "%.160s line %d: not a version %d bay cache", path, lineno, BAYCACHE_VERSION);
+		return -1;
+	}
+	return 0;
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// write c to dir/bays - beside the old file first and renamed over it, so a crash
+/// leaves the old cache or the new one and never half of either
+int baycache_save( const char *dir, const struct baycache *c )
+{
+	char path[1024], tmp[1024];
+	struct timespec t0, t1;
+	FILE *f;
+	int ok;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	snprintf(path, sizeof(path), "%s/%s", dir, BAYCACHE_FILE);
+	snprintf(tmp, sizeof(tmp), "%s/.%s.tmp", dir, BAYCACHE_FILE);
+
+	if ( mkdir(dir, 0755) != 0 && errno != EEXIST ) {
+		snprintf(baycache_errbuf, sizeof(baycache_errbuf), "%.160s: %s", dir, strerror(errno));
+		return -1;
+	}
+	if ( (f = fopen(tmp, "w")) == NULL ) {
+		snprintf(baycache_errbuf, sizeof(baycache_errbuf), "%.160s: %s", tmp, strerror(errno));
+		return -1;
+	}
+	fprintf(f, "hpex49xled-bays %d\n", BAYCACHE_VERSION);
+	fprintf(f, "# written by hpex49xled after each bay discovery - delete it to discover the bays again\n");
+	fprintf(f, "boot %lld\ngeneration %ld\nmap %zu %s\n", c->boot, c->generation, c->nbays, c->map);
+	for ( size_t i = 0; i < c->nent; i++ ) {
+		const struct baycache_ent *e = &c->ent[i];
+		fprintf(f, "bay %d %s %s %d %d %s\n", e->bay, e->dev, ( e->sim[0] ) ? e->sim : "*", e->path_id, e->target_id,
+			( e->ident[0] ) ? e->ident : "-");
+	}
+	ok = ( fflush(f) == 0 && fsync(fileno(f)) == 0 );
+	ok = ( fclose(f) == 0 ) && ok && ( rename(tmp, path) == 0 );
+	if ( !ok ) {
+		snprintf(baycache_errbuf, sizeof(baycache_errbuf), "%.160s: %s", path, strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	++baycache_stats.saves;
+	baycache_stats.save_ns = timespec_diff_ns(&t1, &t0);
+	return 0;
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// the cheap check - the boot and generation say no device came or went since the
+/// cache was written, and the bay map and match rules must still put every cached disk
+/// where the cache says. all of it from memory and the provider's snapshot
+int baycache_current( const struct baycache *c )
+{
+	struct timespec t0, t1;
+	size_t nselected;
+	int ok = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	const long long boot = baycache_boot();
+	const int *selected = devmatch_selected(&nselected);
+
+	if ( boot < 0 || c->boot != boot )
+		snprintf(baycache_errbuf, sizeof(baycache_errbuf), "written before the last boot");
+	else if ( c->generation != diskstats->generation() )
+		snprintf(baycache_errbuf, sizeof(baycache_errbuf), "devices came or went since - generation %ld, now %ld",
+			c->generation, diskstats->generation());
+	else if ( c->nbays != baymap.nbays || strcmp(c->map, baymap.name) != 0 )
+		snprintf(baycache_errbuf, sizeof(baycache_errbuf), "written for the %s bay map", c->map);
+	else {
+		ok = 1;
+		for ( size_t i = 0; i < c->nent && ok; i++ ) {
+			const struct baycache_ent *e = &c->ent[i];
+			const struct bayent *b = baymap_lookup(e->sim, e->path_id, e->target_id);
+			const int idx = diskstats->find(e->dev);
+			size_t s = 0;
+
+			while ( s < nselected && selected[s] != idx )
+				++s;
+			if ( b == NULL || b->bay != e->bay ) {
+				snprintf(baycache_errbuf, sizeof(baycache_errbuf), "bay %d is not %s path_id %d target_id %d in the bay map",
+					e->bay, e->sim, e->path_id, e->target_id);
+				ok = 0;
+			}
+			else if ( idx < 0 || s == nselected ) {
+				snprintf(baycache_errbuf, sizeof(baycache_errbuf), "%s is not a selected device", e->dev);
+				ok = 0;
+			}
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	baycache_stats.load_ns += timespec_diff_ns(&t1, &t0);
+	if ( ok )
+		++baycache_stats.hits;
+	return ok;
+};
+
+const struct baycache_ent *baycache_find( const struct baycache *c, const char *dev )
+{
+	for ( size_t i = 0; i < c->nent; i++ )
+		if ( strcmp(c->ent[i].dev, dev) == 0 )
+			return &c->ent[i];
+	return NULL;
+};
@@ -0,0 +1,92 @@
+#ifndef INCLUDED_HPEX49XLED_BAYCACHE
+#define INCLUDED_HPEX49XLED_BAYCACHE
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_baycache.h
+///////
+/////// Bay cache - the disk to bay assignment of the last run, kept on disk so a
+/////// restart can light the LEDs without discovering the bays again
+///////
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+/////////////////////////////////////////////////////////////////////////////////
+#include <sys/types.h>
+
+#include "hpex49xled_baymap.h"
+#include "hpex49xled_cam.h"
+#include "hpex49xled_stats.h"
+
+#define BAYCACHE_DIR "/var/db/hpex49xled" // default --cache-dir
+#define BAYCACHE_FILE "bays" // file in the cache directory
+#define BAYCACHE_VERSION 1 // first line of the file - anything else is not read
+
+/// one bay as the last discovery found it
+struct baycache_ent {
+	int bay;	///< 1 based - the hpled.HDD value
+	char dev[DISKSTATS_NAME_LEN];	///< "ada0"
+	char sim[BAYMAP_SIM_LEN];
+	int path_id;
+	int target_id;
+	char ident[CAMENUM_IDENT_LEN];	///< serial number - "" where CAM had none
+};
+
+/// the cache is keyed by the boot and the disk stats provider's generation - the same
+/// generation in the same boot means no device came or went since it was written
+struct baycache {
+	long long boot;	///< boot time in seconds since the epoch - a generation only counts within one boot
+	long generation;
+	char map[32];	///< bay map the bays were looked up in
+	size_t nbays;
+	size_t nent;
+	struct baycache_ent ent[BAYMAP_MAX_BAYS];
+};
+
+/// what loading and checking the cache cost
+struct baycache_counters {
+	u_int64_t loads;
+	u_int64_t hits;	///< loads the running system matched
+	u_int64_t saves;
+	long long load_ns;	///< last load plus its baycache_current()
+	long long save_ns;	///< last save
+};
+
+extern struct baycache_counters baycache_stats;
+extern char baycache_errbuf[256];
+
+/// file format, '#' starts a comment:
+///   hpex49xled-bays 1
+///   boot <seconds since the epoch>
+///   generation <n>
+///   map <nbays> <bay map name>
+///   bay <bay> <dev> <sim> <path_id> <target_id> <ident or ->
+int baycache_load( const char *dir, struct baycache *c );	///< 0 on success, -1 with the reason in baycache_errbuf
+int baycache_save( const char *dir, const struct baycache *c );	///< written beside the old file and renamed over it - 0 on success, -1 with the reason in baycache_errbuf
+/// 1 when c still describes the system - same boot, same generation, same bay map and every
+/// cached disk still a selected device in the provider's current snapshot. no device is
+/// opened. 0 with the reason in baycache_errbuf otherwise
+int baycache_current( const struct baycache *c );
+const struct baycache_ent *baycache_find( const struct baycache *c, const char *dev );	///< NULL if dev has no bay in c
+long long baycache_boot(void);	///< this boot's time in seconds since the epoch, -1 if unknown
+
+#endif //INCLUDED_HPEX49XLED_BAYCACHE
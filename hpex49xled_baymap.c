@@ -0,0 +1,229 @@
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_baymap.c
+///////
+/////// Bay map - CAM (sim, path_id, target_id) to bay and LED bits
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <err.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/types.h>
+
+#include "hpex49xled_baymap.h"
+
+struct baymap baymap;
+
+/////////////////////////////////////////////////////////////////////////
+/// build the lookup tables once the entries are in - both are plain arrays so a
+/// lookup is one index, never a walk of the map. returns 0 on success
+static int baymap_index( struct baymap *m )
+{
+	m->npath = m->ntarget = 1;
+	m->nbays = 0;
+
+	for ( size_t i = 0; i < m->nent; ++i ) {
+		if ( m->ent[i].path_id >= m->npath ) m->npath = m->ent[i].path_id + 1;
+		if ( m->ent[i].target_id >= m->ntarget ) m->ntarget = m->ent[i].target_id + 1;
+		if ( (size_t)m->ent[i].bay > m->nbays ) m->nbays = m->ent[i].bay;
+	}
+	m->lut = calloc((size_t)m->npath * m->ntarget, sizeof(*m->lut));
+	m->bybay = calloc(m->nbays + 1, sizeof(*m->bybay));
+	if ( m->lut == NULL || m->bybay == NULL )
+		return -1;
+
+	for ( size_t i = 0; i < m->nent; ++i ) {
+		const struct bayent *e = &m->ent[i];
+		short *slot = &m->lut[e->path_id * m->ntarget + e->target_id];
+
+		if ( *slot || m->bybay[e->bay] ) {
+			fprintf(stderr, "%s: bay %d or path_id %d target_id %d is in the map twice\n", m->name, e->bay, e->path_id, e->target_id);
+			return -1;
+		}
+		*slot = m->bybay[e->bay] = i + 1;
+	}
+	return 0;
+};
+/////////////////////////////////////////////////////////////////////////
+/// replace the current map - takes ownership of ent
+static int baymap_install( const char *name, struct bayent *ent, size_t nent )
+{
+	struct baymap m;
+
+	memset(&m, 0, sizeof(m));
+	snprintf(m.name, sizeof(m.name), "%s", name);
+	m.ent = ent;
+	m.nent = nent;
+
+	if ( nent == 0 || baymap_index(&m) != 0 ) {
+		if ( nent == 0 )
+			fprintf(stderr, "%s: no bays in the map\n", name);
+		free(m.lut);
+		free(m.bybay);
+		free(ent);
+		return -1;
+	}
+	baymap_free();
+	baymap = m;
+	return 0;
+};
+/////////////////////////////////////////////////////////////////////////
+/// LED bit from a map file - a number or '-' for no LED
+static int baymap_bit( const char *s, int *bit )
+{
+	char *end;
+
+	if ( strcmp(s, "-") == 0 ) {
+		*bit = -1;
+		return 0;
+	}
+	const long v = strtol(s, &end, 0);
+	if ( *end != '\0' || v < 0 || v > 255 )
+		return -1;
+	*bit = v;
+	return 0;
+};
+/////////////////////////////////////////////////////////////////////////
+/// load a map file - see hpex49xled_baymap.h for the format
+int baymap_load( const char *file )
+{
+	FILE *f = fopen(file, "r");
+	struct bayent *ent = NULL;
+	size_t nent = 0, cap = 0;
+	char line[256];
+	int lineno = 0;
+
+	if ( f == NULL ) {
+		fprintf(stderr, "Unable to open bay map %s: %s\n", file, strerror(errno));
+		return -1;
+	}
+	while ( fgets(line, sizeof(line), f) != NULL ) {
+		char sim[BAYMAP_SIM_LEN], blue[16], red[16];
+		struct bayent e;
+		char *hash = strchr(line, '#');
+
+		++lineno;
+		if ( hash ) *hash = '\0';
+		if ( line[strspn(line, " \t\r\n")] == '\0' )
+			continue;
+
+		memset(&e, 0, sizeof(e));
+		if ( sscanf(line, "%d %15s %d %d %15s %15s", &e.bay, sim, &e.path_id, &e.target_id, blue, red) != 6 ||
+			e.bay < 1 || e.bay > BAYMAP_MAX_BAYS || e.path_id < 0 || e.path_id >= BAYMAP_MAX_PATH ||
+			e.target_id < 0 || e.target_id >= BAYMAP_MAX_TARGET || baymap_bit(blue, &e.blue) != 0 || baymap_bit(red, &e.red) != 0 ) {
+			fprintf(stderr, "%s line %d: expected <bay> <sim> <path_id> <target_id> <blue> <red>\n", file, lineno);
+			fclose(f);
+			free(ent);
+			return -1;
+		}
+		snprintf(e.sim, sizeof(e.sim), "%s", sim);
+
+		if ( nent == cap ) {
+			cap = ( cap ) ? cap * 2 : 16;
+			struct bayent *grown = realloc(ent, cap * sizeof(*ent));
+			if ( grown == NULL )
+				err(1, "realloc failed in %s line %d", __FUNCTION__, __LINE__);
+			ent = grown;
+		}
+		ent[nent++] = e;
+	}
+	fclose(f);
+	return baymap_install(file, ent, nent);
+};
+/////////////////////////////////////////////////////////////////////////
+/// every LED bit in the map within lo - hi - a bit the platform can not drive would
+/// trip an assert in the LED writer or toggle some other GPIO. returns 0 when they all are
+static int baymap_bits( const char *platform, int lo, int hi )
+{
+	for ( size_t i = 0; i < baymap.nent; ++i ) {
+		const struct bayent *e = &baymap.ent[i];
+		const int bits[2] = { e->blue, e->red };
+
+		for ( int c = 0; c < 2; ++c ) {
+			if ( bits[c] >= 0 && ( bits[c] < lo || bits[c] > hi ) ) {
+				fprintf(stderr, "%s: bay %d %s LED bit %#x is outside %#x - %#x, the LED bits of the %s\n",
+					baymap.name, e->bay, ( c ) ? "red" : "blue", bits[c], lo, hi, platform);
+				return -1;
+			}
+		}
+	}
+	return 0;
+};
+/////////////////////////////////////////////////////////////////////////
+/// built in map - bay i + 1 on path_id i + 1, target 0, any SIM
+int baymap_platform( const char *name, const int *blue, const int *red, size_t n, int lo, int hi )
+{
+	struct bayent *ent;
+
+	if ( baymap.nent )
+		return baymap_bits(name, lo, hi); /* a map file wins over the built in layout */
+	if ( (ent = calloc(n, sizeof(*ent))) == NULL )
+		return -1;
+
+	for ( size_t i = 0; i < n; ++i ) {
+		snprintf(ent[i].sim, sizeof(ent[i].sim), "*");
+		ent[i].path_id = i + 1;
+		ent[i].target_id = 0;
+		ent[i].bay = i + 1;
+		ent[i].blue = blue[i];
+		ent[i].red = red[i];
+	}
+	if ( baymap_install(name, ent, n) != 0 )
+		return -1;
+	return baymap_bits(name, lo, hi);
+};
+/////////////////////////////////////////////////////////////////////////
+/// bay for a CAM device - O(1)
+const struct bayent *baymap_lookup( const char *sim, int path_id, int target_id )
+{
+	if ( path_id < 0 || path_id >= baymap.npath || target_id < 0 || target_id >= baymap.ntarget || baymap.lut == NULL )
+		return NULL;
+
+	const short i = baymap.lut[path_id * baymap.ntarget + target_id];
+	if ( i == 0 )
+		return NULL;
+
+	const struct bayent *e = &baymap.ent[i - 1];
+	return ( strcmp(e->sim, "*") == 0 || strcmp(e->sim, sim) == 0 ) ? e : NULL;
+};
+/////////////////////////////////////////////////////////////////////////
+/// entry for a bay number - O(1)
+const struct bayent *baymap_bay( size_t bay )
+{
+	if ( bay < 1 || bay > baymap.nbays || baymap.bybay[bay] == 0 )
+		return NULL;
+	return &baymap.ent[baymap.bybay[bay] - 1];
+};
+/////////////////////////////////////////////////////////////////////////
+void baymap_free(void)
+{
+	free(baymap.ent);
+	free(baymap.lut);
+	free(baymap.bybay);
+	memset(&baymap, 0, sizeof(baymap));
+};
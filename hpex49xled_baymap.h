@@ -0,0 +1,75 @@
+#ifndef INCLUDED_HPEX49XLED_BAYMAP
+#define INCLUDED_HPEX49XLED_BAYMAP
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_baymap.h
+///////
+/////// Bay map - which CAM path and target sits in which bay and which LED
+/////// bits light it, built in for each platform or loaded from a file
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+/////////////////////////////////////////////////////////////////////////////////
+#include <sys/types.h>
+
+#define BAYMAP_SIM_LEN 16 // CAM SIM name - ahcich, ata, mpr
+#define BAYMAP_MAX_BAYS 256 // most bays a map may describe
+#define BAYMAP_MAX_PATH 256 // path_id and target_id bound the lookup table
+#define BAYMAP_MAX_TARGET 64
+
+/// one bay - the disk at (sim, path_id, target_id) is bay "bay" and lights blue / red
+struct bayent {
+	char sim[BAYMAP_SIM_LEN];	///< SIM name, "*" matches any
+	int path_id;
+	int target_id;
+	int bay;	///< 1 based - the hpled.HDD value
+	int blue;	///< LED bit as the platform's set_led() takes it, -1 = no LED
+	int red;
+};
+
+struct baymap {
+	char name[32];	///< platform or file the map came from
+	size_t nbays;	///< highest bay number - the monitor has this many slots
+	size_t nent;
+	struct bayent *ent;
+	short *lut;	///< path_id * ntarget + target_id -> entry + 1, 0 = not a bay
+	short *bybay;	///< bay -> entry + 1
+	int npath, ntarget;	///< lut dimensions
+};
+
+extern struct baymap baymap;
+
+/// map file, one bay per line, '#' starts a comment. blue and red are LED bits in the
+/// platform's numbering (ICH9 GPIO number on the HP EX48x/EX49x) or '-' for none:
+///   <bay> <sim> <path_id> <target_id> <blue> <red>
+///   1     ahcich 1        0           22     4
+int baymap_load( const char *file );	///< 0 on success, -1 with the reason on stderr
+/// built in map for a platform whose bays n sit on path_id 1 - n, target 0 - only installed
+/// when no map was loaded from a file. every LED bit in the map in use must lie in lo - hi,
+/// the bits the platform can drive. returns 0 on success, -1 with the reason on stderr
+int baymap_platform( const char *name, const int *blue, const int *red, size_t n, int lo, int hi );
+const struct bayent *baymap_lookup( const char *sim, int path_id, int target_id );	///< NULL if not a bay
+const struct bayent *baymap_bay( size_t bay );	///< entry for a 1 based bay, NULL if the map has no such bay
+void baymap_free(void);
+
+#endif //INCLUDED_HPEX49XLED_BAYMAP
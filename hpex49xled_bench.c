@@ -0,0 +1,1671 @@
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_bench.c
+///////
+/////// Benchmark for the disk activity to LED path. Runs the real monitor
+/////// event loop against synthetic disk counters and the simulated register
+/////// file, and reports activity-to-LED latency, wakeups, snapshots per tick,
+/////// GPIO operations and CPU time for a set of workloads.
+///////
+/////// Runs on FreeBSD or Linux without the hardware:  make bench
+///////
+/////// -------------------------------------------------------------------------
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* RUSAGE_THREAD on Linux */
+#endif
+#include <stdio.h>
+#include <err.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#if defined(__FreeBSD__)
+#include <fcntl.h>
+#include <camlib.h>
+#include <sys/devicestat.h>
+#else
+/* sys/devicestat.h - the devstat providers hand device_type on as the kind */
+#define DEVSTAT_TYPE_DIRECT 0x000
+#define DEVSTAT_TYPE_IF_SCSI 0x010
+#define DEVSTAT_TYPE_IF_IDE 0x020
+#define DEVSTAT_TYPE_IF_OTHER 0x030
+#define DEVSTAT_TYPE_IF_NVME 0x040
+#define DEVSTAT_TYPE_PASS 0x100
+#endif
+
+#include "hpled.h"
+#include "hpex49xled_io.h"
+#include "hpex49xled_baycache.h"
+#include "hpex49xled_baymap.h"
+#include "hpex49xled_cam.h"
+#include "hpex49xled_delta.h"
+#include "hpex49xled_export.h"
+#include "hpex49xled_health.h"
+#include "hpex49xled_ledq.h"
+#include "hpex49xled_log.h"
+#include "hpex49xled_match.h"
+#include "hpex49xled_perf.h"
+#include "hpex49xled_rate.h"
+#include "hpex49xled_stats.h"
+#include "hpex49xled_timer.h"
+#include "hpex49xled_update.h"
+#include "hpex49xled_monitor.h"
+
+#define BENCH_MAX_BAYS 64 // most bays the synthetic provider models - the bay map sets how many are used
+#define BENCH_STEP 1000000 // generator step in nanoseconds
+#define BENCH_PLUG_MS 500 // hotplug scenario - the last bay detaches/attaches this often
+#define BENCH_ATTACH_MS 200 // attach scenario - the first disk appears this far into the run
+#define BENCH_ATTACH_GAP_MS 40 // attach scenario - the next disk follows this much later
+#define BENCH_CHUNK 65536 // bytes added per generator step on an active bay
+#define BENCH_KERNEL_TICKS 200000 // ticks per device count in the -k delta kernel microbenchmark
+#define BENCH_SCRAPE_MS 10 // -e - time between metrics scrapes
+#define BENCH_UPDATE_CHECKS 100000 // -u - in process checks timed
+#define BENCH_UPDATE_POPENS 100 // -u - popen() round trips timed, the old check's floor
+#define BENCH_CAM_ROUNDS 1000 // -c - bay discoveries timed
+#define BENCH_LOG_CALLS 1000 // -L - synchronous writes timed, one at a time
+#define BENCH_LOG_FLOOD 1000000 // -L - messages one class floods the rate limit with
+#define BENCH_HEALTH_CMD_US 2000 // -H - time the simulated disks take per ATA command
+#define BENCH_HEALTH_IO_US 100 // -H - one read on the simulated disk
+#define BENCH_HEALTH_IOS 1000 // -H - reads timed, one a millisecond
+#define BENCH_HEALTH_EVERY_MS 50 // -H - time between rounds while the reads are timed
+#define BENCH_POWER_IDLE 1 // -P - seconds without I/O before the tracker checks a disk, --standby in the daemon
+#define BENCH_PROCFS_MATCH "name=sd[a-z]|vd[a-z]|hd[a-z]|xvd[a-z]|nvme[0-9]n[0-9]|mmcblk[0-9]" // -d - whole disks, no partitions, loop or dm devices
+#define BENCH_POWER_WATCH_MS 4500 // -P - time the LEDs and the tick rate are watched, one STANDBY_PULSE and a bit
+
+/* ICH9 GPIO register offsets - see hpex49x_led.h */
+#define BENCH_GP_LVL 0x0C
+#define BENCH_GPO_BLINK 0x18
+#define BENCH_GP_LVL2 0x38
+
+/* SCH5127 GP1 - GP6 and the H341/H342 bay LEDs - see hpex49x_led.h */
+#define BENCH_REG_GP1 0x4B
+#define BENCH_GP_REGS 6
+
+/* globals the daemon normally provides */
+size_t debug = 0;
+size_t HP = 1;
+static int bench_bays = 0; /* bays in the bay map, up to BENCH_MAX_BAYS */
+static int bench_perf = 0; /* -p - dump the self instrumentation after each workload */
+static int bench_trace = 0; /* -w - record each workload as a trace the replay provider reads */
+extern const char *hardware;
+const char* desc(void) { return hardware; }
+
+extern size_t init_hpex49x_led(void);
+extern int ioledblue( size_t led_idx );
+extern int ioledred( size_t led_idx );
+extern unsigned int gpiobase, sch5127_regs;
+extern void gpio_shadow_init(void);
+extern void setgpregslvl( int bit, int state );
+
+static double ms_since( const struct timespec *t0 )
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - t0->tv_sec) * 1e3 + (now.tv_nsec - t0->tv_nsec) / 1e6;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// synthetic disks ada0 - ada3 - the generator thread moves the counters and
+/// the monitor reads them through this provider
+static struct {
+	pthread_mutex_t lock;
+	struct diskstat ds[BENCH_MAX_BAYS];
+	int present[BENCH_MAX_BAYS];
+	long generation;
+	long seen;
+	u_int64_t snapshots;
+	struct diskstat view[BENCH_MAX_BAYS];
+	int view_present[BENCH_MAX_BAYS];
+	FILE *trace;	/* -w - every snapshot in the stats trace format */
+	int traced[BENCH_MAX_BAYS];	/* present in the last traced snapshot */
+	struct timespec trace_t0;
+} synth = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static int synth_open( const char *arg ) { return 0; }
+static void synth_close(void) { }
+
+static int synth_snapshot(void)
+{
+	pthread_mutex_lock(&synth.lock);
+	memcpy(synth.view, synth.ds, sizeof(synth.view));
+	memcpy(synth.view_present, synth.present, sizeof(synth.view_present));
+	++synth.snapshots;
+	if ( synth.trace ) {
+		const u_int64_t msec = ms_since(&synth.trace_t0);
+
+		for ( int b = 0; b < bench_bays; ++b ) {
+			char name[DISKSTATS_NAME_LEN];
+
+			snprintf(name, sizeof(name), "ada%d", b);
+			if ( synth.view_present[b] )
+				diskstats_trace_line(synth.trace, msec, name, &synth.view[b]);
+			else if ( synth.traced[b] )
+				fprintf(synth.trace, "%ju %s detach\n", (uintmax_t)msec, name);
+			synth.traced[b] = synth.view_present[b];
+		}
+	}
+	const int changed = ( synth.generation != synth.seen );
+	synth.seen = synth.generation;
+	pthread_mutex_unlock(&synth.lock);
+	return changed;
+}
+
+static int synth_find( const char *dev )
+{
+	int unit;
+	if ( sscanf(dev, "ada%d", &unit) != 1 || unit < 0 || unit >= bench_bays || !synth.view_present[unit] )
+		return -1;
+	return unit;
+}
+
+static int synth_read( int idx, struct diskstat *ds )
+{
+	if ( idx < 0 || idx >= bench_bays || !synth.view_present[idx] ) return -1;
+	*ds = synth.view[idx];
+	return 0;
+}
+
+static int synth_count(void) { return bench_bays; }
+
+static const char *synth_device( int idx )
+{
+	static char name[DISKSTATS_NAME_LEN];
+
+	if ( idx < 0 || idx >= bench_bays || !synth.view_present[idx] ) return NULL;
+	snprintf(name, sizeof(name), "ada%d", idx);
+	return name;
+}
+
+/* SATA disks on AHCI - ada, as the HP EX49x has them and devstat reports them */
+static unsigned synth_kind( int idx ) { return DEVSTAT_TYPE_DIRECT | DEVSTAT_TYPE_IF_IDE; }
+
+static long synth_generation(void) { return synth.seen; }
+
+static const struct diskstats_ops diskstats_synth = {
+	.name = "synthetic",
+	.open = synth_open,
+	.close = synth_close,
+	.snapshot = synth_snapshot,
+	.find = synth_find,
+	.count = synth_count,
+	.device = synth_device,
+	.kind = synth_kind,
+	.read = synth_read,
+	.generation = synth_generation,
+};
+
+const struct diskstats_ops *diskstats = &diskstats_synth;
+
+/////////////////////////////////////////////////////////////////////////
+/// LED observer - every port write lands in the simulated register file and
+/// is then decoded back into per bay LED state for the timeline and latency
+static struct {
+	pthread_mutex_t lock;
+	int colour[BENCH_MAX_BAYS];	///< bit 0 blue, bit 1 red, bit 2 hardware blink
+	struct timespec pending[BENCH_MAX_BAYS];	///< first counter change while the LED was dark
+	double *lat;
+	size_t nlat, cap;
+	FILE *timeline;
+	struct timespec t0;
+	u_int64_t lit[BENCH_MAX_BAYS];	///< times a dark bay lit up
+} obs = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static struct portio_ops bench_io;
+
+static int bench_bit( unsigned int lvl, unsigned int lvl2, int bit )
+{
+	if ( bit < 0 )
+		return 1; /* no LED - reads as dark, the LEDs are active low */
+	return ( ( (bit < 32) ? lvl : lvl2 ) >> (bit % 32) ) & 0x1;
+}
+
+static void bench_observe(void)
+{
+	const unsigned int base = portio_sim_config.gpiobase;
+	const unsigned int lvl = portio_sim_peek(base + BENCH_GP_LVL);
+	const unsigned int lvl2 = portio_sim_peek(base + BENCH_GP_LVL2);
+	const unsigned int blink = portio_sim_peek(base + BENCH_GPO_BLINK);
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	pthread_mutex_lock(&obs.lock);
+
+	for ( int b = 0; b < bench_bays; ++b ) {
+		const int blue = ioledblue(b), red = ioledred(b);
+		/* LEDs are active low */
+		int colour = ( !bench_bit(lvl, lvl2, blue) ) | ( !bench_bit(lvl, lvl2, red) << 1 );
+		if ( (blue >= 0 && blue < 32 && (blink >> blue & 0x1)) || (red >= 0 && red < 32 && (blink >> red & 0x1)) )
+			colour |= 4;
+
+		if ( colour == obs.colour[b] )
+			continue;
+
+		if ( obs.colour[b] == 0 && obs.pending[b].tv_sec ) {
+			if ( obs.nlat == obs.cap ) {
+				obs.cap = ( obs.cap ) ? obs.cap * 2 : 4096;
+				if ( (obs.lat = realloc(obs.lat, obs.cap * sizeof(*obs.lat))) == NULL )
+					err(1, "realloc failed in %s line %d", __FUNCTION__, __LINE__);
+			}
+			obs.lat[obs.nlat++] = (now.tv_sec - obs.pending[b].tv_sec) * 1e3 + (now.tv_nsec - obs.pending[b].tv_nsec) / 1e6;
+			obs.pending[b].tv_sec = 0;
+		}
+		if ( obs.timeline ) {
+			static const char *names[] = { "off", "blue", "red", "purple" };
+			fprintf(obs.timeline, "%10.3f bay%d %s%s\n", ms_since(&obs.t0), b + 1, names[colour & 3], ( colour & 4 ) ? "+blink" : "");
+		}
+		obs.lit[b] += ( obs.colour[b] == 0 );
+		obs.colour[b] = colour;
+	}
+	pthread_mutex_unlock(&obs.lock);
+}
+
+static void bench_outl( unsigned int port, unsigned int val )
+{
+	portio_sim.outl(port, val);
+	bench_observe();
+}
+
+static void bench_outb( unsigned int port, unsigned int val )
+{
+	portio_sim.outb(port, val);
+	bench_observe();
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// workloads - deterministic so timelines can be compared run to run
+enum bench_plug {
+	PLUG_NONE,
+	PLUG_TOGGLE,	///< bay 4 detaches and attaches every BENCH_PLUG_MS
+	PLUG_ATTACH,	///< no disks at start, then all four attach BENCH_ATTACH_GAP_MS apart
+};
+
+struct scenario {
+	const char *name;
+	int (*active)(int bay, double ms);	///< 1 = read, 2 = write, 3 = both, 0 = idle
+	enum bench_plug hotplug;
+};
+
+static int wl_idle( int bay, double ms ) { return 0; }
+
+/* each bay bursts for 100 ms once a second, staggered by 250 ms */
+static int wl_bursty( int bay, double ms )
+{
+	const long t = ((long)ms + bay * 250) % 1000;
+	return ( t < 100 ) ? 1 + (bay & 1) : 0;
+}
+
+/* bay 1 writes for 20 ms every 1.3 s - long enough idle gaps to reach the backoff ceiling */
+static int wl_sparse( int bay, double ms )
+{
+	return ( bay == 0 && (long)ms % 1300 < 20 ) ? 2 : 0;
+}
+
+/* all four bays reading and writing flat out */
+static int wl_stream( int bay, double ms ) { return 3; }
+
+static const struct scenario scenarios[] = {
+	{ "idle", wl_idle, PLUG_NONE },
+	{ "bursty", wl_bursty, PLUG_NONE },
+	{ "sparse", wl_sparse, PLUG_NONE },
+	{ "stream", wl_stream, PLUG_NONE },
+	{ "hotplug", wl_bursty, PLUG_TOGGLE },
+	{ "attach", wl_bursty, PLUG_ATTACH },
+};
+
+static struct {
+	const struct scenario *sc;
+	double secs;
+	volatile int run;
+	u_int64_t wakeups;
+	double cpu_ms;
+	struct timespec t0;
+} gen;
+
+static void* bench_generator( void *arg )
+{
+	struct timespec step = { .tv_sec = 0, .tv_nsec = BENCH_STEP };
+	double last_active[BENCH_MAX_BAYS];
+	double next_plug = ( gen.sc->hotplug == PLUG_ATTACH ) ? BENCH_ATTACH_MS : BENCH_PLUG_MS;
+	int attached = 0;
+
+	for ( int b = 0; b < BENCH_MAX_BAYS; ++b ) last_active[b] = -1e9;
+	struct rusage ru;
+
+	while ( gen.run ) {
+		const double ms = ms_since(&gen.t0);
+
+		if ( ms >= gen.secs * 1000 ) {
+			/* end of the run - keep the monitor stopped until the driver is done */
+			if ( __atomic_load_n(&thread_run, __ATOMIC_ACQUIRE) )
+				monitor_stop();
+			nanosleep(&step, NULL);
+			++gen.wakeups;
+			continue;
+		}
+		pthread_mutex_lock(&synth.lock);
+		for ( int b = 0; b < bench_bays; ++b ) {
+			const int a = gen.sc->active(b, ms);
+			synth.ds[b].queue = ( a && synth.present[b] ) ? 1 : 0;
+			if ( !a || !synth.present[b] )
+				continue;
+			if ( a & 1 ) { synth.ds[b].bytes_read += BENCH_CHUNK; ++synth.ds[b].ops_read; synth.ds[b].duration_ns += BENCH_STEP / 2; }
+			if ( a & 2 ) { synth.ds[b].bytes_write += BENCH_CHUNK; ++synth.ds[b].ops_write; synth.ds[b].duration_ns += BENCH_STEP / 2; }
+			synth.ds[b].busy_ns += BENCH_STEP;
+
+			/* arm the latency clock at the start of a burst on a dark bay the monitor knows about -
+			   activity before a disk is identified is part of its baseline */
+			pthread_mutex_lock(&obs.lock);
+			if ( ms - last_active[b] > LED_DELAY / 1e6 && obs.colour[b] == 0 && !obs.pending[b].tv_sec &&
+				__atomic_load_n(&hpex49x[b].HDD, __ATOMIC_ACQUIRE) )
+				clock_gettime(CLOCK_MONOTONIC, &obs.pending[b]);
+			pthread_mutex_unlock(&obs.lock);
+			last_active[b] = ms;
+		}
+		if ( gen.sc->hotplug == PLUG_TOGGLE && ms >= next_plug ) {
+			synth.present[bench_bays - 1] = !synth.present[bench_bays - 1];
+			++synth.generation;
+			next_plug += BENCH_PLUG_MS;
+		}
+		else if ( gen.sc->hotplug == PLUG_ATTACH && attached < bench_bays && ms >= next_plug ) {
+			synth.present[attached++] = 1;
+			++synth.generation;
+			next_plug += BENCH_ATTACH_GAP_MS;
+		}
+		pthread_mutex_unlock(&synth.lock);
+
+		nanosleep(&step, NULL);
+		++gen.wakeups;
+	}
+	getrusage(RUSAGE_THREAD, &ru);
+	gen.cpu_ms = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e3 + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e3;
+	return NULL;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// what cam_bay_identify() does on the real box - adaN sits in bay N + 1
+static int bench_identify( const char *dev, int stat_index, struct hpled *bay )
+{
+	int unit;
+
+	if ( sscanf(dev, "ada%d", &unit) != 1 || unit < 0 || unit >= bench_bays )
+		return -1;
+	snprintf(bay->path, sizeof(bay->path), "/dev/%s", dev);
+	bay->path_id = unit + 1;
+	bay->target_id = 0;
+	bay->dev_index = stat_index;
+	return unit;
+}
+
+/// what disk_init() does on the real box - one bay per present disk
+static size_t bench_disk_init(void)
+{
+	size_t disks = 0;
+
+	synth_snapshot();
+	memset(hpex49x, 0, hpbays * sizeof(*hpex49x));
+
+	for ( int b = 0; b < bench_bays; ++b ) {
+		if ( !synth.view_present[b] )
+			continue;
+		bench_identify(synth_device(b), b, &hpex49x[b]);
+		hpex49x[b].HDD = b + 1;
+		++disks;
+	}
+	hpdisks = disks;
+	init_hpex49x_led();
+
+	/* start from dark LEDs so the first burst is measurable */
+	led_bays_off(set_hpex_led, 1);
+	gpio_flush();
+	return disks;
+}
+
+static int cmp_double( const void *a, const void *b )
+{
+	const double x = *(const double *)a, y = *(const double *)b;
+	return ( x > y ) - ( x < y );
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// -e - a Prometheus scraper on loopback while the workload runs, timing each GET
+/// /metrics from connect to the last byte
+static struct {
+	int port;
+	int run;
+	double *lat;
+	size_t nlat, cap, bytes;
+} scrape;
+
+static void* bench_scraper( void *arg )
+{
+	const struct timespec pause = { .tv_sec = 0, .tv_nsec = BENCH_SCRAPE_MS * 1000000L };
+	struct sockaddr_in sin = { .sin_family = AF_INET, .sin_port = htons(scrape.port) };
+	static const char req[] = "GET /metrics HTTP/1.0\r\n\r\n";
+	char buf[65536];
+
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	while ( __atomic_load_n(&scrape.run, __ATOMIC_ACQUIRE) ) {
+		struct timespec t0;
+		size_t got = 0;
+		ssize_t n;
+		int fd;
+
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		if ( (fd = socket(AF_INET, SOCK_STREAM, 0)) == -1 )
+			err(1, "socket");
+		if ( connect(fd, (struct sockaddr *)&sin, sizeof(sin)) != 0 || write(fd, req, sizeof(req) - 1) != sizeof(req) - 1 )
+			err(1, "Unable to scrape 127.0.0.1:%d", scrape.port);
+		while ( (n = read(fd, buf, sizeof(buf))) > 0 )
+			got += n;
+		close(fd);
+
+		if ( scrape.nlat == scrape.cap ) {
+			scrape.cap = ( scrape.cap ) ? scrape.cap * 2 : 1024;
+			if ( (scrape.lat = realloc(scrape.lat, scrape.cap * sizeof(*scrape.lat))) == NULL )
+				err(1, "realloc");
+		}
+		scrape.lat[scrape.nlat++] = ms_since(&t0) * 1e3;
+		scrape.bytes = got;
+		nanosleep(&pause, NULL);
+	}
+	return NULL;
+}
+
+static void bench_run( const struct scenario *sc, double secs, const char *outdir )
+{
+	pthread_t generator, scraper;
+	struct rusage ru0, ru1;
+	char path[256];
+	u_int64_t ticks = 0, snapshots = 0, reinits = 0;
+	double reinit_ms = 0;
+	struct timespec stopped;
+
+	memset(synth.ds, 0, sizeof(synth.ds));
+	for ( int b = 0; b < bench_bays; ++b ) synth.present[b] = ( sc->hotplug != PLUG_ATTACH );
+	synth.generation = synth.seen = 0;
+	memset(&hotplug_stats, 0, sizeof(hotplug_stats));
+	perf_reset();
+
+	memset(obs.colour, 0, sizeof(obs.colour));
+	memset(obs.pending, 0, sizeof(obs.pending));
+	obs.nlat = 0;
+	snprintf(path, sizeof(path), "%s/bench-%s%s.timeline", outdir, sc->name, ( hw_blink ) ? "-hwblink" : "");
+	if ( (obs.timeline = fopen(path, "w")) == NULL )
+		warn("unable to write timeline %s", path);
+	clock_gettime(CLOCK_MONOTONIC, &obs.t0);
+	if ( bench_trace ) {
+		snprintf(path, sizeof(path), "%s/bench-%s.trace", outdir, sc->name);
+		if ( (synth.trace = fopen(path, "w")) == NULL )
+			warn("unable to write trace %s", path);
+		memset(synth.traced, 0, sizeof(synth.traced));
+		synth.trace_t0 = obs.t0;
+	}
+
+	portio_open(&bench_io);
+	bench_disk_init();
+	memset(&portio_stats, 0, sizeof(portio_stats));
+
+	memset(&gen, 0, sizeof(gen));
+	gen.sc = sc;
+	gen.secs = secs;
+	gen.run = 1;
+	clock_gettime(CLOCK_MONOTONIC, &gen.t0);
+	getrusage(RUSAGE_SELF, &ru0);
+
+	thread_run = 1;
+	if ( pthread_create(&generator, NULL, bench_generator, NULL) != 0 )
+		err(1, "Unable to create generator thread");
+	scrape.nlat = 0;
+	scrape.run = ( scrape.port > 0 );
+	if ( scrape.run && pthread_create(&scraper, NULL, bench_scraper, NULL) != 0 )
+		err(1, "Unable to create scraper thread");
+
+	while ( 1 ) {
+		synth.snapshots = 0;
+		if ( !monitor_baseline() ) {
+			bench_disk_init();
+			continue;
+		}
+		dev_change = 0;
+		if ( led_writer_start() != 0 )
+			err(1, "Unable to start the LED writer");
+		if ( pthread_create(&monitor, NULL, monitor_thread_run, NULL) != 0 )
+			err(1, "Unable to create monitor thread");
+		pthread_join(monitor, NULL);
+		led_writer_stop();
+
+		ticks += sample_tick;
+		snapshots += synth.snapshots;
+
+		if ( !dev_change || ms_since(&gen.t0) >= secs * 1000 )
+			break;
+
+		/* -r - the same full re-initialization main() does on a device change, timed
+		   from the monitor stopping to it sampling again */
+		clock_gettime(CLOCK_MONOTONIC, &stopped);
+		bench_disk_init();
+		perf_record(PERF_HOTPLUG, ms_since(&stopped) * 1e6);
+		thread_run = 1;
+		++reinits;
+		reinit_ms += ms_since(&stopped);
+	}
+	reinits += hotplug_stats.reconciles;
+	reinit_ms += hotplug_stats.total_ns / 1e6;
+	gen.run = 0;
+	pthread_join(generator, NULL);
+	if ( scrape.run ) {
+		__atomic_store_n(&scrape.run, 0, __ATOMIC_RELEASE);
+		pthread_join(scraper, NULL);
+	}
+	getrusage(RUSAGE_SELF, &ru1);
+
+	const double elapsed = ms_since(&gen.t0) / 1e3;
+	const double cpu_ms = (ru1.ru_utime.tv_sec - ru0.ru_utime.tv_sec + ru1.ru_stime.tv_sec - ru0.ru_stime.tv_sec) * 1e3 +
+		(ru1.ru_utime.tv_usec - ru0.ru_utime.tv_usec + ru1.ru_stime.tv_usec - ru0.ru_stime.tv_usec) / 1e3 - gen.cpu_ms;
+	const double wakeups = (ru1.ru_nvcsw - ru0.ru_nvcsw) + (ru1.ru_nivcsw - ru0.ru_nivcsw) - (double)gen.wakeups;
+	const u_int64_t gpio_ops = portio_stats.inl + portio_stats.inb + portio_stats.outl + portio_stats.outb;
+	double p50 = 0, p99 = 0, mbs = 0;
+
+	/* the rate engine's view of the load as the run ended - every bay, read and write */
+	for ( int b = 0; b < bench_bays; ++b ) {
+		struct bayrates r;
+		if ( monitor_rate(b, &r) )
+			mbs += r.ewma[RATE_1S].v[RATE_MB_READ] + r.ewma[RATE_1S].v[RATE_MB_WRITE];
+	}
+	if ( obs.nlat ) {
+		qsort(obs.lat, obs.nlat, sizeof(*obs.lat), cmp_double);
+		p50 = obs.lat[obs.nlat / 2];
+		p99 = obs.lat[(size_t)(obs.nlat * 0.99)];
+	}
+	printf("%-8s %6.1f %8.1f %9.1f %9.2f %10.1f %8.2f %8.2f %8.2f %6zu %7ju %9.2f %8.1f\n",
+		sc->name, elapsed, ticks / elapsed, ( wakeups > 0 ) ? wakeups / elapsed : 0, ( ticks ) ? (double)snapshots / ticks : 0,
+		gpio_ops / elapsed, cpu_ms / elapsed, p50, p99, obs.nlat, (uintmax_t)reinits, ( reinits ) ? reinit_ms / reinits : 0, mbs);
+	if ( scrape.nlat ) {
+		qsort(scrape.lat, scrape.nlat, sizeof(*scrape.lat), cmp_double);
+		printf("  %zu scrapes of %zu bytes: p50 %.1f us, p99 %.1f us, rendering %.1f us last, %.1f us worst\n",
+			scrape.nlat, scrape.bytes, scrape.lat[scrape.nlat / 2], scrape.lat[(size_t)(scrape.nlat * 0.99)],
+			export_stats.last_ns / 1e3, export_stats.max_ns / 1e3);
+	}
+	if ( bench_perf )
+		perf_dump(stdout, 0);
+
+	if ( obs.timeline ) fclose(obs.timeline);
+	obs.timeline = NULL;
+	pthread_mutex_lock(&synth.lock);
+	if ( synth.trace ) fclose(synth.trace);
+	synth.trace = NULL;
+	pthread_mutex_unlock(&synth.lock);
+	portio_close();
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// -k - the per tick counter pass on its own. the old path made one varargs
+/// devstat_compute_statistics() call per device for the two byte totals and compared
+/// them with the last tick's; this stand-in has the same calling pattern and the same
+/// va_arg dispatch, and is kept out of line as the shared library call is
+enum bench_dsm { BENCH_DSM_NONE, BENCH_DSM_TOTAL_BYTES_READ, BENCH_DSM_TOTAL_BYTES_WRITE };
+
+static __attribute__((noinline)) int bench_compute_statistics( const struct diskstat *current, const struct diskstat *previous, long double etime, ... )
+{
+	va_list ap;
+	int metric;
+
+	va_start(ap, etime);
+	while ( (metric = va_arg(ap, int)) != BENCH_DSM_NONE ) {
+		u_int64_t *dst = va_arg(ap, u_int64_t *);
+
+		switch ( metric ) {
+			case BENCH_DSM_TOTAL_BYTES_READ: *dst = current->bytes_read - ( previous ? previous->bytes_read : 0 ); break;
+			case BENCH_DSM_TOTAL_BYTES_WRITE: *dst = current->bytes_write - ( previous ? previous->bytes_write : 0 ); break;
+			default: va_end(ap); return -1;
+		}
+	}
+	va_end(ap);
+	return 0;
+}
+
+static void bench_kernel(void)
+{
+	static const size_t counts[] = { 4, 16, 64, 256 };
+	volatile u_int64_t sink = 0;
+
+	printf("%-8s %14s %14s %14s %8s\n", "devices", "varargs ns", "soa ns", "kernel ns", "speedup");
+
+	for ( size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c ) {
+		const size_t n = counts[c];
+		struct diskstat *ds = calloc(n, sizeof(*ds));
+		u_int64_t *b_read = calloc(n, sizeof(*b_read)), *b_write = calloc(n, sizeof(*b_write));
+		u_int64_t mask[4] = { 0 };
+		struct baycounters bc;
+		struct timespec t0;
+
+		if ( ds == NULL || b_read == NULL || b_write == NULL || baycounters_alloc(&bc, n) != 0 )
+			err(1, "Unable to allocate %zu devices", n);
+
+		/* a third of the devices move each tick so neither path can skip the work */
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		for ( u_int64_t t = 0; t < BENCH_KERNEL_TICKS; ++t ) {
+			for ( size_t i = t % 3; i < n; i += 3 ) ds[i].bytes_read += BENCH_CHUNK;
+			for ( size_t i = 0; i < n; ++i ) {
+				u_int64_t r, w;
+
+				bench_compute_statistics(&ds[i], NULL, 1.00, BENCH_DSM_TOTAL_BYTES_READ, &r, BENCH_DSM_TOTAL_BYTES_WRITE, &w, BENCH_DSM_NONE);
+				if ( r != b_read[i] || w != b_write[i] ) mask[i / 64] |= (u_int64_t)1 << (i % 64);
+				else mask[i / 64] &= ~((u_int64_t)1 << (i % 64));
+				b_read[i] = r;
+				b_write[i] = w;
+			}
+			sink += mask[0];
+		}
+		const double varargs = ms_since(&t0) * 1e6 / BENCH_KERNEL_TICKS;
+
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		for ( u_int64_t t = 0; t < BENCH_KERNEL_TICKS; ++t ) {
+			for ( size_t i = t % 3; i < n; i += 3 ) ds[i].bytes_read += BENCH_CHUNK;
+			for ( size_t i = 0; i < n; ++i )
+				baycounters_store(&bc, i, &ds[i]);
+			baycounters_delta(&bc);
+			sink += bc.active[0];
+		}
+		const double soa = ms_since(&t0) * 1e6 / BENCH_KERNEL_TICKS;
+
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		for ( u_int64_t t = 0; t < BENCH_KERNEL_TICKS; ++t ) {
+			bc.now[BAY_BYTES_READ][t % n] += BENCH_CHUNK;
+			baycounters_delta(&bc);
+			sink += bc.active[0];
+		}
+		const double kernel = ms_since(&t0) * 1e6 / BENCH_KERNEL_TICKS;
+
+		printf("%-8zu %14.1f %14.1f %14.1f %7.2fx\n", n, varargs, soa, kernel, ( soa > 0 ) ? varargs / soa : 0);
+
+		baycounters_free(&bc);
+		free(ds);
+		free(b_read);
+		free(b_write);
+	}
+	(void)sink;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// -u - the freebsd-update check against a scratch work directory. the old check
+/// popen()ed the freebsd-update script - a popen() of echo is the least that cost, the
+/// script itself comes on top. then the watcher: time from the install link appearing
+/// or going to changed() running, and how long stopping the watcher takes
+static struct {
+	struct timespec at;	/* when changed() last ran */
+	int ready;
+	int calls;
+} upd;
+
+static void bench_update_changed( int ready )
+{
+	clock_gettime(CLOCK_MONOTONIC, &upd.at);
+	__atomic_store_n(&upd.ready, ready, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&upd.calls, 1, __ATOMIC_RELEASE);
+}
+
+static double bench_update_wait( int calls, const struct timespec *t0 )
+{
+	for ( int i = 0; i < 1000 && __atomic_load_n(&upd.calls, __ATOMIC_ACQUIRE) < calls; ++i )
+		usleep(1000);
+	if ( __atomic_load_n(&upd.calls, __ATOMIC_ACQUIRE) < calls )
+		return -1;
+	return timespec_diff_ns(&upd.at, t0) / 1e3;
+}
+
+static void bench_update(void)
+{
+	char dir[] = "/tmp/hpex49xled-update.XXXXXX", link[256];
+	struct timespec t0;
+	volatile int sink = 0;
+	char line[128];
+
+	if ( mkdtemp(dir) == NULL )
+		err(1, "Unable to create a scratch work directory");
+	snprintf(link, sizeof(link), "%s/%s-install", dir, UPDATE_BDHASH);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for ( int i = 0; i < BENCH_UPDATE_CHECKS; ++i )
+		sink += updates_ready(dir);
+	const double check_ns = ms_since(&t0) * 1e6 / BENCH_UPDATE_CHECKS;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for ( int i = 0; i < BENCH_UPDATE_POPENS; ++i ) {
+		FILE *p = popen("echo No updates are available to install.", "r");
+		if ( p == NULL )
+			err(1, "popen");
+		sink += ( fgets(line, sizeof(line), p) != NULL );
+		pclose(p);
+	}
+	const double popen_us = ms_since(&t0) * 1e3 / BENCH_UPDATE_POPENS;
+
+	printf("in process check %.2f us, popen of echo %.1f us (%.0fx)\n", check_ns / 1e3, popen_us, popen_us * 1e3 / check_ns);
+
+	memset(&upd, 0, sizeof(upd));
+	if ( update_start(dir, bench_update_changed) != 0 )
+		errx(1, "Unable to start the update watcher");
+	bench_update_wait(1, &t0);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if ( symlink("files/0", link) != 0 )
+		err(1, "symlink %s", link);
+	const double appear_us = bench_update_wait(2, &t0);
+	const int ready = upd.ready;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	unlink(link);
+	const double gone_us = bench_update_wait(3, &t0);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	update_stop();
+	const double stop_us = ms_since(&t0) * 1e3;
+
+	printf("watcher: install link seen in %.1f us (ready %d), removal seen in %.1f us (ready %d), %ju checks for %ju events, stopped in %.1f us\n",
+		appear_us, ready, gone_us, upd.ready, (uintmax_t)update_stats.checks, (uintmax_t)update_stats.events, stop_us);
+	rmdir(dir);
+	(void)sink;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// -c - bay discovery, nothing known to the first bay LED lit: one CAM scan, every
+/// disk looked up in it and in the bay map, the LED bits set, then the first bay's
+/// blue LED written. on FreeBSD against the real buses, with the per device
+/// cam_open_device() loop it replaced timed on the same disks - elsewhere the
+/// fixture EX49x stands in and there is no loop to compare against. then a restart
+/// from the bay cache those bays were written to, and a cache miss - the monitor
+/// starting with no bays and discovering them on its own thread
+static void bench_cam_light(void)
+{
+	for ( size_t b = 0; b < hpbays; ++b )
+		if ( hpex49x[b].HDD ) {
+			set_hpex_led(LED_BLUE, ON, hpex49x[b].blue);
+			gpio_flush();
+			return;
+		}
+}
+
+static void bench_cam_cache(void)
+{
+	static struct baycache c;
+	char dir[] = "/tmp/hpex49xled-cache.XXXXXX", path[256];
+	struct timespec t0;
+
+	/* the disks the scan found are the provider's ada0 - ada3 */
+	pthread_mutex_lock(&synth.lock);
+	for ( int b = 0; b < bench_bays; ++b ) synth.present[b] = 1;
+	++synth.generation;
+	pthread_mutex_unlock(&synth.lock);
+	synth_snapshot();
+
+	memset(&c, 0, sizeof(c));
+	c.boot = baycache_boot();
+	c.generation = diskstats->generation();
+	c.nbays = baymap.nbays;
+	snprintf(c.map, sizeof(c.map), "%s", baymap.name);
+	for ( size_t b = 0; b < hpbays; ++b ) {
+		struct baycache_ent *e = &c.ent[c.nent];
+		const struct camperiph *p;
+
+		if ( !hpex49x[b].HDD )
+			continue;
+		snprintf(e->dev, sizeof(e->dev), "%s", hpex49x[b].path + strlen("/dev/"));
+		if ( (p = camenum_find(e->dev)) == NULL )
+			continue;
+		e->bay = hpex49x[b].HDD;
+		e->path_id = p->path_id;
+		e->target_id = p->target_id;
+		snprintf(e->sim, sizeof(e->sim), "%s", p->sim);
+		snprintf(e->ident, sizeof(e->ident), "%s", p->ident);
+		++c.nent;
+	}
+	if ( mkdtemp(dir) == NULL )
+		err(1, "Unable to create a scratch cache directory");
+	if ( baycache_save(dir, &c) != 0 )
+		errx(1, "Unable to write the bay cache - %s", baycache_errbuf);
+	const double save_us = baycache_stats.save_ns / 1e3;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for ( int r = 0; r < BENCH_CAM_ROUNDS; ++r ) {
+		if ( baycache_load(dir, &c) != 0 || !baycache_current(&c) )
+			errx(1, "The bay cache just written is not current - %s", baycache_errbuf);
+		memset(hpex49x, 0, hpbays * sizeof(*hpex49x));
+		for ( size_t i = 0; i < c.nent; ++i ) {
+			struct hpled *bay = &hpex49x[c.ent[i].bay - 1];
+
+			snprintf(bay->path, sizeof(bay->path), "/dev/%.10s", c.ent[i].dev);
+			bay->path_id = c.ent[i].path_id;
+			bay->target_id = c.ent[i].target_id;
+			bay->HDD = c.ent[i].bay;
+			led_bay_bits(bay);
+		}
+		bench_cam_light();
+	}
+	const double cache_us = ms_since(&t0) * 1e3 / BENCH_CAM_ROUNDS;
+
+	printf("bay cache: %zu bays written in %.1f us, loaded and checked in %.1f us, first LED after %.1f us\n",
+		c.nent, save_us, baycache_stats.load_ns / 1e3, cache_us);
+
+	snprintf(path, sizeof(path), "%s/%s", dir, BAYCACHE_FILE);
+	unlink(path);
+	rmdir(dir);
+
+	/* a miss - no bays, the monitor's first tick identifies every disk */
+	memset(hpex49x, 0, hpbays * sizeof(*hpex49x));
+	hpdisks = 0;
+	bay_identify = bench_identify;
+	if ( !monitor_baseline() || led_writer_start() != 0 )
+		errx(1, "Unable to start the monitor");
+	monitor_discover();
+	thread_run = 1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if ( pthread_create(&monitor, NULL, monitor_thread_run, NULL) != 0 )
+		err(1, "Unable to create monitor thread");
+	while ( __atomic_load_n(&hpdisks, __ATOMIC_ACQUIRE) < (size_t)bench_bays && ms_since(&t0) < 1000 )
+		usleep(100);
+	const double discover_ms = ms_since(&t0);
+	monitor_stop();
+	pthread_join(monitor, NULL);
+	led_writer_stop();
+
+	printf("cache miss: the monitor discovered %zu of %d bays in the background in %.2f ms, reconciled in %.1f us\n",
+		hpdisks, bench_bays, discover_ms, hotplug_stats.last_ns / 1e3);
+}
+
+static void bench_cam(void)
+{
+	char dev[DISKSTATS_NAME_LEN];
+	struct timespec t0;
+	size_t disks = 0, bays = 0;
+
+	for ( int r = 0; r < BENCH_CAM_ROUNDS; ++r ) {
+		if ( camenum_scan() != 0 )
+			errx(1, "Unable to scan the CAM buses with %s - %s", camenum->name, camenum_errbuf);
+	}
+	const double scan_us = camenum_stats.last_ns / 1e3;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for ( int r = 0; r < BENCH_CAM_ROUNDS; ++r ) {
+		camenum_scan();
+		memset(hpex49x, 0, hpbays * sizeof(*hpex49x));
+		disks = bays = 0;
+		for ( int u = 0; u < CAMENUM_MAX; ++u ) {
+			const struct camperiph *p;
+
+			/* the names devstat hands disk_init() - "ada0" - looked up the way cam_bay() does */
+			snprintf(dev, sizeof(dev), "ada%d", u);
+			if ( (p = camenum_find(dev)) == NULL )
+				break;
+			++disks;
+			const struct bayent *e = baymap_lookup(p->sim, p->path_id, p->target_id);
+			if ( e == NULL || (size_t)e->bay > hpbays )
+				continue;
+			struct hpled *bay = &hpex49x[e->bay - 1];
+			snprintf(bay->path, sizeof(bay->path), "/dev/ada%d", u);
+			bay->path_id = p->path_id;
+			bay->target_id = p->target_id;
+			bay->HDD = e->bay;
+			led_bay_bits(bay);
+			++bays;
+		}
+		bench_cam_light();
+	}
+	const double first_us = ms_since(&t0) * 1e3 / BENCH_CAM_ROUNDS;
+
+	printf("%s scan: %zu periphs in %.1f us, %ju ioctls for %ju scans\n", camenum->name, camenum_stats.periphs, scan_us,
+		(uintmax_t)camenum_stats.ioctls, (uintmax_t)camenum_stats.scans);
+	printf("first LED after %.1f us - %zu ada disks, %zu in bays\n", first_us, disks, bays);
+	bench_cam_cache();
+
+#if defined(__FreeBSD__)
+	/* the replaced loop - open every disk through its pass device and read the path
+	   back. a disk that is busy or asleep makes each open slower, not the scan */
+	size_t opened = 0;
+
+	camenum_scan();
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for ( int u = 0; u < CAMENUM_MAX; ++u ) {
+		struct cam_device *cam_dev;
+		char path[sizeof("/dev/") + DISKSTATS_NAME_LEN];
+
+		snprintf(dev, sizeof(dev), "ada%d", u);
+		if ( camenum_find(dev) == NULL )
+			break;
+		snprintf(path, sizeof(path), "/dev/%s", dev);
+		if ( (cam_dev = cam_open_device(path, O_RDWR)) == NULL )
+			continue;
+		baymap_lookup(cam_dev->sim_name, cam_dev->path_id, cam_dev->target_id);
+		cam_close_device(cam_dev);
+		++opened;
+	}
+	const double loop_us = ms_since(&t0) * 1e3;
+
+	if ( opened )
+		printf("cam_open_device() loop: %zu disks in %.1f us (%.1fx the scan)\n", opened, loop_us, loop_us / scan_us);
+	else
+		printf("cam_open_device() loop: no disk could be opened - %s\n", cam_errbuf);
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// -L - what a log call costs the thread that makes it. the old way, formatted and
+/// flushed to a file inline as syslog() hands it to syslogd, against a message put
+/// in the thread's ring for the flusher - every class spending its burst. then one
+/// class flooding the rate limit, as a flapping drive does
+static double bench_log_pct( double *lat, size_t n, double pct )
+{
+	return lat[(size_t)(pct * (n - 1))];
+}
+
+static void bench_log(void)
+{
+	static double lat[BENCH_LOG_CALLS];
+	char path[] = "/tmp/hpex49xled-log.XXXXXX", line[LOG_MSG_LEN + 64];
+	struct timespec t0;
+	size_t n = 0, lines = 0;
+	int fd;
+
+	if ( (fd = mkstemp(path)) == -1 )
+		err(1, "Unable to create a scratch log file");
+	close(fd);
+
+	FILE *f = fopen(path, "a");
+	if ( f == NULL )
+		err(1, "%s", path);
+	for ( int i = 0; i < BENCH_LOG_CALLS; ++i ) {
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		fprintf(f, "%d hotplug: /dev/ada%d removed from HP Mediasmart Server Slot %d\n", i, i & 3, ( i & 3 ) + 1);
+		fflush(f);
+		lat[i] = ms_since(&t0) * 1e3;
+	}
+	fclose(f);
+	qsort(lat, BENCH_LOG_CALLS, sizeof(*lat), cmp_double);
+	printf("inline fprintf+fflush: p50 %.2f us p99 %.2f us max %.2f us\n", bench_log_pct(lat, BENCH_LOG_CALLS, 0.5),
+		bench_log_pct(lat, BENCH_LOG_CALLS, 0.99), lat[BENCH_LOG_CALLS - 1]);
+
+	if ( log_start(path) != 0 )
+		errx(1, "Unable to start the log flusher");
+	/* a class's burst is less than a ring - a pause between them lets the flusher catch up */
+	for ( int c = 0; c < LOGC_CLASSES; ++c ) {
+		for ( int i = 0; i < LOG_BURST && n < BENCH_LOG_CALLS; ++i ) {
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			log_submit(c, LOG_NOTICE, "/dev/ada%d removed from HP Mediasmart Server Slot %d", i & 3, ( i & 3 ) + 1);
+			lat[n++] = ms_since(&t0) * 1e3;
+		}
+		usleep(1000);
+	}
+	qsort(lat, n, sizeof(*lat), cmp_double);
+	printf("log_submit into the ring: p50 %.2f us p99 %.2f us max %.2f us - %zu messages, %ju dropped\n", bench_log_pct(lat, n, 0.5),
+		bench_log_pct(lat, n, 0.99), lat[n - 1], n, (uintmax_t)log_stats.dropped);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for ( int i = 0; i < BENCH_LOG_FLOOD; ++i )
+		log_submit(LOGC_HOTPLUG, LOG_NOTICE, "/dev/ada%d removed from HP Mediasmart Server Slot %d", i & 3, ( i & 3 ) + 1);
+	const double flood_ns = ms_since(&t0) * 1e6 / BENCH_LOG_FLOOD;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	log_stop();
+	const double stop_us = ms_since(&t0) * 1e3;
+
+	if ( (f = fopen(path, "r")) != NULL ) {
+		while ( fgets(line, sizeof(line), f) != NULL )
+			lines += ( strstr(line, "\n") != NULL );
+		fclose(f);
+	}
+	unlink(path);
+
+	printf("flood: %.1f ns per message, %ju of %d suppressed, %ju dropped - %ju written in %ju flushes, %zu lines with the report, stopped in %.1f us\n",
+		flood_ns, (uintmax_t)log_stats.suppressed[LOGC_HOTPLUG], BENCH_LOG_FLOOD, (uintmax_t)log_stats.dropped,
+		(uintmax_t)log_stats.messages, (uintmax_t)log_stats.flushes, lines - BENCH_LOG_CALLS, stop_us);
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// -H - the SMART health poll against the simulated responder. the first four bays
+/// hold a healthy disk, one spun down, one with a pre-fail attribute at its threshold
+/// and one that says it is failing. one round from the health thread, the red LEDs it
+/// latches through the running monitor, then what rounds do to reads on the healthy
+/// disk - every command holds the disk as a non queued ATA command would
+static struct {
+	struct timespec at;	/* last latch */
+	int latched;
+} hl;
+
+static void bench_health_led( size_t b, int state )
+{
+	if ( state == HEALTH_FAILING || state == HEALTH_PREFAIL ) {
+		monitor_latch(b, LED_RED);
+		clock_gettime(CLOCK_MONOTONIC, &hl.at);
+		__atomic_add_fetch(&hl.latched, 1, __ATOMIC_RELEASE);
+	}
+}
+
+static int bench_health_stop = 0;
+
+/* LEDs are active low */
+static int bench_red_lit( int b )
+{
+	const unsigned int base = portio_sim_config.gpiobase;
+
+	return !bench_bit(portio_sim_peek(base + BENCH_GP_LVL), portio_sim_peek(base + BENCH_GP_LVL2), ioledred(b));
+}
+
+static void *bench_health_rounds( void *arg )
+{
+	while ( !__atomic_load_n(&bench_health_stop, __ATOMIC_ACQUIRE) ) {
+		health_poll(1);
+		usleep(BENCH_HEALTH_EVERY_MS * 1000);
+	}
+	return NULL;
+}
+
+static void bench_health_io( const char *what )
+{
+	static double lat[BENCH_HEALTH_IOS];
+
+	for ( int i = 0; i < BENCH_HEALTH_IOS; ++i ) {
+		lat[i] = health_sim_io(0, BENCH_HEALTH_IO_US) / 1e3;
+		usleep(1000);
+	}
+	qsort(lat, BENCH_HEALTH_IOS, sizeof(*lat), cmp_double);
+	printf("reads of %d us %-28s p50 %7.1f us p99 %7.1f us max %7.1f us\n", BENCH_HEALTH_IO_US, what, lat[BENCH_HEALTH_IOS / 2],
+		lat[BENCH_HEALTH_IOS * 99 / 100], lat[BENCH_HEALTH_IOS - 1]);
+}
+
+/* the provider's ada0 - ada3, brought up by the monitor as it would after a start, and
+   every LED dark */
+static void bench_health_monitor(void)
+{
+	struct timespec t0;
+
+	pthread_mutex_lock(&synth.lock);
+	for ( int b = 0; b < bench_bays; ++b ) synth.present[b] = 1;
+	++synth.generation;
+	pthread_mutex_unlock(&synth.lock);
+	synth_snapshot();
+	memset(hpex49x, 0, hpbays * sizeof(*hpex49x));
+	hpdisks = 0;
+	bay_identify = bench_identify;
+	if ( !monitor_baseline() || led_writer_start() != 0 )
+		errx(1, "Unable to start the monitor");
+	monitor_discover();
+	thread_run = 1;
+	if ( pthread_create(&monitor, NULL, monitor_thread_run, NULL) != 0 )
+		err(1, "Unable to create monitor thread");
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	while ( __atomic_load_n(&hpdisks, __ATOMIC_ACQUIRE) < (size_t)bench_bays && ms_since(&t0) < 1000 )
+		usleep(100);
+	led_bays_off(set_hpex_led, 1);
+	gpio_flush();
+	usleep(10000);
+}
+
+static void bench_health(void)
+{
+	static const char *states[] = { "unknown", "ok", "pre-fail", "failing" };
+	struct timespec t0;
+	pthread_t rounds;
+
+	if ( bench_bays < 4 )
+		errx(1, "-H needs a bay map with four bays");
+	/* dark, so the latched red LEDs are the only ones lit */
+	bench_health_monitor();
+
+	health = &health_sim;
+	for ( int d = 0; d < HEALTH_SIM_DISKS; ++d )
+		health_simdisks[d].busy_us = BENCH_HEALTH_CMD_US;
+	health_simdisks[1].power = HEALTH_POWER_STANDBY;
+	health_simdisks[2].prefail = 5;
+	health_simdisks[3].failing = 1;
+
+	if ( health_start(HEALTH_INTERVAL, 0, bench_health_led) != 0 )
+		errx(1, "Unable to start the health poll");
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	while ( __atomic_load_n(&health_stats.rounds, __ATOMIC_ACQUIRE) < 1 && ms_since(&t0) < 2000 )
+		usleep(100);
+	/* the monitor may be backed off to idle_delay_max - the LEDs follow on its next tick */
+	while ( !( bench_red_lit(2) && bench_red_lit(3) ) && ms_since(&t0) < 2000 )
+		usleep(100);
+	const double led_ms = ms_since(&hl.at);
+	health_stop();
+
+	printf("%s round over %d bays in %.1f ms, %ju commands (%d us each), slowest %.1f us, %ju spun down left alone\n", health->name,
+		bench_bays, health_stats.last_ns / 1e6, (uintmax_t)health_stats.commands, BENCH_HEALTH_CMD_US, health_stats.cmd_max_ns / 1e3,
+		(uintmax_t)health_stats.standby);
+	for ( int b = 0; b < 4; ++b ) {
+		struct health_bay h;
+
+		health_read(b, &h);
+		printf("bay %d %s: %-8s power 0x%02x attr %3d - red LED %s, %ju SMART commands woke it\n", b + 1, hpex49x[b].path, states[h.state],
+			h.power & 0xff, h.attr, ( bench_red_lit(b) ) ? "latched" : "off", (uintmax_t)health_simdisks[b].spinups);
+	}
+	printf("%d red LEDs latched, lit %.1f ms after the last latch\n", hl.latched, led_ms);
+
+	monitor_stop();
+	pthread_join(monitor, NULL);
+	led_writer_stop();
+
+	bench_health_io("with no poll");
+	if ( pthread_create(&rounds, NULL, bench_health_rounds, NULL) != 0 )
+		err(1, "Unable to create the round thread");
+	bench_health_io("with a round every 50 ms");
+	__atomic_store_n(&bench_health_stop, 1, __ATOMIC_RELEASE);
+	pthread_join(rounds, NULL);
+	printf("%ju rounds in all, %ju commands\n", (uintmax_t)health_stats.rounds, (uintmax_t)health_stats.commands);
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// -P - the power tracker against the simulated responder. the first four bays hold a
+/// disk that is active, one idle and two spun down, none with any I/O. the tracker
+/// checks each once after BENCH_POWER_IDLE, then the standby flashes and the monitor's
+/// tick rate are watched with two disks asleep and with all four, and an I/O on a
+/// sleeping disk times how soon its bay is back to active
+static u_int64_t bench_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* LEDs are active low */
+static int bench_blue_lit( int b )
+{
+	const unsigned int base = portio_sim_config.gpiobase;
+
+	return !bench_bit(portio_sim_peek(base + BENCH_GP_LVL), portio_sim_peek(base + BENCH_GP_LVL2), ioledblue(b));
+}
+
+static int bench_power_state( int b )
+{
+	struct hpsample s;
+	return ( monitor_sample(b, &s) ) ? s.power : POWER_UNKNOWN;
+}
+
+/* BENCH_POWER_WATCH_MS of the blue LEDs and the monitor's ticks */
+static void bench_power_watch( const char *what )
+{
+	int lit[4] = { 0 }, flashes[4] = { 0 };
+	double on_ms[4] = { 0 };
+	struct timespec t0, t[4];
+
+	const u_int64_t tick0 = __atomic_load_n(&sample_tick, __ATOMIC_ACQUIRE);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	while ( ms_since(&t0) < BENCH_POWER_WATCH_MS ) {
+		for ( int b = 0; b < 4; ++b ) {
+			const int now = bench_blue_lit(b);
+			if ( now && !lit[b] ) {
+				++flashes[b];
+				clock_gettime(CLOCK_MONOTONIC, &t[b]);
+			}
+			else if ( !now && lit[b] )
+				on_ms[b] += ms_since(&t[b]);
+			lit[b] = now;
+		}
+		usleep(1000);
+	}
+	const double ticks = __atomic_load_n(&sample_tick, __ATOMIC_ACQUIRE) - tick0;
+
+	printf("%-18s %5.2f ticks/s, blue flashes per bay", what, ticks * 1000 / BENCH_POWER_WATCH_MS);
+	for ( int b = 0; b < 4; ++b )
+		printf(" %d%s", flashes[b], ( lit[b] ) ? "+lit" : "");
+	printf(", %.1f ms lit on average\n", ( flashes[2] + flashes[3] ) ? ( on_ms[2] + on_ms[3] ) / ( flashes[2] + flashes[3] ) : 0.0);
+}
+
+static void bench_power(void)
+{
+	static const char *modes[] = { "unknown", "active", "idle", "standby" };
+	struct timespec t0;
+	int known = 0;
+
+	if ( bench_bays < 4 )
+		errx(1, "-P needs a bay map with four bays");
+	bench_health_monitor();
+
+	health = &health_sim;
+	for ( int d = 0; d < HEALTH_SIM_DISKS; ++d )
+		health_simdisks[d].busy_us = BENCH_HEALTH_CMD_US;
+	health_simdisks[0].power = HEALTH_POWER_ACTIVE;
+	health_simdisks[1].power = HEALTH_POWER_IDLE;
+	health_simdisks[2].power = health_simdisks[3].power = HEALTH_POWER_STANDBY;
+
+	/* no SMART rounds - only the tracker */
+	if ( health_start(0, BENCH_POWER_IDLE, NULL) != 0 )
+		errx(1, "Unable to start the power tracker");
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	while ( known < 4 && ms_since(&t0) < 3000 + BENCH_POWER_IDLE * 1000 ) {
+		known = 0;
+		for ( int b = 0; b < 4; ++b )
+			known += ( bench_power_state(b) != POWER_UNKNOWN );
+		usleep(1000);
+	}
+	const double known_ms = ms_since(&t0);
+	const u_int64_t checks = health_stats.power_checks;
+	usleep(BENCH_POWER_IDLE * 2000000);
+
+	printf("%s tracker, %d s without I/O: %d bays known %.0f ms after the start, %ju CHECK POWER MODE, %ju more in the next %d s\n",
+		health->name, BENCH_POWER_IDLE, known, known_ms, (uintmax_t)checks, (uintmax_t)(health_stats.power_checks - checks), BENCH_POWER_IDLE * 2);
+	for ( int b = 0; b < 4; ++b )
+		printf("bay %d %s: %-7s - %ju commands, %ju woke it\n", b + 1, hpex49x[b].path, modes[bench_power_state(b)],
+			(uintmax_t)health_simdisks[b].commands, (uintmax_t)health_simdisks[b].spinups);
+
+	bench_power_watch("two asleep");
+	/* the other two spin down - told to the monitor as the tracker's next check would */
+	monitor_power(0, POWER_STANDBY, bench_ns());
+	monitor_power(1, POWER_STANDBY, bench_ns());
+	usleep(IDLE_DELAY_MAX / 1000);
+	bench_power_watch("all four asleep");
+
+	/* a read on bay 3 - the LED pass sees it on the next tick, however far backed off */
+	pthread_mutex_lock(&synth.lock);
+	synth.ds[2].bytes_read += 4096;
+	++synth.ds[2].ops_read;
+	pthread_mutex_unlock(&synth.lock);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	while ( bench_power_state(2) != POWER_ACTIVE && ms_since(&t0) < 5000 )
+		usleep(100);
+	const double wake_ms = ms_since(&t0);
+	struct hpsample s;
+
+	monitor_sample(3, &s);
+	printf("bay 3 active again %.1f ms after a read, bay 4 %.2f s in standby so far\n", wake_ms, s.standby_ns / 1e9);
+
+	health_stop();
+	monitor_stop();
+	pthread_join(monitor, NULL);
+	led_writer_stop();
+}
+
+static int bench_help( const char *progname )
+{
+	printf("Usage: %s [-b] [-c] [-e] [-H] [-i ms] [-k] [-L] [-m bay map] [-M match] [-p] [-P] [-r] [-R trace] [-s scenario] [-t seconds] [-u] [-w] [-d] [-o timeline dir]\n", progname);
+	printf("-b	use GPO_BLINK hardware blinking\n");
+	printf("-c	time bay discovery to the first LED - one %s CAM scan, a restart from the bay cache and a background discovery\n", camenum->name);
+	printf("-e	scrape the Prometheus exporter on loopback every %d ms during each workload and time the scrapes\n", BENCH_SCRAPE_MS);
+	printf("-H	poll SMART health from simulated disks - one healthy, one spun down, one pre-fail, one failing - and time reads during rounds\n");
+	printf("-i	idle backoff ceiling in ms as for hpex49xled --idle (default %d)\n", IDLE_DELAY_MAX / 1000000);
+	printf("-k	time the per tick counter pass at 4, 16, 64 and 256 devices, varargs per device against the delta kernel\n");
+	printf("-L	time a log call - inline to a file against the ring and flusher - and a flood of one class against its rate limit\n");
+	printf("-m	bay map file as for hpex49xled --map (default the HP EX49x four bays)\n");
+	printf("-M	device match rule as for hpex49xled --match - repeatable\n");
+	printf("-p	dump the self instrumentation histograms after each workload, as SIGUSR1 does for hpex49xled\n");
+	printf("-P	track the power mode of simulated disks - active, idle and two spun down - then watch the standby flashes and the tick rate\n");
+	printf("-r	restart the monitor on every device change instead of reconciling the bays that changed\n");
+	printf("-R	replay a trace through the monitor and check every bay's counters against it - see hpex49xled_stats.h for the format\n");
+	printf("-s	run one scenario: idle, bursty, sparse, stream, hotplug, attach (default all)\n");
+	printf("-t	seconds per scenario (default 3)\n");
+	printf("-u	time the freebsd-update check and the work directory watcher against a scratch directory\n");
+	printf("-w	record each workload as bench-<scenario>.trace for -R\n");
+	printf("-d	record /proc/diskstats for -t seconds as bench-procfs.trace for -R, whole disks unless -M picks others\n");
+	printf("-o	directory for the bench-<scenario>.timeline LED timelines and the traces (default .)\n");
+	return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// -R - a recorded trace through the replay provider and the real monitor, one snapshot
+/// a tick with the idle backoff off. disks take bays in the order they first appear, the
+/// match rules deciding which. once the trace has run out every bay's counters must be
+/// the provider's, or the bench fails
+static char replay_bays[BENCH_MAX_BAYS][DISKSTATS_NAME_LEN];
+
+static int bench_replay_identify( const char *dev, int stat_index, struct hpled *bay )
+{
+	int b;
+
+	for ( b = 0; b < bench_bays && replay_bays[b][0] && strcmp(replay_bays[b], dev) != 0; ++b )
+		;
+	if ( b == bench_bays )
+		return -1;
+	snprintf(replay_bays[b], DISKSTATS_NAME_LEN, "%s", dev);
+	snprintf(bay->path, sizeof(bay->path), "/dev/%s", dev);
+	bay->path_id = b + 1;
+	bay->target_id = 0;
+	bay->dev_index = stat_index;
+	return b;
+}
+
+/* distinct timestamps in a trace - the snapshots replaying it takes */
+static u_int64_t bench_trace_snapshots( const char *trace )
+{
+	FILE *f = fopen(trace, "r");
+	char line[256];
+	uintmax_t msec, last = 0;
+	u_int64_t n = 0;
+
+	if ( f == NULL )
+		err(1, "Unable to read %s", trace);
+	while ( fgets(line, sizeof(line), f) != NULL ) {
+		if ( line[0] == '#' || sscanf(line, "%ju", &msec) != 1 )
+			continue;
+		n += ( n == 0 || msec != last );
+		last = msec;
+	}
+	fclose(f);
+	return n;
+}
+
+static void bench_replay( const char *trace )
+{
+	const u_int64_t snapshots = bench_trace_snapshots(trace);
+	struct timespec t0;
+	int bays = 0;
+
+	diskstats = &diskstats_replay;
+	if ( diskstats->open(trace) != 0 )
+		errx(1, "Unable to replay %s", trace);
+	memset(hpex49x, 0, hpbays * sizeof(*hpex49x));
+	memset(replay_bays, 0, sizeof(replay_bays));
+	memset(obs.lit, 0, sizeof(obs.lit));
+	hpdisks = 0;
+	bay_identify = bench_replay_identify;
+	idle_delay_max = LED_DELAY;
+	if ( !monitor_baseline() || led_writer_start() != 0 )
+		errx(1, "Unable to start the monitor");
+	monitor_discover();
+	led_bays_off(set_hpex_led, 1);
+	gpio_flush();
+
+	thread_run = 1;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if ( pthread_create(&monitor, NULL, monitor_thread_run, NULL) != 0 )
+		err(1, "Unable to create monitor thread");
+	/* open took the first snapshot and each tick takes the next - one spare to publish the last */
+	while ( __atomic_load_n(&sample_tick, __ATOMIC_ACQUIRE) < snapshots && ms_since(&t0) < snapshots * (LED_DELAY / 1e6) * 2 + 5000 )
+		usleep(1000);
+	const double secs = ms_since(&t0) / 1e3;
+	monitor_stop();
+	pthread_join(monitor, NULL);
+	led_writer_stop();
+
+	printf("%s: %ju snapshots replayed in %ju ticks, %.1f s, %zu disks in bays\n", trace, (uintmax_t)snapshots,
+		(uintmax_t)sample_tick, secs, hpdisks);
+	for ( int b = 0; b < bench_bays; ++b ) {
+		struct hpsample s;
+		struct diskstat ds;
+
+		if ( !monitor_sample(b, &s) )
+			continue;
+		const int idx = diskstats->find(replay_bays[b]);
+		if ( idx < 0 || diskstats->read(idx, &ds) != 0 || ds.bytes_read != s.n_read || ds.bytes_write != s.n_write )
+			errx(1, "bay %d %s: the monitor has %ju bytes read and %ju written, the trace %ju and %ju", b + 1, replay_bays[b],
+				(uintmax_t)s.n_read, (uintmax_t)s.n_write, (uintmax_t)ds.bytes_read, (uintmax_t)ds.bytes_write);
+		printf("bay %d %-8s %10.1f MB read %10.1f MB written, lit %ju times - counters match the trace\n", b + 1, replay_bays[b],
+			s.n_read / 1e6, s.n_write / 1e6, (uintmax_t)obs.lit[b]);
+		++bays;
+	}
+	diskstats->close();
+	diskstats = &diskstats_synth;
+	if ( bays == 0 )
+		errx(1, "no disk in %s went in a bay - see -M", trace);
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// -d - the Linux /proc/diskstats provider, read every LED_DELAY for -t seconds into
+/// <outdir>/bench-procfs.trace for -R. only the devices the match rules select are
+/// recorded, whole disks unless -M says otherwise. a counter that goes backwards while
+/// the device list stays the same fails the bench
+static void bench_procfs( double secs, const char *outdir )
+{
+	static struct diskstat start[DISKSTATS_MAX], prev[DISKSTATS_MAX];
+	const struct timespec step = { .tv_sec = 0, .tv_nsec = LED_DELAY };
+	struct timespec t0;
+	char path[256];
+	u_int64_t snapshots = 0;
+	int changes = 0, selected = 0, rc = 1;
+	FILE *f;
+
+	diskstats = &diskstats_procfs;
+	if ( diskstats->open(NULL) != 0 )
+		err(1, "Unable to open /proc/diskstats");
+	snprintf(path, sizeof(path), "%s/bench-procfs.trace", outdir);
+	if ( (f = fopen(path, "w")) == NULL )
+		err(1, "Unable to write %s", path);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	for (;;) {
+		const u_int64_t msec = ms_since(&t0);
+
+		for ( int i = 0; i < diskstats->count(); ++i ) {
+			const char *dev = diskstats->device(i);
+			struct diskstat ds;
+
+			if ( dev == NULL || !devmatch_device(dev, diskstats->kind(i)) || diskstats->read(i, &ds) != 0 )
+				continue;
+			/* a new device list - this is where the device at i starts from */
+			if ( rc == 1 )
+				start[i] = prev[i] = ds;
+			if ( ds.bytes_read < prev[i].bytes_read || ds.bytes_write < prev[i].bytes_write ||
+				ds.ops_read < prev[i].ops_read || ds.ops_write < prev[i].ops_write || ds.busy_ns < prev[i].busy_ns )
+				errx(1, "%s counters went backwards in /proc/diskstats", dev);
+			prev[i] = ds;
+			diskstats_trace_line(f, msec, dev, &ds);
+		}
+		++snapshots;
+		if ( ms_since(&t0) >= secs * 1000 )
+			break;
+		nanosleep(&step, NULL);
+		if ( (rc = diskstats->snapshot()) < 0 )
+			errx(1, "Bad snapshot from the procfs disk stats provider");
+		changes += ( rc == 1 );
+	}
+	fclose(f);
+
+	for ( int i = 0; i < diskstats->count(); ++i ) {
+		const char *dev = diskstats->device(i);
+
+		if ( dev == NULL || !devmatch_device(dev, diskstats->kind(i)) )
+			continue;
+		printf("%-10s kind 0x%03x %10.1f MB read %10.1f MB written %8.1f ms busy\n", dev, diskstats->kind(i),
+			(prev[i].bytes_read - start[i].bytes_read) / 1e6, (prev[i].bytes_write - start[i].bytes_write) / 1e6,
+			(prev[i].busy_ns - start[i].busy_ns) / 1e6);
+		++selected;
+	}
+	printf("procfs: %ju snapshots in %.1f s, %d device list changes, %d of %d devices selected - replay %s with -R\n",
+		(uintmax_t)snapshots, ms_since(&t0) / 1e3, changes, selected, diskstats->count(), path);
+	diskstats->close();
+	diskstats = &diskstats_synth;
+	if ( selected == 0 )
+		errx(1, "no device in /proc/diskstats is selected - see -M");
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// the match rules against devstat's own device_type values - run before every mode, a
+/// rule that picks the wrong interface fails the bench
+static void bench_match_kinds(void)
+{
+	static const struct { const char *rule, *dev; unsigned kind; int selected; } cases[] = {
+		{ "if=ide", "ada0", DEVSTAT_TYPE_DIRECT | DEVSTAT_TYPE_IF_IDE, 1 },
+		{ "if=ide", "da0", DEVSTAT_TYPE_DIRECT | DEVSTAT_TYPE_IF_SCSI, 0 },
+		{ "if=scsi", "da0", DEVSTAT_TYPE_DIRECT | DEVSTAT_TYPE_IF_SCSI, 1 },
+		{ "if=nvme", "nda0", DEVSTAT_TYPE_DIRECT | DEVSTAT_TYPE_IF_NVME, 1 },
+		{ "if=other", "ada0", DEVSTAT_TYPE_DIRECT | DEVSTAT_TYPE_IF_IDE, 0 },
+		{ "!if=nvme;type=direct", "nvd0", DEVSTAT_TYPE_DIRECT | DEVSTAT_TYPE_IF_NVME, 0 },
+		{ "!if=nvme;type=direct", "ada0", DEVSTAT_TYPE_DIRECT | DEVSTAT_TYPE_IF_IDE, 1 },
+		{ DEVMATCH_DEFAULT, "pass0", DEVSTAT_TYPE_PASS | DEVSTAT_TYPE_IF_SCSI, 0 },
+	};
+
+	for ( size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i ) {
+		devmatch_clear();
+		if ( devmatch_add(cases[i].rule) != 0 || devmatch_device(cases[i].dev, cases[i].kind) != cases[i].selected )
+			errx(1, "match \"%s\" %s %s with kind 0x%03x", cases[i].rule, ( cases[i].selected ) ? "leaves out" : "selects",
+				cases[i].dev, cases[i].kind);
+	}
+	devmatch_clear();
+}
+
+/////////////////////////////////////////////////////////////////////////
+/// every H341/H342 bay LED against the simulated SCH5127 - lighting one must change
+/// exactly one GP register and turning it off must put that register back
+static void bench_sch5127_leds(void)
+{
+	static const struct { const char *name; int bit; } leds[] = {
+		{ "BLUE0", 0x4b }, { "BLUE1", 0x4c }, { "BLUE2", 0x52 }, { "BLUE3", 0x50 },
+		{ "RED0", 0x59 }, { "RED1", 0x58 }, { "RED2", 0x4e }, { "RED3", 0x51 },
+	};
+
+	portio_open(&portio_sim);
+	gpiobase = portio_sim_config.gpiobase;
+	sch5127_regs = portio_sim_config.sch5127_regs;
+	gpio_shadow_init();
+
+	for ( size_t i = 0; i < sizeof(leds) / sizeof(leds[0]); ++i ) {
+		unsigned int before[BENCH_GP_REGS];
+		int changed = 0, restored = 1;
+
+		for ( int r = 0; r < BENCH_GP_REGS; ++r )
+			before[r] = portio_sim_peek(sch5127_regs + BENCH_REG_GP1 + r);
+		setgpregslvl(leds[i].bit, 1);
+		gpio_write();
+		for ( int r = 0; r < BENCH_GP_REGS; ++r )
+			changed += ( portio_sim_peek(sch5127_regs + BENCH_REG_GP1 + r) != before[r] );
+		setgpregslvl(leds[i].bit, 0);
+		gpio_write();
+		for ( int r = 0; r < BENCH_GP_REGS; ++r )
+			restored &= ( portio_sim_peek(sch5127_regs + BENCH_REG_GP1 + r) == before[r] );
+
+		if ( changed != 1 || !restored )
+			errx(1, "H341 %s (0x%02x) changed %d GP registers%s", leds[i].name, leds[i].bit, changed,
+				( restored ) ? "" : " and turning it off left one changed");
+	}
+	portio_close();
+	memset(&portio_stats, 0, sizeof(portio_stats));
+}
+
+int main( int argc, char **argv )
+{
+	const char *only = NULL, *outdir = ".", *map = NULL, *replay = NULL;
+	double secs = 3;
+	int c, restart = 0, exporter = 0, cam = 0, smart = 0, power = 0, procfs = 0, matched = 0;
+
+	bench_match_kinds();
+	bench_sch5127_leds();
+	while ( (c = getopt(argc, argv, "bcdeHi:kLm:M:pPrR:s:t:uwo:h")) != -1 ) {
+		switch ( c ) {
+			case 'b': hw_blink = 1; break;
+			case 'c': cam = 1; break;
+			case 'd': procfs = 1; break;
+			case 'e': exporter = 1; break;
+			case 'H': smart = 1; break;
+			case 'i': idle_delay_max = atol(optarg) * 1000000; break;
+			case 'k':
+				bench_kernel();
+				return 0;
+			case 'L':
+				bench_log();
+				return 0;
+			case 'm': map = optarg; break;
+			case 'M':
+				if ( devmatch_add(optarg) != 0 )
+					return 1;
+				matched = 1;
+				break;
+			case 'p': bench_perf = 1; break;
+			case 'P': power = 1; break;
+			case 'r': restart = 1; break;
+			case 'R': replay = optarg; break;
+			case 's': only = optarg; break;
+			case 't': secs = atof(optarg); break;
+			case 'u':
+				bench_update();
+				return 0;
+			case 'w': bench_trace = 1; break;
+			case 'o': outdir = optarg; break;
+			default: return bench_help(argv[0]);
+		}
+	}
+	if ( procfs ) {
+		if ( !matched && devmatch_add(BENCH_PROCFS_MATCH) != 0 )
+			return 1;
+		bench_procfs(secs, outdir);
+		return 0;
+	}
+	if ( evloop_open() != 0 )
+		err(1, "Unable to open the event loop");
+	bay_identify = ( restart ) ? NULL : bench_identify;
+
+	bench_io = portio_sim;
+	bench_io.name = "bench";
+	bench_io.outl = bench_outl;
+	bench_io.outb = bench_outb;
+
+	/* the platform's built in bay map unless -m loaded one */
+	if ( map && baymap_load(map) != 0 )
+		errx(1, "Unable to load the bay map %s", map);
+	portio_open(&bench_io);
+	if ( init_hpex49x_led() != 1 || !monitor_bays(baymap.nbays) )
+		errx(1, "Unable to set up %zu bays", baymap.nbays);
+	bench_bays = ( baymap.nbays < BENCH_MAX_BAYS ) ? baymap.nbays : BENCH_MAX_BAYS;
+	if ( cam ) {
+		bench_cam();
+		portio_close();
+		return 0;
+	}
+	if ( smart ) {
+		bench_health();
+		portio_close();
+		return 0;
+	}
+	if ( power ) {
+		bench_power();
+		portio_close();
+		return 0;
+	}
+	if ( replay ) {
+		bench_replay(replay);
+		portio_close();
+		return 0;
+	}
+	portio_close();
+
+	if ( exporter ) {
+		if ( export_start("127.0.0.1:0", NULL) != 0 || export_port() == -1 )
+			errx(1, "Unable to start the exporter");
+		scrape.port = export_port();
+	}
+
+	/* snap/tick is disk stats snapshots (devstat_getdevs() calls on FreeBSD) per monitor tick.
+	   wakeups/s are context switches of the monitoring threads, generator excluded.
+	   reinit ms is the mean time the monitor spent re-initializing per device change burst.
+	   MB/s is the rate engine's 1 s average for all bays together when the run ended */
+	printf("%-8s %6s %8s %9s %9s %10s %8s %8s %8s %6s %7s %9s %8s\n", "workload", "secs", "ticks/s", "wakeups/s", "snap/tick",
+		"gpio ops/s", "cpu ms/s", "p50 ms", "p99 ms", "n", "reinits", "reinit ms", "MB/s");
+
+	for ( size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); ++i ) {
+		if ( only && strcmp(only, scenarios[i].name) != 0 )
+			continue;
+		bench_run(&scenarios[i], secs, outdir);
+	}
+	export_stop();
+	return 0;
+}
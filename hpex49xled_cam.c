@@ -0,0 +1,255 @@
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_cam.c
+///////
+/////// CAM bus enumeration - every periph with its SIM, path and target from one
+/////// XPT_DEV_MATCH query, so bay discovery never opens a disk
+///////
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+/////////////////////////////////////////////////////////////////////////////////
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+
+#if defined(__FreeBSD__)
+#include <sys/ioctl.h>
+#include <camlib.h>
+#include <cam/cam.h>
+#include <cam/cam_ccb.h>
+#include <cam/ata/ata_all.h>
+#include <cam/scsi/scsi_all.h>
+#include <cam/scsi/scsi_pass.h>
+#endif
+
+#include "hpex49xled_cam.h"
+#include "hpex49xled_timer.h"
+
+struct camenum_counters camenum_stats;
+char camenum_errbuf[256];
+
+static struct camperiph periphs[CAMENUM_MAX];
+static size_t nperiphs = 0;
+
+#if defined(__FreeBSD__)
+/////////////////////////////////////////////////////////////////////////
+/// one XPT_DEV_MATCH without patterns returns the whole CAM tree - every bus ahead of
+/// the devices and periphs on it - the way camcontrol devlist reads it. bus results
+/// name the SIM of a path_id, periph results the driver, unit, path and target. only
+/// a tree bigger than CAMENUM_MATCH_BUF takes more than one ioctl. nothing here opens,
+/// or sends a command to, a disk - the device results carry the IDENTIFY and INQUIRY
+/// data CAM kept from probing, so the ident comes along for free
+#define XPT_RETRY 3 // scans restarted because the tree changed under one
+
+/// append the printable part of a fixed size, space padded CAM string to dst
+static void xpt_ident( char *dst, size_t len, const void *src, size_t n )
+{
+	const unsigned char *s = src;
+	size_t at = strlen(dst);
+
+	while ( n > 0 && ( s[n - 1] == ' ' || s[n - 1] == '\0' ) )
+		--n;
+	while ( n > 0 && *s == ' ' )
+		++s, --n;
+	if ( at > 0 && n > 0 && at + 1 < len )
+		dst[at++] = ' ';
+	for ( ; n > 0 && at + 1 < len; ++s, --n )
+		if ( isgraph(*s) || *s == ' ' )
+			dst[at++] = *s;
+	dst[at] = '\0';
+};
+
+static int xpt_scan( struct camperiph *out, size_t max, size_t *n )
+{
+	static struct dev_match_result matches[CAMENUM_MATCH_BUF];
+	static struct { char sim[BAYMAP_SIM_LEN]; int unit, bus_id; } bus[CAMENUM_MAX_PATH];
+	struct { path_id_t path_id; target_id_t target_id; lun_id_t lun; char ident[CAMENUM_IDENT_LEN]; } dev; /* the periphs follow their device */
+	union ccb ccb;
+	int fd, retry = 0;
+
+	if ( (fd = open(XPT_DEVICE, O_RDWR)) == -1 ) {
+		snprintf(camenum_errbuf, sizeof(camenum_errbuf), "%s: %s", XPT_DEVICE, strerror(errno));
+		return -1;
+	}
+restart:
+	*n = 0;
+	memset(bus, 0, sizeof(bus));
+	memset(&dev, 0, sizeof(dev));
+	memset(&ccb, 0, sizeof(ccb));
+	ccb.ccb_h.path_id = CAM_XPT_PATH_ID;
+	ccb.ccb_h.target_id = CAM_TARGET_WILDCARD;
+	ccb.ccb_h.target_lun = CAM_LUN_WILDCARD;
+	ccb.ccb_h.func_code = XPT_DEV_MATCH;
+	ccb.cdm.match_buf_len = sizeof(matches);
+	ccb.cdm.matches = matches;
+	ccb.cdm.num_patterns = 0;
+	ccb.cdm.pattern_buf_len = 0;
+
+	do {
+		if ( ioctl(fd, CAMIOCOMMAND, &ccb) == -1 ) {
+			snprintf(camenum_errbuf, sizeof(camenum_errbuf), "XPT_DEV_MATCH on %s: %s", XPT_DEVICE, strerror(errno));
+			close(fd);
+			return -1;
+		}
+		++camenum_stats.ioctls;
+		if ( ccb.cdm.status == CAM_DEV_MATCH_LIST_CHANGED && ++retry < XPT_RETRY )
+			goto restart;
+		if ( (ccb.ccb_h.status & CAM_STATUS_MASK) != CAM_REQ_CMP ||
+			(ccb.cdm.status != CAM_DEV_MATCH_LAST && ccb.cdm.status != CAM_DEV_MATCH_MORE) ) {
+			snprintf(camenum_errbuf, sizeof(camenum_errbuf), "XPT_DEV_MATCH on %s: CAM status %#x, match status %d",
+				XPT_DEVICE, ccb.ccb_h.status, ccb.cdm.status);
+			close(fd);
+			return -1;
+		}
+		for ( u_int i = 0; i < ccb.cdm.num_matches; i++ ) {
+			const struct dev_match_result *m = &matches[i];
+
+			if ( m->type == DEV_MATCH_BUS ) {
+				const struct bus_match_result *b = &m->result.bus_result;
+				if ( b->path_id >= CAMENUM_MAX_PATH )
+					continue;
+				snprintf(bus[b->path_id].sim, sizeof(bus[b->path_id].sim), "%s", b->dev_name);
+				bus[b->path_id].unit = b->unit_number;
+				bus[b->path_id].bus_id = b->bus_id;
+			}
+			else if ( m->type == DEV_MATCH_DEVICE ) {
+				const struct device_match_result *d = &m->result.device_result;
+
+				dev.path_id = d->path_id;
+				dev.target_id = d->target_id;
+				dev.lun = d->target_lun;
+				dev.ident[0] = '\0';
+				if ( d->protocol == PROTO_ATA )
+					xpt_ident(dev.ident, sizeof(dev.ident), d->ident_data.serial, sizeof(d->ident_data.serial));
+				else if ( d->protocol == PROTO_SCSI ) {
+					xpt_ident(dev.ident, sizeof(dev.ident), d->inq_data.vendor, sizeof(d->inq_data.vendor));
+					xpt_ident(dev.ident, sizeof(dev.ident), d->inq_data.product, sizeof(d->inq_data.product));
+				}
+			}
+			else if ( m->type == DEV_MATCH_PERIPH && *n < max ) {
+				const struct periph_match_result *p = &m->result.periph_result;
+				struct camperiph *c = &out[(*n)++];
+
+				memset(c, 0, sizeof(*c));
+				snprintf(c->name, sizeof(c->name), "%s", p->periph_name);
+				c->unit = p->unit_number;
+				c->path_id = p->path_id;
+				c->target_id = p->target_id;
+				c->lun = p->target_lun;
+				if ( p->path_id < CAMENUM_MAX_PATH ) {
+					snprintf(c->sim, sizeof(c->sim), "%s", bus[p->path_id].sim);
+					c->sim_unit = bus[p->path_id].unit;
+					c->bus_id = bus[p->path_id].bus_id;
+				}
+				if ( p->path_id == dev.path_id && p->target_id == dev.target_id && p->target_lun == dev.lun )
+					snprintf(c->ident, sizeof(c->ident), "%s", dev.ident);
+			}
+		}
+	} while ( ccb.cdm.status == CAM_DEV_MATCH_MORE );
+
+	close(fd);
+	return 0;
+};
+
+#else
+static int xpt_scan( struct camperiph *out, size_t max, size_t *n )
+{
+	*n = 0;
+	snprintf(camenum_errbuf, sizeof(camenum_errbuf), "no CAM on this system");
+	return -1;
+};
+#endif
+
+const struct camenum_ops camenum_xpt = { "xpt", xpt_scan };
+
+/////////////////////////////////////////////////////////////////////////
+/// fixture - an EX49x as CAM shows it: four disks on ahcich1 - 4 (path_id 1 - 4, the
+/// built in bay map's layout), each with its pass device, and a USB stick that is not
+/// in a bay
+static const struct camperiph ex49x[] = {
+	{ "ada", 0, "ahcich", 1, 0, 1, 0, 0, "WD-WCAZA0000001" }, { "pass", 0, "ahcich", 1, 0, 1, 0, 0, "WD-WCAZA0000001" },
+	{ "ada", 1, "ahcich", 2, 0, 2, 0, 0, "WD-WCAZA0000002" }, { "pass", 1, "ahcich", 2, 0, 2, 0, 0, "WD-WCAZA0000002" },
+	{ "ada", 2, "ahcich", 3, 0, 3, 0, 0, "WD-WCAZA0000003" }, { "pass", 2, "ahcich", 3, 0, 3, 0, 0, "WD-WCAZA0000003" },
+	{ "ada", 3, "ahcich", 4, 0, 4, 0, 0, "WD-WCAZA0000004" }, { "pass", 3, "ahcich", 4, 0, 4, 0, 0, "WD-WCAZA0000004" },
+	{ "da", 0, "umass-sim", 0, 0, 7, 0, 0, "SanDisk Cruzer" }, { "pass", 4, "umass-sim", 0, 0, 7, 0, 0, "SanDisk Cruzer" },
+};
+const struct camperiph *camenum_fixture_table = ex49x;
+size_t camenum_fixture_count = sizeof(ex49x) / sizeof(ex49x[0]);
+
+static int fixture_scan( struct camperiph *out, size_t max, size_t *n )
+{
+	*n = ( camenum_fixture_count < max ) ? camenum_fixture_count : max;
+	memcpy(out, camenum_fixture_table, *n * sizeof(*out));
+	return 0;
+};
+
+const struct camenum_ops camenum_fixture = { "fixture", fixture_scan };
+
+#if defined(__FreeBSD__)
+const struct camenum_ops *camenum = &camenum_xpt;
+#else
+const struct camenum_ops *camenum = &camenum_fixture;
+#endif
+
+int camenum_scan(void)
+{
+	struct timespec t0, t1;
+	size_t n;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if ( camenum->scan(periphs, CAMENUM_MAX, &n) != 0 ) {
+		nperiphs = 0;
+		return -1;
+	}
+	nperiphs = n;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	++camenum_stats.scans;
+	camenum_stats.last_ns = timespec_diff_ns(&t1, &t0);
+	camenum_stats.periphs = n;
+	return 0;
+};
+
+const struct camperiph *camenum_find( const char *dev )
+{
+	size_t len = strlen(dev);
+
+	/* "ada12" - the driver name, then the unit */
+	while ( len > 0 && isdigit((unsigned char)dev[len - 1]) )
+		--len;
+	if ( len == 0 || dev[len] == '\0' || len >= CAMENUM_NAME_LEN )
+		return NULL;
+	const int unit = atoi(dev + len);
+
+	for ( size_t i = 0; i < nperiphs; i++ )
+		if ( periphs[i].unit == unit && strncmp(periphs[i].name, dev, len) == 0 && periphs[i].name[len] == '\0' )
+			return &periphs[i];
+	return NULL;
+};
@@ -0,0 +1,84 @@
+#ifndef INCLUDED_HPEX49XLED_CAM
+#define INCLUDED_HPEX49XLED_CAM
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_cam.h
+///////
+/////// CAM bus enumeration - every periph with its SIM, path and target from one
+/////// XPT_DEV_MATCH query, so bay discovery never opens a disk
+///////
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+/////////////////////////////////////////////////////////////////////////////////
+#include <sys/types.h>
+
+#include "hpex49xled_baymap.h"
+
+#define CAMENUM_NAME_LEN 16 // periph driver name - ada, da, pass - DEV_IDLEN
+#define CAMENUM_MAX 512 // periphs one scan keeps - pass and ada count separately
+#define CAMENUM_MAX_PATH 64 // path_ids whose SIM a scan remembers
+#define CAMENUM_MATCH_BUF 256 // results per XPT_DEV_MATCH ioctl - one ioctl covers a box this size
+#define CAMENUM_IDENT_LEN 41 // ATA serial (20), or SCSI vendor and product (8 + 16), printable and trimmed
+
+/// one periph - "ada0" on ahcich1, path_id 1 target 0
+struct camperiph {
+	char name[CAMENUM_NAME_LEN];
+	int unit;
+	char sim[BAYMAP_SIM_LEN];	///< SIM driver of the bus the periph hangs off
+	int sim_unit;
+	int bus_id;
+	int path_id;
+	int target_id;
+	long lun;
+	char ident[CAMENUM_IDENT_LEN];	///< the disk's serial number where CAM has one - "" if not
+};
+
+/// a backend - scan() lists every periph on every bus into out
+struct camenum_ops {
+	const char *name;
+	int (*scan)(struct camperiph *out, size_t max, size_t *n);	///< 0 on success, -1 with the reason in camenum_errbuf
+};
+
+/// what the scans cost
+struct camenum_counters {
+	u_int64_t scans;
+	u_int64_t ioctls;	///< XPT_DEV_MATCH calls - one per scan unless a scan overflows CAMENUM_MATCH_BUF
+	long long last_ns;	///< time the last scan took
+	size_t periphs;	///< periphs the last scan found
+};
+
+extern const struct camenum_ops camenum_xpt;	///< FreeBSD /dev/xpt0
+extern const struct camenum_ops camenum_fixture;	///< canned periphs from camenum_fixture_table - no hardware
+extern const struct camenum_ops *camenum;	///< backend bay discovery uses
+extern struct camenum_counters camenum_stats;
+extern char camenum_errbuf[256];
+
+/// the fixture backend's periphs - an EX49x with four disks on ahcich1 - 4 unless pointed elsewhere
+extern const struct camperiph *camenum_fixture_table;
+extern size_t camenum_fixture_count;
+
+int camenum_scan(void);	///< refresh the list from the backend - 0 on success, -1 with the reason in camenum_errbuf
+const struct camperiph *camenum_find( const char *dev );	///< "ada0" in the last scan, NULL if it is not there
+
+#endif //INCLUDED_HPEX49XLED_CAM
@@ -0,0 +1,136 @@
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_delta.c
+///////
+/////// Per bay disk counters as one array per counter, and the kernel that
+/////// turns a tick's counters into deltas and bitmasks of active bays
+///////
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/types.h>
+
+#include "hpex49xled_delta.h"
+
+#define BAYMASK_WORDS(n) (((n) + 63) / 64)
+
+/* clang vectorizes at -O2, gcc before 12 only at -O3 */
+#if defined(__GNUC__) && !defined(__clang__)
+#define DELTA_VECTORIZE __attribute__((optimize("tree-vectorize")))
+#else
+#define DELTA_VECTORIZE
+#endif
+
+/////////////////////////////////////////////////////////////////////////
+/// arrays for n bays in one cache line aligned block, every counter zero
+/// returns 0 on success, -1 when out of memory
+int baycounters_alloc( struct baycounters *c, size_t n )
+{
+	const size_t stride = (n + DELTA_LANES - 1) / DELTA_LANES * DELTA_LANES;
+	const size_t words = BAYMASK_WORDS(stride);
+	u_int64_t *p;
+
+	memset(c, 0, sizeof(*c));
+	if ( posix_memalign(&c->mem, 64, ((3 * BAY_COUNTERS + 1) * stride + 5 * words) * sizeof(u_int64_t)) != 0 ) {
+		c->mem = NULL;
+		return -1;
+	}
+	memset(c->mem, 0, ((3 * BAY_COUNTERS + 1) * stride + 5 * words) * sizeof(u_int64_t));
+
+	p = c->mem;
+	for ( int k = 0; k < BAY_COUNTERS; ++k ) {
+		c->now[k] = p; p += stride;
+		c->last[k] = p; p += stride;
+		c->delta[k] = p; p += stride;
+	}
+	c->read_mask = p; p += words;
+	c->write_mask = p; p += words;
+	c->active = p; p += words;
+	c->present = p; p += words;
+	c->stored = p; p += words;
+	c->queue = p;
+	c->n = n;
+	c->stride = stride;
+	return 0;
+};
+
+void baycounters_free( struct baycounters *c )
+{
+	free(c->mem);
+	memset(c, 0, sizeof(*c));
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// a bay starts over from ds - the next delta is measured from here
+void baycounters_reset( struct baycounters *c, size_t bay, const struct diskstat *ds )
+{
+	baycounters_store(c, bay, ds);
+	for ( int k = 0; k < BAY_COUNTERS; ++k ) {
+		c->last[k][bay] = c->now[k][bay];
+		c->delta[k][bay] = 0;
+	}
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// one counter - restrict on the parameters tells the compiler the arrays do not overlap
+static inline void baycounters_delta1( const u_int64_t *restrict now, u_int64_t *restrict last, u_int64_t *restrict delta, size_t n )
+{
+	for ( size_t i = 0; i < n; ++i ) {
+		delta[i] = now[i] - last[i];
+		last[i] = now[i];
+	}
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// delta = now - last and last = now for every counter of every bay, then the masks.
+/// no branches and arrays padded to DELTA_LANES, so the compiler turns each pass into
+/// vector loads, subtracts and compares. bays that are not monitored keep now == last
+/// and come out as zero
+DELTA_VECTORIZE void baycounters_delta( struct baycounters *c )
+{
+	const size_t stride = c->stride;
+
+	for ( int k = 0; k < BAY_COUNTERS; ++k )
+		baycounters_delta1(c->now[k], c->last[k], c->delta[k], stride);
+
+	const u_int64_t *restrict dr = c->delta[BAY_BYTES_READ];
+	const u_int64_t *restrict dw = c->delta[BAY_BYTES_WRITE];
+
+	for ( size_t w = 0; w < BAYMASK_WORDS(stride); ++w ) {
+		const size_t base = w * 64, end = ( stride - base < 64 ) ? stride - base : 64;
+		u_int64_t r = 0, wr = 0;
+
+		for ( size_t b = 0; b < end; ++b ) {
+			r |= (u_int64_t)( dr[base + b] != 0 ) << b;
+			wr |= (u_int64_t)( dw[base + b] != 0 ) << b;
+		}
+		c->read_mask[w] = r;
+		c->write_mask[w] = wr;
+		c->active[w] = r | wr;
+		c->present[w] = c->stored[w];
+		c->stored[w] = 0;
+	}
+};
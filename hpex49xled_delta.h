@@ -0,0 +1,96 @@
+#ifndef INCLUDED_HPEX49XLED_DELTA
+#define INCLUDED_HPEX49XLED_DELTA
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_delta.h
+///////
+/////// Per bay disk counters as one array per counter, and the kernel that
+/////// turns a tick's counters into deltas and bitmasks of active bays
+///////
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+/////////////////////////////////////////////////////////////////////////////////
+#include <sys/types.h>
+
+#include "hpex49xled_stats.h"
+
+#define DELTA_LANES 8 // counter arrays are padded to a multiple of this many bays - one AVX-512 vector, two AVX2
+
+/// the counters kept per bay - one array each
+enum baycounter {
+	BAY_BYTES_READ = 0,
+	BAY_BYTES_WRITE,
+	BAY_BYTES_FREE,
+	BAY_OPS_READ,
+	BAY_OPS_WRITE,
+	BAY_OPS_FREE,
+	BAY_BUSY_NS,
+	BAY_DURATION_NS,
+	BAY_COUNTERS
+};
+
+/// structure of arrays over the bays - the monitor stores each bay's cumulative counters
+/// in now[] and baycounters_delta() computes every delta and mask in one pass. the masks
+/// hold one bit per bay, bay i is bit i % 64 of word i / 64
+struct baycounters {
+	size_t n;			///< bays
+	size_t stride;			///< entries per counter array - n rounded up to DELTA_LANES
+	u_int64_t *now[BAY_COUNTERS];	///< cumulative counters as of this tick
+	u_int64_t *last[BAY_COUNTERS];	///< cumulative counters as of the previous tick
+	u_int64_t *delta[BAY_COUNTERS];	///< now - last, filled by baycounters_delta()
+	u_int64_t *read_mask;		///< bays whose bytes read changed
+	u_int64_t *write_mask;		///< bays whose bytes written changed
+	u_int64_t *active;		///< read_mask | write_mask
+	u_int64_t *present;		///< bays stored since the previous baycounters_delta()
+	u_int64_t *stored;		///< bays stored so far this tick - moved to present by baycounters_delta()
+	u_int64_t *queue;		///< transactions outstanding at this tick - stored, not differenced
+	void *mem;
+};
+
+int baycounters_alloc( struct baycounters *c, size_t n );
+void baycounters_free( struct baycounters *c );
+void baycounters_reset( struct baycounters *c, size_t bay, const struct diskstat *ds );
+void baycounters_delta( struct baycounters *c );
+
+/// this tick's cumulative counters for a bay
+static inline void baycounters_store( struct baycounters *c, size_t bay, const struct diskstat *ds )
+{
+	c->now[BAY_BYTES_READ][bay] = ds->bytes_read;
+	c->now[BAY_BYTES_WRITE][bay] = ds->bytes_write;
+	c->now[BAY_BYTES_FREE][bay] = ds->bytes_free;
+	c->now[BAY_OPS_READ][bay] = ds->ops_read;
+	c->now[BAY_OPS_WRITE][bay] = ds->ops_write;
+	c->now[BAY_OPS_FREE][bay] = ds->ops_free;
+	c->now[BAY_BUSY_NS][bay] = ds->busy_ns;
+	c->now[BAY_DURATION_NS][bay] = ds->duration_ns;
+	c->queue[bay] = ds->queue;
+	c->stored[bay / 64] |= (u_int64_t)1 << (bay % 64);
+};
+
+static inline int baymask_test( const u_int64_t *mask, size_t bay )
+{
+	return (mask[bay / 64] >> (bay % 64)) & 1;
+};
+
+#endif //INCLUDED_HPEX49XLED_DELTA
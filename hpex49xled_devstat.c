@@ -0,0 +1,399 @@
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_devstat.c
+///////
+/////// Disk statistics providers for FreeBSD - libdevstat and the mapped /dev/devstat
+///////
+/////// -------------------------------------------------------------------------
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#if defined(__FreeBSD__)
+#include <stdio.h>
+#include <err.h>
+#include <fcntl.h>
+#include <paths.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <devstat.h>
+
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#include "hpex49xled_stats.h"
+#include "hpex49xled_timer.h"
+
+static struct statinfo cur;
+static kvm_t *kd = NULL;
+
+static int ds_open( const char *arg )
+{
+	if ( devstat_checkversion(kd) < 0 )
+		return -1;
+	if ( cur.dinfo != NULL )
+		return 0;
+	if ( (cur.dinfo = (struct devinfo *)calloc(1, sizeof(struct devinfo))) == NULL )
+		return -1;
+	/* calculate all updates since boot */
+	cur.snap_time = 0;
+	return ( devstat_getdevs(kd, &cur) == -1 ) ? -1 : 0;
+};
+
+static void ds_close(void)
+{
+	if ( cur.dinfo != NULL )
+		free(cur.dinfo->mem_ptr);
+	free(cur.dinfo);
+	cur.dinfo = NULL;
+};
+
+static int ds_snapshot(void)
+{
+	return devstat_getdevs(kd, &cur);
+};
+
+static int ds_find( const char *dev )
+{
+	char name[DISKSTATS_NAME_LEN];
+
+	for ( int i = 0; i < cur.dinfo->numdevs; ++i ) {
+		snprintf(name, sizeof(name), "%s%d", cur.dinfo->devices[i].device_name, cur.dinfo->devices[i].unit_number);
+		if ( strcmp(name, dev) == 0 ) return i;
+	}
+	return -1;
+};
+
+static int ds_count(void)
+{
+	return cur.dinfo->numdevs;
+};
+
+static const char *ds_device( int idx )
+{
+	static char name[DISKSTATS_NAME_LEN];
+
+	if ( idx < 0 || idx >= cur.dinfo->numdevs )
+		return NULL;
+	snprintf(name, sizeof(name), "%s%d", cur.dinfo->devices[idx].device_name, cur.dinfo->devices[idx].unit_number);
+	return name;
+};
+
+/* kind() hands devstat's device_type on unchanged */
+_Static_assert((int)DISKSTATS_IF_SCSI == DEVSTAT_TYPE_IF_SCSI && (int)DISKSTATS_IF_IDE == DEVSTAT_TYPE_IF_IDE &&
+	(int)DISKSTATS_IF_OTHER == DEVSTAT_TYPE_IF_OTHER && (int)DISKSTATS_IF_NVME == DEVSTAT_TYPE_IF_NVME &&
+	(int)DISKSTATS_IF_MASK == DEVSTAT_TYPE_IF_MASK && (int)DISKSTATS_PASS == DEVSTAT_TYPE_PASS, "diskstats_kind must match devstat's device_type");
+
+static unsigned ds_kind( int idx )
+{
+	if ( idx < 0 || idx >= cur.dinfo->numdevs )
+		return DISKSTATS_IF_OTHER;
+	return cur.dinfo->devices[idx].device_type;
+};
+
+static int ds_read( int idx, struct diskstat *ds )
+{
+	long double etime = 1.00; /* only totals are asked for - etime is unused */
+	long double busy, duration;
+
+	if ( idx < 0 || idx >= cur.dinfo->numdevs )
+		return -1;
+
+	if ( devstat_compute_statistics(&cur.dinfo->devices[idx], NULL, etime,
+		DSM_TOTAL_BYTES_READ, &ds->bytes_read, DSM_TOTAL_BYTES_WRITE, &ds->bytes_write,
+		DSM_TOTAL_TRANSFERS_READ, &ds->ops_read, DSM_TOTAL_TRANSFERS_WRITE, &ds->ops_write,
+		DSM_TOTAL_BYTES_FREE, &ds->bytes_free, DSM_TOTAL_TRANSFERS_FREE, &ds->ops_free,
+		DSM_TOTAL_BUSY_TIME, &busy, DSM_TOTAL_DURATION, &duration, DSM_QUEUE_LENGTH, &ds->queue, DSM_NONE) != 0 )
+		return -1;
+
+	ds->busy_ns = busy * 1000000000;
+	ds->duration_ns = duration * 1000000000;
+	return 0;
+};
+
+static long ds_generation(void)
+{
+	return cur.dinfo->generation;
+};
+
+const struct diskstats_ops diskstats_devstat = {
+	.name = "devstat",
+	.open = ds_open,
+	.close = ds_close,
+	.snapshot = ds_snapshot,
+	.find = ds_find,
+	.count = ds_count,
+	.device = ds_device,
+	.kind = ds_kind,
+	.read = ds_read,
+	.generation = ds_generation,
+};
+
+/////////////////////////////////////////////////////////////////////////////
+//// /dev/devstat maps the kernel's devstat pages read only - the counters are read straight
+//// from kernel memory with no copy and no system call per tick. each struct devstat stays
+//// at the same address for as long as its device exists, so an index is page * per page
+//// + slot and never moves. the kernel bumps sequence1 before an update and sequence0
+//// after it - a reader that sees them equal around its copy has a consistent record.
+//// pages are only ever added, so a new device that needs one means mapping more of the
+//// file. the generation still comes from sysctl, but only once a DEVMAP_GENERATION_NS -
+//// a removed disk is noticed sooner, on the tick its record is freed or reused
+#define DEVMAP_GENERATION_NS 1000000000LL
+#define DEVMAP_READ_RETRY 100 // a writer holds a record for a few instructions
+
+static int dm_fd = -1;
+static const struct devstat *dm_stats = NULL;
+static size_t dm_npages = 0, dm_spp = 0, dm_pagesize = 0;
+static long dm_generation = -1;
+static struct timespec dm_checked;
+
+/* the records read since the last change - snapshot() checks only these each tick */
+struct dm_watch {
+	int idx;
+	struct bintime created;
+};
+static struct dm_watch *dm_watch = NULL;
+static unsigned char *dm_watched = NULL;
+static size_t dm_nwatch = 0;
+
+/////////////////////////////////////////////////////////////////////////////
+//// map one page more until the kernel has no more to give - returns 1 if the mapping grew
+static int dm_resync(void)
+{
+	const size_t before = dm_npages;
+
+	for (;;) {
+		void *p = mmap(NULL, (dm_npages + 1) * dm_pagesize, PROT_READ, MAP_SHARED, dm_fd, 0);
+
+		if ( p == MAP_FAILED )
+			break;
+		if ( dm_stats != NULL )
+			munmap((void *)dm_stats, dm_npages * dm_pagesize);
+		dm_stats = (const struct devstat *)p;
+		++dm_npages;
+	}
+	if ( dm_npages == before )
+		return 0;
+
+	unsigned char *watched = realloc(dm_watched, dm_npages * dm_spp);
+	struct dm_watch *watch = realloc(dm_watch, dm_npages * dm_spp * sizeof(*dm_watch));
+
+	if ( watched != NULL )
+		dm_watched = watched;
+	if ( watch != NULL )
+		dm_watch = watch;
+	if ( watched == NULL || watch == NULL )
+		return -1;
+	memset(dm_watched, 0, dm_npages * dm_spp);
+	dm_nwatch = 0;
+	return 1;
+};
+
+static inline const struct devstat *dm_record( int idx )
+{
+	if ( idx < 0 || (size_t)idx >= dm_npages * dm_spp )
+		return NULL;
+	/* records do not straddle pages - the tail of each page is unused */
+	return (const struct devstat *)((const char *)dm_stats + (idx / dm_spp) * dm_pagesize) + idx % dm_spp;
+};
+
+static int dm_open( const char *arg )
+{
+	if ( dm_fd != -1 )
+		return 0;
+	if ( devstat_checkversion(NULL) < 0 )
+		return -1;
+	if ( (dm_fd = open(_PATH_DEV DEVSTAT_DEVICE_NAME, O_RDONLY)) == -1 )
+		return -1;
+
+	dm_pagesize = getpagesize();
+	dm_spp = dm_pagesize / sizeof(struct devstat);
+	if ( dm_resync() != 1 || (dm_generation = devstat_getgeneration(NULL)) == -1 ) {
+		close(dm_fd);
+		dm_fd = -1;
+		return -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC_FAST, &dm_checked);
+	return 0;
+};
+
+static void dm_close(void)
+{
+	if ( dm_stats != NULL )
+		munmap((void *)dm_stats, dm_npages * dm_pagesize);
+	if ( dm_fd != -1 )
+		close(dm_fd);
+	free(dm_watch);
+	free(dm_watched);
+	dm_stats = NULL;
+	dm_watch = NULL;
+	dm_watched = NULL;
+	dm_npages = dm_nwatch = 0;
+	dm_fd = -1;
+	dm_generation = -1;
+};
+
+static int dm_snapshot(void)
+{
+	struct timespec now;
+	int changed = 0;
+
+	for ( size_t i = 0; i < dm_nwatch; ++i ) {
+		const struct devstat *d = dm_record(dm_watch[i].idx);
+
+		if ( !__atomic_load_n(&d->allocated, __ATOMIC_RELAXED) ||
+			d->creation_time.sec != dm_watch[i].created.sec || d->creation_time.frac != dm_watch[i].created.frac ) {
+			changed = 1;
+			break;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC_FAST, &now);
+	if ( changed || timespec_diff_ns(&now, &dm_checked) >= DEVMAP_GENERATION_NS ) {
+		const long generation = devstat_getgeneration(NULL);
+
+		dm_checked = now;
+		if ( generation == -1 )
+			return -1;
+		if ( generation != dm_generation ) {
+			dm_generation = generation;
+			if ( dm_resync() == -1 )
+				return -1;
+			changed = 1;
+		}
+	}
+	if ( changed ) {
+		/* re-learned from the reads that follow */
+		memset(dm_watched, 0, dm_npages * dm_spp);
+		dm_nwatch = 0;
+	}
+	return changed;
+};
+
+static int dm_find( const char *dev )
+{
+	for ( int i = 0; (size_t)i < dm_npages * dm_spp; ++i ) {
+		const struct devstat *d = dm_record(i);
+		const size_t len = strnlen(d->device_name, sizeof(d->device_name));
+		char *end;
+
+		if ( !d->allocated || strncmp(d->device_name, dev, len) != 0 || dev[len] < '0' || dev[len] > '9' )
+			continue;
+		if ( strtol(dev + len, &end, 10) == d->unit_number && *end == '\0' )
+			return i;
+	}
+	return -1;
+};
+
+static int dm_count(void)
+{
+	return dm_npages * dm_spp;
+};
+
+static const char *dm_device( int idx )
+{
+	static char name[DISKSTATS_NAME_LEN];
+	const struct devstat *d = dm_record(idx);
+
+	if ( d == NULL || !d->allocated )
+		return NULL;
+	snprintf(name, sizeof(name), "%.*s%d", (int)sizeof(d->device_name), d->device_name, d->unit_number);
+	return name;
+};
+
+static unsigned dm_kind( int idx )
+{
+	const struct devstat *d = dm_record(idx);
+
+	if ( d == NULL || !d->allocated )
+		return DISKSTATS_IF_OTHER;
+	return d->device_type;
+};
+
+/* bintime to nanoseconds - the fraction is in units of 2^-64 seconds */
+static inline u_int64_t dm_bintime_ns( const struct bintime *bt )
+{
+	return (u_int64_t)bt->sec * 1000000000ULL + (((bt->frac >> 32) * 1000000000ULL) >> 32);
+};
+
+static int dm_read( int idx, struct diskstat *ds )
+{
+	const struct devstat *d = dm_record(idx);
+	struct bintime busy, duration[3];
+	u_int seq, start, end;
+
+	if ( d == NULL )
+		return -1;
+
+	/* a freed record keeps its last counters until it is reused - snapshot() notices either */
+	for ( int retry = 0; ; ++retry ) {
+		seq = __atomic_load_n(&d->sequence0, __ATOMIC_ACQUIRE);
+		ds->bytes_read = d->bytes[DEVSTAT_READ];
+		ds->bytes_write = d->bytes[DEVSTAT_WRITE];
+		ds->ops_read = d->operations[DEVSTAT_READ];
+		ds->ops_write = d->operations[DEVSTAT_WRITE];
+		ds->bytes_free = d->bytes[DEVSTAT_FREE];
+		ds->ops_free = d->operations[DEVSTAT_FREE];
+		busy = d->busy_time;
+		duration[0] = d->duration[DEVSTAT_READ];
+		duration[1] = d->duration[DEVSTAT_WRITE];
+		duration[2] = d->duration[DEVSTAT_FREE];
+		start = d->start_count;
+		end = d->end_count;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if ( __atomic_load_n(&d->sequence1, __ATOMIC_RELAXED) == seq )
+			break;
+		if ( retry == DEVMAP_READ_RETRY )
+			return -1;
+	}
+	ds->busy_ns = dm_bintime_ns(&busy);
+	ds->duration_ns = dm_bintime_ns(&duration[0]) + dm_bintime_ns(&duration[1]) + dm_bintime_ns(&duration[2]);
+	ds->queue = start - end;
+
+	if ( !dm_watched[idx] && d->allocated ) {
+		dm_watched[idx] = 1;
+		dm_watch[dm_nwatch].idx = idx;
+		dm_watch[dm_nwatch].created = d->creation_time;
+		++dm_nwatch;
+	}
+	return 0;
+};
+
+static long dm_generation_get(void)
+{
+	return dm_generation;
+};
+
+const struct diskstats_ops diskstats_devmap = {
+	.name = "devmap",
+	.open = dm_open,
+	.close = dm_close,
+	.snapshot = dm_snapshot,
+	.find = dm_find,
+	.count = dm_count,
+	.device = dm_device,
+	.kind = dm_kind,
+	.read = dm_read,
+	.generation = dm_generation_get,
+};
+#endif
@@ -0,0 +1,503 @@
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_export.c
+///////
+/////// Prometheus exporter - a small HTTP listener for /metrics and textfiles
+/////// for node_exporter, both rendered from the monitor's published counters
+///////
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* memmem on Linux */
+#endif
+#include <stdio.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#include "hpled.h"
+#include "hpex49xled_export.h"
+#include "hpex49xled_health.h"
+#include "hpex49xled_io.h"
+#include "hpex49xled_ledq.h"
+#include "hpex49xled_log.h"
+#include "hpex49xled_monitor.h"
+#include "hpex49xled_perf.h"
+#include "hpex49xled_rate.h"
+#include "hpex49xled_timer.h"
+
+struct export_counters export_stats;
+
+static pthread_t exporter;
+static int export_running = 0;
+static int listen_fd = -1;
+static int wake_pipe[2] = { -1, -1 };
+static char *textfile_dir = NULL;
+
+/* exporter thread only - the rendering and the bays it was made from */
+static char *text = NULL;
+static size_t text_len = 0, text_cap = 0;
+static struct export_bay {
+	int monitored, rated;
+	char device[sizeof(((struct hpled *)0)->path)];
+	struct hpsample sample;
+	struct bayrates rates;
+	struct health_bay health;
+} *bays = NULL;
+static size_t nbays = 0;
+
+static const char *window_names[RATE_WINDOWS] = { "1s", "10s", "60s" };
+
+/////////////////////////////////////////////////////////////////////////
+/// append to the rendering, growing the buffer as needed
+static void __attribute__((format(printf, 1, 2))) emit( const char *fmt, ... )
+{
+	va_list ap;
+	int n;
+
+	for (;;) {
+		va_start(ap, fmt);
+		n = vsnprintf(text + text_len, text_cap - text_len, fmt, ap);
+		va_end(ap);
+		if ( n < 0 )
+			return;
+		if ( text_len + n < text_cap )
+			break;
+
+		const size_t cap = ( text_cap ) ? text_cap * 2 + n : 16384;
+		char *grown = realloc(text, cap);
+		if ( grown == NULL )
+			return;
+		text = grown;
+		text_cap = cap;
+	}
+	text_len += n;
+};
+
+static void family( const char *name, const char *type, const char *help )
+{
+	emit("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// one family with a sample per monitored bay - what picks the value out of a bay
+typedef double (*bay_value)( const struct export_bay *b, int w );
+
+static double v_read_bytes( const struct export_bay *b, int w ) { return b->sample.n_read; }
+static double v_write_bytes( const struct export_bay *b, int w ) { return b->sample.n_write; }
+static double v_reads( const struct export_bay *b, int w ) { return b->sample.ops_read; }
+static double v_writes( const struct export_bay *b, int w ) { return b->sample.ops_write; }
+static double v_busy( const struct export_bay *b, int w ) { return b->sample.busy_ns / 1e9; }
+static double v_blue( const struct export_bay *b, int w ) { return ( b->sample.led & LED_BLUE ) != 0; }
+static double v_red( const struct export_bay *b, int w ) { return ( b->sample.led & LED_RED ) != 0; }
+static double v_read_bps( const struct export_bay *b, int w ) { return b->rates.ewma[w].v[RATE_MB_READ] * RATE_MB; }
+static double v_write_bps( const struct export_bay *b, int w ) { return b->rates.ewma[w].v[RATE_MB_WRITE] * RATE_MB; }
+static double v_tps( const struct export_bay *b, int w ) { return b->rates.ewma[w].v[RATE_TPS]; }
+static double v_latency( const struct export_bay *b, int w ) { return b->rates.ewma[w].v[RATE_MS_PER_TRANSACTION] / 1e3; }
+static double v_queue( const struct export_bay *b, int w ) { return b->rates.ewma[w].v[RATE_QUEUE]; }
+static double v_busy_ratio( const struct export_bay *b, int w ) { return b->rates.ewma[w].v[RATE_BUSY_PCT] / 100; }
+static double v_health( const struct export_bay *b, int w ) { return b->health.state; }
+static double v_health_polls( const struct export_bay *b, int w ) { return b->health.polls; }
+static double v_health_standby( const struct export_bay *b, int w ) { return b->health.standby; }
+static double v_power( const struct export_bay *b, int w ) { return b->sample.power; }
+static double v_standby_seconds( const struct export_bay *b, int w ) { return b->sample.standby_ns / 1e9; }
+static double v_power_checks( const struct export_bay *b, int w ) { return b->health.power_checks; }
+
+static void bay_family( const char *name, const char *type, const char *help, bay_value value )
+{
+	family(name, type, help);
+	for ( size_t i = 0; i < nbays; ++i ) {
+		if ( bays[i].monitored )
+			emit("%s{bay=\"%zu\",device=\"%s\"} %.17g\n", name, i + 1, bays[i].device, value(&bays[i], 0));
+	}
+};
+
+static void rate_family( const char *name, const char *help, bay_value value )
+{
+	family(name, "gauge", help);
+	for ( size_t i = 0; i < nbays; ++i ) {
+		if ( !bays[i].rated )
+			continue;
+		for ( int w = 0; w < RATE_WINDOWS; ++w )
+			emit("%s{bay=\"%zu\",device=\"%s\",window=\"%s\"} %.17g\n", name, i + 1, bays[i].device, window_names[w], value(&bays[i], w));
+	}
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// every bay is copied out of the monitor's publication first, so each scrape is one
+/// consistent view and the families below never go back to the monitor
+const char *export_render( size_t *len )
+{
+	struct timespec t0, t1;
+	struct rusage ru;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if ( nbays != hpbays ) {
+		struct export_bay *grown = realloc(bays, hpbays * sizeof(*bays));
+		if ( grown == NULL && hpbays ) {
+			*len = 0;
+			return "";
+		}
+		bays = grown;
+		nbays = hpbays;
+	}
+	for ( size_t i = 0; i < nbays; ++i ) {
+		struct export_bay *b = &bays[i];
+
+		b->monitored = monitor_sample(i, &b->sample);
+		b->rated = b->monitored && monitor_rate(i, &b->rates);
+		if ( !b->monitored || !health_read(i, &b->health) )
+			memset(&b->health, 0, sizeof(b->health));
+		if ( b->monitored ) {
+			/* the slot may be emptied and refilled while path is copied - an unchanged HDD says it was not */
+			const int hdd = __atomic_load_n(&hpex49x[i].HDD, __ATOMIC_ACQUIRE);
+			char path[sizeof(hpex49x[i].path)];
+
+			memcpy(path, hpex49x[i].path, sizeof(path));
+			path[sizeof(path) - 1] = '\0';
+			if ( !hdd || __atomic_load_n(&hpex49x[i].HDD, __ATOMIC_ACQUIRE) != hdd ) {
+				b->monitored = b->rated = 0;
+				memset(&b->health, 0, sizeof(b->health));
+			}
+			const char *dev = strrchr(path, '/');
+			snprintf(b->device, sizeof(b->device), "%s", ( dev ) ? dev + 1 : path);
+		}
+	}
+	text_len = 0;
+	if ( text )
+		text[0] = '\0';
+
+	family("hpex49xled_bay_monitored", "gauge", "1 when a disk in the bay is being monitored");
+	for ( size_t i = 0; i < nbays; ++i )
+		emit("hpex49xled_bay_monitored{bay=\"%zu\"} %d\n", i + 1, bays[i].monitored);
+
+	bay_family("hpex49xled_bay_read_bytes_total", "counter", "Bytes read by the disk in the bay", v_read_bytes);
+	bay_family("hpex49xled_bay_written_bytes_total", "counter", "Bytes written by the disk in the bay", v_write_bytes);
+	bay_family("hpex49xled_bay_reads_total", "counter", "Read transfers completed", v_reads);
+	bay_family("hpex49xled_bay_writes_total", "counter", "Write transfers completed", v_writes);
+	bay_family("hpex49xled_bay_busy_seconds_total", "counter", "Time with at least one transaction outstanding", v_busy);
+	bay_family("hpex49xled_bay_led_blue", "gauge", "1 while the bay's blue LED is lit", v_blue);
+	bay_family("hpex49xled_bay_led_red", "gauge", "1 while the bay's red LED is lit", v_red);
+	bay_family("hpex49xled_bay_health", "gauge", "SMART health - 0 unknown, 1 ok, 2 a pre-fail attribute at its threshold, 3 failing", v_health);
+	bay_family("hpex49xled_bay_health_polls_total", "counter", "SMART health reads", v_health_polls);
+	bay_family("hpex49xled_bay_health_standby_total", "counter", "SMART health reads left out because the disk was spun down", v_health_standby);
+	bay_family("hpex49xled_bay_power_state", "gauge", "Power mode of the disk - 0 unknown, 1 active, 2 idle, 3 standby", v_power);
+	bay_family("hpex49xled_bay_standby_seconds_total", "counter", "Time the disk spent spun down since it came up in the bay", v_standby_seconds);
+	bay_family("hpex49xled_bay_power_checks_total", "counter", "ATA CHECK POWER MODE commands sent to the disk", v_power_checks);
+
+	rate_family("hpex49xled_bay_read_bytes_per_second", "Read throughput averaged over the window", v_read_bps);
+	rate_family("hpex49xled_bay_written_bytes_per_second", "Write throughput averaged over the window", v_write_bps);
+	rate_family("hpex49xled_bay_transfers_per_second", "Transfers of any kind averaged over the window", v_tps);
+	rate_family("hpex49xled_bay_transaction_seconds", "Mean time per transaction over the window", v_latency);
+	rate_family("hpex49xled_bay_queue_length", "Transactions outstanding averaged over the window", v_queue);
+	rate_family("hpex49xled_bay_busy_ratio", "Share of the window with a transaction outstanding", v_busy_ratio);
+
+	family("hpex49xled_disks", "gauge", "Disks being monitored");
+	emit("hpex49xled_disks %zu\n", __atomic_load_n(&hpdisks, __ATOMIC_RELAXED));
+	family("hpex49xled_monitor_ticks_total", "counter", "Monitor ticks since the monitor last started");
+	emit("hpex49xled_monitor_ticks_total %ju\n", (uintmax_t)__atomic_load_n(&sample_tick, __ATOMIC_RELAXED));
+	family("hpex49xled_hotplug_changes_total", "counter", "Device list changes seen by the monitor");
+	emit("hpex49xled_hotplug_changes_total %ju\n", (uintmax_t)__atomic_load_n(&hotplug_stats.changes, __ATOMIC_RELAXED));
+	family("hpex49xled_hotplug_reconciles_total", "counter", "Settled bursts of device changes");
+	emit("hpex49xled_hotplug_reconciles_total %ju\n", (uintmax_t)__atomic_load_n(&hotplug_stats.reconciles, __ATOMIC_RELAXED));
+	family("hpex49xled_hotplug_identified_total", "counter", "Disks brought up in a bay after a device change");
+	emit("hpex49xled_hotplug_identified_total %ju\n", (uintmax_t)__atomic_load_n(&hotplug_stats.identified, __ATOMIC_RELAXED));
+	family("hpex49xled_hotplug_removed_total", "counter", "Disks dropped from a bay after a device change");
+	emit("hpex49xled_hotplug_removed_total %ju\n", (uintmax_t)__atomic_load_n(&hotplug_stats.removed, __ATOMIC_RELAXED));
+	family("hpex49xled_gpio_operations_total", "counter", "LED register reads and writes");
+	emit("hpex49xled_gpio_operations_total %ju\n", (uintmax_t)(__atomic_load_n(&portio_stats.inl, __ATOMIC_RELAXED) +
+		__atomic_load_n(&portio_stats.inb, __ATOMIC_RELAXED) + __atomic_load_n(&portio_stats.outl, __ATOMIC_RELAXED) +
+		__atomic_load_n(&portio_stats.outb, __ATOMIC_RELAXED)));
+	family("hpex49xled_health_commands_total", "counter", "ATA commands sent by the SMART health poll");
+	emit("hpex49xled_health_commands_total %ju\n", (uintmax_t)__atomic_load_n(&health_stats.commands, __ATOMIC_RELAXED));
+	family("hpex49xled_health_errors_total", "counter", "SMART health reads that failed");
+	emit("hpex49xled_health_errors_total %ju\n", (uintmax_t)__atomic_load_n(&health_stats.errors, __ATOMIC_RELAXED));
+	family("hpex49xled_led_commands_total", "counter", "LED changes submitted to the LED writer");
+	emit("hpex49xled_led_commands_total %ju\n", (uintmax_t)__atomic_load_n(&ledq_stats.submitted, __ATOMIC_RELAXED));
+	family("hpex49xled_led_commands_dropped_total", "counter", "LED changes refused because the queue was full");
+	emit("hpex49xled_led_commands_dropped_total %ju\n", (uintmax_t)__atomic_load_n(&ledq_stats.dropped, __ATOMIC_RELAXED));
+
+	getrusage(RUSAGE_SELF, &ru);
+	family("hpex49xled_cpu_seconds_total", "counter", "User and system CPU time of the daemon");
+	emit("hpex49xled_cpu_seconds_total %.6f\n", ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6);
+	family("hpex49xled_scrapes_total", "counter", "Metrics requests answered");
+	emit("hpex49xled_scrapes_total %ju\n", (uintmax_t)export_stats.scrapes);
+	family("hpex49xled_scrape_errors_total", "counter", "Metrics requests refused or not answered in full");
+	emit("hpex49xled_scrape_errors_total %ju\n", (uintmax_t)export_stats.errors);
+	family("hpex49xled_render_seconds", "gauge", "Time the previous rendering of these metrics took");
+	emit("hpex49xled_render_seconds %.9f\n", export_stats.last_ns / 1e9);
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	export_stats.last_ns = timespec_diff_ns(&t1, &t0);
+	if ( export_stats.last_ns > export_stats.max_ns )
+		export_stats.max_ns = export_stats.last_ns;
+	export_stats.last_bytes = text_len;
+	*len = text_len;
+	return ( text ) ? text : "";
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// write all of buf or fail
+static int write_all( int fd, const char *buf, size_t len )
+{
+	while ( len ) {
+		const ssize_t n = write(fd, buf, len);
+		if ( n < 0 && errno == EINTR )
+			continue;
+		if ( n <= 0 )
+			return -1;
+		buf += n;
+		len -= n;
+	}
+	return 0;
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// one client - read the request line, answer GET /metrics (or /) and close.
+/// a client that does not send its request within EXPORT_REQUEST_TIMEOUT is dropped
+static void export_client( int fd )
+{
+	static const char not_found[] = "HTTP/1.0 404 Not Found\r\nContent-Type: text/plain\r\nContent-Length: 10\r\nConnection: close\r\n\r\nnot found\n";
+	char req[1024], head[160];
+	size_t got = 0, len;
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	struct timespec start, now;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while ( got < sizeof(req) - 1 && memmem(req, got, "\r\n\r\n", 4) == NULL && memmem(req, got, "\n\n", 2) == NULL ) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		const long long left = EXPORT_REQUEST_TIMEOUT - timespec_diff_ns(&now, &start) / 1000000;
+		if ( left <= 0 || poll(&pfd, 1, left) <= 0 )
+			break;
+		const ssize_t n = read(fd, req + got, sizeof(req) - 1 - got);
+		if ( n <= 0 )
+			break;
+		got += n;
+	}
+	req[got] = '\0';
+
+	if ( strncmp(req, "GET /metrics ", 13) != 0 && strncmp(req, "GET / ", 6) != 0 ) {
+		++export_stats.errors;
+		if ( got )
+			write_all(fd, not_found, sizeof(not_found) - 1);
+		return;
+	}
+	const char *body = export_render(&len);
+	const int hlen = snprintf(head, sizeof(head), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", len);
+
+	if ( write_all(fd, head, hlen) != 0 || write_all(fd, body, len) != 0 )
+		++export_stats.errors;
+	else
+		++export_stats.scrapes;
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// textfile for node_exporter's textfile collector - written beside the real one and
+/// renamed over it, so the collector never reads half a file
+static void export_textfile(void)
+{
+	static int warned = 0;
+	char tmp[1024], path[1024];
+	size_t len;
+	int fd, ok;
+
+	snprintf(path, sizeof(path), "%s/%s", textfile_dir, EXPORT_TEXTFILE_NAME);
+	snprintf(tmp, sizeof(tmp), "%s/.%s.tmp", textfile_dir, EXPORT_TEXTFILE_NAME);
+
+	const char *body = export_render(&len);
+
+	if ( (fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) != -1 ) {
+		ok = ( write_all(fd, body, len) == 0 );
+		ok = ( close(fd) == 0 ) && ok && ( rename(tmp, path) == 0 );
+		if ( !ok )
+			unlink(tmp);
+	}
+	if ( fd == -1 || !ok ) {
+		/* once - the directory is likely missing or not writable and will stay that way */
+		if ( !warned++ )
+			logmsg(LOGC_EXPORT, LOG_NOTICE, "Unable to write the metrics textfile %s: %s", path, strerror(errno));
+		return;
+	}
+	warned = 0;
+	++export_stats.textfiles;
+};
+
+static void* export_thread( void *arg )
+{
+	struct pollfd pfd[2] = { { .fd = wake_pipe[0], .events = POLLIN }, { .fd = listen_fd, .events = POLLIN } };
+	const nfds_t nfds = ( listen_fd != -1 ) ? 2 : 1;
+	struct timespec next, now;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (;;) {
+		int timeout = -1;
+
+		if ( textfile_dir ) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			const long long wait = timespec_diff_ns(&next, &now);
+			if ( wait <= 0 ) {
+				export_textfile();
+				timespec_add_ns(&next, EXPORT_TEXTFILE_INTERVAL * 1000000L);
+				continue;
+			}
+			timeout = wait / 1000000 + 1;
+		}
+		if ( poll(pfd, nfds, timeout) < 0 && errno != EINTR )
+			break;
+		if ( pfd[0].revents )
+			break;
+		if ( nfds > 1 && (pfd[1].revents & POLLIN) ) {
+			const int fd = accept(listen_fd, NULL, NULL);
+			if ( fd != -1 ) {
+				export_client(fd);
+				close(fd);
+			}
+		}
+		perf_thread_cpu(PERF_THREAD_EXPORT);
+	}
+	return NULL;
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// bind "[address]:port" - an empty address is every address
+static int export_listen( const char *listen_address )
+{
+	struct addrinfo hints, *res, *ai;
+	char host[256];
+	const char *colon = strrchr(listen_address, ':');
+	int fd = -1, one = 1;
+
+	if ( colon == NULL || colon[1] == '\0' || (size_t)(colon - listen_address) >= sizeof(host) ) {
+		fprintf(stderr, "listen address \"%s\": expected [address]:port\n", listen_address);
+		return -1;
+	}
+	memcpy(host, listen_address, colon - listen_address);
+	host[colon - listen_address] = '\0';
+	/* [::1]:9100 */
+	if ( host[0] == '[' && host[strlen(host) - 1] == ']' ) {
+		memmove(host, host + 1, strlen(host));
+		host[strlen(host) - 1] = '\0';
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	if ( getaddrinfo(( host[0] ) ? host : NULL, colon + 1, &hints, &res) != 0 ) {
+		fprintf(stderr, "listen address \"%s\": unable to resolve\n", listen_address);
+		return -1;
+	}
+	for ( ai = res; ai != NULL; ai = ai->ai_next ) {
+		if ( (fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) == -1 )
+			continue;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if ( bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 8) == 0 )
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	if ( fd == -1 )
+		fprintf(stderr, "listen address \"%s\": %s\n", listen_address, strerror(errno));
+	return fd;
+};
+
+int export_start( const char *listen_address, const char *dir )
+{
+	if ( export_running || (listen_address == NULL && dir == NULL) )
+		return 0;
+
+	memset(&export_stats, 0, sizeof(export_stats));
+	/* a port someone else holds costs the listener, not the LEDs - the textfile still goes out */
+	if ( listen_address != NULL && (listen_fd = export_listen(listen_address)) == -1 ) {
+		logmsg(LOGC_EXPORT, LOG_WARNING, "Unable to serve metrics on %s - the listener is off%s", listen_address,
+			( dir != NULL ) ? ", the textfile is still written" : "");
+		if ( dir == NULL )
+			return 0;
+	}
+	if ( dir != NULL && (textfile_dir = strdup(dir)) == NULL )
+		goto fail;
+	if ( pipe(wake_pipe) != 0 )
+		goto fail;
+	if ( pthread_create(&exporter, NULL, export_thread, NULL) != 0 ) {
+		close(wake_pipe[0]);
+		close(wake_pipe[1]);
+		goto fail;
+	}
+	export_running = 1;
+	return 0;
+
+fail:
+	fprintf(stderr, "Unable to start the exporter: %s\n", strerror(errno));
+	if ( listen_fd != -1 )
+		close(listen_fd);
+	listen_fd = -1;
+	free(textfile_dir);
+	textfile_dir = NULL;
+	return -1;
+};
+
+void export_stop(void)
+{
+	if ( !export_running )
+		return;
+	write_all(wake_pipe[1], "x", 1);
+	pthread_join(exporter, NULL);
+	close(wake_pipe[0]);
+	close(wake_pipe[1]);
+	if ( listen_fd != -1 )
+		close(listen_fd);
+	listen_fd = -1;
+	free(textfile_dir);
+	textfile_dir = NULL;
+	export_running = 0;
+};
+
+int export_port(void)
+{
+	struct sockaddr_storage ss;
+	socklen_t len = sizeof(ss);
+
+	if ( listen_fd == -1 || getsockname(listen_fd, (struct sockaddr *)&ss, &len) != 0 )
+		return -1;
+	if ( ss.ss_family == AF_INET )
+		return ntohs(((struct sockaddr_in *)&ss)->sin_port);
+	if ( ss.ss_family == AF_INET6 )
+		return ntohs(((struct sockaddr_in6 *)&ss)->sin6_port);
+	return -1;
+};
@@ -0,0 +1,65 @@
+#ifndef INCLUDED_HPEX49XLED_EXPORT
+#define INCLUDED_HPEX49XLED_EXPORT
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_export.h
+///////
+/////// Prometheus exporter - a small HTTP listener for /metrics and textfiles
+/////// for node_exporter, both rendered from the monitor's published counters
+///////
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+/////////////////////////////////////////////////////////////////////////////////
+#include <sys/types.h>
+
+#define EXPORT_LISTEN_DEFAULT ":9849" // suggested port - node_exporter, which reads the textfile, holds 9100
+#define EXPORT_TEXTFILE_NAME "hpex49xled.prom" // written as .<name>.tmp and renamed over this
+#define EXPORT_TEXTFILE_INTERVAL 15000 // milliseconds between textfiles - node_exporter's default scrape
+#define EXPORT_REQUEST_TIMEOUT 1000 // milliseconds a client gets to send its request
+
+/// scrapes served and what they cost - written by the exporter thread only
+struct export_counters {
+	u_int64_t scrapes;	///< HTTP requests answered with metrics
+	u_int64_t errors;	///< requests refused, timed out or not written in full
+	u_int64_t textfiles;	///< textfiles renamed into place
+	long long last_ns;	///< rendering time of the last scrape or textfile
+	long long max_ns;
+	size_t last_bytes;	///< size of the last rendering
+};
+extern struct export_counters export_stats;
+
+/// start the exporter thread. listen is "[address]:port", ":9849" for every address, and
+/// NULL for no listener. textfile_dir gets EXPORT_TEXTFILE_NAME every
+/// EXPORT_TEXTFILE_INTERVAL, NULL for none. the socket is bound before returning, so
+/// this can run before privileges are dropped. a listener that can not bind is logged and
+/// left off. returns 0 on success, -1 with the reason on stderr
+int export_start( const char *listen, const char *textfile_dir );
+void export_stop(void);
+int export_port(void);	///< port the listener is bound to - for ":0"
+
+/// render the metrics in the Prometheus text format into the exporter's buffer - never
+/// blocks the monitor. returns the text, valid until the next call, and its length in *len
+const char *export_render( size_t *len );
+
+#endif //INCLUDED_HPEX49XLED_EXPORT
@@ -0,0 +1,706 @@
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_health.c
+///////
+/////// Disk health - SMART RETURN STATUS and the attribute table through CAM ATA
+/////// passthrough, polled on a slow schedule that leaves sleeping disks asleep
+///////
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+/////////////////////////////////////////////////////////////////////////////////
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+
+#if defined(__FreeBSD__)
+#include <camlib.h>
+#include <cam/cam.h>
+#include <cam/cam_ccb.h>
+#include <cam/ata/ata_all.h>
+#endif
+
+#include "hpled.h"
+#include "hpex49xled_baymap.h"
+#include "hpex49xled_health.h"
+#include "hpex49xled_log.h"
+#include "hpex49xled_monitor.h"
+#include "hpex49xled_perf.h"
+#include "hpex49xled_timer.h"
+
+struct health_counters health_stats;
+char health_errbuf[256];
+
+static const char *state_names[] = { "unknown", "ok", "pre-fail", "failing" };
+
+/* what the poll knows about each bay - the disk it last saw there and whether that disk
+   is due. results[] is what health_read() hands out, written with atomics */
+static struct {
+	char path[sizeof(((struct hpled *)0)->path)];
+	int due;
+	int tries;	/* times it was put off because it was busy */
+	int warned;	/* a failure for this disk was logged */
+	u_int64_t power_ns;	/* CLOCK_MONOTONIC nanoseconds the last CHECK POWER MODE went out at */
+} track[BAYMAP_MAX_BAYS];
+static struct health_bay results[BAYMAP_MAX_BAYS] = { [0 ... BAYMAP_MAX_BAYS - 1] = { .power = -1 } };
+
+static pthread_t poller;
+static int health_running = 0;
+static int stopping = 0;
+static int wake_pipe[2] = { -1, -1 };
+static int interval = HEALTH_INTERVAL;
+static int standby_idle = HEALTH_STANDBY_IDLE;
+static time_t next_round = 0; /* CLOCK_MONOTONIC seconds - kept over a stop and start */
+static void (*health_changed)( size_t bay, int state ) = NULL;
+
+#if defined(__FreeBSD__)
+/////////////////////////////////////////////////////////////////////////
+/// XPT_ATA_IO through the disk's pass device, as camcontrol cmd sends it. the
+/// commands are not queued, so the disk finishes what it has first and takes
+/// nothing else until the command is done - one reason the poll is rare
+static void *cam_open( const char *path )
+{
+	struct cam_device *dev = cam_open_device(path, O_RDWR);
+
+	if ( dev == NULL )
+		snprintf(health_errbuf, sizeof(health_errbuf), "%s", cam_errbuf);
+	return dev;
+};
+
+static int cam_command( void *dev, struct health_cmd *cmd )
+{
+	union ccb *ccb = cam_getccb(dev);
+	int rc = -1;
+
+	if ( ccb == NULL ) {
+		snprintf(health_errbuf, sizeof(health_errbuf), "unable to allocate a CCB");
+		return -1;
+	}
+	CCB_CLEAR_ALL_EXCEPT_HDR(&ccb->ataio);
+	cam_fill_ataio(&ccb->ataio, 0, NULL, ( cmd->data ) ? CAM_DIR_IN : CAM_DIR_NONE, MSG_SIMPLE_Q_TAG,
+		cmd->data, ( cmd->data ) ? HEALTH_SECTOR : 0, HEALTH_TIMEOUT);
+	ata_28bit_cmd(&ccb->ataio, cmd->command, cmd->features, cmd->lba, cmd->count);
+	ccb->ataio.cmd.flags |= CAM_ATAIO_NEEDRESULT;
+	ccb->ccb_h.flags |= CAM_DEV_QFRZDIS;
+
+	if ( cam_send_ccb(dev, ccb) != 0 )
+		snprintf(health_errbuf, sizeof(health_errbuf), "CAMIOCOMMAND: %s", strerror(errno));
+	else if ( (ccb->ccb_h.status & CAM_STATUS_MASK) != CAM_REQ_CMP )
+		snprintf(health_errbuf, sizeof(health_errbuf), "ATA command 0x%02x feature 0x%02x: CAM status 0x%x, ATA error 0x%02x",
+			cmd->command, cmd->features, ccb->ccb_h.status & CAM_STATUS_MASK, ccb->ataio.res.error);
+	else {
+		cmd->count = ccb->ataio.res.sector_count;
+		cmd->lba = ccb->ataio.res.lba_low | ccb->ataio.res.lba_mid << 8 | ccb->ataio.res.lba_high << 16;
+		rc = 0;
+	}
+	cam_freeccb(ccb);
+	return rc;
+};
+
+static void cam_close( void *dev )
+{
+	cam_close_device(dev);
+};
+
+#else
+static void *cam_open( const char *path )
+{
+	snprintf(health_errbuf, sizeof(health_errbuf), "no CAM on this system");
+	return NULL;
+};
+
+static int cam_command( void *dev, struct health_cmd *cmd )
+{
+	return -1;
+};
+
+static void cam_close( void *dev )
+{
+};
+#endif
+
+const struct health_ops health_cam = { "cam", cam_open, cam_command, cam_close };
+
+/////////////////////////////////////////////////////////////////////////
+/// simulated responder - answers as an ATA disk with a SMART attribute table
+/// would. each command holds the disk busy_us, and a SMART command that finds
+/// it in standby spins it up and is counted, as a real one would be
+struct health_simdisk health_simdisks[HEALTH_SIM_DISKS] = {
+	[0 ... HEALTH_SIM_DISKS - 1] = { .power = HEALTH_POWER_ACTIVE, .lock = PTHREAD_MUTEX_INITIALIZER }
+};
+
+static const struct {
+	u_int8_t id;
+	u_int16_t flags;	/* bit 0 - pre-fail, an attribute whose threshold means the disk is about to fail */
+	u_int8_t value;
+	u_int8_t threshold;
+} sim_attrs[] = {
+	{ 1, 0x000f, 200, 51 },	/* raw read error rate */
+	{ 3, 0x0027, 178, 21 },	/* spin up time */
+	{ 5, 0x0033, 200, 140 },	/* reallocated sectors */
+	{ 9, 0x0032, 87, 0 },	/* power on hours - advisory */
+	{ 194, 0x0022, 117, 0 },	/* temperature - advisory */
+	{ 197, 0x0032, 200, 0 },	/* pending sectors - advisory */
+};
+
+static void sim_sector( const struct health_simdisk *d, int thresholds, u_int8_t *data )
+{
+	u_int8_t sum = 0;
+
+	memset(data, 0, HEALTH_SECTOR);
+	data[0] = 0x10; /* revision */
+	for ( size_t a = 0; a < sizeof(sim_attrs) / sizeof(sim_attrs[0]); ++a ) {
+		u_int8_t *e = data + 2 + a * 12;
+
+		e[0] = sim_attrs[a].id;
+		if ( thresholds ) {
+			e[1] = sim_attrs[a].threshold;
+			continue;
+		}
+		e[1] = sim_attrs[a].flags & 0xff;
+		e[2] = sim_attrs[a].flags >> 8;
+		e[3] = e[4] = ( d->prefail == sim_attrs[a].id ) ? sim_attrs[a].threshold : sim_attrs[a].value;
+	}
+	for ( int k = 0; k < HEALTH_SECTOR - 1; ++k )
+		sum += data[k];
+	data[HEALTH_SECTOR - 1] = -sum;
+};
+
+static void *sim_open( const char *path )
+{
+	size_t len = strlen(path);
+
+	/* /dev/ada2 is disk 2 */
+	while ( len > 0 && path[len - 1] >= '0' && path[len - 1] <= '9' )
+		--len;
+	if ( path[len] == '\0' ) {
+		snprintf(health_errbuf, sizeof(health_errbuf), "%s is not a simulated disk", path);
+		return NULL;
+	}
+	return &health_simdisks[atoi(path + len) % HEALTH_SIM_DISKS];
+};
+
+static int sim_command( void *dev, struct health_cmd *cmd )
+{
+	struct health_simdisk *d = dev;
+	int rc = 0;
+
+	pthread_mutex_lock(&d->lock);
+	if ( d->busy_us )
+		usleep(d->busy_us);
+	++d->commands;
+	if ( cmd->command == HEALTH_ATA_CHECK_POWER_MODE )
+		cmd->count = d->power;
+	else if ( cmd->command != HEALTH_ATA_SMART || cmd->lba != HEALTH_SMART_LBA )
+		rc = -1;
+	else {
+		if ( d->power < HEALTH_POWER_IDLE ) {
+			++d->spinups;
+			d->power = HEALTH_POWER_ACTIVE;
+		}
+		if ( cmd->features == HEALTH_SMART_RETURN_STATUS )
+			/* LBA low is reserved in the answer - some disks leave whatever was there */
+			cmd->lba = ( ( d->failing ) ? HEALTH_SMART_EXCEEDED << 8 : HEALTH_SMART_LBA ) | 0xa5;
+		else if ( ( cmd->features == HEALTH_SMART_READ_DATA || cmd->features == HEALTH_SMART_READ_THRESHOLDS ) && cmd->data )
+			sim_sector(d, cmd->features == HEALTH_SMART_READ_THRESHOLDS, cmd->data);
+		else
+			rc = -1;
+	}
+	pthread_mutex_unlock(&d->lock);
+	if ( rc )
+		snprintf(health_errbuf, sizeof(health_errbuf), "ATA command 0x%02x feature 0x%02x aborted", cmd->command, cmd->features);
+	return rc;
+};
+
+static void sim_close( void *dev )
+{
+};
+
+const struct health_ops health_sim = { "simulated", sim_open, sim_command, sim_close };
+
+#if defined(__FreeBSD__)
+const struct health_ops *health = &health_cam;
+#else
+const struct health_ops *health = &health_sim;
+#endif
+
+long long health_sim_io( int n, long us )
+{
+	struct health_simdisk *d = &health_simdisks[n % HEALTH_SIM_DISKS];
+	struct timespec t0, t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	pthread_mutex_lock(&d->lock);
+	if ( us )
+		usleep(us);
+	pthread_mutex_unlock(&d->lock);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return timespec_diff_ns(&t1, &t0);
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// one command, timed
+static int health_command( void *dev, struct health_cmd *cmd )
+{
+	struct timespec t0, t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	const int rc = health->command(dev, cmd);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	const long long ns = timespec_diff_ns(&t1, &t0);
+
+	++health_stats.commands;
+	if ( ns > health_stats.cmd_max_ns )
+		health_stats.cmd_max_ns = ns;
+	perf_record(PERF_HEALTH_CMD, ns);
+	return rc;
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// the id of a pre-fail attribute at or below its threshold, 0 for none, -1 when a
+/// sector's checksum is wrong. a threshold of 0 never trips, and a normalized value
+/// of 0, 0xfe or 0xff means the disk has none for that attribute
+static int health_attrs( const u_int8_t *data, const u_int8_t *thresholds )
+{
+	u_int8_t sum_d = 0, sum_t = 0;
+
+	for ( int k = 0; k < HEALTH_SECTOR; ++k ) {
+		sum_d += data[k];
+		sum_t += thresholds[k];
+	}
+	if ( sum_d || sum_t )
+		return -1;
+
+	for ( int a = 0; a < HEALTH_ATTRS; ++a ) {
+		const u_int8_t *e = data + 2 + a * 12;
+		const int flags = e[1] | e[2] << 8, value = e[3];
+
+		if ( e[0] == 0 || !( flags & 1 ) || value == 0 || value >= 0xfe )
+			continue;
+		/* the thresholds are in the same order as the attributes on every disk seen, but look */
+		for ( int t = 0; t < HEALTH_ATTRS; ++t ) {
+			const u_int8_t *h = thresholds + 2 + t * 12;
+
+			if ( h[0] != e[0] )
+				continue;
+			if ( h[1] && value <= h[1] )
+				return e[0];
+			break;
+		}
+	}
+	return 0;
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// the bay's disk now, if it has one - the monitor fills a slot before it stores HDD and
+/// clears HDD before the slot is reused, so an unchanged HDD means path was not torn
+static int bay_path( size_t i, char *path, size_t len )
+{
+	const int hdd = __atomic_load_n(&hpex49x[i].HDD, __ATOMIC_ACQUIRE);
+
+	if ( !hdd )
+		return 0;
+	memcpy(path, hpex49x[i].path, len);
+	path[len - 1] = '\0';
+	return __atomic_load_n(&hpex49x[i].HDD, __ATOMIC_ACQUIRE) == hdd;
+};
+
+static void health_forget( size_t i )
+{
+	memset(&track[i], 0, sizeof(track[i]));
+	__atomic_store_n(&results[i].state, HEALTH_UNKNOWN, __ATOMIC_RELAXED);
+	__atomic_store_n(&results[i].power, -1, __ATOMIC_RELAXED);
+	__atomic_store_n(&results[i].attr, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&results[i].checked, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&results[i].polls, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&results[i].standby, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&results[i].deferred, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&results[i].power_checks, 0, __ATOMIC_RELAXED);
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// the disk in a bay, noting when it is not the one the poll last saw there - that
+/// one's results are dropped and the new disk is due for SMART at once. 0 for an empty bay
+static int bay_track( size_t i, char *path )
+{
+	if ( !bay_path(i, path, sizeof(track[i].path)) ) {
+		if ( track[i].path[0] )
+			health_forget(i);
+		return 0;
+	}
+	if ( strcmp(path, track[i].path) != 0 ) {
+		health_forget(i);
+		memcpy(track[i].path, path, sizeof(track[i].path));
+		track[i].due = 1;
+	}
+	return 1;
+};
+
+static u_int64_t health_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// a CHECK POWER MODE answer sent at at_ns - below 0x80 the spindle is down, 0x40 and
+/// 0x41 included, 0x80 - 0x83 are the idle modes and 0xff is active. kept for
+/// health_read() and handed to the monitor, which shows a spun down disk as such
+static void power_seen( size_t i, int count, u_int64_t at_ns )
+{
+	int state = POWER_IDLE;
+
+	if ( count < HEALTH_POWER_IDLE )
+		state = POWER_STANDBY;
+	else if ( count == HEALTH_POWER_ACTIVE )
+		state = POWER_ACTIVE;
+
+	++health_stats.power_checks;
+	__atomic_store_n(&results[i].power, count, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&results[i].power_checks, 1, __ATOMIC_RELAXED);
+	monitor_power(i, state, at_ns);
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// CHECK POWER MODE first - it is answered without spinning the disk up. a disk in
+/// standby is left for the next round, anything else gets RETURN STATUS and, when the
+/// disk says it is fine, the attribute table to look for a pre-fail attribute
+static void health_bay( size_t i, const char *path )
+{
+	u_int8_t data[HEALTH_SECTOR], thresholds[HEALTH_SECTOR];
+	struct health_cmd cmd;
+	int state = HEALTH_UNKNOWN, attr = 0;
+	void *dev = health->open(path);
+
+	if ( dev == NULL )
+		goto fail;
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.command = HEALTH_ATA_CHECK_POWER_MODE;
+	track[i].power_ns = health_ns();
+	if ( health_command(dev, &cmd) != 0 )
+		goto fail;
+	power_seen(i, cmd.count, track[i].power_ns);
+	if ( cmd.count < HEALTH_POWER_IDLE ) {
+		/* standby - and 0x40/0x41, NV cache with the spindle down */
+		++health_stats.standby;
+		__atomic_add_fetch(&results[i].standby, 1, __ATOMIC_RELAXED);
+		health->close(dev);
+		return;
+	}
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.command = HEALTH_ATA_SMART;
+	cmd.features = HEALTH_SMART_RETURN_STATUS;
+	cmd.lba = HEALTH_SMART_LBA;
+	if ( health_command(dev, &cmd) != 0 )
+		goto fail;
+	/* mid and high only, as smartmontools does - LBA low is reserved in the answer */
+	if ( (cmd.lba >> 8) == HEALTH_SMART_EXCEEDED )
+		state = HEALTH_FAILING;
+	else if ( (cmd.lba >> 8) != HEALTH_SMART_LBA >> 8 ) {
+		snprintf(health_errbuf, sizeof(health_errbuf), "SMART RETURN STATUS answered LBA 0x%06x - is SMART off?", cmd.lba);
+		goto fail;
+	}
+	else {
+		memset(&cmd, 0, sizeof(cmd));
+		cmd.command = HEALTH_ATA_SMART;
+		cmd.features = HEALTH_SMART_READ_DATA;
+		cmd.lba = HEALTH_SMART_LBA;
+		cmd.count = 1;
+		cmd.data = data;
+		if ( health_command(dev, &cmd) != 0 )
+			goto fail;
+		cmd.features = HEALTH_SMART_READ_THRESHOLDS;
+		cmd.lba = HEALTH_SMART_LBA;
+		cmd.data = thresholds;
+		if ( health_command(dev, &cmd) != 0 )
+			goto fail;
+		if ( (attr = health_attrs(data, thresholds)) < 0 ) {
+			snprintf(health_errbuf, sizeof(health_errbuf), "bad SMART data checksum");
+			goto fail;
+		}
+		state = ( attr ) ? HEALTH_PREFAIL : HEALTH_OK;
+	}
+	health->close(dev);
+	dev = NULL;
+	track[i].warned = 0;
+
+	const int was = __atomic_load_n(&results[i].state, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&results[i].attr, attr, __ATOMIC_RELAXED);
+	__atomic_store_n(&results[i].checked, (int64_t)time(NULL), __ATOMIC_RELAXED);
+	__atomic_add_fetch(&results[i].polls, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&results[i].state, state, __ATOMIC_RELEASE);
+	if ( state == was )
+		return;
+
+	if ( state == HEALTH_FAILING )
+		logmsg(LOGC_HEALTH, LOG_CRIT, "%s in HP Mediasmart Server Slot %zu: SMART says the disk is failing", path, i + 1);
+	else if ( state == HEALTH_PREFAIL )
+		logmsg(LOGC_HEALTH, LOG_WARNING, "%s in HP Mediasmart Server Slot %zu: SMART pre-fail attribute %d is at its threshold", path, i + 1, attr);
+	else
+		logmsg(LOGC_HEALTH, LOG_NOTICE, "%s in HP Mediasmart Server Slot %zu: SMART health %s", path, i + 1, state_names[state]);
+	if ( health_changed )
+		health_changed(i, state);
+	return;
+
+fail:
+	if ( dev != NULL )
+		health->close(dev);
+	++health_stats.errors;
+	if ( !track[i].warned++ )
+		logmsg(LOGC_HEALTH, LOG_NOTICE, "No SMART health for %s in HP Mediasmart Server Slot %zu - %s", path, i + 1, health_errbuf);
+};
+
+int health_poll( int every )
+{
+	char path[sizeof(track[0].path)];
+	struct timespec t0, t1;
+	int pending = 0, polled = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	for ( size_t i = 0; i < hpbays && i < BAYMAP_MAX_BAYS; ++i ) {
+		struct hpsample s;
+
+		if ( !bay_track(i, path) )
+			continue;
+		if ( every )
+			track[i].due = 1;
+		if ( !track[i].due )
+			continue;
+
+		/* a non queued command waits for the disk's queue to drain and holds up what
+		   comes after it - put it off while the disk is busy, but not for ever */
+		if ( monitor_sample(i, &s) && ( s.d_read || s.d_write ) && track[i].tries < HEALTH_DEFER_TRIES ) {
+			++track[i].tries;
+			++health_stats.deferred;
+			__atomic_add_fetch(&results[i].deferred, 1, __ATOMIC_RELAXED);
+			++pending;
+			continue;
+		}
+		track[i].due = track[i].tries = 0;
+		health_bay(i, path);
+		++polled;
+	}
+	if ( polled ) {
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		++health_stats.rounds;
+		health_stats.last_ns = timespec_diff_ns(&t1, &t0);
+	}
+	return pending;
+};
+
+int health_read( size_t bay, struct health_bay *out )
+{
+	if ( bay >= BAYMAP_MAX_BAYS || bay >= hpbays || !__atomic_load_n(&hpex49x[bay].HDD, __ATOMIC_ACQUIRE) )
+		return 0;
+
+	const struct health_bay *r = &results[bay];
+
+	out->state = __atomic_load_n(&r->state, __ATOMIC_ACQUIRE);
+	out->power = __atomic_load_n(&r->power, __ATOMIC_RELAXED);
+	out->attr = __atomic_load_n(&r->attr, __ATOMIC_RELAXED);
+	out->checked = __atomic_load_n(&r->checked, __ATOMIC_RELAXED);
+	out->polls = __atomic_load_n(&r->polls, __ATOMIC_RELAXED);
+	out->standby = __atomic_load_n(&r->standby, __ATOMIC_RELAXED);
+	out->deferred = __atomic_load_n(&r->deferred, __ATOMIC_RELAXED);
+	out->power_checks = __atomic_load_n(&r->power_checks, __ATOMIC_RELAXED);
+	return 1;
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// CHECK POWER MODE on its own - answered from the disk's electronics, it never spins
+/// the disk up
+static void power_check( size_t i, const char *path )
+{
+	struct health_cmd cmd;
+	void *dev = health->open(path);
+
+	track[i].power_ns = health_ns();
+	if ( dev == NULL )
+		goto fail;
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.command = HEALTH_ATA_CHECK_POWER_MODE;
+	const int rc = health_command(dev, &cmd);
+	health->close(dev);
+	if ( rc != 0 )
+		goto fail;
+	power_seen(i, cmd.count, track[i].power_ns);
+	return;
+
+fail:
+	++health_stats.errors;
+	if ( !track[i].warned++ )
+		logmsg(LOGC_HEALTH, LOG_NOTICE, "No power mode for %s in HP Mediasmart Server Slot %zu - %s", path, i + 1, health_errbuf);
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// when a bay checked since its last I/O is checked again - later if it was spun down
+static u_int64_t power_recheck( size_t i )
+{
+	const int count = __atomic_load_n(&results[i].power, __ATOMIC_RELAXED);
+	const int secs = ( count >= 0 && count < HEALTH_POWER_IDLE ) ? HEALTH_POWER_RECHECK_STANDBY : HEALTH_POWER_RECHECK;
+
+	return track[i].power_ns + (u_int64_t)secs * 1000000000;
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// the power tracker - a bay whose disk has had no I/O for standby_idle seconds has its
+/// power mode checked once, then every HEALTH_POWER_RECHECK while it stays quiet, or
+/// HEALTH_POWER_RECHECK_STANDBY once it is spun down. when a bay last saw I/O comes from
+/// the monitor's samples, so a disk that is in use is never sent a command. returns the
+/// milliseconds until the next bay is due, -1 when none is
+static long long power_poll(void)
+{
+	char path[sizeof(track[0].path)];
+	const u_int64_t quiet = (u_int64_t)standby_idle * 1000000000;
+	long long due = -1;
+
+	for ( size_t i = 0; i < hpbays && i < BAYMAP_MAX_BAYS; ++i ) {
+		struct hpsample s;
+
+		if ( !bay_track(i, path) || !monitor_sample(i, &s) )
+			continue;
+		const u_int64_t now = health_ns();
+		u_int64_t at = s.active_ns + quiet;
+
+		if ( s.tick == 0 )
+			at = now + 1000000000; /* the monitor has not published it yet */
+		else if ( track[i].power_ns > s.active_ns )
+			at = power_recheck(i); /* checked since its last I/O */
+		if ( at <= now ) {
+			power_check(i, path);
+			at = power_recheck(i);
+		}
+		const long long ms = ( at > now ) ? (long long)(at - now) / 1000000 + 1 : 1;
+		if ( due < 0 || ms < due )
+			due = ms;
+	}
+	return due;
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// the health thread - sleeps in poll() on its wake pipe until the next round, the
+/// next power check, or HEALTH_DEFER while a busy bay was put off. health_kick() wakes
+/// it to look at disks that arrived, so a hot swapped disk does not wait for the next round
+static time_t health_clock(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+};
+
+static void* health_thread( void *arg )
+{
+	struct pollfd pfd = { .fd = wake_pipe[0], .events = POLLIN };
+	int pending = 0, kicked = 0;
+	char buf[16];
+
+	for (;;) {
+		time_t now = health_clock();
+
+		if ( interval && now >= next_round ) {
+			pending = health_poll(1);
+			next_round = now + interval;
+		}
+		else if ( interval && ( pending || kicked ) )
+			pending = health_poll(0);
+		const long long power_in = ( standby_idle ) ? power_poll() : -1;
+		perf_thread_cpu(PERF_THREAD_HEALTH);
+
+		/* milliseconds, -1 for nothing due */
+		now = health_clock();
+		long long wait = -1;
+		if ( interval )
+			wait = ( next_round > now ) ? ( next_round - now ) * 1000 : 0;
+		if ( pending && ( wait < 0 || wait > HEALTH_DEFER * 1000 ) )
+			wait = HEALTH_DEFER * 1000;
+		if ( power_in >= 0 && ( wait < 0 || power_in < wait ) )
+			wait = power_in;
+
+		if ( poll(&pfd, 1, (int)wait) < 0 && errno != EINTR )
+			break;
+		if ( __atomic_load_n(&stopping, __ATOMIC_ACQUIRE) )
+			break;
+		kicked = ( pfd.revents && read(wake_pipe[0], buf, sizeof(buf)) > 0 );
+	}
+	return NULL;
+};
+
+void health_kick(void)
+{
+	if ( __atomic_load_n(&health_running, __ATOMIC_ACQUIRE) && write(wake_pipe[1], "k", 1) < 0 ) {
+		/* full - a kick is already waiting */
+	}
+};
+
+int health_start( int seconds, int idle, void (*changed)( size_t bay, int state ) )
+{
+	if ( health_running )
+		return 0;
+	interval = seconds;
+	standby_idle = idle;
+	health_changed = changed;
+	if ( pipe(wake_pipe) != 0 )
+		goto fail;
+	fcntl(wake_pipe[0], F_SETFL, fcntl(wake_pipe[0], F_GETFL) | O_NONBLOCK);
+	fcntl(wake_pipe[1], F_SETFL, fcntl(wake_pipe[1], F_GETFL) | O_NONBLOCK);
+	__atomic_store_n(&stopping, 0, __ATOMIC_RELEASE);
+	if ( pthread_create(&poller, NULL, health_thread, NULL) != 0 ) {
+		close(wake_pipe[0]);
+		close(wake_pipe[1]);
+		goto fail;
+	}
+	__atomic_store_n(&health_running, 1, __ATOMIC_RELEASE);
+	return 0;
+
+fail:
+	fprintf(stderr, "Unable to start the health poll: %s\n", strerror(errno));
+	return -1;
+};
+
+void health_stop(void)
+{
+	if ( !health_running )
+		return;
+	__atomic_store_n(&health_running, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+	if ( write(wake_pipe[1], "x", 1) < 0 ) {
+		/* full - the thread wakes anyway */
+	}
+	pthread_join(poller, NULL);
+	close(wake_pipe[0]);
+	close(wake_pipe[1]);
+};
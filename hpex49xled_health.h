@@ -0,0 +1,150 @@
+#ifndef INCLUDED_HPEX49XLED_HEALTH
+#define INCLUDED_HPEX49XLED_HEALTH
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_health.h
+///////
+/////// Disk health - SMART RETURN STATUS and the attribute table through CAM ATA
+/////// passthrough, polled on a slow schedule that leaves sleeping disks asleep
+///////
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+/////////////////////////////////////////////////////////////////////////////////
+#include <pthread.h>
+#include <sys/types.h>
+
+#define HEALTH_INTERVAL 1800 // default seconds between polls of every bay - --health
+#define HEALTH_INTERVAL_MAX 86400 // longest --health
+#define HEALTH_DEFER 5 // seconds a bay that was busy waits before it is tried again
+#define HEALTH_DEFER_TRIES 12 // times a busy bay is put off before it is polled busy or not
+#define HEALTH_TIMEOUT 5000 // milliseconds CAM waits for one ATA command
+#define HEALTH_SECTOR 512 // SMART READ DATA and READ THRESHOLDS transfer one sector
+#define HEALTH_ATTRS 30 // attribute entries in a SMART data sector
+#define HEALTH_STANDBY_IDLE 600 // default seconds without I/O before a bay's power mode is checked - --standby
+#define HEALTH_STANDBY_IDLE_MAX 86400 // longest --standby
+#define HEALTH_POWER_RECHECK 600 // seconds between checks of a quiet disk that is still spinning
+#define HEALTH_POWER_RECHECK_STANDBY 1800 // seconds between checks of a disk that is spun down - I/O wakes it without one
+#define HEALTH_SIM_DISKS 8 // disks the simulated responder answers for - ada0 - ada7
+
+/// ATA - the commands and SMART subcommands the poll sends
+#define HEALTH_ATA_SMART 0xb0
+#define HEALTH_ATA_CHECK_POWER_MODE 0xe5
+#define HEALTH_SMART_READ_DATA 0xd0
+#define HEALTH_SMART_READ_THRESHOLDS 0xd1
+#define HEALTH_SMART_RETURN_STATUS 0xda
+#define HEALTH_SMART_LBA 0xc24f00 // LBA mid 0x4f, high 0xc2 - every SMART command carries it
+#define HEALTH_SMART_EXCEEDED 0x2cf4 // LBA high and mid RETURN STATUS answers when a threshold is exceeded - LBA low is reserved
+#define HEALTH_POWER_STANDBY 0x00 // CHECK POWER MODE count - spun down
+#define HEALTH_POWER_IDLE 0x80
+#define HEALTH_POWER_ACTIVE 0xff
+
+/// a bay's health as of its last SMART read - a failing or pre-fail disk latches its red LED
+enum health_state {
+	HEALTH_UNKNOWN = 0,	///< not read yet, or the disk does not answer SMART through ATA passthrough
+	HEALTH_OK,
+	HEALTH_PREFAIL,	///< a pre-fail attribute is at or below its threshold
+	HEALTH_FAILING,	///< RETURN STATUS - the disk itself says a threshold is exceeded
+};
+
+/// one ATA command - the 28 bit registers going out and, on success, coming back
+struct health_cmd {
+	u_int8_t command;
+	u_int8_t features;
+	u_int8_t count;	///< the power mode after CHECK POWER MODE
+	u_int32_t lba;	///< LBA low, mid and high
+	u_int8_t *data;	///< HEALTH_SECTOR bytes read, NULL for a command without data
+};
+
+/// a responder - CAM ATA passthrough on the disk's device, or the simulated one
+struct health_ops {
+	const char *name;
+	void *(*open)(const char *path);	///< /dev/ada0 - NULL with the reason in health_errbuf
+	int (*command)(void *dev, struct health_cmd *cmd);	///< 0 with the result registers in cmd, -1 with the reason in health_errbuf
+	void (*close)(void *dev);
+};
+
+extern const struct health_ops health_cam;	///< FreeBSD XPT_ATA_IO through the disk's pass device
+extern const struct health_ops health_sim;	///< health_simdisks[] - no hardware
+extern const struct health_ops *health;	///< responder the poll uses
+extern char health_errbuf[256];
+
+/// one bay - written by the health thread, any thread may read it with health_read()
+struct health_bay {
+	int state;	///< enum health_state
+	int power;	///< CHECK POWER MODE count at the last poll, -1 before the first
+	int attr;	///< id of the pre-fail attribute at or below its threshold, 0 for none
+	int64_t checked;	///< time(NULL) of the last SMART read, 0 for never
+	u_int64_t polls;	///< SMART reads
+	u_int64_t standby;	///< polls left out because the disk was spun down
+	u_int64_t deferred;	///< polls put off because the disk was busy
+	u_int64_t power_checks;	///< CHECK POWER MODE commands, from the power tracker and the SMART poll
+};
+
+/// what polling costs - written by the health thread only
+struct health_counters {
+	u_int64_t rounds;	///< wakeups that polled one or more bays
+	u_int64_t commands;	///< ATA commands sent
+	u_int64_t errors;	///< commands or opens that failed
+	u_int64_t standby;	///< bays left out because they were spun down
+	u_int64_t deferred;	///< bays put off because they were busy
+	u_int64_t power_checks;	///< CHECK POWER MODE commands
+	long long last_ns;	///< time the last round took
+	long long cmd_max_ns;	///< slowest ATA command
+};
+extern struct health_counters health_stats;
+
+/// the simulated responder's disks - what each answers, and what it was asked
+struct health_simdisk {
+	int power;	///< CHECK POWER MODE count - a SMART command in standby spins the disk up
+	int failing;	///< RETURN STATUS reports a threshold exceeded
+	int prefail;	///< id of a pre-fail attribute to put at its threshold, 0 for none
+	long busy_us;	///< time each command keeps the disk from other I/O
+	u_int64_t commands;
+	u_int64_t spinups;	///< SMART commands that woke the disk - the poll should never cause one
+	pthread_mutex_t lock;	///< held while a command runs - health_sim_io() waits on it
+};
+extern struct health_simdisk health_simdisks[HEALTH_SIM_DISKS];
+
+/// an I/O of us microseconds on simulated disk n, queued behind any command in progress
+/// as the disk would queue it - returns the nanoseconds from submission to completion
+long long health_sim_io( int n, long us );
+
+/// poll the bays that are due - the health thread's round, callable directly while the
+/// thread is not running. a bay is due when every is set or it was put off earlier.
+/// returns the bays still put off because they were busy
+int health_poll( int every );
+
+/// copy a bay's last result - never blocks. returns 0 for a bay the poll does not know
+int health_read( size_t bay, struct health_bay *out );
+
+/// start the health thread - every bay once every interval seconds, the first round
+/// interval seconds after the last one, or at once for the first start. changed(bay, state)
+/// runs on it whenever a bay's state changes. a bay that has had no I/O for idle seconds
+/// has its power mode checked and handed to the monitor with monitor_power(). 0 for either
+/// turns that part off. 0 on success, -1 with the reason on stderr
+int health_start( int interval, int idle, void (*changed)( size_t bay, int state ) );
+void health_kick(void);	///< a disk arrived - the thread polls disks it has not seen without waiting for the round
+void health_stop(void);	///< a command in progress finishes first - at most HEALTH_TIMEOUT
+
+#endif //INCLUDED_HPEX49XLED_HEALTH
@@ -0,0 +1,277 @@
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_io.c
+///////
+/////// Port I/O backends for the LED code - real port I/O or a simulated
+/////// ICH9/SCH5127 register file for running without the hardware
+///////
+/////// -------------------------------------------------------------------------
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__FreeBSD__)
+#include <machine/cpufunc.h>
+#elif defined(__linux__) && (defined(__x86_64__) || defined(__i386__))
+#include <sys/io.h>
+#endif
+
+#include <sys/types.h>
+
+#include "hpex49xled_io.h"
+
+const struct portio_ops *portio = &portio_hw;
+struct portio_counters portio_stats;
+
+/////////////////////////////////////////////////////////////////////////
+/// select a backend and open it - returns 0 on success
+int portio_open( const struct portio_ops *ops )
+{
+	portio = ops;
+	memset(&portio_stats, 0, sizeof(portio_stats));
+	return portio->open();
+};
+
+void portio_close(void)
+{
+	portio->close();
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// real port I/O
+#if defined(__FreeBSD__)
+
+static int hw_fd = -1;
+
+static int hw_open(void)
+{
+	/* an open descriptor on /dev/io grants this process I/O privilege */
+	hw_fd = open("/dev/io", O_RDWR);
+	return ( hw_fd < 0 ) ? -1 : 0;
+};
+
+static void hw_close(void)
+{
+	if ( hw_fd >= 0 ) close(hw_fd);
+	hw_fd = -1;
+};
+
+static unsigned int hw_inl( unsigned int port ) { return inl( port ); }
+static unsigned int hw_inb( unsigned int port ) { return inb( port ); }
+static void hw_outl( unsigned int port, unsigned int val ) { outl( port, val ); }
+static void hw_outb( unsigned int port, unsigned int val ) { outb( port, val ); }
+
+#elif defined(__linux__) && (defined(__x86_64__) || defined(__i386__))
+
+static int hw_open(void) { return iopl(3); }
+static void hw_close(void) { iopl(0); }
+
+/* LINUX is the opposite of FreeBSD - value first, port second */
+static unsigned int hw_inl( unsigned int port ) { return inl( port ); }
+static unsigned int hw_inb( unsigned int port ) { return inb( port ); }
+static void hw_outl( unsigned int port, unsigned int val ) { outl( val, port ); }
+static void hw_outb( unsigned int port, unsigned int val ) { outb( val, port ); }
+
+#else
+
+static int hw_open(void) { errno = ENODEV; return -1; }
+static void hw_close(void) { }
+static unsigned int hw_inl( unsigned int port ) { return 0xFFFFFFFF; }
+static unsigned int hw_inb( unsigned int port ) { return 0xFF; }
+static void hw_outl( unsigned int port, unsigned int val ) { }
+static void hw_outb( unsigned int port, unsigned int val ) { }
+
+#endif
+
+const struct portio_ops portio_hw = {
+	.name = "hardware",
+	.open = hw_open,
+	.close = hw_close,
+	.inl = hw_inl,
+	.inb = hw_inb,
+	.outl = hw_outl,
+	.outb = hw_outb,
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// simulated register file
+///  0x0CF8/0x0CFC   PCI configuration mechanism #1 - 0:31.0 vendor id and GPIOBASE
+///  0x2e/0x4e       LPC SIO index/data - enter/exit, device id, LDN 0x0a base address
+///  gpiobase        ICH9 GPIO registers, 0x40 bytes as 32 bit registers
+///  sch5127_regs    SCH5127 runtime registers, 0x80 bytes, HWM index/data at 0x70/0x71
+/// unmapped reads float high and unmapped writes are dropped, like the real bus
+struct portio_sim_config portio_sim_config = {
+	.did_vid = 0x29168086,		/* ICH9R - HP EX48x/EX49x */
+	.gpiobase = 0x0480,
+	.sio_addr = 0x2e,
+	.sch5127_regs = 0x0a00,
+};
+
+enum {
+	SIM_PCI_ADDRESS = 0x0CF8,
+	SIM_PCI_DATA = 0x0CFC,
+	SIM_GPIO_SIZE = 0x40,
+	SIM_RT_SIZE = 0x80,
+	SIM_SIO_ENTER = 0x55,
+	SIM_SIO_EXIT = 0xaa,
+	SIM_SCH5127_ID = 0x86,
+};
+
+static struct {
+	unsigned int pci_addr;
+	unsigned int gpio[SIM_GPIO_SIZE / 4];
+	unsigned char rt[SIM_RT_SIZE];
+	unsigned char hwm[256];
+	unsigned char sio_cfg[256];
+	unsigned int sio_index;
+	unsigned int sio_ldn;
+	int sio_config_mode;
+} sim;
+
+static int sim_open(void)
+{
+	memset(&sim, 0, sizeof(sim));
+	sim.sio_cfg[0x20] = SIM_SCH5127_ID;
+	sim.sio_cfg[0x26] = portio_sim_config.sio_addr;
+	return 0;
+};
+
+static void sim_close(void) { }
+
+static int sim_is_gpio( unsigned int port )
+{
+	return port >= portio_sim_config.gpiobase && port < portio_sim_config.gpiobase + SIM_GPIO_SIZE;
+};
+
+static int sim_is_rt( unsigned int port )
+{
+	return port >= portio_sim_config.sch5127_regs && port < portio_sim_config.sch5127_regs + SIM_RT_SIZE;
+};
+
+/* both SIO addresses decode - 0x26 tells the LED code which one the chip really sits at */
+static int sim_is_sio( unsigned int port )
+{
+	return port == 0x2e || port == 0x2f || port == 0x4e || port == 0x4f;
+};
+
+static unsigned int sim_pci_read(void)
+{
+	switch ( sim.pci_addr ) {
+		case 0x8000F800: return portio_sim_config.did_vid;
+		case 0x8000F848: return portio_sim_config.gpiobase | 0x1;
+		default: return 0xFFFFFFFF;
+	}
+};
+
+static unsigned int sim_sio_read( unsigned int port )
+{
+	if ( !( port & 0x1 ) || !sim.sio_config_mode )
+		return 0xFF;
+
+	if ( sim.sio_ldn == 0x0a && sim.sio_index == 0x60 )
+		return ( portio_sim_config.sch5127_regs >> 8 ) & 0xFF;
+	if ( sim.sio_ldn == 0x0a && sim.sio_index == 0x61 )
+		return portio_sim_config.sch5127_regs & 0xFF;
+	if ( sim.sio_index == 0x07 )
+		return sim.sio_ldn;
+
+	return sim.sio_cfg[sim.sio_index];
+};
+
+static void sim_sio_write( unsigned int port, unsigned int val )
+{
+	val &= 0xFF;
+
+	if ( !( port & 0x1 ) ) {
+		if ( val == SIM_SIO_ENTER ) sim.sio_config_mode = 1;
+		else if ( val == SIM_SIO_EXIT ) sim.sio_config_mode = 0;
+		else sim.sio_index = val;
+		return;
+	}
+	if ( !sim.sio_config_mode )
+		return;
+	if ( sim.sio_index == 0x07 )
+		sim.sio_ldn = val;
+	else
+		sim.sio_cfg[sim.sio_index] = val;
+};
+
+static unsigned int sim_inl( unsigned int port )
+{
+	if ( port == SIM_PCI_DATA ) return sim_pci_read();
+	if ( port == SIM_PCI_ADDRESS ) return sim.pci_addr;
+	if ( sim_is_gpio( port ) ) return sim.gpio[( port - portio_sim_config.gpiobase ) / 4];
+	return 0xFFFFFFFF;
+};
+
+static void sim_outl( unsigned int port, unsigned int val )
+{
+	if ( port == SIM_PCI_ADDRESS ) sim.pci_addr = val;
+	else if ( sim_is_gpio( port ) ) sim.gpio[( port - portio_sim_config.gpiobase ) / 4] = val;
+};
+
+static unsigned int sim_inb( unsigned int port )
+{
+	if ( sim_is_sio( port ) ) return sim_sio_read( port );
+	if ( sim_is_rt( port ) ) {
+		const unsigned int off = port - portio_sim_config.sch5127_regs;
+		if ( off == 0x71 ) return sim.hwm[sim.rt[0x70]];
+		return sim.rt[off];
+	}
+	return 0xFF;
+};
+
+static void sim_outb( unsigned int port, unsigned int val )
+{
+	if ( sim_is_sio( port ) ) {
+		sim_sio_write( port, val );
+	}
+	else if ( sim_is_rt( port ) ) {
+		const unsigned int off = port - portio_sim_config.sch5127_regs;
+		if ( off == 0x71 ) sim.hwm[sim.rt[0x70]] = val;
+		else sim.rt[off] = val;
+	}
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// read a simulated register without going through the counters
+unsigned int portio_sim_peek( unsigned int port )
+{
+	if ( sim_is_gpio( port ) ) return sim.gpio[( port - portio_sim_config.gpiobase ) / 4];
+	if ( sim_is_rt( port ) ) return sim.rt[port - portio_sim_config.sch5127_regs];
+	return 0xFFFFFFFF;
+};
+
+const struct portio_ops portio_sim = {
+	.name = "simulated",
+	.open = sim_open,
+	.close = sim_close,
+	.inl = sim_inl,
+	.inb = sim_inb,
+	.outl = sim_outl,
+	.outb = sim_outb,
+};
@@ -0,0 +1,95 @@
+#ifndef INCLUDED_HPEX49XLED_IO
+#define INCLUDED_HPEX49XLED_IO
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_io.h
+///////
+/////// Port I/O backends for the LED code - real port I/O or a simulated
+/////// ICH9/SCH5127 register file for running without the hardware
+///////
+/////// -------------------------------------------------------------------------
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#include <sys/types.h>
+
+/// argument order follows FreeBSD <machine/cpufunc.h> - port first, value second
+struct portio_ops {
+	const char *name;
+	int (*open)(void);	///< returns 0 on success
+	void (*close)(void);
+	unsigned int (*inl)(unsigned int port);
+	unsigned int (*inb)(unsigned int port);
+	void (*outl)(unsigned int port, unsigned int val);
+	void (*outb)(unsigned int port, unsigned int val);
+};
+
+struct portio_counters {
+	u_int64_t inl;
+	u_int64_t inb;
+	u_int64_t outl;
+	u_int64_t outb;
+};
+
+extern const struct portio_ops portio_hw;	///< /dev/io on FreeBSD, iopl() on Linux x86
+extern const struct portio_ops portio_sim;	///< in-memory ICH9 + SCH5127 register file
+extern const struct portio_ops *portio;		///< backend in use
+extern struct portio_counters portio_stats;	///< every access through io_*() below
+
+int portio_open( const struct portio_ops *ops );
+void portio_close(void);
+
+/// simulated hardware - identity and base addresses the sim reports
+struct portio_sim_config {
+	unsigned int did_vid;		///< PCI 0:31.0 register 0x00
+	unsigned int gpiobase;		///< PCI 0:31.0 register 0x48 without the I/O space bit
+	unsigned int sio_addr;		///< 0x2e or 0x4e - where the SCH5127 answers
+	unsigned int sch5127_regs;	///< runtime register base for LDN 0x0a
+};
+extern struct portio_sim_config portio_sim_config;
+unsigned int portio_sim_peek( unsigned int port );	///< current value without counting an access
+
+static inline unsigned int io_inl( unsigned int port )
+{
+	++portio_stats.inl;
+	return portio->inl( port );
+}
+
+static inline unsigned int io_inb( unsigned int port )
+{
+	++portio_stats.inb;
+	return portio->inb( port );
+}
+
+static inline void io_outl( unsigned int port, unsigned int val )
+{
+	++portio_stats.outl;
+	portio->outl( port, val );
+}
+
+static inline void io_outb( unsigned int port, unsigned int val )
+{
+	++portio_stats.outb;
+	portio->outb( port, val );
+}
+
+#endif //INCLUDED_HPEX49XLED_IO
@@ -47,26 +47,29 @@
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
-#include <kvm.h>
-#include <devstat.h>
-#include <camlib.h>
 #include <getopt.h>
 #include <pwd.h>
 #include <pthread.h>
 #include <syslog.h>
-#include <machine/cpufunc.h>
 
 #include <sys/param.h>
 #include <sys/errno.h>
 #include <sys/resource.h>
-#include <sys/sysctl.h>
 #include <sys/types.h>
 
 #include "hpex49x_led.h"
+#include "hpex49xled_io.h"
 #include "hpled.h"
+#include "hpex49xled_ledq.h"
+#include "hpex49xled_log.h"
+#include "hpex49xled_baymap.h"
 
-extern pthread_spinlock_t hpex49x_gpio_lock2;
-extern struct hpled hpex49x[4];
+extern struct hpled *hpex49x;
+extern size_t hpbays;
+
+/* cached image of the LED output registers - see gpio_shadow_init() */
+struct gpio_shadow gpio_shadow[SHADOW_REGS];
+struct gpio_counters gpio_stats;
 
 ///////////////////////////////////////////////////////////
 //// Initialize the SCH5127 Interface - where applicable
@@ -91,16 +94,16 @@ size_t initsch5127(const unsigned int vendor)
 
 	// retrieve vendor and device identification
 	// LINUX is the opposite of FreeBSD regarding outl or outw etc.  outl( CONF_VENDOR_ID, PCI_CONFIG_ADDRESS );
-	outl(PCI_CONFIG_ADDRESS, CONF_VENDOR_ID);
-	const unsigned int did_vid = inl( PCI_CONFIG_DATA );
+	io_outl(PCI_CONFIG_ADDRESS, CONF_VENDOR_ID);
+	const unsigned int did_vid = io_inl( PCI_CONFIG_DATA );
 	
 	if ( vendor != did_vid ) {
 		fprintf(stderr,"GPIO Vendor %d did not match return from inl() %d in %s line %d\n", vendor, did_vid, __FUNCTION__, __LINE__);
 		return 0;
 	}
 	// retrieve GPIO Base Address
-	outl( PCI_CONFIG_ADDRESS, CONF_GPIOBASE );
-	gpiobase = inl( PCI_CONFIG_DATA );
+	io_outl( PCI_CONFIG_ADDRESS, CONF_GPIOBASE );
+	gpiobase = io_inl( PCI_CONFIG_DATA );
 
 	if (debug)
 		printf("in %s gpiobase is: %#08X on line %d\n",__FUNCTION__, gpiobase, __LINE__);
@@ -124,19 +127,19 @@ size_t initsch5127(const unsigned int vendor)
 	unsigned int sio_data = sio_addr + 1;
 		
 	// enter configuration mode
-	outb( sio_addr, IDX_ENTER );
+	io_outb( sio_addr, IDX_ENTER );
 		
 	// retrieve identification
-	outb( sio_addr, IDX_ID );
-	const unsigned int device_id = inb( sio_data );
+	io_outb( sio_addr, IDX_ID );
+	const unsigned int device_id = io_inb( sio_data );
 	if ( debug ) 
 		printf("Device 0x %#08X in %s on line %d \n", device_id,__FUNCTION__, __LINE__);
-	outb( sio_addr, 0x26 );
-	const unsigned int in = inb( sio_data );
+	io_outb( sio_addr, 0x26 );
+	const unsigned int in = io_inb( sio_data );
 	if( debug )
 		printf("in from inb() is 0x%#08X in %s on line %d \n",in,__FUNCTION__, __LINE__);
 	if ( 0x4e == in ) {
-		outb( sio_addr, IDX_EXIT );
+		io_outb( sio_addr, IDX_EXIT );
 			
 		// and switch to these if we are told to
 		if ( debug ) 
@@ -144,19 +147,19 @@ size_t initsch5127(const unsigned int vendor)
 		sio_addr = 0x4e;
 		sio_data = sio_addr + 1;
 				
-		outb( sio_addr, IDX_ENTER );
+		io_outb( sio_addr, IDX_ENTER );
 	}
 	// select logical device 0x0a (base address?)
-	outb( sio_addr, IDX_LDN );
-	outb( sio_data, 0x0a );
+	io_outb( sio_addr, IDX_LDN );
+	io_outb( sio_data, 0x0a );
 		
 	// get base address of runtime registers
-	outb( sio_addr, IDX_BASE_MSB );
-	const unsigned int index_msb = inb( sio_data );
+	io_outb( sio_addr, IDX_BASE_MSB );
+	const unsigned int index_msb = io_inb( sio_data );
 	if( debug )
 		printf("in %s and index_msb is: %#08X on line %d \n",__FUNCTION__, index_msb, __LINE__);
-	outb( sio_addr, IDX_BASE_LSB );
-	const unsigned int index_lsb = inb( sio_data );
+	io_outb( sio_addr, IDX_BASE_LSB );
+	const unsigned int index_lsb = io_inb( sio_data );
 	if( debug )
 		printf("in %s and index_lsb is: %#08X on line %d \n",__FUNCTION__, index_lsb, __LINE__);
 	
@@ -166,7 +169,7 @@ size_t initsch5127(const unsigned int vendor)
 		printf("in %s and sch5127_regs is now: %#08X on line %d \n",__FUNCTION__, sch5127_regs, __LINE__);
 		
 	// exit configuration
-	outb( sio_addr, IDX_EXIT );
+	io_outb( sio_addr, IDX_EXIT );
 		
 	// watchdog registers to zero out
 	const int WDT_REGS[] = { REG_WDT_TIME_OUT, REG_WDT_VAL, REG_WDT_CFG, REG_WDT_CTRL };
@@ -174,7 +177,7 @@ size_t initsch5127(const unsigned int vendor)
 		
 	// zero them out
 	for ( size_t i = 0; i < WDT_REGS_CNT; ++i ) {
-		outb( sch5127_regs + WDT_REGS[i], 0 );
+		io_outb( sch5127_regs + WDT_REGS[i], 0 );
 	}
 	
 	if(debug)
@@ -202,11 +205,15 @@ size_t init_hpex49x_led(void)
 	if ( !initsch5127(HPEX49X) ) 
 		return 0;
 
+	/* the built in layout, unless a bay map was loaded */
+	if ( baymap_platform("HP Mediasmart EX48x/EX49x", IO_LEDS_BLUE, IO_LEDS_RED, sizeof(IO_LEDS_BLUE) / sizeof(IO_LEDS_BLUE[0]), ICH9_LED_MIN, ICH9_LED_MAX) != 0 )
+		return 0;
+
 	/////////////////////////////////////////////////////////////////////////
-	/// enable LEDs for HP
-	for ( size_t i = 0; i < MAX_HDD_LEDS; ++i ) {
-		setbits32( ioledblue( i ), &bits1, &bits2 );
-		setbits32( ioledred( i ),  &bits1, &bits2 );
+	/// enable LEDs for HP - every bay LED in the map
+	for ( size_t i = 0; i < baymap.nent; ++i ) {
+		if ( baymap.ent[i].blue >= 0 ) setbits32( baymap.ent[i].blue, &bits1, &bits2 );
+		if ( baymap.ent[i].red >= 0 ) setbits32( baymap.ent[i].red, &bits1, &bits2 );
 	}	
 
 	setbits32( OUT_USB_DEVICE,  &bits1, &bits2 );
@@ -214,13 +221,14 @@ size_t init_hpex49x_led(void)
 	setbits32( OUT_SYSTEM_RED,  &bits1, &bits2 );
 	
 	setgpioselinput( bits1, bits2 );
+	gpio_shadow_init();
 
 	if(debug)
 		printf("In %s() line %d performed I/O port initialization\n",__FUNCTION__, __LINE__);
 
-	for(int i = 0; i < hpdisks; i++){
-		hpex49x[i].blue = IO_LEDS_BLUE[ ((hpex49x[i].HDD) - 1) ];
-		hpex49x[i].red = IO_LEDS_RED[ ((hpex49x[i].HDD) - 1) ];
+	for(size_t i = 0; i < hpbays; i++){
+		if( hpex49x[i].HDD )
+			led_bay_bits( &hpex49x[i] );
 	}
 	
 	if(debug)
@@ -252,13 +260,18 @@ size_t init_acer_altos(void)
 	setbits32( ALTOS_SYSTEM_RED, &bits1, &bits2 );
 		
 	setgpioselinput( bits1, bits2 );
+	gpio_shadow_init();
 
 	if(debug)
 		printf("In %s() line %d performed port initialization - about to return \n",__FUNCTION__, __LINE__);
 	
-	for(int i = 0; i < hpdisks; i++){
-		hpex49x[i].blue = IO_LEDS_BLUE[ ((hpex49x[i].HDD) - 1) ];
-		hpex49x[i].red = IO_LEDS_RED[ ((hpex49x[i].HDD) - 1) ];
+	/* the built in layout, unless a bay map was loaded */
+	if ( baymap_platform("Acer Altos", IO_LEDS_BLUE, IO_LEDS_RED, sizeof(IO_LEDS_BLUE) / sizeof(IO_LEDS_BLUE[0]), SCH5127_LED_MIN, SCH5127_LED_MAX) != 0 )
+		return 0;
+
+	for(size_t i = 0; i < hpbays; i++){
+		if( hpex49x[i].HDD )
+			led_bay_bits( &hpex49x[i] );
 	}
 
 	return 1;
@@ -287,13 +300,18 @@ size_t init_h340(void)
 	setbits32( H340_SYSTEM_RED,	&bits1, &bits2 );
 		
 	setgpioselinput( bits1, bits2 );
+	gpio_shadow_init();
 
 	if(debug)
 		printf("In %s() line %d performed port initialization - about to return \n",__FUNCTION__, __LINE__);
 
-	for(int i = 0; i < hpdisks; i++){
-		hpex49x[i].blue = IO_LEDS_BLUE[ ((hpex49x[i].HDD) - 1) ];
-		hpex49x[i].red = IO_LEDS_RED[ ((hpex49x[i].HDD) - 1) ];
+	/* the built in layout, unless a bay map was loaded */
+	if ( baymap_platform("Lenovo H340", IO_LEDS_BLUE, IO_LEDS_RED, sizeof(IO_LEDS_BLUE) / sizeof(IO_LEDS_BLUE[0]), SCH5127_LED_MIN, SCH5127_LED_MAX) != 0 )
+		return 0;
+
+	for(size_t i = 0; i < hpbays; i++){
+		if( hpex49x[i].HDD )
+			led_bay_bits( &hpex49x[i] );
 	}
 
 	return 1;
@@ -321,13 +339,18 @@ size_t init_h341(void)
 	setbits32( H341_SYSTEM_RED,	&bits1, &bits2 );
 		
 	setgpioselinput( bits1, bits2 );
+	gpio_shadow_init();
 
 	if(debug)
 		printf("In %s() line %d performed port initialization - about to return \n",__FUNCTION__, __LINE__);
 	
-	for(int i = 0; i < hpdisks; i++){
-		hpex49x[i].blue = IO_LEDS_BLUE[ ((hpex49x[i].HDD) - 1) ];
-		hpex49x[i].red = IO_LEDS_RED[ ((hpex49x[i].HDD) - 1) ];
+	/* the built in layout, unless a bay map was loaded */
+	if ( baymap_platform("Lenovo H341/H342", IO_LEDS_BLUE, IO_LEDS_RED, sizeof(IO_LEDS_BLUE) / sizeof(IO_LEDS_BLUE[0]), SCH5127_LED_MIN, SCH5127_LED_MAX) != 0 )
+		return 0;
+
+	for(size_t i = 0; i < hpbays; i++){
+		if( hpex49x[i].HDD )
+			led_bay_bits( &hpex49x[i] );
 	}
 
 	return 1;
@@ -341,28 +364,139 @@ void setbits32( int bit, int *bits1, int *bits2 )
 	*bits |= 1 << bit;
 }
 /////////////////////////////////////////////////////////////////////
-//// Set GPL Level
+//// Set GPL Level - queued in the shadow register, written by gpio_flush()
 void setgplpllvl( int bit, int state ) 
 {
-	dobits( (1 << (bit % 32)), gpiobase + ((bit < 32) ? GP_LVL : GP_LVL2),state);
+	gpio_queue( (bit < 32) ? SHADOW_GP_LVL : SHADOW_GP_LVL2, (1 << (bit % 32)), state );
 };
 //////////////////////////////////////////////////////////////////////
-//// Set General Purpose Registers
+//// Set General Purpose Registers - queued in the shadow register, written by gpio_flush()
+//// the high nibble picks GP1 - GP6 and the low nibble a bit counted from that register,
+//// so bits 8 - 15 belong to the next GP register up - GP1 - GP6 are consecutive bytes
 void setgpregslvl( int bit, int state ) 
 {
-	const int reg = ((bit >> 4) & 0xF) - 1;
-	assert( reg >= 0 );
+	const int reg = ((bit >> 4) & 0xF) - 1 + (bit & 0xF) / 8;
+	assert( bit >= 0x10 && reg < 6 );
 						
-	dobits( (1 << (bit & 0xF)), sch5127_regs + REG_GP1 + reg, state );
+	gpio_queue( SHADOW_GP1 + reg, (1 << ((bit & 0xF) % 8)), state );
 };
 /////////////////////////////////////////////////////////
-//// Set the bits
+//// Set the bits - immediate read-modify-write, bypasses the shadow registers
 void dobits( unsigned int bits, unsigned int port, int state ) 
 {
-	const unsigned int val = inl( port );
+	const unsigned int val = io_inl( port );
 	const unsigned int new_val = ( state ) ? val | bits : val & ~bits;
 
-	if ( val != new_val ) outl( port, new_val );
+	++gpio_stats.port_reads;
+	if ( val != new_val ) {
+		io_outl( port, new_val );
+		++gpio_stats.port_writes;
+	}
+};
+/////////////////////////////////////////////////////////////////////////
+/// seed the shadow registers with one read of each LED output register
+/// called from the init functions once gpiobase and sch5127_regs are known
+/// after this the LED registers are never read again - GP_LVL and the SCH5127
+/// GP registers ignore writes to bits configured as inputs, so writing back
+/// the cached image is safe
+void gpio_shadow_init(void)
+{
+	const unsigned int ports[SHADOW_REGS] = {
+		gpiobase + GP_LVL, gpiobase + GP_LVL2, gpiobase + GPO_BLINK,
+		sch5127_regs + REG_GP1, sch5127_regs + REG_GP2, sch5127_regs + REG_GP3,
+		sch5127_regs + REG_GP4, sch5127_regs + REG_GP5, sch5127_regs + REG_GP6,
+	};
+
+	for ( size_t i = 0; i < SHADOW_REGS; ++i ) {
+		gpio_shadow[i].port = ports[i];
+		gpio_shadow[i].wide = ( i < SHADOW_GP1 );
+		gpio_shadow[i].val = ( gpio_shadow[i].wide ) ? io_inl( ports[i] ) : io_inb( ports[i] );
+		gpio_shadow[i].set = 0;
+		gpio_shadow[i].clr = 0;
+		++gpio_stats.port_reads;
+	}
+	if(debug)
+		printf("In %s line %d seeded shadow registers GP_LVL: %#08X GP_LVL2: %#08X GPO_BLINK: %#08X\n", __FUNCTION__, __LINE__,
+			gpio_shadow[SHADOW_GP_LVL].val, gpio_shadow[SHADOW_GP_LVL2].val, gpio_shadow[SHADOW_GPO_BLINK].val);
+};
+/////////////////////////////////////////////////////////////////////////
+/// queue a bit change against a shadow register - no port I/O
+/// LED writer only, or the one thread running while no writer is started
+void gpio_queue( size_t reg, unsigned int bits, int state )
+{
+	struct gpio_shadow *g = &gpio_shadow[reg];
+	const unsigned int pending = ( g->val | g->set ) & ~g->clr;
+
+	/* what the old per-change inl()/outl() path would have cost */
+	++gpio_stats.requests;
+	++gpio_stats.legacy_ops;
+	if ( pending != (( state ) ? pending | bits : pending & ~bits) )
+		++gpio_stats.legacy_ops;
+
+	if ( state ) {
+		g->set |= bits;
+		g->clr &= ~bits;
+	}
+	else {
+		g->clr |= bits;
+		g->set &= ~bits;
+	}
+};
+/////////////////////////////////////////////////////////////////////////
+/// write every queued change - one write per register whose value changed
+/// LED writer only - everyone else submits through gpio_flush()
+void gpio_write(void)
+{
+	for ( size_t i = 0; i < SHADOW_REGS; ++i ) {
+		struct gpio_shadow *g = &gpio_shadow[i];
+		if ( !( g->set | g->clr ) ) 
+			continue;
+
+		const unsigned int new_val = ( g->val | g->set ) & ~g->clr;
+		g->set = g->clr = 0;
+
+		if ( new_val == g->val ) 
+			continue;
+
+		if ( g->wide ) 
+			io_outl( g->port, new_val );
+		else 
+			io_outb( g->port, new_val );
+
+		g->val = new_val;
+		++gpio_stats.port_writes;
+	}
+	++gpio_stats.flushes;
+};
+/////////////////////////////////////////////////////////////////////////
+/// hand the LED changes submitted so far to the LED writer as one batch
+void gpio_flush(void)
+{
+	ledq_kick();
+};
+/////////////////////////////////////////////////////////////////////////
+/// submit one LED command - the LED writer applies it with the rest of its batch
+static void led_submit( int op, int colour, int state, size_t led )
+{
+	const struct ledcmd cmd = { .op = op, .colour = colour, .state = state, .led = led };
+
+	if ( led == (size_t)-1 )
+		return; /* a bay the map gives no LED of this colour */
+
+	if ( ledq_push(&cmd) != 0 )
+		logmsg(LOGC_LED, LOG_DEBUG, "LED queue full - dropped op %d for LED %zu in %s line %d", op, led, __FUNCTION__, __LINE__);
+};
+/////////////////////////////////////////////////////////////////////////
+/// log the port I/O counters and what the shadow registers saved
+void gpio_report(void)
+{
+	const u_int64_t ops = gpio_stats.port_reads + gpio_stats.port_writes;
+	const u_int64_t saved = ( gpio_stats.legacy_ops > ops ) ? gpio_stats.legacy_ops - ops : 0;
+
+	logmsg(LOGC_LED, LOG_NOTICE, "GPIO: %ju LED changes in %ju flushes - %ju port reads %ju port writes - %ju saved vs read-modify-write - %ju commands %ju dropped %ju writer wakeups",
+		(uintmax_t)gpio_stats.requests, (uintmax_t)gpio_stats.flushes, (uintmax_t)gpio_stats.port_reads,
+		(uintmax_t)gpio_stats.port_writes, (uintmax_t)saved, (uintmax_t)ledq_stats.submitted, (uintmax_t)ledq_stats.dropped,
+		(uintmax_t)ledq_stats.wakeups);
 };
 ////////////////////////////////////////////////////////
 //// Set GPIO Select Input
@@ -373,32 +507,26 @@ void setgpioselinput( int bits1, int bits2 )
 	const unsigned int gpio_use_sel  = gpiobase + GPIO_USE_SEL;
 	const unsigned int gpio_use_sel2 = gpiobase + GPIO_USE_SEL2;
 	
-	outl( gpio_use_sel, inl(gpio_use_sel)  | bits1 );
-	outl( gpio_use_sel2, inl(gpio_use_sel2) | bits2 );
+	io_outl( gpio_use_sel, io_inl(gpio_use_sel)  | bits1 );
+	io_outl( gpio_use_sel2, io_inl(gpio_use_sel2) | bits2 );
 	
 	// Input/Output select (0 = Output, 1 = Input)
 	
 	const unsigned int gp_io_sel  = gpiobase + GP_IO_SEL;
 	const unsigned int gp_io_sel2 = gpiobase + GP_IO_SEL2;
 		
-	outl( gp_io_sel, inl(gp_io_sel) & ~bits1 );
-	outl( gp_io_sel2, inl(gp_io_sel2) & ~bits2 );
+	io_outl( gp_io_sel, io_inl(gp_io_sel) & ~bits1 );
+	io_outl( gp_io_sel2, io_inl(gp_io_sel2) & ~bits2 );
 			
 };
 /////////////////////////////////////////////////////////////////////////
 /// function to set the System LED (blinking light on front of HPEX4xx) pass blue, red 
 /// or combine turning each on at once for purple
+/// submitted and handed to the LED writer straight away
 void setsystemled( int led_type, int state ) 
 {
-	const int on_off_state = ( LED_ON == state );
-	if ( led_type & LED_BLUE ) setgplpllvl( out_system_blue, !on_off_state );
-	if ( led_type & LED_RED  ) setgplpllvl( out_system_red,  !on_off_state );
-	
-	const int blink_state  = ( LED_BLINK == state );
-	int val = 0;
-	if ( led_type & LED_BLUE ) val |= 1 << out_system_blue;
-	if ( led_type & LED_RED  ) val |= 1 << out_system_red;
-	if ( val ) dobits( val, gpiobase + GPO_BLINK, blink_state );
+	led_submit( LEDQ_SYSTEM, led_type, state, 0 );
+	gpio_flush();
 };
 /////////////////////////////////////////////////////////////////////////
 /// set brightness level
@@ -409,58 +537,113 @@ void setbrightness( int val )
 	static const unsigned int HWM_PWM3_DUTY_CYCLE = 0x32;	///< PWM3 Current Duty Cycle
 	static const unsigned char LED_BRIGHTNESS[] = { 0x00, 0xbe, 0xc3, 0xcb, 0xd3, 0xdb, 0xe3, 0xeb, 0xf3, 0xff };
 	val = fmax( 0, fmin( val, sizeof(LED_BRIGHTNESS) / sizeof(LED_BRIGHTNESS[0]) - 1 ) );
-	outb( sch5127_regs + REG_HWM_INDEX, HWM_PWM3_DUTY_CYCLE );
-	outb( sch5127_regs + REG_HWM_DATA, LED_BRIGHTNESS[val] );
+	io_outb( sch5127_regs + REG_HWM_INDEX, HWM_PWM3_DUTY_CYCLE );
+	io_outb( sch5127_regs + REG_HWM_DATA, LED_BRIGHTNESS[val] );
 };
 /////////////////////////////////////////////////////////////////////////
-/// blue LED mappings for HP disks only - *UNUSED*
+/// blue LED bit for a 0 based bay from the bay map - -1 for none
 int ioledblue( size_t led_idx )
 {
-	const int IO_LEDS_BLUE[] = { OUT_BLUE0, OUT_BLUE1, OUT_BLUE2, OUT_BLUE3 };
-	assert( led_idx < MAX_HDD_LEDS );
-	return IO_LEDS_BLUE[ led_idx ];
+	const struct bayent *e = baymap_bay( led_idx + 1 );
+	return ( e ) ? e->blue : -1;
 };
 /////////////////////////////////////////////////////////////////////////
-/// red LED mappings for HP disks only - *UNUSED*
+/// red LED bit for a 0 based bay from the bay map - -1 for none
 int ioledred( size_t led_idx )
 {
-	const int IO_LEDS_RED[] = { OUT_RED0, OUT_RED1, OUT_RED2, OUT_RED3 };
-	assert( led_idx < MAX_HDD_LEDS );
-	return IO_LEDS_RED[ led_idx ];
+	const struct bayent *e = baymap_bay( led_idx + 1 );
+	return ( e ) ? e->red : -1;
+};
+/////////////////////////////////////////////////////////////////////////
+/// fill in the LED bits for a bay from its HDD number - used by the init
+/// functions and for a disk that attaches while monitoring runs
+void led_bay_bits( struct hpled *bay )
+{
+	const struct bayent *e = baymap_bay( bay->HDD );
+
+	assert( e != NULL );
+	bay->blue = e->blue;
+	bay->red = e->red;
+};
+/////////////////////////////////////////////////////////////////////////
+/// queue every bay LED in the map off, and its GPO_BLINK bit when blink is set -
+/// for shutdown and restarts, whether or not a disk sits in the bay
+void led_bays_off( void (*set_led)( int led_type, int state, size_t led ), int blink )
+{
+	for ( size_t i = 0; i < baymap.nent; ++i ) {
+		const struct bayent *e = &baymap.ent[i];
+
+		if ( e->blue >= 0 ) {
+			set_led( LED_BLUE, OFF, e->blue );
+			if ( blink ) set_hpex_blink( e->blue, OFF );
+		}
+		if ( e->red >= 0 ) {
+			set_led( LED_RED, OFF, e->red );
+			if ( blink ) set_hpex_blink( e->red, OFF );
+		}
+	}
 };
 /////////////////////////////////////////////////////////////////////////
 /// function to set the LEDs for HP devices - pass blue, red 
 /// or combine turning each on at once for purple
-/// gcc atomic built-in while(__sync_lock_test_and_set(&hpex49xgpio_lock2, 1));	and __sync_lock_release(&hpex49xgpio_lock2);
+/// the change is queued - call gpio_flush() to submit it
 void set_hpex_led( int led_type, int state, size_t led )
 {
-	if( (pthread_spin_lock(&hpex49x_gpio_lock2)) == EDEADLK ) {
-		thread_run = 0; /* nuclear option - this should never happen */
-		pthread_spin_unlock(&hpex49x_gpio_lock2);
-		err(1,"Deadlock condition returned from pthread_spin_lock in %s line %d", __FUNCTION__, __LINE__);
-	}
-
-	if ( led_type & LED_BLUE ) setgplpllvl( led, !state );
-	if ( led_type & LED_RED  ) setgplpllvl( led, !state );
+	led_submit( LEDQ_HPEX, led_type, state, led );
+};
+/////////////////////////////////////////////////////////////////////////
+/// hardware blink for an HP bay LED through the ICH9 GPO_BLINK register
+/// GPO_BLINK only covers GPIO 0 - 31 - returns 0 for LEDs it can not blink
+/// the change is queued - call gpio_flush() to submit it
+size_t set_hpex_blink( size_t led, int state )
+{
+	if ( led >= 32 )
+		return 0;
 
-	if( (pthread_spin_unlock(&hpex49x_gpio_lock2)) != 0)
-		err(1, "Invalid return from pthread_spin_unlock in %s line %d", __FUNCTION__, __LINE__);
+	led_submit( LEDQ_BLINK, 0, state, led );
+	return 1;
 };
 /////////////////////////////////////////////////////////////////////////
 /// control leds
 /// @param led_type LED type to turn on/off LED_BLUE, LED_RED, LED_BLUE | LED_RED
 /// @param led Which LED to turn on/off (0 -> 3)
 /// @param state Whether we are turning LED on or off 
+/// the change is queued - call gpio_flush() to submit it
 void set_acer_led( int led_type, int state, size_t led ) 
 {
-	if( (pthread_spin_lock(&hpex49x_gpio_lock2)) == EDEADLK ){
-		thread_run = 0; /* nuclear option - this should never happen */
-		err(1,"Invalid return from pthread_spin_lock in %s line %d",  __FUNCTION__, __LINE__);
+	led_submit( LEDQ_ACER, led_type, state, led );
+};
+/////////////////////////////////////////////////////////////////////////
+/// apply one LED command to the shadow registers - LED writer only
+/// gpio_write() puts the result on the hardware at the end of the batch
+void led_apply( const struct ledcmd *cmd )
+{
+	switch ( cmd->op ) {
+		case LEDQ_HPEX:
+			/* HP LEDs are active low */
+			if ( cmd->colour & LED_BLUE ) setgplpllvl( cmd->led, !cmd->state );
+			if ( cmd->colour & LED_RED  ) setgplpllvl( cmd->led, !cmd->state );
+			break;
+		case LEDQ_ACER:
+			if ( cmd->colour & LED_BLUE ) setgpregslvl( cmd->led, cmd->state );
+			if ( cmd->colour & LED_RED  ) setgpregslvl( cmd->led, cmd->state );
+			break;
+		case LEDQ_BLINK:
+			gpio_queue( SHADOW_GPO_BLINK, 1 << cmd->led, cmd->state );
+			break;
+		case LEDQ_SYSTEM: {
+			const int on_off_state = ( LED_ON == cmd->state );
+			if ( cmd->colour & LED_BLUE ) setgplpllvl( out_system_blue, !on_off_state );
+			if ( cmd->colour & LED_RED  ) setgplpllvl( out_system_red,  !on_off_state );
+
+			const int blink_state  = ( LED_BLINK == cmd->state );
+			int val = 0;
+			if ( cmd->colour & LED_BLUE ) val |= 1 << out_system_blue;
+			if ( cmd->colour & LED_RED  ) val |= 1 << out_system_red;
+			if ( val ) gpio_queue( SHADOW_GPO_BLINK, val, blink_state );
+			break;
+		}
+		default:
+			break;
 	}
-
-	if ( led_type & LED_BLUE ) setgpregslvl( led, state );
-	if ( led_type & LED_RED  ) setgpregslvl( led, state );
-
-	if( (pthread_spin_unlock(&hpex49x_gpio_lock2)) != 0)
-		err(1, "Invalid return from pthread_spin_unlock in %s line %d", __FUNCTION__, __LINE__);
 };
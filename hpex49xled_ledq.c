@@ -0,0 +1,194 @@
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_ledq.c
+///////
+/////// LED command queue - any thread submits LED changes into a lock-free
+/////// ring and a single writer thread owns the GPIO registers
+///////
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <string.h>
+
+#include <sys/types.h>
+
+#include "hpled.h"
+#include "hpex49xled_io.h"
+#include "hpex49xled_ledq.h"
+#include "hpex49xled_perf.h"
+
+struct ledq_counters ledq_stats;
+
+/////////////////////////////////////////////////////////////////////////
+/// bounded multi producer, single consumer ring. each slot carries a sequence
+/// number - a producer claims a slot by moving tail with a compare and swap,
+/// fills it and then releases the slot by storing its sequence. the writer
+/// takes slots in order as long as their sequence says they are filled.
+/// producers never wait on each other for longer than a failed CAS, and never
+/// on the writer or on port I/O. the sequences are stored less the slot index
+/// so the zeroed ring is already the empty ring
+static struct {
+	struct {
+		u_int64_t seq;	/* + slot index: == pos free for pos, == pos + 1 filled */
+		struct ledcmd cmd;
+	} slot[LEDQ_SIZE];
+	u_int64_t tail __attribute__((aligned(CACHE_LINE)));	/* next slot for a producer */
+	u_int64_t head __attribute__((aligned(CACHE_LINE)));	/* next slot for the writer */
+	int kicked;	/* a wakeup is already pending */
+	u_int64_t kicked_ns;	/* when the pending wakeup was posted - perf_now() */
+	int running;	/* writer thread started */
+	int stop;
+	sem_t kick;
+	pthread_t writer;
+} ledq;
+
+int ledq_push( const struct ledcmd *cmd )
+{
+	u_int64_t pos = __atomic_load_n(&ledq.tail, __ATOMIC_RELAXED);
+
+	while ( 1 ) {
+		const u_int64_t seq = __atomic_load_n(&ledq.slot[pos % LEDQ_SIZE].seq, __ATOMIC_ACQUIRE) + pos % LEDQ_SIZE;
+		const int64_t dif = (int64_t)(seq - pos);
+
+		if ( dif == 0 ) {
+			if ( __atomic_compare_exchange_n(&ledq.tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED) )
+				break;
+			perf_count_retry();
+		}
+		else if ( dif < 0 ) {
+			__atomic_add_fetch(&ledq_stats.dropped, 1, __ATOMIC_RELAXED);
+			return -1;
+		}
+		else
+			pos = __atomic_load_n(&ledq.tail, __ATOMIC_RELAXED);
+	}
+	ledq.slot[pos % LEDQ_SIZE].cmd = *cmd;
+	__atomic_store_n(&ledq.slot[pos % LEDQ_SIZE].seq, pos + 1 - pos % LEDQ_SIZE, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&ledq_stats.submitted, 1, __ATOMIC_RELAXED);
+	return 0;
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// apply every command in the ring to the shadow registers, then write the
+/// registers once. an on and an off for the same LED inside one batch cancel
+/// in the shadow and cost no port I/O. only the writer (or the one thread
+/// running while no writer is started) calls this
+static void ledq_drain(void)
+{
+	const u_int64_t ops = portio_stats.inl + portio_stats.inb + portio_stats.outl + portio_stats.outb;
+	size_t n = 0;
+
+	while ( 1 ) {
+		const u_int64_t pos = ledq.head;
+		const u_int64_t idx = pos % LEDQ_SIZE;
+		if ( __atomic_load_n(&ledq.slot[idx].seq, __ATOMIC_ACQUIRE) + idx != pos + 1 )
+			break;
+		led_apply(&ledq.slot[idx].cmd);
+		__atomic_store_n(&ledq.slot[idx].seq, pos + LEDQ_SIZE - idx, __ATOMIC_RELEASE);
+		__atomic_store_n(&ledq.head, pos + 1, __ATOMIC_RELEASE);
+		++n;
+	}
+	if ( n ) {
+		gpio_write();
+		++ledq_stats.batches;
+		perf_record(PERF_GPIO_OPS, portio_stats.inl + portio_stats.inb + portio_stats.outl + portio_stats.outb - ops);
+	}
+};
+
+void ledq_kick(void)
+{
+	/* nothing submitted since the writer last drained - no wakeup */
+	if ( __atomic_load_n(&ledq.tail, __ATOMIC_ACQUIRE) == __atomic_load_n(&ledq.head, __ATOMIC_ACQUIRE) )
+		return;
+	if ( !__atomic_load_n(&ledq.running, __ATOMIC_ACQUIRE) ) {
+		ledq_drain();
+		return;
+	}
+	/* one wakeup covers every batch submitted before the writer gets to run. seq_cst, paired
+	   with the fence in led_writer_run() - the slot's seq store must not pass the look at kicked,
+	   or the writer misses the slot while this sees kicked still set and skips the post */
+	if ( __atomic_exchange_n(&ledq.kicked, 1, __ATOMIC_SEQ_CST) == 0 ) {
+		__atomic_store_n(&ledq.kicked_ns, perf_now(), __ATOMIC_RELAXED);
+		sem_post(&ledq.kick);
+	}
+};
+
+static void* led_writer_run( void *arg )
+{
+	while ( 1 ) {
+		while ( sem_wait(&ledq.kick) != 0 && errno == EINTR )
+			;
+		/* the time to here is what a tick waits for the GPIO owner - the stop post has no stamp */
+		if ( !__atomic_load_n(&ledq.stop, __ATOMIC_ACQUIRE) )
+			perf_record(PERF_LEDQ_WAIT, perf_now() - __atomic_load_n(&ledq.kicked_ns, __ATOMIC_RELAXED));
+		if ( ++ledq_stats.wakeups % PERF_CPU_EVERY == 1 )
+			perf_thread_cpu(PERF_THREAD_WRITER);
+		__atomic_store_n(&ledq.kicked, 0, __ATOMIC_RELEASE);
+		/* kicked cleared before any slot is read - see ledq_kick() */
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		ledq_drain();
+		if ( __atomic_load_n(&ledq.stop, __ATOMIC_ACQUIRE) )
+			break;
+	}
+	ledq_drain();
+	perf_thread_cpu(PERF_THREAD_WRITER);
+	return NULL;
+};
+
+int led_writer_start(void)
+{
+	if ( sem_init(&ledq.kick, 0, 0) != 0 )
+		return -1;
+	ledq.kicked = 0;
+	ledq.stop = 0;
+	__atomic_store_n(&ledq.running, 1, __ATOMIC_RELEASE);
+
+	if ( pthread_create(&ledq.writer, NULL, led_writer_run, NULL) != 0 ) {
+		__atomic_store_n(&ledq.running, 0, __ATOMIC_RELEASE);
+		sem_destroy(&ledq.kick);
+		return -1;
+	}
+	return 0;
+};
+
+void led_writer_stop(void)
+{
+	if ( !__atomic_load_n(&ledq.running, __ATOMIC_ACQUIRE) )
+		return;
+
+	__atomic_store_n(&ledq.stop, 1, __ATOMIC_RELEASE);
+	sem_post(&ledq.kick);
+	if ( pthread_join(ledq.writer, NULL) != 0 )
+		warn("Unable to join the LED writer in %s line %d", __FUNCTION__, __LINE__);
+
+	__atomic_store_n(&ledq.running, 0, __ATOMIC_RELEASE);
+	sem_destroy(&ledq.kick);
+	/* anything pushed between the writer's last drain and now */
+	ledq_drain();
+};
@@ -0,0 +1,70 @@
+#ifndef INCLUDED_HPEX49XLED_LEDQ
+#define INCLUDED_HPEX49XLED_LEDQ
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_ledq.h
+///////
+/////// LED command queue - any thread submits LED changes into a lock-free
+/////// ring and a single writer thread owns the GPIO registers
+///////
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+/////////////////////////////////////////////////////////////////////////////////
+#include <sys/types.h>
+
+#define LEDQ_SIZE 1024 // commands the ring holds - a power of two
+
+enum ledq_op {
+	LEDQ_HPEX = 0,	///< HP bay LED - led is the ICH9 GPIO bit
+	LEDQ_ACER,	///< Acer/Lenovo bay LED - led is the SCH5127 register and bit
+	LEDQ_BLINK,	///< ICH9 GPO_BLINK for one GPIO bit
+	LEDQ_SYSTEM,	///< system LED - state is LED_OFF, LED_ON or LED_BLINK
+};
+
+/// one LED change - bay (GPIO bit), colour, state and pattern
+struct ledcmd {
+	unsigned char op;	///< enum ledq_op
+	unsigned char colour;	///< LED_BLUE | LED_RED
+	unsigned char state;	///< ON/OFF, or enum ledstate for LEDQ_SYSTEM
+	unsigned int led;
+};
+
+struct ledq_counters {
+	u_int64_t submitted;	///< commands accepted into the ring
+	u_int64_t dropped;	///< commands refused because the ring was full
+	u_int64_t batches;	///< batches the writer applied
+	u_int64_t wakeups;	///< times the writer thread woke
+};
+extern struct ledq_counters ledq_stats;
+
+int ledq_push( const struct ledcmd *cmd );	///< 0 on success, -1 when the ring is full - never blocks
+void ledq_kick(void);	///< end of a batch - wake the writer, or apply it here when no writer runs
+int led_writer_start(void);	///< returns 0 on success
+void led_writer_stop(void);	///< applies everything submitted so far, then joins the writer
+
+/* from hpex49xled_led.c - writer side only */
+void led_apply( const struct ledcmd *cmd );
+void gpio_write(void);
+
+#endif //INCLUDED_HPEX49XLED_LEDQ
@@ -0,0 +1,331 @@
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_log.c
+///////
+/////// Logging - messages are formatted into a ring per thread and written to
+/////// syslog, a file or stdout by one flusher thread, rate limited per class
+///////
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+/////////////////////////////////////////////////////////////////////////////////
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+
+#include "hpled.h"
+#include "hpex49xled_log.h"
+
+/////////////////////////////////////////////////////////////////////////
+/// one ring per thread that logs - the thread is its only producer and the flusher
+/// its only consumer, so neither ever waits on the other. a full ring drops the
+/// message. rings are claimed on a thread's first message and handed back when the
+/// thread ends, with whatever it left still waiting for the flusher
+struct logent {
+	u_int64_t ns;	/* CLOCK_REALTIME - the flusher writes the rings out in this order */
+	int cls;
+	int pri;
+	char msg[LOG_MSG_LEN];
+};
+
+struct logring {
+	u_int64_t head __attribute__((aligned(CACHE_LINE)));	/* next slot the thread fills */
+	u_int64_t tail __attribute__((aligned(CACHE_LINE)));	/* next slot the flusher writes */
+	int owned;
+	struct logent ent[LOG_RING_SLOTS];
+};
+
+struct log_counters log_stats;
+
+static struct logring rings[LOG_RINGS];
+static __thread struct logring *mine = NULL;
+static pthread_key_t ring_key;
+static pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+
+static pthread_t flusher;
+static int running = 0; /* set while the flusher takes messages */
+static int pending = 0; /* a wakeup is in the pipe - producers only write one */
+static int wake_pipe[2] = { -1, -1 };
+static FILE *logfile = NULL;
+
+/* rate limit - per class, the time the next message would be due at LOG_RATE. a message
+   passes while that is less than LOG_BURST messages ahead of now */
+static u_int64_t due[LOGC_CLASSES];
+static u_int64_t held[LOGC_CLASSES]; /* suppressed since the last report */
+static u_int64_t reported; /* CLOCK_MONOTONIC of the last report */
+
+static const char *class_names[] = { "main", "monitor", "hotplug", "led", "cam", "update", "export", "health" };
+
+static u_int64_t log_clock( clockid_t id )
+{
+	struct timespec ts;
+	clock_gettime(id, &ts);
+	return (u_int64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+};
+
+static int log_allow( int cls, u_int64_t now )
+{
+	const u_int64_t interval = 1000000000ULL / LOG_RATE;
+	u_int64_t d = __atomic_load_n(&due[cls], __ATOMIC_RELAXED), next;
+
+	do {
+		next = ( ( d > now ) ? d : now ) + interval;
+		if ( next - now > interval * LOG_BURST )
+			return 0;
+	} while ( !__atomic_compare_exchange_n(&due[cls], &d, next, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED) );
+	return 1;
+};
+
+/* seq_cst, paired with the fence in log_flusher() - the message's head store must not
+   pass the look at pending, or both sides can miss the other and the message waits */
+static void log_wake(void)
+{
+	if ( __atomic_exchange_n(&pending, 1, __ATOMIC_SEQ_CST) == 0 && write(wake_pipe[1], "l", 1) < 0 ) { /* already pending */ }
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// the message's destination - runs on the flusher, or on the caller before log_start()
+static void log_write( const struct logent *e )
+{
+	if ( logfile != NULL ) {
+		const time_t sec = e->ns / 1000000000ULL;
+		struct tm tm;
+		char when[32];
+
+		strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime_r(&sec, &tm));
+		fprintf(logfile, "%s.%03u %s: %s\n", when, (unsigned)(e->ns / 1000000 % 1000), class_names[e->cls], e->msg);
+		fflush(logfile);
+	}
+	else if ( e->pri < LOG_DEBUG )
+		syslog(e->pri, "%s", e->msg);
+	if ( debug )
+		printf("%s\n", e->msg);
+};
+
+static void log_ring_release( void *r )
+{
+	__atomic_store_n(&((struct logring *)r)->owned, 0, __ATOMIC_RELEASE);
+};
+
+static void log_ring_key(void)
+{
+	if ( pthread_key_create(&ring_key, log_ring_release) != 0 )
+		ring_key = (pthread_key_t)-1;
+};
+
+static struct logring *log_ring(void)
+{
+	if ( mine != NULL )
+		return mine;
+	for ( int i = 0; i < LOG_RINGS; i++ ) {
+		int free_ring = 0;
+
+		if ( __atomic_compare_exchange_n(&rings[i].owned, &free_ring, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED) ) {
+			mine = &rings[i];
+			pthread_setspecific(ring_key, mine);
+			return mine;
+		}
+	}
+	return NULL;
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// the calling thread's only costs are the rate limit's compare and swap, the
+/// vsnprintf() and, when the flusher is asleep, one byte into its pipe
+void log_submit( int cls, int pri, const char *fmt, ... )
+{
+	const u_int64_t now = log_clock(CLOCK_MONOTONIC);
+	struct logring *r = NULL;
+	struct logent direct, *e = &direct;
+	u_int64_t head = 0;
+	va_list ap;
+
+	if ( cls < 0 || cls >= LOGC_CLASSES )
+		cls = LOGC_MAIN;
+	if ( !log_allow(cls, now) ) {
+		__atomic_add_fetch(&log_stats.suppressed[cls], 1, __ATOMIC_RELAXED);
+		if ( __atomic_fetch_add(&held[cls], 1, __ATOMIC_RELAXED) == 0 && __atomic_load_n(&running, __ATOMIC_ACQUIRE) )
+			log_wake(); /* so the flusher times the report */
+		return;
+	}
+	if ( __atomic_load_n(&running, __ATOMIC_ACQUIRE) && (r = log_ring()) != NULL ) {
+		head = r->head;
+		if ( head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= LOG_RING_SLOTS ) {
+			__atomic_add_fetch(&log_stats.dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		e = &r->ent[head % LOG_RING_SLOTS];
+	}
+	e->ns = log_clock(CLOCK_REALTIME);
+	e->cls = cls;
+	e->pri = pri;
+	va_start(ap, fmt);
+	vsnprintf(e->msg, sizeof(e->msg), fmt, ap);
+	va_end(ap);
+
+	if ( r != NULL ) {
+		__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+		log_wake();
+		return;
+	}
+	__atomic_add_fetch(&log_stats.direct, 1, __ATOMIC_RELAXED);
+	log_write(e);
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// write every waiting message, oldest first across the rings
+static void log_drain(void)
+{
+	int wrote = 0;
+
+	for (;;) {
+		struct logring *oldest = NULL;
+		const struct logent *e = NULL;
+
+		for ( int i = 0; i < LOG_RINGS; i++ ) {
+			struct logring *r = &rings[i];
+			const u_int64_t tail = r->tail;
+
+			if ( tail == __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) )
+				continue;
+			if ( oldest == NULL || r->ent[tail % LOG_RING_SLOTS].ns < e->ns ) {
+				oldest = r;
+				e = &r->ent[tail % LOG_RING_SLOTS];
+			}
+		}
+		if ( oldest == NULL )
+			break;
+		log_write(e);
+		__atomic_store_n(&oldest->tail, oldest->tail + 1, __ATOMIC_RELEASE);
+		++log_stats.messages;
+		wrote = 1;
+	}
+	if ( wrote )
+		++log_stats.flushes;
+};
+
+/// what the rate limit held back, once every LOG_SUPPRESS_REPORT seconds or when told to.
+/// returns the milliseconds until the next report is due, -1 if nothing is held back
+static int log_report( int now_or_never )
+{
+	const u_int64_t now = log_clock(CLOCK_MONOTONIC), every = LOG_SUPPRESS_REPORT * 1000000000ULL;
+	int any = 0;
+
+	for ( int c = 0; c < LOGC_CLASSES; c++ )
+		any |= ( __atomic_load_n(&held[c], __ATOMIC_RELAXED) != 0 );
+	if ( !any )
+		return -1;
+	if ( !now_or_never && now - reported < every )
+		return (int)( ( reported + every - now ) / 1000000 ) + 1;
+
+	for ( int c = 0; c < LOGC_CLASSES; c++ ) {
+		const u_int64_t n = __atomic_exchange_n(&held[c], 0, __ATOMIC_RELAXED);
+		struct logent e = { .ns = log_clock(CLOCK_REALTIME), .cls = c, .pri = LOG_NOTICE };
+
+		if ( n == 0 )
+			continue;
+		snprintf(e.msg, sizeof(e.msg), "%ju %s messages suppressed - more than %d/s", (uintmax_t)n, class_names[c], LOG_RATE);
+		log_write(&e);
+	}
+	reported = now;
+	return -1;
+};
+
+static void* log_flusher( void *arg )
+{
+	struct pollfd pfd = { .fd = wake_pipe[0], .events = POLLIN };
+	int timeout = -1;
+	char buf[64];
+
+	for (;;) {
+		if ( poll(&pfd, 1, timeout) < 0 && errno != EINTR )
+			break;
+		while ( read(wake_pipe[0], buf, sizeof(buf)) > 0 )
+			;
+		__atomic_store_n(&pending, 0, __ATOMIC_RELEASE);
+		/* pending cleared before any head is read - see log_wake() */
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		log_drain();
+		timeout = log_report(0);
+		if ( !__atomic_load_n(&running, __ATOMIC_ACQUIRE) )
+			break;
+	}
+	log_drain();
+	log_report(1);
+	return NULL;
+};
+
+int log_start( const char *file )
+{
+	pthread_once(&ring_once, log_ring_key);
+
+	if ( file != NULL && (logfile = fopen(file, "a")) == NULL ) {
+		fprintf(stderr, "log file %s: %s\n", file, strerror(errno));
+		return -1;
+	}
+	if ( pipe(wake_pipe) != 0 )
+		goto fail;
+	/* a full pipe already has a wakeup pending - producers never block */
+	fcntl(wake_pipe[0], F_SETFL, fcntl(wake_pipe[0], F_GETFL) | O_NONBLOCK);
+	fcntl(wake_pipe[1], F_SETFL, fcntl(wake_pipe[1], F_GETFL) | O_NONBLOCK);
+
+	reported = log_clock(CLOCK_MONOTONIC);
+	__atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+	if ( pthread_create(&flusher, NULL, log_flusher, NULL) == 0 )
+		return 0;
+	__atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+fail:
+	fprintf(stderr, "Unable to start the log flusher: %s\n", strerror(errno));
+	if ( wake_pipe[0] != -1 ) { close(wake_pipe[0]); close(wake_pipe[1]); }
+	wake_pipe[0] = wake_pipe[1] = -1;
+	if ( logfile != NULL ) fclose(logfile);
+	logfile = NULL;
+	return -1;
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// after the threads that log have stopped - a message submitted while this runs may
+/// be written directly instead of through its ring
+void log_stop(void)
+{
+	if ( !__atomic_exchange_n(&running, 0, __ATOMIC_ACQ_REL) )
+		return;
+	if ( write(wake_pipe[1], "s", 1) < 0 ) { /* already pending */ }
+	pthread_join(flusher, NULL);
+
+	close(wake_pipe[0]);
+	close(wake_pipe[1]);
+	wake_pipe[0] = wake_pipe[1] = -1;
+	__atomic_store_n(&pending, 0, __ATOMIC_RELEASE);
+	if ( logfile != NULL ) fclose(logfile);
+	logfile = NULL;
+};
@@ -0,0 +1,89 @@
+#ifndef INCLUDED_HPEX49XLED_LOG
+#define INCLUDED_HPEX49XLED_LOG
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_log.h
+///////
+/////// Logging - messages are formatted into a ring per thread and written to
+/////// syslog, a file or stdout by one flusher thread, rate limited per class
+///////
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+/////////////////////////////////////////////////////////////////////////////////
+#include <sys/types.h>
+#include <syslog.h>
+
+#define LOG_RING_SLOTS 64 // messages one thread can have waiting - more are dropped, never waited for
+#define LOG_RINGS 16 // threads with a ring at once - a ring goes back when its thread ends
+#define LOG_MSG_LEN 240 // longest message, longer ones are cut
+#define LOG_RATE 10 // messages per second one class may log once its burst is spent
+#define LOG_BURST 20 // messages one class may log at once
+#define LOG_SUPPRESS_REPORT 60 // seconds between reports of what the rate limit held back
+
+/// priorities above this are compiled out - -DHPEX49XLED_LOG_MAX=LOG_INFO drops every
+/// debug message and its arguments from the binary
+#ifndef HPEX49XLED_LOG_MAX
+#define HPEX49XLED_LOG_MAX LOG_DEBUG
+#endif
+
+/// message classes - each has its own rate limit and suppression counter
+enum log_class {
+	LOGC_MAIN = 0,
+	LOGC_MONITOR,	///< monitor thread - ticks, the end of monitoring
+	LOGC_HOTPLUG,	///< disks coming and going - a flapping drive floods this one
+	LOGC_LED,	///< LED queue and writer
+	LOGC_CAM,	///< bay discovery and the bay cache
+	LOGC_UPDATE,	///< freebsd-update watcher
+	LOGC_EXPORT,	///< metrics exporter
+	LOGC_HEALTH,	///< SMART health poll
+	LOGC_CLASSES
+};
+
+struct log_counters {
+	u_int64_t messages;	///< written by the flusher
+	u_int64_t direct;	///< written on the calling thread - no flusher yet, or no ring left
+	u_int64_t dropped;	///< lost to a full ring
+	u_int64_t suppressed[LOGC_CLASSES];	///< held back by the rate limit since it started
+	u_int64_t flushes;	///< flusher wakeups that wrote something
+};
+
+extern struct log_counters log_stats;
+extern size_t debug;
+
+/// log a message of class cls at syslog priority pri. LOG_DEBUG messages only when -d is
+/// given, and not at all when HPEX49XLED_LOG_MAX is below LOG_DEBUG. never blocks once
+/// log_start() ran: the message is formatted into the thread's ring and the flusher writes it
+#define logmsg(cls, pri, ...) do { \
+	if ( (pri) <= HPEX49XLED_LOG_MAX && ( (pri) < LOG_DEBUG || debug ) ) \
+		log_submit((cls), (pri), __VA_ARGS__); \
+} while (0)
+
+void log_submit( int cls, int pri, const char *fmt, ... ) __attribute__((format(printf, 3, 4)));
+/// start the flusher - file NULL writes to syslog (and LOG_DEBUG to stdout), otherwise every
+/// message goes to file with a timestamp. with -d everything is echoed to stdout as well.
+/// 0 on success, -1 with the reason on stderr. until it runs messages are written directly
+int log_start( const char *file );
+void log_stop(void);	///< write what is waiting, report what was suppressed and stop the flusher
+
+#endif //INCLUDED_HPEX49XLED_LOG
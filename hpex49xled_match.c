@@ -0,0 +1,251 @@
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_match.c
+///////
+/////// Device match rules - include/exclude by name pattern, type and interface
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <err.h>
+#include <fnmatch.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/types.h>
+
+#include "hpex49xled_stats.h"
+#include "hpex49xled_match.h"
+
+#define DEVMATCH_PASS_BIT 16 // type bit for passthrough devices - above the devstat types
+#define DEVMATCH_MEMO 512 // names whose verdict is remembered - a power of two
+
+struct devmatch_rule {
+	int exclude;
+	int nnames;
+	char names[DEVMATCH_MAX_NAMES][DISKSTATS_NAME_LEN];	/* none = any name */
+	unsigned types;	/* 1 << type, 1 << DEVMATCH_PASS_BIT - 0 = any type */
+	unsigned ifs;	/* 1 << if_names[] index - 0 = any interface */
+};
+
+static struct devmatch_rule rules[DEVMATCH_MAX_RULES];
+static int nrules = 0;
+
+/* verdicts by name and kind, so a new generation only runs the rules for new names */
+static struct {
+	char name[DISKSTATS_NAME_LEN];
+	unsigned kind;
+	int verdict;	/* 0 = empty, 1 = selected, 2 = left out */
+} memo[DEVMATCH_MEMO];
+
+/* selection for the provider generation it was built from */
+static int *sel = NULL;
+static size_t nsel = 0, capsel = 0;
+static long sel_generation = -1;
+static const struct diskstats_ops *sel_provider = NULL;
+
+static const char *type_names[] = { "direct", "sequential", "printer", "processor", "worm", "cdrom",
+	"scanner", "optical", "changer", "comm", "asc0", "asc1", "storarray", "enclosure", "floppy" };
+static const char *if_names[] = { "scsi", "ide", "other", "nvme" };	/* DISKSTATS_IF_SCSI >> 4 is 1 */
+
+/////////////////////////////////////////////////////////////////////////
+/// one key=value[|value] condition into a rule
+static int devmatch_cond( struct devmatch_rule *r, char *cond, const char *expr )
+{
+	char *value = strchr(cond, '=');
+	char *alt, *save = NULL;
+
+	if ( value == NULL || value[1] == '\0' ) {
+		fprintf(stderr, "match \"%s\": expected key=value, got \"%s\"\n", expr, cond);
+		return -1;
+	}
+	*value++ = '\0';
+
+	for ( alt = strtok_r(value, "|", &save); alt; alt = strtok_r(NULL, "|", &save) ) {
+		size_t i;
+
+		if ( strcmp(cond, "name") == 0 ) {
+			if ( r->nnames == DEVMATCH_MAX_NAMES || strlen(alt) >= DISKSTATS_NAME_LEN ) {
+				fprintf(stderr, "match \"%s\": at most %d names of %d characters in a rule\n", expr, DEVMATCH_MAX_NAMES, DISKSTATS_NAME_LEN - 1);
+				return -1;
+			}
+			snprintf(r->names[r->nnames++], DISKSTATS_NAME_LEN, "%s", alt);
+		}
+		else if ( strcmp(cond, "type") == 0 ) {
+			if ( strcmp(alt, "pass") == 0 ) {
+				r->types |= 1u << DEVMATCH_PASS_BIT;
+				continue;
+			}
+			for ( i = 0; i < sizeof(type_names) / sizeof(type_names[0]) && strcmp(alt, type_names[i]) != 0; ++i )
+				;
+			if ( i == sizeof(type_names) / sizeof(type_names[0]) ) {
+				fprintf(stderr, "match \"%s\": unknown type %s\n", expr, alt);
+				return -1;
+			}
+			r->types |= 1u << i;
+		}
+		else if ( strcmp(cond, "if") == 0 ) {
+			for ( i = 0; i < sizeof(if_names) / sizeof(if_names[0]) && strcmp(alt, if_names[i]) != 0; ++i )
+				;
+			if ( i == sizeof(if_names) / sizeof(if_names[0]) ) {
+				fprintf(stderr, "match \"%s\": unknown interface %s\n", expr, alt);
+				return -1;
+			}
+			r->ifs |= 1u << i;
+		}
+		else {
+			fprintf(stderr, "match \"%s\": unknown key %s - name, type or if\n", expr, cond);
+			return -1;
+		}
+	}
+	return 0;
+};
+/////////////////////////////////////////////////////////////////////////
+/// parse an expression into rules - see hpex49xled_match.h
+int devmatch_add( const char *expr )
+{
+	char *copy = strdup(expr), *rule, *save = NULL;
+	int added = 0;
+
+	if ( copy == NULL )
+		err(1, "strdup failed in %s line %d", __FUNCTION__, __LINE__);
+
+	for ( rule = strtok_r(copy, ";", &save); rule; rule = strtok_r(NULL, ";", &save) ) {
+		struct devmatch_rule r;
+		char *cond, *csave = NULL;
+
+		memset(&r, 0, sizeof(r));
+		if ( *rule == '!' ) {
+			r.exclude = 1;
+			++rule;
+		}
+		for ( cond = strtok_r(rule, ",", &csave); cond; cond = strtok_r(NULL, ",", &csave) )
+			if ( devmatch_cond(&r, cond, expr) != 0 )
+				goto fail;
+
+		if ( nrules == DEVMATCH_MAX_RULES ) {
+			fprintf(stderr, "match \"%s\": more than %d rules\n", expr, DEVMATCH_MAX_RULES);
+			goto fail;
+		}
+		rules[nrules++] = r;
+		++added;
+	}
+	free(copy);
+	if ( added == 0 ) {
+		fprintf(stderr, "match \"%s\": no rules\n", expr);
+		return -1;
+	}
+	/* earlier verdicts were made under other rules */
+	memset(memo, 0, sizeof(memo));
+	sel_generation = -1;
+	return 0;
+fail:
+	free(copy);
+	return -1;
+};
+/////////////////////////////////////////////////////////////////////////
+void devmatch_clear(void)
+{
+	nrules = 0;
+	memset(memo, 0, sizeof(memo));
+	sel_generation = -1;
+};
+/////////////////////////////////////////////////////////////////////////
+/// run the rules for one device
+static int devmatch_rules( const char *dev, unsigned kind )
+{
+	const unsigned type = ( kind & DISKSTATS_PASS ) ? 1u << DEVMATCH_PASS_BIT : 1u << (kind & DISKSTATS_TYPE_MASK);
+	const int ifi = (int)((kind & DISKSTATS_IF_MASK) >> 4) - 1;
+	/* no interface, or one newer than if_names[] - only rules without if= can match */
+	const unsigned ifc = ( ifi >= 0 && ifi < (int)(sizeof(if_names) / sizeof(if_names[0])) ) ? 1u << ifi : 0;
+
+	if ( nrules == 0 && devmatch_add(DEVMATCH_DEFAULT) != 0 )
+		errx(1, "bad built in match rules in %s line %d", __FUNCTION__, __LINE__);
+
+	for ( int i = 0; i < nrules; ++i ) {
+		const struct devmatch_rule *r = &rules[i];
+		int named = ( r->nnames == 0 );
+
+		if ( r->types && !(r->types & type) )
+			continue;
+		if ( r->ifs && !(r->ifs & ifc) )
+			continue;
+		for ( int n = 0; n < r->nnames && !named; ++n )
+			named = ( fnmatch(r->names[n], dev, 0) == 0 );
+		if ( named )
+			return !r->exclude;
+	}
+	return 0;
+};
+/////////////////////////////////////////////////////////////////////////
+/// rules for a device, remembered by name and kind
+int devmatch_device( const char *dev, unsigned kind )
+{
+	unsigned h = kind * 31;
+
+	for ( const char *c = dev; *c; ++c )
+		h = h * 33 + (unsigned char)*c;
+
+	for ( unsigned probe = 0; probe < 8; ++probe ) {
+		const unsigned i = (h + probe) & (DEVMATCH_MEMO - 1);
+
+		if ( memo[i].verdict == 0 ) {
+			const int selected = devmatch_rules(dev, kind);
+			snprintf(memo[i].name, sizeof(memo[i].name), "%s", dev);
+			memo[i].kind = kind;
+			memo[i].verdict = ( selected ) ? 1 : 2;
+			return selected;
+		}
+		if ( memo[i].kind == kind && strcmp(memo[i].name, dev) == 0 )
+			return memo[i].verdict == 1;
+	}
+	/* a crowded neighbourhood - decide without remembering */
+	return devmatch_rules(dev, kind);
+};
+/////////////////////////////////////////////////////////////////////////
+/// selected stat indexes for the provider's current generation
+const int *devmatch_selected( size_t *n )
+{
+	const long generation = diskstats->generation();
+
+	if ( generation != sel_generation || diskstats != sel_provider ) {
+		const int count = diskstats->count();
+
+		if ( (size_t)count > capsel ) {
+			capsel = count;
+			if ( (sel = realloc(sel, capsel * sizeof(*sel))) == NULL )
+				err(1, "realloc failed in %s line %d", __FUNCTION__, __LINE__);
+		}
+		nsel = 0;
+		for ( int idx = 0; idx < count; ++idx ) {
+			const char *dev = diskstats->device(idx);
+			if ( dev && devmatch_device(dev, diskstats->kind(idx)) )
+				sel[nsel++] = idx;
+		}
+		sel_generation = generation;
+		sel_provider = diskstats;
+	}
+	*n = nsel;
+	return sel;
+};
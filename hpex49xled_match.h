@@ -0,0 +1,55 @@
+#ifndef INCLUDED_HPEX49XLED_MATCH
+#define INCLUDED_HPEX49XLED_MATCH
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_match.h
+///////
+/////// Device match rules - which of the disk stats provider's devices the
+/////// daemon looks at, by name pattern, type and interface
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+/////////////////////////////////////////////////////////////////////////////////
+#include <sys/types.h>
+
+#define DEVMATCH_MAX_RULES 32 // rules across every --match
+#define DEVMATCH_MAX_NAMES 8 // name patterns in one rule
+#define DEVMATCH_DEFAULT "!type=pass;type=direct" // every disk, whatever it attaches through - the bay map picks the bays
+
+/// rules, tried in order - the first rule whose conditions all hold decides and a device
+/// no rule matches is left out. a rule is conditions joined by ',' and a leading '!'
+/// makes it an exclude. one expression may hold several rules separated by ';'
+///   name=<glob>[|<glob>...]	fnmatch(3) patterns on "ada0" style names
+///   type=<type>[|<type>...]	direct, cdrom, optical, sequential, changer, enclosure,
+///				storarray, floppy ... or pass for passthrough devices
+///   if=<if>[|<if>...]		scsi, ide, other, nvme
+/// e.g. "!name=da9*;name=ada*|da*,type=direct" or "if=ide|nvme"
+int devmatch_add( const char *expr );	///< 0 on success, -1 with the reason on stderr
+void devmatch_clear(void);
+int devmatch_device( const char *dev, unsigned kind );	///< 1 if the rules select the device
+/// stat indexes of the selected devices in the provider's current snapshot. only walks
+/// the device list when its generation changed, and only runs the rules for names it
+/// has not decided before - valid until the next call
+const int *devmatch_selected( size_t *n );
+
+#endif //INCLUDED_HPEX49XLED_MATCH
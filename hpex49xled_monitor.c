@@ -0,0 +1,830 @@
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_monitor.c
+///////
+/////// Disk activity monitoring - one event loop samples every disk and drives
+/////// every bay LED on the same tick
+///////
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <err.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__FreeBSD__)
+#include <pthread_np.h>
+#else
+#include <sys/syscall.h>
+#endif
+
+#include <sys/resource.h>
+#include <sys/types.h>
+
+#include "hpled.h"
+#include "hpex49xled_delta.h"
+#include "hpex49xled_rate.h"
+#include "hpex49xled_stats.h"
+#include "hpex49xled_log.h"
+#include "hpex49xled_match.h"
+#include "hpex49xled_perf.h"
+#include "hpex49xled_timer.h"
+#include "hpex49xled_monitor.h"
+
+size_t thread_run = 0; /* both set and read with atomics - the monitor reads them, main and signals write them */
+size_t dev_change = 0;
+void (*monitor_exited)(int dev_change) = NULL;
+void (*monitor_reconciled)(void) = NULL;
+size_t hpdisks = 0;
+size_t hw_blink = 0; /* blink bay LEDs through the ICH9 GPO_BLINK register */
+struct hpled *hpex49x = NULL;
+size_t hpbays = 0;
+
+/* monitor - one disk stats snapshot and one LED pass per tick for all bays */
+pthread_t monitor; /* monitor thread instance */
+u_int64_t sample_tick = 0; /* bumped each time the per bay counters are published */
+long idle_delay_max = IDLE_DELAY_MAX; /* ceiling in nanoseconds for the idle backoff - LED_DELAY turns it off */
+
+/* per bay counters from the last tick - a sequence count over two copies of the sample.
+   seq goes up by two per publication and is odd while the monitor writes the copy readers
+   are not directed to, so a reader never waits on a write in progress - it only retries
+   when it was held up long enough for the monitor to start rewriting the copy it was
+   reading. one bay per cache line pair, no false sharing */
+static struct baypub {
+	u_int64_t seq;	/* sample[(seq >> 1) & 1] is the current one */
+	struct hpsample sample[2];
+} __attribute__((aligned(CACHE_LINE))) *hpex49x_pub;
+
+/* per bay LED state - only touched by the monitor thread */
+struct baystate {
+	int colour;	/* LED_BLUE | LED_RED showing now, 0 = dark */
+	int next;	/* colour to show once the blink off phase ends, 0 = not blinking */
+	int held;	/* latched colour lit on top of colour - latched[] as of the last LED pass */
+	struct timespec idle_since;	/* first tick without activity while lit */
+	int power;	/* enum powerstate */
+	int pulse;	/* the standby flash is lit */
+	struct timespec standby_since;	/* when the disk was last seen to spin down */
+	struct timespec pulse_at;	/* when the last standby flash came on */
+	u_int64_t standby_ns;	/* finished standby spells since the bay came up */
+};
+
+/* colours another thread holds lit on each bay with monitor_latch() - the health poll's
+   red LED for a failing disk. the monitor picks a change up on its next tick */
+static int *latched;
+
+/* CHECK POWER MODE results another thread hands the monitor with monitor_power() - the
+   CLOCK_MONOTONIC nanoseconds the command went out at shifted up by POWERED_BITS, with the
+   enum powerstate in the low bits. one word so the pair can never tear. 0 = nothing new */
+#define POWERED_BITS 2
+static u_int64_t *powered;
+
+/* hotplug - the device list as of the last reconcile, so only names that appeared since
+   then are handed to bay_identify(). a bay whose name disappears is dropped at once, new
+   names wait for the list to settle so a burst of attaches costs one pass */
+int (*bay_identify)(const char *dev, int stat_index, struct hpled *bay) = NULL;
+struct hotplug_counters hotplug_stats;
+static char hotplug_known[DISKSTATS_MAX][DISKSTATS_NAME_LEN];
+static int hotplug_nknown = 0;
+static struct timespec settle_first, settle_last; /* first and latest change of the burst being settled */
+static int settling = 0;
+
+/* monitor thread state, in file scope so the hotplug passes can reset a single bay */
+static struct hpsample *sample;
+static struct baystate *bay;
+static struct baycounters counters; /* each bay's counters this tick, one array per counter */
+static struct timespec sampled; /* when the counters the next tick differences against were read */
+
+/////////////////////////////////////////////////////////////
+//// id of the calling thread for debug output
+int thread_id(void)
+{
+#if defined(__FreeBSD__)
+	return pthread_getthreadid_np();
+#else
+	return (int)syscall(SYS_gettid);
+#endif
+};
+/////////////////////////////////////////////////////////////
+//// size the per bay arrays for a bay map with n bays - called before disk_init() fills
+//// hpex49x[] and while the monitor thread is not running. returns 0 on allocation failure
+size_t monitor_bays(size_t n)
+{
+	free(hpex49x);
+	free(hpex49x_pub);
+	free(sample);
+	free(bay);
+	free(latched);
+	free(powered);
+	baycounters_free(&counters);
+	rate_free();
+	hpbays = 0;
+
+	hpex49x = calloc(n, sizeof(*hpex49x));
+	sample = calloc(n, sizeof(*sample));
+	bay = calloc(n, sizeof(*bay));
+	latched = calloc(n, sizeof(*latched));
+	powered = calloc(n, sizeof(*powered));
+	if( posix_memalign((void **)&hpex49x_pub, CACHE_LINE, n * sizeof(*hpex49x_pub)) != 0 )
+		hpex49x_pub = NULL;
+	if( hpex49x == NULL || sample == NULL || bay == NULL || latched == NULL || powered == NULL ||
+		hpex49x_pub == NULL ||
+		baycounters_alloc(&counters, n) != 0 || rate_alloc(n) != 0 )
+		return 0;
+
+	memset(hpex49x_pub, 0, n * sizeof(*hpex49x_pub));
+	hpbays = n;
+	return 1;
+};
+/////////////////////////////////////////////////////////////
+//// remember the provider's current device list for the next hotplug diff
+static void hotplug_remember(void)
+{
+	const int n = diskstats->count();
+
+	hotplug_nknown = 0;
+	for(int i = 0; i < n && hotplug_nknown < DISKSTATS_MAX; i++) {
+		const char *dev = diskstats->device(i);
+		if( dev )
+			snprintf(hotplug_known[hotplug_nknown++], DISKSTATS_NAME_LEN, "%s", dev);
+	}
+};
+/////////////////////////////////////////////////////////////
+//// true if dev was in the device list at the last reconcile
+static int hotplug_was_known (const char *dev)
+{
+	for(int i = 0; i < hotplug_nknown; i++)
+		if( strcmp(hotplug_known[i], dev) == 0 )
+			return 1;
+	return 0;
+};
+/////////////////////////////////////////////////////////////
+//// forget dev so the next reconcile identifies it again
+static void hotplug_forget (const char *dev)
+{
+	for(int i = 0; i < hotplug_nknown; i++)
+		if( strcmp(hotplug_known[i], dev) == 0 ) {
+			memmove(hotplug_known[i], hotplug_known[--hotplug_nknown], DISKSTATS_NAME_LEN);
+			return;
+		}
+};
+/////////////////////////////////////////////////////////////
+//// "ada0" for a bay - hpled.path is /dev/ada0 and the providers know the device as ada0
+static const char *bay_device (const struct hpled *mediasmart)
+{
+	const char *dev = strrchr(mediasmart->path, '/');
+	return (dev) ? dev + 1 : mediasmart->path;
+};
+/////////////////////////////////////////////////////////////
+//// resolve each bay in the disk stats provider and take its starting counters
+//// called before the monitor thread starts - returns 0 if a bay is missing
+size_t monitor_baseline(void)
+{
+	struct diskstat ds;
+
+	for(size_t i = 0; i < hpbays; i++) {
+		if( !hpex49x[i].HDD )
+			continue;
+		hpex49x[i].stat_index = diskstats->find( bay_device(&hpex49x[i]) );
+
+		if( hpex49x[i].stat_index < 0 || diskstats->read(hpex49x[i].stat_index, &ds) != 0 ) {
+			logmsg(LOGC_MONITOR, LOG_NOTICE, "%s not found by the %s disk stats provider in %s line %d", hpex49x[i].path, diskstats->name, __FUNCTION__, __LINE__);
+			return 0;
+		}
+		hpex49x[i].b_read = hpex49x[i].n_read = ds.bytes_read;
+		hpex49x[i].b_write = hpex49x[i].n_write = ds.bytes_write;
+		baycounters_reset(&counters, i, &ds);
+		rate_reset(i);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &sampled);
+	memset(hpex49x_pub, 0, hpbays * sizeof(*hpex49x_pub));
+	__atomic_store_n(&sample_tick, 0, __ATOMIC_RELEASE);
+	hotplug_remember();
+	settling = 0;
+	return 1;
+};
+/////////////////////////////////////////////////////////////
+//// after monitor_baseline() and before the thread starts - forget every device but the
+//// bays already up, and make the first tick reconcile. the bays disk_init() could not
+//// name are then discovered on the monitor thread while the others blink
+void monitor_discover(void)
+{
+	hotplug_nknown = 0;
+	for(size_t i = 0; i < hpbays; i++)
+		if( hpex49x[i].HDD )
+			snprintf(hotplug_known[hotplug_nknown++], DISKSTATS_NAME_LEN, "%s", bay_device(&hpex49x[i]));
+
+	/* the burst settled long ago - due on the first tick */
+	clock_gettime(CLOCK_MONOTONIC, &settle_last);
+	settle_last.tv_sec -= HOTPLUG_SETTLE_MAX / 1000000000 + 1;
+	settle_first = settle_last;
+	settling = 1;
+};
+/////////////////////////////////////////////////////////////
+//// publish one bay's counters - monitor thread only
+static void monitor_publish (struct baypub *pub, const struct hpsample *sample)
+{
+	const u_int64_t seq = __atomic_load_n(&pub->seq, __ATOMIC_RELAXED);
+	struct hpsample *next = &pub->sample[((seq >> 1) + 1) & 1];
+
+	__atomic_store_n(&pub->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&next->tick, sample->tick, __ATOMIC_RELAXED);
+	__atomic_store_n(&next->n_read, sample->n_read, __ATOMIC_RELAXED);
+	__atomic_store_n(&next->n_write, sample->n_write, __ATOMIC_RELAXED);
+	__atomic_store_n(&next->d_read, sample->d_read, __ATOMIC_RELAXED);
+	__atomic_store_n(&next->d_write, sample->d_write, __ATOMIC_RELAXED);
+	__atomic_store_n(&next->ops_read, sample->ops_read, __ATOMIC_RELAXED);
+	__atomic_store_n(&next->ops_write, sample->ops_write, __ATOMIC_RELAXED);
+	__atomic_store_n(&next->busy_ns, sample->busy_ns, __ATOMIC_RELAXED);
+	__atomic_store_n(&next->led, sample->led, __ATOMIC_RELAXED);
+	__atomic_store_n(&next->power, sample->power, __ATOMIC_RELAXED);
+	__atomic_store_n(&next->active_ns, sample->active_ns, __ATOMIC_RELAXED);
+	__atomic_store_n(&next->standby_ns, sample->standby_ns, __ATOMIC_RELAXED);
+	__atomic_store_n(&pub->seq, seq + 2, __ATOMIC_RELEASE);
+};
+/////////////////////////////////////////////////////////////
+//// copy the last published counters for a bay - never blocks, safe from any thread
+//// returns 0 for a bay that is not being monitored
+size_t monitor_sample (size_t bay, struct hpsample *out)
+{
+	if( bay >= hpbays || !__atomic_load_n(&hpex49x[bay].HDD, __ATOMIC_ACQUIRE) )
+		return 0;
+
+	const struct baypub *pub = &hpex49x_pub[bay];
+	u_int64_t seq;
+
+	do {
+		seq = __atomic_load_n(&pub->seq, __ATOMIC_ACQUIRE);
+		const struct hpsample *cur = &pub->sample[(seq >> 1) & 1];
+
+		out->tick = __atomic_load_n(&cur->tick, __ATOMIC_RELAXED);
+		out->n_read = __atomic_load_n(&cur->n_read, __ATOMIC_RELAXED);
+		out->n_write = __atomic_load_n(&cur->n_write, __ATOMIC_RELAXED);
+		out->d_read = __atomic_load_n(&cur->d_read, __ATOMIC_RELAXED);
+		out->d_write = __atomic_load_n(&cur->d_write, __ATOMIC_RELAXED);
+		out->ops_read = __atomic_load_n(&cur->ops_read, __ATOMIC_RELAXED);
+		out->ops_write = __atomic_load_n(&cur->ops_write, __ATOMIC_RELAXED);
+		out->busy_ns = __atomic_load_n(&cur->busy_ns, __ATOMIC_RELAXED);
+		out->led = __atomic_load_n(&cur->led, __ATOMIC_RELAXED);
+		out->power = __atomic_load_n(&cur->power, __ATOMIC_RELAXED);
+		out->active_ns = __atomic_load_n(&cur->active_ns, __ATOMIC_RELAXED);
+		out->standby_ns = __atomic_load_n(&cur->standby_ns, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		/* the copy just read is next rewritten once seq passes the following even value */
+	} while( __atomic_load_n(&pub->seq, __ATOMIC_RELAXED) - (seq & ~(u_int64_t)1) >= 3 );
+
+	return 1;
+};
+/////////////////////////////////////////////////////////////
+//// rates for a bay as of the last tick - never blocks, safe from any thread
+//// returns 0 for a bay that is not being monitored or has no rates yet
+size_t monitor_rate (size_t bay, struct bayrates *out)
+{
+	if( bay >= hpbays || !__atomic_load_n(&hpex49x[bay].HDD, __ATOMIC_ACQUIRE) )
+		return 0;
+	return rate_read(bay, out);
+};
+/////////////////////////////////////////////////////////////
+//// hold colour lit on a bay whatever its activity shows, 0 to let go - safe from any
+//// thread, the monitor lights it on its next tick. the hold ends when the disk leaves
+//// the bay. returns 0 for a bay that is not being monitored
+size_t monitor_latch (size_t bay, int colour)
+{
+	if( bay >= hpbays || !__atomic_load_n(&hpex49x[bay].HDD, __ATOMIC_ACQUIRE) )
+		return 0;
+	__atomic_store_n(&latched[bay], colour, __ATOMIC_RELEASE);
+	return 1;
+};
+/////////////////////////////////////////////////////////////
+//// a bay's disk answered CHECK POWER MODE with state, the command having gone out at
+//// at_ns (CLOCK_MONOTONIC) - safe from any thread, the monitor takes it on its next tick
+//// unless the bay saw I/O since at_ns, which has the disk spinning whatever it said.
+//// returns 0 for a bay that is not being monitored
+size_t monitor_power (size_t bay, int state, u_int64_t at_ns)
+{
+	if( bay >= hpbays || !__atomic_load_n(&hpex49x[bay].HDD, __ATOMIC_ACQUIRE) )
+		return 0;
+	__atomic_store_n(&powered[bay], at_ns << POWERED_BITS | (u_int64_t)state, __ATOMIC_RELEASE);
+	return 1;
+};
+/////////////////////////////////////////////////////////////
+//// colour for the activity since the last tick from the masks baycounters_delta() built - 0 when idle
+//// reads and writes together show blue, reads alone purple (blue and red), writes alone blue
+static int bay_activity (const struct hpled *mediasmart)
+{
+	const size_t i = mediasmart->HDD - 1;
+	const int reads = baymask_test(counters.read_mask, i), writes = baymask_test(counters.write_mask, i);
+	int colour = 0;
+
+	if( reads && writes )
+		colour = LED_BLUE;
+	else if( reads )
+		colour = LED_BLUE | LED_RED;
+	else if( writes )
+		colour = LED_BLUE;
+
+	if( colour )
+		logmsg(LOGC_MONITOR, LOG_DEBUG, "HDD is: %i Read I/O = %ju Write I/O = %ju", mediasmart->HDD, (uintmax_t)mediasmart->n_read, (uintmax_t)mediasmart->n_write);
+
+	return colour;
+};
+/////////////////////////////////////////////////////////////
+//// true once a lit bay has gone LED_DELAY without activity
+static int bay_idle_expired (struct baystate *bay, const struct timespec *now)
+{
+	if( bay->idle_since.tv_sec == 0 && bay->idle_since.tv_nsec == 0 ) {
+		bay->idle_since = *now;
+		return 0;
+	}
+	return timespec_diff_ns(now, &bay->idle_since) >= LED_DELAY;
+};
+/////////////////////////////////////////////////////////////
+//// light colour on a bay, and whatever is latched on it with it
+static void bay_show (const struct hpled *mediasmart, const struct baystate *bay, int colour,
+	void (*set_led)( int led_type, int state, size_t led ))
+{
+	colour |= bay->held;
+	set_led(LED_BLUE, (colour & LED_BLUE) ? ON : OFF, mediasmart->blue);
+	set_led(LED_RED, (colour & LED_RED) ? ON : OFF, mediasmart->red);
+};
+/////////////////////////////////////////////////////////////
+//// one tick of software blinking - returns 1 while the bay needs BLINK_DELAY ticks
+//// an active bay that is already lit goes dark for one tick and comes back on the next,
+//// so sustained activity blinks with a 2 * BLINK_DELAY period. a lit bay goes dark after
+//// LED_DELAY without activity
+static int bay_tick (struct hpled *mediasmart, struct baystate *bay, const struct timespec *now,
+	void (*set_led)( int led_type, int state, size_t led ))
+{
+	const int colour = bay_activity(mediasmart);
+	const int held = __atomic_load_n(&latched[mediasmart->HDD - 1], __ATOMIC_ACQUIRE);
+
+	if( held != bay->held ) {
+		bay->held = held;
+		bay_show(mediasmart, bay, bay->colour, set_led);
+	}
+	if( bay->next ) {
+		/* end of the off phase - activity seen meanwhile is covered by this on phase */
+		bay_show(mediasmart, bay, bay->next, set_led);
+		bay->colour = bay->next;
+		bay->next = 0;
+		return 1;
+	}
+	if( colour ) {
+		bay->idle_since.tv_sec = bay->idle_since.tv_nsec = 0;
+
+		if( bay->colour ) {
+			bay_show(mediasmart, bay, 0, set_led);
+			bay->colour = 0;
+			bay->next = colour;
+		}
+		else {
+			bay_show(mediasmart, bay, colour, set_led);
+			bay->colour = colour;
+		}
+		return 1;
+	}
+	if( bay->colour && bay_idle_expired(bay, now) ) {
+		bay_show(mediasmart, bay, 0, set_led);
+		bay->colour = 0;
+	}
+	return 0;
+};
+/////////////////////////////////////////////////////////////
+//// one tick of hardware blink mode for an HP bay - returns 1 on activity
+//// the colour and GPO_BLINK bits are only written when the activity type changes, so
+//// sustained activity costs no port writes until the bay goes idle.
+//// the bay is considered idle after LED_DELAY without a counter change. a latched
+//// colour is lit steady, not blinked
+static int bay_hwblink_tick (struct hpled *mediasmart, struct baystate *bay, const struct timespec *now)
+{
+	const int colour = bay_activity(mediasmart);
+	const int held = __atomic_load_n(&latched[mediasmart->HDD - 1], __ATOMIC_ACQUIRE);
+
+	if( colour )
+		bay->idle_since.tv_sec = bay->idle_since.tv_nsec = 0;
+	else if( bay->colour && !bay_idle_expired(bay, now) )
+		return 0;
+
+	if( colour == bay->colour && held == bay->held )
+		return colour != 0;
+
+	set_hpex_led(LED_BLUE, ((colour | held) & LED_BLUE) ? ON : OFF, mediasmart->blue);
+	set_hpex_led(LED_RED, ((colour | held) & LED_RED) ? ON : OFF, mediasmart->red);
+	set_hpex_blink(mediasmart->blue, (colour & ~held & LED_BLUE) ? ON : OFF);
+	set_hpex_blink(mediasmart->red, (colour & ~held & LED_RED) ? ON : OFF);
+
+	logmsg(LOGC_LED, LOG_DEBUG, "HDD is: %i hardware blink colour changed from %d to %d", mediasmart->HDD, bay->colour, colour);
+
+	bay->colour = colour;
+	bay->held = held;
+	return colour != 0;
+};
+/////////////////////////////////////////////////////////////
+//// the disk in a bay changed power state - keeps the time in standby and puts out a
+//// standby flash that is lit when the disk spins up
+static void bay_power (struct hpled *mediasmart, struct baystate *bay, int state, const struct timespec *now,
+	void (*set_led)( int led_type, int state, size_t led ))
+{
+	if( state == bay->power )
+		return;
+	if( bay->power == POWER_STANDBY ) {
+		const long long spell = timespec_diff_ns(now, &bay->standby_since);
+		bay->standby_ns += spell;
+		if( bay->pulse ) {
+			bay_show(mediasmart, bay, 0, set_led);
+			bay->pulse = 0;
+		}
+		logmsg(LOGC_MONITOR, LOG_INFO, "%s in HP Mediasmart Server Slot %i spun up after %.1f minutes in standby", mediasmart->path, mediasmart->HDD, spell / 60e9);
+	}
+	else if( state == POWER_STANDBY ) {
+		bay->standby_since = *now;
+		bay->pulse_at.tv_sec = bay->pulse_at.tv_nsec = 0; /* first flash on the next tick */
+		logmsg(LOGC_MONITOR, LOG_INFO, "%s in HP Mediasmart Server Slot %i is in standby", mediasmart->path, mediasmart->HDD);
+	}
+	bay->power = state;
+};
+/////////////////////////////////////////////////////////////
+//// one tick of a bay whose disk is spun down and shows no activity - returns 1 while
+//// the standby flash is lit. the bay stays dark but for one LED_DELAY blue flash every
+//// STANDBY_PULSE, so a sleeping disk can be told from an idle one at a glance and a
+//// flash never reads as activity. a latched colour stays lit throughout
+static int bay_standby_tick (struct hpled *mediasmart, struct baystate *bay, const struct timespec *now,
+	void (*set_led)( int led_type, int state, size_t led ))
+{
+	const int held = __atomic_load_n(&latched[mediasmart->HDD - 1], __ATOMIC_ACQUIRE);
+	int colour = -1;
+
+	if( bay->pulse )
+		colour = bay->pulse = 0;
+	else if( (bay->pulse_at.tv_sec == 0 && bay->pulse_at.tv_nsec == 0) ||
+		timespec_diff_ns(now, &bay->pulse_at) >= STANDBY_PULSE ) {
+		colour = LED_BLUE;
+		bay->pulse = 1;
+		bay->pulse_at = *now;
+	}
+	else if( held != bay->held )
+		colour = 0;
+
+	bay->held = held;
+	if( colour >= 0 )
+		bay_show(mediasmart, bay, colour, set_led);
+	return bay->pulse;
+};
+/////////////////////////////////////////////////////////////
+//// a device appeared or disappeared - drop the bays whose disk went away and re-find the
+//// rest, whose index in the provider may have moved. runs at once so a pulled disk goes
+//// dark on the tick the provider notices. a name that is still present but whose
+//// counters went backwards is a different disk that took the same name - drop the bay
+//// and let the reconcile identify it again
+static void hotplug_resolve (void (*set_led)( int led_type, int state, size_t led ))
+{
+	for(size_t i = 0; i < hpbays; i++) {
+		struct hpled *mediasmart = &hpex49x[i];
+		struct diskstat ds;
+
+		if( !mediasmart->HDD )
+			continue;
+
+		const char *dev = bay_device(mediasmart);
+		mediasmart->stat_index = diskstats->find(dev);
+
+		if( mediasmart->stat_index >= 0 && diskstats->read(mediasmart->stat_index, &ds) == 0 &&
+			ds.bytes_read >= mediasmart->n_read && ds.bytes_write >= mediasmart->n_write )
+			continue;
+
+		set_led(LED_BLUE, OFF, mediasmart->blue);
+		set_led(LED_RED, OFF, mediasmart->red);
+		if( HP && hw_blink ) {
+			set_hpex_blink(mediasmart->blue, OFF);
+			set_hpex_blink(mediasmart->red, OFF);
+		}
+		logmsg(LOGC_HOTPLUG, LOG_NOTICE, "%s removed from HP Mediasmart Server Slot %i", mediasmart->path, mediasmart->HDD);
+
+		hotplug_forget(dev);
+		__atomic_store_n(&latched[i], 0, __ATOMIC_RELEASE);
+		__atomic_store_n(&powered[i], 0, __ATOMIC_RELEASE);
+		__atomic_store_n(&mediasmart->HDD, 0, __ATOMIC_RELEASE);
+		__atomic_store_n(&hpdisks, hpdisks - 1, __ATOMIC_RELEASE);
+		++hotplug_stats.removed;
+	}
+};
+/////////////////////////////////////////////////////////////
+//// the device list has settled - identify only the selected names that were not there at
+//// the last reconcile and bring their bays up. bays that kept their disk are not touched
+static void hotplug_reconcile (const struct timespec *now)
+{
+	struct timespec t_start, t_end;
+	size_t n;
+
+	clock_gettime(CLOCK_MONOTONIC, &t_start);
+	const int *selected = devmatch_selected(&n);
+
+	for(size_t i = 0; i < n; i++) {
+		const int idx = selected[i];
+		const char *name = diskstats->device(idx);
+		struct diskstat ds;
+		struct hpled found;
+		char dev[DISKSTATS_NAME_LEN];
+
+		if( name == NULL || hotplug_was_known(name) )
+			continue;
+
+		snprintf(dev, sizeof(dev), "%s", name);
+		memset(&found, 0, sizeof(found));
+		const int slot = bay_identify(dev, idx, &found);
+
+		if( slot < 0 || (size_t)slot >= hpbays )
+			continue;
+		if( hpex49x[slot].HDD ) {
+			logmsg(LOGC_HOTPLUG, LOG_NOTICE, "%s identified as HP Mediasmart Server Slot %i which is already monitoring %s - ignored", dev, slot + 1, hpex49x[slot].path);
+			continue;
+		}
+		if( diskstats->read(idx, &ds) != 0 )
+			continue;
+
+		found.stat_index = idx;
+		found.HDD = slot + 1;
+		found.b_read = found.n_read = ds.bytes_read;
+		found.b_write = found.n_write = ds.bytes_write;
+		led_bay_bits(&found);
+
+		memset(&bay[slot], 0, sizeof(bay[slot]));
+		memset(&sample[slot], 0, sizeof(sample[slot]));
+		sample[slot].n_read = found.n_read;
+		sample[slot].n_write = found.n_write;
+		sample[slot].active_ns = (u_int64_t)now->tv_sec * 1000000000 + now->tv_nsec;
+		baycounters_reset(&counters, slot, &ds);
+		rate_reset(slot);
+
+		/* health and export read path once they see HDD - fill the slot first, publish HDD last */
+		found.HDD = 0;
+		hpex49x[slot] = found;
+		__atomic_store_n(&hpex49x[slot].HDD, slot + 1, __ATOMIC_RELEASE);
+		__atomic_store_n(&hpdisks, hpdisks + 1, __ATOMIC_RELEASE);
+		++hotplug_stats.identified;
+
+		logmsg(LOGC_HOTPLUG, LOG_NOTICE, "Now Monitoring %s in HP Mediasmart Server Slot %i for activity", found.path, slot + 1);
+	}
+	hotplug_remember();
+	settling = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &t_end);
+	hotplug_stats.last_ns = timespec_diff_ns(&t_end, &t_start);
+	hotplug_stats.total_ns += hotplug_stats.last_ns;
+	if( hotplug_stats.last_ns > hotplug_stats.max_ns )
+		hotplug_stats.max_ns = hotplug_stats.last_ns;
+	perf_record(PERF_HOTPLUG, hotplug_stats.last_ns);
+	hotplug_stats.settle_ns = timespec_diff_ns(now, &settle_first);
+	++hotplug_stats.reconciles;
+
+	logmsg(LOGC_HOTPLUG, LOG_NOTICE, "Hotplug: %zu disks after %ju device list changes settled in %.1f ms, reconciled in %.3f ms",
+		hpdisks, (uintmax_t)hotplug_stats.changes, hotplug_stats.settle_ns / 1e6, hotplug_stats.last_ns / 1e6);
+	if( monitor_reconciled )
+		monitor_reconciled();
+};
+/////////////////////////////////////////////////////////////
+//// monitor thread - one event loop for every bay
+//// each tick takes one disk stats snapshot, publishes the per bay counters, runs every
+//// bay's LED state machine and flushes the GPIO registers once. ticks sit on absolute
+//// deadlines (deadline += interval) so a late wakeup shortens the next interval instead
+//// of pushing every later tick back. a wakeup more than one interval late starts a
+//// new schedule from now rather than firing the missed ticks back to back.
+////
+//// ticks every BLINK_DELAY while any bay shows activity or is mid blink and every
+//// LED_DELAY when all are idle. once every bay has been idle for IDLE_BACKOFF_TICKS
+//// ticks the idle delay doubles each tick up to idle_delay_max, and drops straight back
+//// to BLINK_DELAY on the first counter change - or up to STANDBY_DELAY_MAX while every
+//// disk is spun down. the backoff only starts after the bays
+//// have had LED_DELAY to turn their lights off, so it never holds a light on - the cost
+//// is the first blink after a quiet spell, which can come up to idle_delay_max - LED_DELAY
+//// later than it would at the fixed rate (350 ms by default)
+void* monitor_thread_run (void *arg)
+{
+	struct timespec deadline, now, t_start, t_end;
+	struct rusage ru_start, ru_end;
+	void (*set_led)( int led_type, int state, size_t led ) = (HP) ? set_hpex_led : set_acer_led;
+	u_int64_t ticks = 0, late = 0;
+	u_int64_t idle_ticks = 0;
+	long long overshoot_max = 0;
+	long interval = LED_DELAY;
+
+	memset(bay, 0, hpbays * sizeof(*bay));
+	clock_gettime(CLOCK_MONOTONIC, &t_start);
+	getrusage(RUSAGE_SELF, &ru_start);
+	deadline = t_start;
+
+	memset(sample, 0, hpbays * sizeof(*sample));
+	for(size_t i = 0; i < hpbays; i++) {
+		sample[i].n_read = hpex49x[i].b_read;
+		sample[i].n_write = hpex49x[i].b_write;
+		sample[i].active_ns = (u_int64_t)t_start.tv_sec * 1000000000 + t_start.tv_nsec;
+	}
+
+	while(__atomic_load_n(&thread_run, __ATOMIC_ACQUIRE)) {
+
+		const u_int64_t t_tick = perf_now();
+		int retval = diskstats->snapshot();
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		const u_int64_t t_snapshot = perf_now() - t_tick;
+
+		if( retval == 1 && bay_identify == NULL ) {
+			__atomic_store_n(&dev_change, 1, __ATOMIC_RELEASE); /* a device has changed and we must re-initialize */
+			__atomic_store_n(&thread_run, 0, __ATOMIC_RELEASE); /* end the loop so we can re-initialize */
+			break;
+		}
+		if( retval == 1 ) {
+			/* drop what went away now, identify what arrived once the burst is over */
+			hotplug_resolve(set_led);
+			if( !settling )
+				settle_first = now;
+			settle_last = now;
+			settling = 1;
+			++hotplug_stats.changes;
+		}
+		if( settling && ( timespec_diff_ns(&now, &settle_last) >= HOTPLUG_SETTLE ||
+			timespec_diff_ns(&now, &settle_first) >= HOTPLUG_SETTLE_MAX ) )
+			hotplug_reconcile(&now);
+		if( retval == -1 ) {
+			__atomic_store_n(&thread_run, 0, __ATOMIC_RELEASE); /* end the loop - we have a real problem */
+			__atomic_store_n(&dev_change, 0, __ATOMIC_RELEASE); /* not a device change */
+			syslog(LOG_CRIT, "Bad snapshot from the %s disk stats provider in monitor function %s line %d", diskstats->name, __FUNCTION__, __LINE__ );
+			err(1, "invalid return from %s snapshot in %s line %d", diskstats->name, __FUNCTION__, __LINE__);
+		}
+
+		const u_int64_t t_read = perf_now();
+		for(size_t i = 0; i < hpbays; i++) {
+			struct diskstat ds;
+
+			if( !hpex49x[i].HDD )
+				continue;
+			if (diskstats->read(hpex49x[i].stat_index, &ds) != 0)
+				err(1, "Unable to read %s from the %s disk stats provider in %s line %d", hpex49x[i].path, diskstats->name, __FUNCTION__, __LINE__);
+			baycounters_store(&counters, i, &ds);
+		}
+		/* every delta and the active bay masks in one pass over the counter arrays, then the
+		   rates over the real time since the last read - the interval varies with the backoff */
+		baycounters_delta(&counters);
+		perf_record(PERF_SAMPLE, t_snapshot + perf_now() - t_read);
+		rate_update(&counters, timespec_diff_ns(&now, &sampled) / 1e9, sample_tick + 1);
+		sampled = now;
+
+		const u_int64_t now_ns = (u_int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+
+		for(size_t i = 0; i < hpbays; i++) {
+			if( !hpex49x[i].HDD )
+				continue;
+			sample[i].d_read = counters.delta[BAY_BYTES_READ][i];
+			sample[i].d_write = counters.delta[BAY_BYTES_WRITE][i];
+			sample[i].n_read = hpex49x[i].n_read = counters.now[BAY_BYTES_READ][i];
+			sample[i].n_write = hpex49x[i].n_write = counters.now[BAY_BYTES_WRITE][i];
+			sample[i].ops_read = counters.now[BAY_OPS_READ][i];
+			sample[i].ops_write = counters.now[BAY_OPS_WRITE][i];
+			sample[i].busy_ns = counters.now[BAY_BUSY_NS][i];
+
+			/* I/O means the disk is spinning - a power check from before it is stale */
+			if( baymask_test(counters.active, i) ) {
+				sample[i].active_ns = now_ns;
+				bay_power(&hpex49x[i], &bay[i], POWER_ACTIVE, &now, set_led);
+			}
+			else if( __atomic_load_n(&powered[i], __ATOMIC_RELAXED) ) {
+				const u_int64_t checked = __atomic_exchange_n(&powered[i], 0, __ATOMIC_ACQUIRE);
+				if( checked >> POWERED_BITS > sample[i].active_ns )
+					bay_power(&hpex49x[i], &bay[i], checked & ((1 << POWERED_BITS) - 1), &now, set_led);
+			}
+		}
+
+		/* every bay on the same tick, one register flush for all of them */
+		int fast = 0, pulse = 0;
+		size_t watched = 0, standby = 0;
+
+		for(size_t i = 0; i < hpbays; i++) {
+			if( !hpex49x[i].HDD )
+				continue;
+			++watched;
+			/* a spun down disk, once its light is out, only shows the standby flash */
+			if( bay[i].power == POWER_STANDBY && !bay[i].colour && !bay[i].next ) {
+				++standby;
+				pulse |= bay_standby_tick(&hpex49x[i], &bay[i], &now, set_led);
+				continue;
+			}
+			/* a dark bay with nothing to show has nothing to do */
+			if( !baymask_test(counters.active, i) && !bay[i].colour && !bay[i].next &&
+				bay[i].held == __atomic_load_n(&latched[i], __ATOMIC_RELAXED) )
+				continue;
+			/* GPO_BLINK only covers GPIO 0 - 31, bays wired above that fall back to software blinking */
+			if( HP && hw_blink && hpex49x[i].blue < 32 && hpex49x[i].red < 32 )
+				fast |= bay_hwblink_tick(&hpex49x[i], &bay[i], &now);
+			else
+				fast |= bay_tick(&hpex49x[i], &bay[i], &now, set_led);
+		}
+		gpio_flush();
+		++ticks;
+
+		/* publish for anything else that wants the counters - no locks, see monitor_sample().
+		   after the LED pass, so readers never delay the lights and see what they show */
+		const u_int64_t tick = sample_tick + 1;
+		for(size_t i = 0; i < hpbays; i++) {
+			if( !hpex49x[i].HDD )
+				continue;
+			sample[i].tick = tick;
+			sample[i].led = bay[i].colour | bay[i].held | ((bay[i].pulse) ? LED_BLUE : 0);
+			sample[i].power = bay[i].power;
+			sample[i].standby_ns = bay[i].standby_ns;
+			if( bay[i].power == POWER_STANDBY )
+				sample[i].standby_ns += timespec_diff_ns(&now, &bay[i].standby_since);
+			monitor_publish(&hpex49x_pub[i], &sample[i]);
+		}
+		__atomic_store_n(&sample_tick, tick, __ATOMIC_RELEASE);
+		perf_record(PERF_TICK, perf_now() - t_tick);
+		if( ticks % PERF_CPU_EVERY == 1 )
+			perf_thread_cpu(PERF_THREAD_MONITOR);
+
+		/* with every disk spun down the backoff goes on to STANDBY_DELAY_MAX - one snapshot
+		   covers all the bays, so a single disk that is awake keeps the usual ceiling */
+		long ceiling = idle_delay_max;
+		if( watched && standby == watched && idle_delay_max > LED_DELAY && ceiling < STANDBY_DELAY_MAX )
+			ceiling = STANDBY_DELAY_MAX;
+
+		if( fast ) {
+			idle_ticks = 0;
+			interval = BLINK_DELAY;
+		}
+		else if( ++idle_ticks > IDLE_BACKOFF_TICKS && interval < ceiling )
+			interval = ( interval * 2 < ceiling ) ? interval * 2 : ceiling;
+		else if( idle_ticks == 1 )
+			interval = LED_DELAY;
+		if( interval > ceiling )
+			interval = ceiling;
+		/* no backoff while a burst of device changes settles - the reconcile is due soon */
+		if( settling && interval > LED_DELAY )
+			interval = LED_DELAY;
+		/* a standby flash goes out after LED_DELAY without giving up the backoff */
+		const long wait = ( pulse && interval > LED_DELAY ) ? LED_DELAY : interval;
+
+		timespec_add_ns(&deadline, wait);
+		if( timespec_diff_ns(&now, &deadline) > 0 ) {
+			/* overran a whole interval - start a new schedule rather than catch up */
+			++late;
+			deadline = now;
+			timespec_add_ns(&deadline, wait);
+		}
+		if( evloop_wait(&deadline) < 0 )
+			err(1, "Unable to wait for the monitor tick in %s line %d", __FUNCTION__, __LINE__);
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		const long long overshoot = timespec_diff_ns(&now, &deadline);
+		if( overshoot > overshoot_max )
+			overshoot_max = overshoot;
+		perf_record(PERF_OVERSHOOT, ( overshoot > 0 ) ? overshoot : 0);
+	}
+	perf_thread_cpu(PERF_THREAD_MONITOR);
+
+	clock_gettime(CLOCK_MONOTONIC, &t_end);
+	getrusage(RUSAGE_SELF, &ru_end);
+
+	double secs = (t_end.tv_sec - t_start.tv_sec) + (t_end.tv_nsec - t_start.tv_nsec) / 1e9;
+	double cpu = (ru_end.ru_utime.tv_sec - ru_start.ru_utime.tv_sec) + (ru_end.ru_utime.tv_usec - ru_start.ru_utime.tv_usec) / 1e6 +
+		(ru_end.ru_stime.tv_sec - ru_start.ru_stime.tv_sec) + (ru_end.ru_stime.tv_usec - ru_start.ru_stime.tv_usec) / 1e6;
+
+	logmsg(LOGC_MONITOR, LOG_NOTICE, "Monitor: %ju ticks in %.1f seconds (%.1f ticks/s), %.3f ms CPU per tick for %ld disks, idle backoff to %ld ms, %ju late ticks, %.3f ms worst timer overshoot",
+		(uintmax_t)ticks, secs, (secs > 0) ? ticks / secs : 0.0, (ticks) ? cpu * 1000 / ticks : 0.0, hpdisks, idle_delay_max / 1000000,
+		(uintmax_t)late, overshoot_max / 1e6);
+
+	if( monitor_exited )
+		monitor_exited(__atomic_load_n(&dev_change, __ATOMIC_ACQUIRE));
+	pthread_exit(NULL);
+};
+/////////////////////////////////////////////////////////////
+//// stop the monitor thread - thread_run is cleared and the tick wait ends at once
+void monitor_stop(void)
+{
+	__atomic_store_n(&thread_run, 0, __ATOMIC_RELEASE);
+	evloop_wake();
+};
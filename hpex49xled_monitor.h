@@ -0,0 +1,98 @@
+#ifndef INCLUDED_HPEX49XLED_MONITOR
+#define INCLUDED_HPEX49XLED_MONITOR
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_monitor.h
+///////
+/////// Disk activity monitoring - one event loop samples every disk and drives
+/////// every bay LED on the same tick
+///////
+/////// -------------------------------------------------------------------------
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#include <sys/types.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "hpled.h"
+
+extern size_t thread_run;	///< 0 tells the monitor thread to exit
+extern size_t dev_change;	///< set by the monitor when the device list changed
+extern size_t hpdisks;		///< bays in use in hpex49x[]
+extern size_t hw_blink;		///< use GPO_BLINK for activity on HP bays
+extern size_t HP;		///< HP EX48x/EX49x LED wiring, otherwise Acer/Lenovo
+extern size_t debug;
+extern struct hpled *hpex49x;	///< one slot per bay in the bay map, slot = HDD - 1
+extern size_t hpbays;		///< slots in hpex49x[]
+extern pthread_t monitor;
+extern u_int64_t sample_tick;	///< monitor ticks since monitor_baseline()
+extern long idle_delay_max;	///< idle backoff ceiling in nanoseconds
+
+/// hotplug - how often the device list changed and what reconciling it cost
+struct hotplug_counters {
+	u_int64_t changes;	///< snapshots that reported a new device list
+	u_int64_t reconciles;	///< settled bursts - one identify pass each
+	u_int64_t identified;	///< bays brought up by a reconcile
+	u_int64_t removed;	///< bays dropped because their disk went away
+	long long last_ns;	///< time spent in the last reconcile
+	long long max_ns;	///< longest reconcile
+	long long total_ns;	///< time spent in every reconcile
+	long long settle_ns;	///< first change of the last burst to its reconcile
+};
+extern struct hotplug_counters hotplug_stats;
+
+/// identify a device that appeared since the last reconcile - fills path, path_id,
+/// target_id and dev_index and returns the slot (HDD - 1), or -1 if it is not a bay disk.
+/// NULL restarts the monitor on every device change instead
+extern int (*bay_identify)(const char *dev, int stat_index, struct hpled *bay);
+
+/// runs on the monitor thread as it ends - dev_change says whether it stopped for a
+/// device change (bay_identify NULL) or was told to stop. NULL when whoever started the
+/// monitor only joins it
+extern void (*monitor_exited)(int dev_change);
+
+/// runs on the monitor thread after each reconcile, with the bays as it left them - NULL
+/// when nobody keeps track
+extern void (*monitor_reconciled)(void);
+
+int thread_id(void);
+size_t monitor_bays(size_t n);
+size_t monitor_baseline(void);
+void monitor_discover(void);
+size_t monitor_sample (size_t bay, struct hpsample *out);
+struct bayrates;
+size_t monitor_rate (size_t bay, struct bayrates *out);
+size_t monitor_latch (size_t bay, int colour);
+size_t monitor_power (size_t bay, int state, u_int64_t at_ns);
+void* monitor_thread_run (void *arg);
+void monitor_stop(void);
+
+/* LED functions from hpex49xled_led.c */
+extern void set_hpex_led( int led_type, int state, size_t led );
+extern void set_acer_led( int led_type, int state, size_t led );
+extern size_t set_hpex_blink( size_t led, int state );
+extern void gpio_flush(void);
+extern void led_bay_bits( struct hpled *bay );
+extern void led_bays_off( void (*set_led)( int led_type, int state, size_t led ), int blink );
+
+#endif //INCLUDED_HPEX49XLED_MONITOR
@@ -0,0 +1,347 @@
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_perf.c
+///////
+/////// Self instrumentation - histograms of what the hot paths cost, dumped to
+/////// syslog on SIGUSR1 and to anyone connecting to the query socket
+///////
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* RUSAGE_THREAD on Linux */
+#endif
+#include <stdio.h>
+/////////////////////////////////////////////////////////////////////////////////
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+#include "hpex49xled_perf.h"
+
+#if !defined(HPEX49XLED_MINIMAL)
+
+struct perf_histogram perf_hist[PERF_HISTS];
+struct perf_counters perf_stats;
+
+static const char *hist_names[PERF_HISTS] = { "tick_ns", "sample_ns", "ledq_wait_ns", "gpio_ops", "overshoot_ns", "hotplug_ns", "health_cmd_ns" };
+static const char *thread_names[PERF_THREADS] = { "main", "monitor", "writer", "exporter", "update", "health" };
+
+static pthread_t dumper;
+static int perf_running = 0;
+static int query_fd = -1;
+static int wake_pipe[2] = { -1, -1 };
+static char *query_path = NULL;
+static struct timespec since; /* last reset */
+
+void perf_thread_cpu( enum perf_thread t )
+{
+#if defined(RUSAGE_THREAD)
+	struct rusage ru;
+
+	if ( getrusage(RUSAGE_THREAD, &ru) != 0 )
+		return;
+	__atomic_store_n(&perf_stats.cpu_us[t][0], (u_int64_t)ru.ru_utime.tv_sec * 1000000 + ru.ru_utime.tv_usec, __ATOMIC_RELAXED);
+	__atomic_store_n(&perf_stats.cpu_us[t][1], (u_int64_t)ru.ru_stime.tv_sec * 1000000 + ru.ru_stime.tv_usec, __ATOMIC_RELAXED);
+#endif
+};
+
+void perf_reset(void)
+{
+	memset(perf_hist, 0, sizeof(perf_hist));
+	perf_stats.cas_retries = 0;
+	clock_gettime(CLOCK_MONOTONIC, &since);
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// lowest and highest value bucket b counts - the inverse of perf_bucket()
+static void bucket_range( unsigned b, u_int64_t *low, u_int64_t *high )
+{
+	if ( b < (2u << PERF_SUB_BITS) ) {
+		*low = *high = b;
+		return;
+	}
+	const unsigned shift = (b >> PERF_SUB_BITS) - 1;
+	const u_int64_t m = (b & ((1u << PERF_SUB_BITS) - 1)) + (1u << PERF_SUB_BITS);
+	*low = m << shift;
+	*high = ((m + 1) << shift) - 1;
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// smallest value at least q of the recorded values are at or below - to the bucket's
+/// resolution, and never above the largest value recorded
+static u_int64_t percentile( const u_int64_t *bucket, u_int64_t count, u_int64_t max, double q )
+{
+	const u_int64_t want = (u_int64_t)(q * count + 0.5);
+	u_int64_t seen = 0, low, high;
+
+	for ( unsigned b = 0; b < PERF_BUCKETS; b++ ) {
+		seen += bucket[b];
+		if ( seen && seen >= want ) {
+			bucket_range(b, &low, &high);
+			/* the last bucket also holds everything past PERF_MAX_BITS */
+			return ( high < max && b < PERF_BUCKETS - 1 ) ? high : max;
+		}
+	}
+	return max;
+};
+
+void perf_dump( FILE *f, int buckets )
+{
+	struct timespec now;
+	u_int64_t bucket[PERF_BUCKETS], low, high;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	fprintf(f, "hpex49xled self instrumentation over %.1f seconds\n",
+		(now.tv_sec - since.tv_sec) + (now.tv_nsec - since.tv_nsec) / 1e9);
+	fprintf(f, "%-14s %10s %12s %12s %12s %12s %12s %12s\n", "histogram", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+
+	for ( int h = 0; h < PERF_HISTS; h++ ) {
+		const struct perf_histogram *p = &perf_hist[h];
+		u_int64_t count = 0;
+
+		/* the buckets are the truth - count may be a record ahead of them */
+		for ( unsigned b = 0; b < PERF_BUCKETS; b++ )
+			count += bucket[b] = __atomic_load_n(&p->bucket[b], __ATOMIC_RELAXED);
+		const u_int64_t sum = __atomic_load_n(&p->sum, __ATOMIC_RELAXED);
+		const u_int64_t max = __atomic_load_n(&p->max, __ATOMIC_RELAXED);
+
+		fprintf(f, "%-14s %10ju %12.1f %12ju %12ju %12ju %12ju %12ju\n", hist_names[h], (uintmax_t)count,
+			( count ) ? (double)sum / count : 0.0,
+			(uintmax_t)percentile(bucket, count, max, 0.50), (uintmax_t)percentile(bucket, count, max, 0.90),
+			(uintmax_t)percentile(bucket, count, max, 0.99), (uintmax_t)percentile(bucket, count, max, 0.999), (uintmax_t)max);
+		if ( !buckets )
+			continue;
+		for ( unsigned b = 0; b < PERF_BUCKETS; b++ ) {
+			if ( !bucket[b] )
+				continue;
+			bucket_range(b, &low, &high);
+			fprintf(f, "  %-12s %12ju %12ju %10ju\n", hist_names[h], (uintmax_t)low, (uintmax_t)high, (uintmax_t)bucket[b]);
+		}
+	}
+
+	fprintf(f, "ledq_cas_retries %ju\n", (uintmax_t)__atomic_load_n(&perf_stats.cas_retries, __ATOMIC_RELAXED));
+	for ( int t = 0; t < PERF_THREADS; t++ ) {
+		const u_int64_t user = __atomic_load_n(&perf_stats.cpu_us[t][0], __ATOMIC_RELAXED);
+		const u_int64_t sys = __atomic_load_n(&perf_stats.cpu_us[t][1], __ATOMIC_RELAXED);
+		if ( user || sys )
+			fprintf(f, "cpu %-10s user %.3f s system %.3f s\n", thread_names[t], user / 1e6, sys / 1e6);
+	}
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// render a dump into a buffer the caller frees - NULL when out of memory
+static char *perf_render( int buckets, size_t *len )
+{
+	char *buf = NULL;
+	FILE *f = open_memstream(&buf, len);
+
+	if ( f == NULL )
+		return NULL;
+	perf_dump(f, buckets);
+	if ( fclose(f) != 0 ) {
+		free(buf);
+		return NULL;
+	}
+	return buf;
+};
+
+/* SIGUSR1 - only the async signal safe part, the dump thread does the rest */
+static void perf_signal( int s )
+{
+	const int saved = errno;
+	if ( write(wake_pipe[1], "d", 1) < 0 )
+		; /* a dump is already pending */
+	errno = saved;
+};
+
+static void perf_syslog(void)
+{
+	size_t len;
+	char *buf = perf_render(0, &len), *last;
+
+	if ( buf == NULL )
+		return;
+	for ( char *line = strtok_r(buf, "\n", &last); line != NULL; line = strtok_r(NULL, "\n", &last) )
+		syslog(LOG_NOTICE, "%s", line);
+	free(buf);
+	++perf_stats.dumps;
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// one query - the whole dump with the buckets, then close. a client that stops reading
+/// is given up on after a second
+static void perf_query( int fd )
+{
+	const struct timeval timeout = { .tv_sec = 1, .tv_usec = 0 };
+	size_t len;
+	char *buf = perf_render(1, &len);
+
+	if ( buf == NULL )
+		return;
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+	for ( const char *p = buf; len; ) {
+		const ssize_t n = write(fd, p, len);
+		if ( n < 0 && errno == EINTR )
+			continue;
+		if ( n <= 0 )
+			break;
+		p += n;
+		len -= n;
+	}
+	free(buf);
+	++perf_stats.queries;
+};
+
+static void* perf_thread( void *arg )
+{
+	struct pollfd pfd[2] = { { .fd = wake_pipe[0], .events = POLLIN }, { .fd = query_fd, .events = POLLIN } };
+	const nfds_t nfds = ( query_fd != -1 ) ? 2 : 1;
+	char cmd[16];
+
+	for (;;) {
+		if ( poll(pfd, nfds, -1) < 0 ) {
+			if ( errno == EINTR )
+				continue;
+			break;
+		}
+		if ( pfd[0].revents ) {
+			const ssize_t n = read(wake_pipe[0], cmd, sizeof(cmd));
+			if ( n > 0 && memchr(cmd, 'q', n) != NULL )
+				break;
+			if ( n > 0 )
+				perf_syslog();
+		}
+		if ( nfds > 1 && (pfd[1].revents & POLLIN) ) {
+			const int fd = accept(query_fd, NULL, NULL);
+			if ( fd != -1 ) {
+				perf_query(fd);
+				close(fd);
+			}
+		}
+	}
+	return NULL;
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// bind the query socket, root only - a stale socket from an earlier run is replaced
+static int perf_listen( const char *path )
+{
+	struct sockaddr_un sun;
+	int fd;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	if ( strlen(path) >= sizeof(sun.sun_path) ) {
+		fprintf(stderr, "query socket \"%s\": path too long\n", path);
+		return -1;
+	}
+	strcpy(sun.sun_path, path);
+	if ( (fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1 ) {
+		fprintf(stderr, "query socket \"%s\": %s\n", path, strerror(errno));
+		return -1;
+	}
+	unlink(path);
+	if ( bind(fd, (struct sockaddr *)&sun, sizeof(sun)) != 0 || chmod(path, 0600) != 0 || listen(fd, 4) != 0 ) {
+		fprintf(stderr, "query socket \"%s\": %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+};
+
+int perf_start( const char *path )
+{
+	struct sigaction sa;
+
+	if ( perf_running )
+		return 0;
+	clock_gettime(CLOCK_MONOTONIC, &since);
+	if ( path != NULL && (query_fd = perf_listen(path)) == -1 )
+		return -1;
+	if ( path != NULL && (query_path = strdup(path)) == NULL )
+		goto fail;
+	if ( pipe(wake_pipe) != 0 )
+		goto fail;
+	/* the signal handler never blocks - a full pipe already has a dump pending */
+	fcntl(wake_pipe[1], F_SETFL, fcntl(wake_pipe[1], F_GETFL) | O_NONBLOCK);
+	if ( pthread_create(&dumper, NULL, perf_thread, NULL) != 0 ) {
+		close(wake_pipe[0]);
+		close(wake_pipe[1]);
+		goto fail;
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = perf_signal;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGUSR1, &sa, NULL);
+	perf_running = 1;
+	return 0;
+
+fail:
+	fprintf(stderr, "Unable to start the instrumentation dump thread: %s\n", strerror(errno));
+	if ( query_fd != -1 ) {
+		close(query_fd);
+		unlink(path);
+	}
+	query_fd = -1;
+	free(query_path);
+	query_path = NULL;
+	return -1;
+};
+
+void perf_stop(void)
+{
+	if ( !perf_running )
+		return;
+	signal(SIGUSR1, SIG_IGN);
+	while ( write(wake_pipe[1], "q", 1) < 0 && errno == EAGAIN )
+		usleep(1000);
+	pthread_join(dumper, NULL);
+	close(wake_pipe[0]);
+	close(wake_pipe[1]);
+	if ( query_fd != -1 ) {
+		close(query_fd);
+		/* fails once privileges are dropped - the next start replaces it */
+		unlink(query_path);
+	}
+	query_fd = -1;
+	free(query_path);
+	query_path = NULL;
+	perf_running = 0;
+};
+
+#endif //HPEX49XLED_MINIMAL
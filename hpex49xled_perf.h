@@ -0,0 +1,145 @@
+#ifndef INCLUDED_HPEX49XLED_PERF
+#define INCLUDED_HPEX49XLED_PERF
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_perf.h
+///////
+/////// Self instrumentation - histograms of what the hot paths cost, dumped to
+/////// syslog on SIGUSR1 and to anyone connecting to the query socket
+///////
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+/////////////////////////////////////////////////////////////////////////////////
+#include <sys/types.h>
+#include <time.h>
+
+#define PERF_SOCKET_DEFAULT "/var/run/hpex49xled.sock" // hpex49xled_query_socket in hpex49xled.rc
+#define PERF_SUB_BITS 3 // 8 linear buckets per power of two - values within 12.5%
+#define PERF_MAX_BITS 40 // largest value a histogram tells apart, 2^40 ns is 18 minutes
+#define PERF_BUCKETS ((PERF_MAX_BITS - PERF_SUB_BITS + 1) << PERF_SUB_BITS)
+#define PERF_CPU_EVERY 64 // ticks or batches between per thread CPU samples
+
+/// what the histograms record - nanoseconds unless the name says otherwise
+enum perf_hist {
+	PERF_TICK = 0,	///< monitor tick, wakeup to the counters published
+	PERF_SAMPLE,	///< disk stats snapshot and every bay's read - the sampler's share of a tick
+	PERF_LEDQ_WAIT,	///< LED batch kicked to the writer taking it - the wait for the GPIO owner
+	PERF_GPIO_OPS,	///< register reads and writes per LED batch - one batch per tick
+	PERF_OVERSHOOT,	///< monitor wakeup past its deadline
+	PERF_HOTPLUG,	///< hotplug reconcile, or disk_init() when the monitor restarts
+	PERF_HEALTH_CMD,	///< one ATA command of the SMART health poll
+	PERF_HISTS
+};
+
+/// threads whose CPU time is sampled with getrusage(RUSAGE_THREAD)
+enum perf_thread {
+	PERF_THREAD_MAIN = 0,
+	PERF_THREAD_MONITOR,
+	PERF_THREAD_WRITER,
+	PERF_THREAD_EXPORT,
+	PERF_THREAD_UPDATE,
+	PERF_THREAD_HEALTH,
+	PERF_THREADS
+};
+
+#if !defined(HPEX49XLED_MINIMAL)
+
+/// log linear histogram - values below 2 << PERF_SUB_BITS get a bucket each, above that
+/// each power of two is split into 1 << PERF_SUB_BITS buckets. any thread may record
+struct perf_histogram {
+	u_int64_t count;
+	u_int64_t sum;
+	u_int64_t max;
+	u_int64_t bucket[PERF_BUCKETS];
+};
+
+struct perf_counters {
+	u_int64_t cas_retries;	///< LED queue slots lost to another producer - the queue's only contention
+	u_int64_t dumps;	///< SIGUSR1 dumps written to syslog
+	u_int64_t queries;	///< dumps written to the query socket
+	u_int64_t cpu_us[PERF_THREADS][2];	///< user and system CPU time as each thread last sampled it
+};
+
+extern struct perf_histogram perf_hist[PERF_HISTS];
+extern struct perf_counters perf_stats;
+
+static inline unsigned perf_bucket( u_int64_t v )
+{
+	if ( v < (2u << PERF_SUB_BITS) )
+		return v;
+	const unsigned shift = 63 - __builtin_clzll(v) - PERF_SUB_BITS;
+	if ( shift > PERF_MAX_BITS - PERF_SUB_BITS - 1 )
+		return PERF_BUCKETS - 1;
+	return ((shift + 1) << PERF_SUB_BITS) + (unsigned)(v >> shift) - (1u << PERF_SUB_BITS);
+}
+
+static inline void perf_record( enum perf_hist h, u_int64_t v )
+{
+	struct perf_histogram *p = &perf_hist[h];
+	u_int64_t max = __atomic_load_n(&p->max, __ATOMIC_RELAXED);
+
+	__atomic_add_fetch(&p->bucket[perf_bucket(v)], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&p->sum, v, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&p->count, 1, __ATOMIC_RELAXED);
+	while ( v > max && !__atomic_compare_exchange_n(&p->max, &max, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED) )
+		;
+}
+
+static inline u_int64_t perf_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline void perf_count_retry(void)
+{
+	__atomic_add_fetch(&perf_stats.cas_retries, 1, __ATOMIC_RELAXED);
+}
+
+void perf_thread_cpu( enum perf_thread t );	///< sample the calling thread's CPU time into slot t
+void perf_reset(void);	///< clear every histogram - only while nothing records
+void perf_dump( FILE *f, int buckets );	///< percentiles, counters and CPU times, each bucket too if buckets
+
+/// start the dump thread - SIGUSR1 dumps to syslog and every connection to the unix socket
+/// at path gets a dump with the buckets. NULL for no socket. the socket is bound before
+/// returning with mode 0600, so this runs before privileges are dropped. returns 0 on
+/// success, -1 with the reason on stderr
+int perf_start( const char *path );
+void perf_stop(void);
+
+#else /* HPEX49XLED_MINIMAL - no instrumentation, every call below compiles to nothing */
+
+static inline void perf_record( enum perf_hist h, u_int64_t v ) {}
+static inline u_int64_t perf_now(void) { return 0; }
+static inline void perf_count_retry(void) {}
+static inline void perf_thread_cpu( enum perf_thread t ) {}
+static inline void perf_reset(void) {}
+static inline void perf_dump( FILE *f, int buckets ) {}
+static inline int perf_start( const char *path ) { return 0; }
+static inline void perf_stop(void) {}
+
+#endif //HPEX49XLED_MINIMAL
+
+#endif //INCLUDED_HPEX49XLED_PERF
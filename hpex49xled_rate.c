@@ -0,0 +1,197 @@
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_rate.c
+///////
+/////// Per bay rates - throughput, transfers, latency, queue length and busy
+/////// time over the real time between ticks, smoothed over 1, 10 and 60 seconds
+///////
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/types.h>
+
+#include "hpled.h"
+#include "hpex49xled_rate.h"
+
+#define RATE_WORDS ( sizeof(struct bayrates) / sizeof(u_int64_t) )
+
+_Static_assert(sizeof(struct bayrates) % sizeof(u_int64_t) == 0, "struct bayrates must be whole 64 bit words");
+
+/* the rates as the words they are published in - copied through the union, never
+   through a cast, so the double and u_int64_t accesses do not alias */
+union ratewords {
+	struct bayrates rates;
+	u_int64_t words[RATE_WORDS];
+};
+
+static const double rate_tau[RATE_WINDOWS] = { 1.0, 10.0, 60.0 };
+
+/* published the way monitor_sample() reads the counters - a sequence count over two
+   copies, so a reader on any thread never blocks the monitor */
+static struct ratepub {
+	u_int64_t seq;
+	union ratewords rates[2];
+} __attribute__((aligned(CACHE_LINE))) *ratepub;
+
+/* monitor thread only - the averages as accumulated and how much of each window they
+   cover so far. dividing by the weight removes the pull towards zero they start with, so
+   a bay's first seconds read as the mean since it came up rather than a fraction of it */
+static struct ratestate {
+	struct bayrates rates;
+	struct bayrate sum[RATE_WINDOWS];
+	double weight[RATE_WINDOWS];
+} *rates;
+static size_t nrates = 0;
+
+/////////////////////////////////////////////////////////////////////////
+/// rates for n bays - returns 0 on success, -1 when out of memory
+int rate_alloc( size_t n )
+{
+	void *mem;
+
+	rate_free();
+	if ( posix_memalign(&mem, CACHE_LINE, n * sizeof(*ratepub)) != 0 )
+		return -1;
+	ratepub = mem;
+	if ( (rates = calloc(n, sizeof(*rates))) == NULL ) {
+		rate_free();
+		return -1;
+	}
+	memset(ratepub, 0, n * sizeof(*ratepub));
+	nrates = n;
+	return 0;
+};
+
+void rate_free(void)
+{
+	free(ratepub);
+	free(rates);
+	ratepub = NULL;
+	rates = NULL;
+	nrates = 0;
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// a bay has a new disk - its averages start over
+void rate_reset( size_t bay )
+{
+	if ( bay < nrates )
+		memset(&rates[bay], 0, sizeof(rates[bay]));
+};
+
+static void rate_publish( struct ratepub *pub, const struct bayrates *r )
+{
+	const u_int64_t seq = __atomic_load_n(&pub->seq, __ATOMIC_RELAXED);
+	union ratewords *next = &pub->rates[((seq >> 1) + 1) & 1];
+	const union ratewords from = { .rates = *r };
+
+	__atomic_store_n(&pub->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	for ( size_t w = 0; w < RATE_WORDS; ++w )
+		__atomic_store_n(&next->words[w], from.words[w], __ATOMIC_RELAXED);
+	__atomic_store_n(&pub->seq, seq + 2, __ATOMIC_RELEASE);
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// this tick's deltas over etime seconds into rates and averages for every bay that was
+/// stored this tick, then publish them. the averages weigh each tick by the time it covered,
+/// 1 - e^(-etime / tau), so they hold their time constant when the tick interval backs
+/// off. monitor thread only
+void rate_update( const struct baycounters *c, double etime, u_int64_t tick )
+{
+	double alpha[RATE_WINDOWS];
+
+	if ( etime <= 0 )
+		return;
+	for ( int w = 0; w < RATE_WINDOWS; ++w )
+		alpha[w] = 1.0 - exp(-etime / rate_tau[w]);
+
+	for ( size_t i = 0; i < c->n && i < nrates; ++i ) {
+		if ( !baymask_test(c->present, i) )
+			continue;
+
+		struct ratestate *s = &rates[i];
+		struct bayrates *r = &s->rates;
+		struct bayrate *l = &r->last;
+		const u_int64_t ops = c->delta[BAY_OPS_READ][i] + c->delta[BAY_OPS_WRITE][i] + c->delta[BAY_OPS_FREE][i];
+
+		l->v[RATE_MB_READ] = c->delta[BAY_BYTES_READ][i] / RATE_MB / etime;
+		l->v[RATE_MB_WRITE] = c->delta[BAY_BYTES_WRITE][i] / RATE_MB / etime;
+		l->v[RATE_TPS_READ] = c->delta[BAY_OPS_READ][i] / etime;
+		l->v[RATE_TPS_WRITE] = c->delta[BAY_OPS_WRITE][i] / etime;
+		l->v[RATE_TPS] = ops / etime;
+		l->v[RATE_MS_PER_TRANSACTION] = ( ops ) ? c->delta[BAY_DURATION_NS][i] / 1e6 / ops : 0;
+		l->v[RATE_QUEUE] = c->queue[i];
+		l->v[RATE_BUSY_PCT] = c->delta[BAY_BUSY_NS][i] / 1e7 / etime;
+		if ( l->v[RATE_BUSY_PCT] > 100 )
+			l->v[RATE_BUSY_PCT] = 100;
+
+		/* latency is averaged per transaction, not per tick - the sums keep transaction
+		   time per second and the average divides it by the transfers per second */
+		struct bayrate in = *l;
+		in.v[RATE_MS_PER_TRANSACTION] = c->delta[BAY_DURATION_NS][i] / 1e6 / etime;
+
+		for ( int w = 0; w < RATE_WINDOWS; ++w ) {
+			double *sum = s->sum[w].v, *avg = r->ewma[w].v;
+
+			s->weight[w] += alpha[w] * (1.0 - s->weight[w]);
+			for ( int f = 0; f < RATE_FIELDS; ++f ) {
+				sum[f] += alpha[w] * (in.v[f] - sum[f]);
+				avg[f] = sum[f] / s->weight[w];
+			}
+			avg[RATE_MS_PER_TRANSACTION] = ( sum[RATE_TPS] > 0 ) ? sum[RATE_MS_PER_TRANSACTION] / sum[RATE_TPS] : 0;
+		}
+		r->etime = etime;
+		r->tick = tick;
+		rate_publish(&ratepub[i], r);
+	}
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// copy the last published rates for a bay - never blocks, safe from any thread
+/// returns 0 before the bay's first rates
+size_t rate_read( size_t bay, struct bayrates *out )
+{
+	if ( bay >= nrates )
+		return 0;
+
+	const struct ratepub *pub = &ratepub[bay];
+	union ratewords to;
+	u_int64_t seq;
+
+	do {
+		seq = __atomic_load_n(&pub->seq, __ATOMIC_ACQUIRE);
+		const union ratewords *from = &pub->rates[(seq >> 1) & 1];
+
+		for ( size_t w = 0; w < RATE_WORDS; ++w )
+			to.words[w] = __atomic_load_n(&from->words[w], __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while( __atomic_load_n(&pub->seq, __ATOMIC_RELAXED) - (seq & ~(u_int64_t)1) >= 3 );
+
+	*out = to.rates;
+	return out->tick != 0;
+};
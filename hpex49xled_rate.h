@@ -0,0 +1,80 @@
+#ifndef INCLUDED_HPEX49XLED_RATE
+#define INCLUDED_HPEX49XLED_RATE
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_rate.h
+///////
+/////// Per bay rates - throughput, transfers, latency, queue length and busy
+/////// time over the real time between ticks, smoothed over 1, 10 and 60 seconds
+///////
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+/////////////////////////////////////////////////////////////////////////////////
+#include <sys/types.h>
+
+#include "hpex49xled_delta.h"
+
+#define RATE_MB 1048576.0 // bytes per MB, as devstat's DSM_MB_PER_SECOND
+
+/// smoothing windows - an exponentially weighted moving average with this time constant
+enum rate_window {
+	RATE_1S = 0,
+	RATE_10S,
+	RATE_60S,
+	RATE_WINDOWS
+};
+
+/// fields of a bay's rates - struct bayrate is indexed by these
+enum rate_field {
+	RATE_MB_READ = 0,	///< MB/s read
+	RATE_MB_WRITE,		///< MB/s written
+	RATE_TPS_READ,		///< read transfers/s
+	RATE_TPS_WRITE,		///< write transfers/s
+	RATE_TPS,		///< every transfer, reads, writes and frees, per second
+	RATE_MS_PER_TRANSACTION,	///< mean time per completed transaction
+	RATE_QUEUE,		///< transactions outstanding
+	RATE_BUSY_PCT,		///< share of the time with a transaction outstanding
+	RATE_FIELDS
+};
+
+/// one bay's rates - an array, so the averages run over every field in one loop
+struct bayrate {
+	double v[RATE_FIELDS];
+};
+
+/// what rate_read() returns - the last tick's rates and their averages
+struct bayrates {
+	double etime;		///< seconds the last tick covered
+	u_int64_t tick;		///< monitor tick the rates come from - 0 before the first
+	struct bayrate last;	///< over the last tick alone
+	struct bayrate ewma[RATE_WINDOWS];
+};
+
+int rate_alloc( size_t n );
+void rate_free(void);
+void rate_reset( size_t bay );
+void rate_update( const struct baycounters *c, double etime, u_int64_t tick );
+size_t rate_read( size_t bay, struct bayrates *out );
+
+#endif //INCLUDED_HPEX49XLED_RATE
@@ -59,7 +59,6 @@
 #include <syslog.h>
 #include <pthread.h>
 #include <pthread_np.h>
-#include <machine/cpufunc.h>
 
 #include <sys/param.h>
 #include <sys/errno.h>
@@ -68,65 +67,69 @@
 #include <sys/types.h>
 
 #include "hpled.h"
+#include "hpex49xled_baycache.h"
+#include "hpex49xled_baymap.h"
+#include "hpex49xled_cam.h"
+#include "hpex49xled_export.h"
+#include "hpex49xled_health.h"
+#include "hpex49xled_io.h"
+#include "hpex49xled_ledq.h"
+#include "hpex49xled_log.h"
+#include "hpex49xled_match.h"
+#include "hpex49xled_perf.h"
+#include "hpex49xled_stats.h"
+#include "hpex49xled_super.h"
+#include "hpex49xled_timer.h"
+#include "hpex49xled_update.h"
+#include "hpex49xled_monitor.h"
 
-struct statinfo cur;
-kvm_t *kd = NULL;
 char *devicename;
-char **specified_devices;
 size_t num_devices;
-struct device_selection *dev_select;
-struct devstat_match *matches;
-devstat_select_mode select_mode;
 long generation;
-long select_generation;
-int num_matches;
-int num_devices_specified;
-int num_selected, num_selections;
-size_t maxshowdevs;
-size_t thread_run = 0;
-size_t dev_change = 0;
-size_t hpdisks = 0;
-char *HD = "ide";
 size_t debug = 0;
 size_t HP = 1; /* for now set all options to HP */
-int io; 
-
-struct hpled ide0, ide1, ide2, ide3 ;
-struct hpled hpex49x[4];
+size_t sim_io = 0; /* drive the simulated register file instead of /dev/io */
+const struct diskstats_ops *diskstats = &diskstats_devmap; /* disk stats provider for the monitor */
+static const char *cache_dir = BAYCACHE_DIR; /* --cache-dir, NULL for no bay cache */
+static struct baycache cache; /* the bays of the last run, then of the last discovery */
+static int discover = 0; /* disk_init() left the bays to the monitor's first reconcile */
 
 const char *VERSION = "1.1.0";
 const char *progname;
-extern const char *hardware;
 
 pthread_attr_t attr; // attributes for threads
-pthread_t hpexled_led[4]; /* there can be only 4! */
-/* using spinlocks vs. mutex as the thread should spin vs. sleep */
-pthread_spinlock_t  hpex49x_gpio_lock; 
-pthread_spinlock_t	hpex49x_gpio_lock2;
 
 char* curdir(char *str);
 int show_help(char * progname);
 int show_version(char * progname );
 void drop_priviledges( void );
 size_t disk_init(void);
-size_t run_mediasmart(void);
-void* hpex49x_thread_run (void *arg);
-void* acer_thread_run (void *arg);
+static int cam_scanned = 0; /* the CAM bus list from hpex49xled_cam.c is current */
+static long cam_generation = -1; /* device list generation it was taken for */
+static void cam_scan(long gen);
+static int cam_bay(const char *name, size_t di, struct hpled *bay);
+static int cache_bay(const char *name, size_t di, struct hpled *bay);
+static void bays_reconciled(void);
+int cam_bay_identify(const char *dev, int stat_index, struct hpled *bay);
+void run_mediasmart(void);
+void stop_mediasmart(void);
 void sigterm_handler(int s);
 const char* desc(void);
 
+/* health poll - SMART through CAM, a failing disk latches its red LED */
+static int health_interval = HEALTH_INTERVAL; /* --health in seconds, 0 for no poll */
+static int standby_idle = HEALTH_STANDBY_IDLE; /* --standby in seconds, 0 for no power tracking */
+static void health_led(size_t bay, int state);
+
 /* update monitor - monitor for freebsd-update */
 size_t update_monitor = 0; /* monitor freebsd-update for fetched updates */
-pthread_t updatemonitor; /* update monitor thread instance */
-void *update_monitor_thread(void *arg);
-void thread_cleanup_handler(void *arg);
-size_t updates_ready(void);
+void update_led(int ready);
 
 /* external functions */
 extern void setsystemled( int led_type, int state );
-extern void set_hpex_led( int led_type, int state, size_t led );
-extern void set_acer_led( int led_type, int state, size_t led );
 extern size_t init_hpex49x_led(void);
+extern void gpio_report(void);
+extern const char *hardware;
 
 char* curdir(char *str)
 {
@@ -141,6 +144,19 @@ int show_help(char * progname )
 	printf("%s %s %s", "Usage: ", this,"\n");
 	printf("-d, --debug 	Print Debug Messages\n");
 	printf("-D, --daemon 	Detach and Run as a Daemon - do not use this in service setup \n");
+	printf("-b, --blink 	Blink drive activity with the ICH9 hardware blink register (HP EX48x/EX49x) instead of software timers\n");
+	printf("-c, --cache-dir <dir>	Keep the bays found in dir/%s and light them from it on the next start, default %s - \"\" for none\n", BAYCACHE_FILE, BAYCACHE_DIR);
+	printf("-H, --health <minutes>	Read SMART health from every bay through CAM this often, default %d - 0 for never. A failing disk latches its red LED\n", HEALTH_INTERVAL / 60);
+	printf("-s, --standby <minutes>	Check the power mode of a disk that has had no I/O this long, default %d - 0 for never. A spun down disk flashes blue every %lld seconds\n", HEALTH_STANDBY_IDLE / 60, STANDBY_PULSE / 1000000000);
+	printf("-l, --listen <[address]:port>	Serve Prometheus metrics on /metrics, e.g. \"%s\" - off by default\n", EXPORT_LISTEN_DEFAULT);
+	printf("-T, --textfile-dir <dir>	Write %s for the node_exporter textfile collector into dir every %d seconds\n", EXPORT_TEXTFILE_NAME, EXPORT_TEXTFILE_INTERVAL / 1000);
+	printf("-L, --log-file <file>	Append the log to file instead of syslog - debug messages included with -d\n");
+	printf("-i, --idle <ms>	Longest monitor tick while every disk is idle, %d - %d ms, default %d - %d disables the backoff\n",
+		LED_DELAY / 1000000, IDLE_DELAY_LIMIT, IDLE_DELAY_MAX / 1000000, LED_DELAY / 1000000);
+	printf("-q, --query-socket <path>	Unix socket that answers every connection with the self instrumentation, default %s - \"\" for none. SIGUSR1 logs it\n", PERF_SOCKET_DEFAULT);
+	printf("-m, --map <file>	Bay map - which CAM sim, path_id and target_id is in which bay and its LED bits - see hpex49xled_baymap.h\n");
+	printf("-M, --match <rule>	Devices to look at, e.g. \"name=ada*|da*\" or \"!if=nvme;type=direct\" - repeatable, default \"%s\" - see hpex49xled_match.h\n", DEVMATCH_DEFAULT);
+	printf("-S, --simulate 	Drive LEDs against a simulated ICH9/SCH5127 register file instead of /dev/io\n");
 	printf("-u, --update 	Monitor freebsd-update for fetched updates requires adding - @daily root /usr/sbin/freebsd-update -t root cron to /etc/crontab\n");
 	printf("-h, --help	Print This Message\n");
 	printf("-v, --version	Print Version Information\n");
@@ -173,201 +189,151 @@ const char* desc(void)
 		return hardware;	
 };
 
-void thread_cleanup_handler(void *arg)
+/////////////////////////////////////////////////////////////////////////////
+//// health poll - a failing or pre-fail disk keeps its red LED lit until it leaves the
+//// bay, even if a later poll finds it fine again
+static void health_led(size_t bay, int state)
 {
-        setsystemled( LED_RED, LED_OFF);
-        setsystemled( LED_BLUE, LED_OFF);
-        syslog(LOG_NOTICE,"Update Monitor Thread Cleaned Up and Ending");
-        if(debug) printf("\n\n\nUpdate Monitor Thread Ending in %s line %d\n",__FUNCTION__, __LINE__);
-
-}
-
-size_t updates_ready(void)
+	if( state == HEALTH_FAILING || state == HEALTH_PREFAIL )
+		monitor_latch(bay, LED_RED);
+};
+/////////////////////////////////////////////////////////////////////////////
+//// update watcher - red system LED while fetched updates wait to be installed
+void update_led(int ready)
 {
-   FILE* freebsd_check = popen("/usr/sbin/freebsd-update updatesready", "r");
-
-	if(freebsd_check == NULL)
-	{
-		fprintf(stderr, "Unable to open /usr/sbin/freebsd-update for reading in %s line %d", __FUNCTION__, __LINE__);
-		return -1;
+	if(ready) {
+		setsystemled(LED_BLUE, LED_OFF);
+		setsystemled(LED_RED, LED_ON);
+		logmsg(LOGC_UPDATE, LOG_NOTICE, "UPDATE MONITOR - freebsd-update indicates updates ready");
 	}
-	char *line = NULL;
-	size_t len = 0;
-	size_t res = getline(&line, &len, freebsd_check);
-	pclose(freebsd_check);
-	
-	if(debug)
-		printf("Return from freebsd-update is: %s \n", line);
-
-	if(res == -1)
-	{
-		fprintf(stderr, "Could not read line res = %ld len = %ld line = %s \n", res, len, line);
-		return -1;
-	}
-
-	return (strncmp(line, "No updates are available to install.", 36) == 0) ? 0 : 1;
-}
-
-void *update_monitor_thread(void *arg)
-{
-	sigset_t sigempty;
-	sigemptyset( &sigempty );
-	struct timespec timeout = { .tv_sec = 3600, .tv_nsec = 0 }; /* wait an hour between checks */
-
-	if(debug)
-        printf("\nUpdate Monitor Thread Executing\n");
-
-	size_t monitor_update_thread = 1;
-    pthread_cleanup_push(thread_cleanup_handler, NULL);
-    syslog(LOG_NOTICE,"FreeBSD-Updates Monitor Thread Initialized. Now Monitoring for FreeBSD System Updates");
-        
-    while(monitor_update_thread)
-	{
-		if (pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL) != 0)
-			err(1, "Unable to set pthread_setcancelstate to disable in %s line %d", __FUNCTION__, __LINE__);
-		
-		size_t update_count = updates_ready();
-
-		if (update_count == -1) 
-		{
-			monitor_update_thread = 0;
-			syslog(LOG_NOTICE, "Update Monitor Thread Encountered an issue and is terminating");
-			fprintf(stderr, "illegal return from status_update() in %s line %d", __FUNCTION__, __LINE__);
-			break;
-		}
-		else if (update_count == 1) /* updates found - hopefully */
-		{
-			setsystemled(LED_BLUE, LED_OFF);
-			setsystemled(LED_RED, LED_ON);
-			syslog(LOG_NOTICE, "UPDATE MONITOR THREAD - freebsd-update indicates updates ready");
-		}
-		else /* we do not need to account for a return of zero from updates_ready() - just set the system led off and move on to pselect() */
-			setsystemled(LED_BLUE | LED_RED, LED_OFF);
-
-		if (pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL) != 0)
-			err(1, "Unable to set pthread_setcancelstate to enable in %s line %d", __FUNCTION__, __LINE__);
-
-		// sleep(43200);
-		// cancellation point
-		// sigset_t sigempty;
-		// sigemptyset( &sigempty );
-		// struct timespec timeout = { 900, 0 };
-		
-		size_t t = pselect( 0, NULL, NULL, NULL, &timeout, &sigempty );
-        
-		if( t < 0 )
-		{
-			monitor_update_thread = 0;
-        	if( EINTR != errno ) err(1, "Exiting due to signal");
-            break;
-        }
-    }        
-    pthread_cleanup_pop(1); //Remove handler and execute it.
-
-    if(debug) printf("\n\n\nUpdate Monitor Thread Ending\n in %s line %d\n",__FUNCTION__, __LINE__);
+	else
+		setsystemled(LED_BLUE | LED_RED, LED_OFF);
 
-    return NULL;
+	logmsg(LOGC_UPDATE, LOG_DEBUG, "freebsd-update %s", (ready) ? "has updates ready to install" : "has no updates to install");
 }
 
 size_t disk_init(void) 
 {
-    size_t dn, di;
-    u_int64_t total_bytes_read, total_bytes_write; 
-    char *devicename;
-	struct cam_device *cam_dev = NULL;
-    long double etime = 1.00; /* unneeded for our needs but passed in case of future need */
-	size_t disks = 0;
-	num_matches = 0;
-
-	matches = NULL;
+	struct diskstat ds;
+	size_t disks = 0, nselected;
 
-	if (devstat_buildmatch(HD, &matches, &num_matches) != 0)
-		errx(1, "%s in %s line %d", devstat_errbuf,__FUNCTION__, __LINE__);
+	memset(hpex49x, 0, hpbays * sizeof(*hpex49x)); /* an empty slot has HDD == 0 */
 
-	if(debug) printf("\nAfter devstat_buildmatch - Matched Categories: %d Number of Matches: %d \n", matches->num_match_categories, num_matches);
+	if (diskstats->snapshot() == -1)
+		err(1, "Unable to take a snapshot from the %s disk stats provider in %s line %d", diskstats->name, __FUNCTION__, __LINE__);
 
-	if (devstat_checkversion(kd) < 0)
-		errx(1, "%s in %s line %d", devstat_errbuf, __FUNCTION__, __LINE__);
-
-	if ((num_devices = devstat_getnumdevs(kd)) < 0)
-		err(1, "can't get number of devices in %s line %d", __FUNCTION__, __LINE__);
+	num_devices = diskstats->count();
+	generation = diskstats->generation();
 
 	if(debug) printf("Number of devices is: %ld \n", num_devices);
 
-	cur.dinfo = (struct devinfo *)calloc(1, sizeof(struct devinfo));
-
-	if (cur.dinfo == NULL)
-		err(1, "calloc failed in %s line %d", __FUNCTION__, __LINE__);
-
-    if (devstat_getdevs(kd, &cur) == -1)
-        err(1, "%s in %s line %d", devstat_errbuf, __FUNCTION__, __LINE__);
-	
-    specified_devices = calloc(num_matches, sizeof(char *));
-	
-	if (specified_devices == NULL)
-		err(1, "calloc failed for specified_device in %s line %d", __FUNCTION__, __LINE__);
-
-	/* Two characters would suffice - but bigger is sometimes better, especially when its zeroed */
-	specified_devices[0] = calloc(1, strlen("111"));
-
-	if( specified_devices[0] == NULL )
-		err(1, "Allocation Error: failed to allocate memory for specified_devices[a] in %s line %d", __FUNCTION__, __LINE__);
-
-	if(num_devices != cur.dinfo->numdevs)
-		err(1, "Number of devices is inconsistent in %s line %d", __FUNCTION__, __LINE__);
-
-	assert(sizeof(specified_devices[0]) > sizeof("4"));
-	strlcpy(specified_devices[0], "4", sizeof(specified_devices[0]));
+	/* the match rules pick the devices, the bay map decides which of them sit in a bay */
+	const int *selected = devmatch_selected(&nselected);
 
-	maxshowdevs = 4;
-	num_devices = cur.dinfo->numdevs;
-	generation = cur.dinfo->generation;
-	num_devices_specified = num_matches;
+	/* the bays of the last run, if nothing came or went since - no CAM at all. otherwise
+	   start with no bays and let the monitor discover them while it runs */
+	const int cached = ( cache_dir != NULL && baycache_load(cache_dir, &cache) == 0 && baycache_current(&cache) );
 
-	/* calculate all updates since boot - and I can't get bintime to work no matter what I do */
-	cur.snap_time = 0;
+	if( cache_dir != NULL && !cached ) {
+		syslog(LOG_NOTICE, "Bay cache not used - %s - discovering the bays in the background", baycache_errbuf);
+		discover = 1;
+		return 0;
+	}
+	if( cached ) {
+		if(debug)
+			printf("Bay cache %s/%s: %zu bays, checked in %.3f ms\n", cache_dir, BAYCACHE_FILE, cache.nent, baycache_stats.load_ns / 1e6);
+	}
+	/* which periph sits on which path and target - for all of them at once, no disk is opened */
+	else
+		cam_scan(generation);
 
 	if(debug) {
 		printf("\n");
-		printf("Max Show Devices            : %ld \n", maxshowdevs);
 		printf("Number of Devices           : %ld \n", num_devices);
 		printf("Generation                  : %ld \n", generation);
-		printf("Number of Devices Specified : %d \n", num_devices_specified);
-		printf("Specified Devices is        : %s \n", specified_devices[0]);
-		printf("End of devstat preparation in %s line %d\n\n\n", __FUNCTION__, __LINE__);
+		printf("Devices Matched             : %zu \n", nselected);
+		printf("End of %s preparation in %s line %d\n\n\n", diskstats->name, __FUNCTION__, __LINE__);
 	}
-	dev_select = NULL;
-	select_mode = DS_SELECT_ONLY;
-
-	if (devstat_selectdevs(&dev_select, &num_selected,
-                            &num_selections, &select_generation, generation,
-                            cur.dinfo->devices, num_devices, matches,
-                            num_matches, specified_devices,
-                            num_devices_specified, select_mode, maxshowdevs,
-                            0) == -1)
-    		errx(1, "%s", devstat_errbuf);
-
-    for (dn = 0; dn < num_devices; dn++) {
-		//if ((dev_select[dn].selected == 0) || (dev_select[dn].selected > maxshowdevs))
-		if (dev_select[dn].selected > maxshowdevs)
-			continue;
 
-        di = dev_select[dn].position;
-		/* etime is not used for these statistics - passing for completeness */
-        if (devstat_compute_statistics(&cur.dinfo->devices[di], NULL, etime, DSM_TOTAL_BYTES_READ, &total_bytes_read, DSM_TOTAL_BYTES_WRITE, &total_bytes_write, DSM_NONE) != 0)
-			err(1, "%s in %s line %d", devstat_errbuf, __FUNCTION__, __LINE__);
+    for (size_t dn = 0; dn < nselected; dn++) {
+        const size_t di = selected[dn];
+		const char *name = diskstats->device(di);
 
-		if ((dev_select[dn].selected == 0) || (dev_select[dn].selected > maxshowdevs))
+        if (name == NULL || diskstats->read(di, &ds) != 0)
+			err(1, "Unable to read device %zu from the %s disk stats provider in %s line %d", di, diskstats->name, __FUNCTION__, __LINE__);
+
+		struct hpled hdd;
+		memset(&hdd, 0, sizeof(hdd));
+
+		const int slot = ( cached ) ? cache_bay(name, di, &hdd) : cam_bay(name, di, &hdd);
+
+		if( slot < 0 || hpex49x[slot].HDD ) {
+			logmsg(LOGC_CAM, LOG_NOTICE, "/dev/%s is not in a bay of the %s bay map - not monitored", name, baymap.name);
 			continue;
+		}
+		hdd.b_read = ds.bytes_read;
+		hdd.b_write = ds.bytes_write;
+		hpex49x[slot] = hdd;
+
+		if(debug){
+			printf("HP Disk %d :\nTotal bytes read: %ju\nTotal bytes write: %ju\n\n", hdd.HDD, (uintmax_t)hdd.b_read, (uintmax_t)hdd.b_write);
+			printf("Now Monitoring %s in HP Mediasmart Server Slot %i \n\n", hdd.path, hdd.HDD);
+		}
+		syslog(LOG_NOTICE,"Now Monitoring %s in HP Mediasmart Server Slot %i for activity", hdd.path, hdd.HDD);
+		++disks;
+	}
+	if(debug)
+		printf("\nsize_t disks is %ld before returning from %s line %d\n", disks, __FUNCTION__, __LINE__);
+	return (disks);
+};
+/////////////////////////////////////////////////////////////////////////////
+//// bring the CAM bus list up to date for the device list of generation gen - one
+//// XPT_DEV_MATCH query for every periph. when /dev/xpt0 can not be used each device
+//// is opened instead, as before
+static void cam_scan(long gen)
+{
+	cam_scanned = ( camenum_scan() == 0 );
+	cam_generation = gen;
+
+	if( !cam_scanned )
+		logmsg(LOGC_CAM, LOG_NOTICE, "Unable to enumerate the CAM buses - %s - opening each device to find its bay", camenum_errbuf);
+	else
+		logmsg(LOGC_CAM, LOG_DEBUG, "CAM %s scan: %zu periphs in %.3f ms, %ju ioctls so far", camenum->name, camenum_stats.periphs,
+			camenum_stats.last_ns / 1e6, (uintmax_t)camenum_stats.ioctls);
+};
+/////////////////////////////////////////////////////////////////////////////
+//// look a device up in the bay map by its CAM sim, path_id and target_id - from the
+//// CAM scan, or by opening the device when there is none. name is "ada0" style.
+//// fills path, path_id, target_id, dev_index, HDD and the LED bits - returns the slot
+//// (HDD - 1) or -1 when the device is not in a bay
+static int cam_bay(const char *name, size_t di, struct hpled *bay)
+{
+	char devicename[sizeof(bay->path)];
+	struct cam_device *cam_dev = NULL;
+	const char *sim;
+	int path_id, target_id, slot = -1;
 
-        if (asprintf(&devicename, "/dev/%s%d", cur.dinfo->devices[di].device_name, cur.dinfo->devices[di].unit_number) == -1)
- 			errx(1, "asprintf"); 
+	if( snprintf(devicename, sizeof(devicename), "/dev/%s", name) >= (int)sizeof(devicename) )
+		return -1;
 
-		cam_dev = cam_open_device(devicename, O_RDWR);
+	if( cam_scanned ) {
+		const struct camperiph *p = camenum_find(name);
 
+		if( p == NULL )
+			return -1;
+		logmsg(LOGC_CAM, LOG_DEBUG, "%s is %s%d on %s%d bus %d, path_id %d, target_id %d, lun %ld - hpled.dev_index %zu",
+			devicename, p->name, p->unit, p->sim, p->sim_unit, p->bus_id, p->path_id, p->target_id, p->lun, di);
+		sim = p->sim;
+		path_id = p->path_id;
+		target_id = p->target_id;
+	}
+	else {
+		if( (cam_dev = cam_open_device(devicename, O_RDWR)) == NULL ) {
+			logmsg(LOGC_CAM, LOG_NOTICE, "Unable to open %s to identify its bay: %s", devicename, cam_errbuf);
+			return -1;
+		}
 		if(debug) {
-			printf("\nStruct devinfo device name after adding 0-3 is :  %s \n",devicename);
-			printf("The string length of %s is : %ld\n", devicename, (strlen(devicename)));
+			printf("\nStruct devinfo device name is :  %s \n",devicename);
 			printf("CAM device name is           : %s \n", cam_dev->device_name);
 			printf("The Unit Number is           : %i \n", cam_dev->dev_unit_num);
 			printf("The Sim Name is              : %s \n", cam_dev->sim_name);
@@ -380,438 +346,196 @@ size_t disk_init(void)
 			printf("The hpled.dev_index value is : %ld\n", di);
 			printf("The file descriptor is       : %i \n\n\n",cam_dev->fd);
 		}
-		/* on a HP EX48x and EX49x there are only 4 IDE devices. These will always be the same */
-		/* rather than mess around with dynamically allocating and figuring them out, Just if/else if them here */
-		if( cam_dev->path_id == 1 && cam_dev->target_id == 0) {
-			assert(sizeof(devicename) < sizeof(ide0.path));
-			strlcpy(ide0.path,devicename, sizeof(ide0.path));
-			ide0.target_id = cam_dev->target_id;		
-			ide0.path_id = cam_dev->path_id;
-			ide0.b_read = total_bytes_read;
-			ide0.b_write = total_bytes_write;
-			ide0.n_read = 0;
-			ide0.n_write = 0;
-			ide0.dev_index = di;
-			ide0.HDD = 1;
-			hpex49x[di] = ide0;
-
-			if(debug){
-				printf("HP Disk %d :\nTotal bytes read: %ld\nTotal bytes write: %ld\n\n",ide0.HDD, ide0.b_read, ide0.b_write);
-				printf("Now Monitoring %s in HP Mediasmart Server Slot %i \n\n",ide0.path, ide0.HDD);
-			}
-
-			syslog(LOG_NOTICE,"Now Monitoring %s in HP Mediasmart Server Slot %i for activity",ide0.path, ide0.HDD);
-			++disks;	
-		}
-		else if ( cam_dev->path_id == 2 && cam_dev->target_id == 0) {
-			assert(sizeof(devicename) < sizeof(ide1.path));
-			strlcpy(ide1.path,devicename, sizeof(ide1.path));
-			ide1.target_id = cam_dev->target_id;		
-			ide1.path_id = cam_dev->path_id;
-			ide1.b_read = total_bytes_read;
-			ide1.b_write = total_bytes_write;
-			ide1.n_read = 0;
-			ide1.n_write = 0;
-			ide1.dev_index = di;
-			ide1.HDD = 2;
-			hpex49x[di] = ide1;
-
-			if(debug){
-				printf("HP Disk %d :\nTotal bytes read: %ld \nTotal bytes write: %ld\n\n",ide1.HDD, ide1.b_read, ide1.b_write);
-				printf("Now Monitoring %s in HP Mediasmart Server Slot %i \n\n",ide1.path, ide1.HDD);
-			}
-
-			syslog(LOG_NOTICE,"Now Monitoring %s in HP Mediasmart Server Slot %i for activity",ide1.path, ide1.HDD);
-			++disks;
-		}
-		else if ( cam_dev->path_id == 3 && cam_dev->target_id == 0) {
-			assert(sizeof(devicename) < sizeof(ide2.path));
-			strlcpy(ide2.path,devicename, sizeof(ide2.path));
-			ide2.target_id = cam_dev->target_id;		
-			ide2.path_id = cam_dev->path_id;
-			ide2.b_read = total_bytes_read;
-			ide2.b_write = total_bytes_write;
-			ide2.n_read = 0;
-			ide2.n_write = 0;
-			ide2.dev_index = di;
-			ide2.HDD = 3;
-			hpex49x[di] = ide2;
-
-			if(debug){
-				printf("HP Disk %d :\nTotal bytes read: %ld\nTotal bytes write: %ld\n\n",ide2.HDD, ide2.b_read, ide2.b_write);
-				printf("Now Monitoring %s in HP Mediasmart Server Slot %i \n\n",ide2.path, ide2.HDD);
-			}
-
-			syslog(LOG_NOTICE,"Now Monitoring %s in HP Mediasmart Server Slot %i for activity",ide2.path, ide2.HDD);
-			++disks;
-		}
-		else if ( cam_dev->path_id == 4 && cam_dev->target_id == 0) {
-			assert(sizeof(devicename) < sizeof(ide3.path));
-			strlcpy(ide3.path,devicename, sizeof(ide3.path));
-			ide3.target_id = cam_dev->target_id;		
-			ide3.path_id = cam_dev->path_id;
-			ide3.b_read = total_bytes_read;
-			ide3.b_write = total_bytes_write;
-			ide3.n_read = 0;
-			ide3.n_write = 0;
-			ide3.dev_index = di;
-			ide3.HDD = 4;
-			hpex49x[di] = ide3;
-
-			if(debug){
-				printf("HP Disk %d :\nTotal bytes read: %ld \nTotal bytes write: %ld\n\n",ide3.HDD, ide3.b_read, ide3.b_write);
-				printf("Now Monitoring %s in HP Mediasmart Server Slot %i \n\n",ide3.path, ide3.HDD);
-			}
-
-			syslog(LOG_NOTICE,"Now Monitoring %s in HP Mediasmart Server Slot %i for activity",ide3.path, ide3.HDD);
-			++disks;
-		}
-		else { /* something went wrong here */
-			err(1, "unknown path_id or target_id in %s line %d", __FUNCTION__, __LINE__);
-		}
-
-		if(di > 3)
-			err(1, "Illegal number of devices in devstat() in %s line %d", __FUNCTION__, __LINE__);
-
-		cam_close_device(cam_dev);
-		free(devicename);
+		sim = cam_dev->sim_name;
+		path_id = cam_dev->path_id;
+		target_id = cam_dev->target_id;
 	}
-	free(specified_devices[0]);
-	specified_devices[0] = NULL;
-	free(specified_devices);
-	specified_devices = NULL;
-	free(dev_select);
-	dev_select = NULL;
-	free(matches);
-	matches = NULL;
-	if(debug)
-		printf("\nsize_t disks is %ld before returning from %s line %d\n", disks, __FUNCTION__, __LINE__);
-	return (disks);
+	const struct bayent *e = baymap_lookup(sim, path_id, target_id);
+
+	if( e != NULL && (size_t)e->bay <= hpbays ) {
+		strlcpy(bay->path, devicename, sizeof(bay->path));
+		bay->target_id = target_id;
+		bay->path_id = path_id;
+		bay->dev_index = di;
+		bay->HDD = e->bay;
+		led_bay_bits(bay);
+		slot = e->bay - 1;
+	}
+	if( cam_dev != NULL )
+		cam_close_device(cam_dev);
+	return slot;
 };
-/////////////////////////////////////////////////////////////
-//// run disk monintoring thread for HP EX48x or EX49x
-void* hpex49x_thread_run (void *arg)
+/////////////////////////////////////////////////////////////////////////////
+//// the bay the cache has for name - as cam_bay(), but from a cache baycache_current()
+//// accepted
+static int cache_bay(const char *name, size_t di, struct hpled *bay)
 {
-	struct hpled mediasmart = *(struct hpled *)arg;
-    long double etime = 1.00;
-	int led_state = 0;
-	struct timespec t_led = { .tv_sec = 0, .tv_nsec = LED_DELAY }; /* overall delay before turning off the LEDs */
-	struct timespec t_blink = { .tv_sec = 0, .tv_nsec = BLINK_DELAY}; /* see if we can't get the lights to blink */
-	int thID = pthread_getthreadid_np();
-
-	while(thread_run) {
-
-		if( (pthread_spin_lock(&hpex49x_gpio_lock)) == EDEADLK ){
-
-			syslog(LOG_NOTICE, "Deadlock condition in HP disk %d function %s line %d",mediasmart.HDD, __FUNCTION__, __LINE__ );
-			fprintf(stderr, "Deadlock return from pthread_spin_lock from thread %d for HP disk %d in %s line %d\n",thID, mediasmart.HDD, __FUNCTION__, __LINE__);
-			thread_run = 0;
-			pthread_spin_unlock(&hpex49x_gpio_lock);
-		}
-		/* check to see if a device change occured and was identified in another thread before lock acquisiton */
-		if( cur.dinfo == NULL || thread_run == 0) {
-			fprintf(stderr, "Thread %d terminating due to conditions: cur.dinfo: %d thread_run: %ld in %s line %d\n", thID, (cur.dinfo == NULL) ? 0 : 1, thread_run, __FUNCTION__, __LINE__);
-			thread_run = 0;
-			pthread_spin_unlock(&hpex49x_gpio_lock);
-			break;
-		}
-
-		int retval = devstat_getdevs(kd, &cur);
+	const struct baycache_ent *e = baycache_find(&cache, name);
 
-		if( retval == 1 ) {
-			thread_run = 0; /* end the threads so we can re-initialize */
-			dev_change = 1; /* a device has changed and we must re-initialize */
-			if( (pthread_spin_unlock(&hpex49x_gpio_lock)) != 0)
-				err(1, "invalid return from pthread_spin_unlock in thread %d from HP disk %d in %s line %d", thID, mediasmart.HDD, __FUNCTION__, __LINE__);
-			break;
-		}
-		if (retval == -1 ) {
-			thread_run = 0; /* end the threads - we have a real problem */
-			dev_change = 0; /* not a device change */
-			
-			syslog(LOG_CRIT, "Bad return from devstat_getdevs() in thread for HP disk %d function %s line %d",mediasmart.HDD, __FUNCTION__, __LINE__ );
-			err(1, "invalid return from devstat_getdevs() from thread %d for HP disk %d in %s line %d", thID, mediasmart.HDD, __FUNCTION__, __LINE__);
-			
-			if( (pthread_spin_unlock(&hpex49x_gpio_lock)) != 0)
-				err(1, "invalid return from pthread_spin_unlock in thread %d for HP disk %d in %s line %d", thID, mediasmart.HDD, __FUNCTION__, __LINE__);
-			
-			break; /* just in case */
-		} 
-        if (devstat_compute_statistics(&cur.dinfo->devices[mediasmart.dev_index], NULL, etime, DSM_TOTAL_BYTES_READ, &mediasmart.n_read,
-        	DSM_TOTAL_BYTES_WRITE, &mediasmart.n_write, DSM_NONE) != 0)
-			err(1, "%s in %s line %d", devstat_errbuf, __FUNCTION__, __LINE__);
-		
-		if( (pthread_spin_unlock(&hpex49x_gpio_lock)) != 0)
-			err(1, "invalid return from pthread_spin_unlock from thread %d for HP disk %d in %s line %d",thID, mediasmart.HDD, __FUNCTION__, __LINE__);
-
-		if( ( mediasmart.b_read != mediasmart.n_read ) && ( mediasmart.b_write != mediasmart.n_write) ) {
-
-			mediasmart.b_read = mediasmart.n_read;
-			mediasmart.b_write = mediasmart.n_write;
-
-			if(debug) 
-				printf("HDD is: %i Thread is: %d Read I/O = %li Write I/O = %li \n", mediasmart.HDD, thID, mediasmart.n_read, mediasmart.n_write);
-
-			/* the lights are on and we want them to blink. Turn them off, wait, turn them on, wait, rinse...repeat */
-			if(led_state) {
-				set_hpex_led(LED_BLUE, OFF, mediasmart.blue); 
-				set_hpex_led(LED_RED, OFF, mediasmart.red);	
-
-				nanosleep(&t_blink, NULL);
-			}
-
-			set_hpex_led(LED_BLUE, ON, mediasmart.blue);
-			set_hpex_led(LED_RED, OFF, mediasmart.red);
-
-			led_state = 1;
-			nanosleep(&t_blink, NULL);
-		}
-		else if( mediasmart.b_read != mediasmart.n_read ) {
-
-			mediasmart.b_read = mediasmart.n_read;
+	if( e == NULL || (size_t)e->bay > hpbays )
+		return -1;
 
-			if(debug)
-				printf("HDD is: %i Thread ID is: %d Read I/O is: %li\n", mediasmart.HDD, thID, mediasmart.n_read);
-			
-			if(led_state){
-				set_hpex_led(LED_BLUE, OFF, mediasmart.blue);
-				set_hpex_led(LED_RED, OFF, mediasmart.red);	
+	snprintf(bay->path, sizeof(bay->path), "/dev/%s", name);
+	bay->target_id = e->target_id;
+	bay->path_id = e->path_id;
+	bay->dev_index = di;
+	bay->HDD = e->bay;
+	led_bay_bits(bay);
+	return e->bay - 1;
+};
+/////////////////////////////////////////////////////////////////////////////
+//// monitor thread, after a reconcile - have the health poll look at the disks that
+//// arrived and write the bays to the cache for the next start. sim and ident come from
+//// the CAM scan, or from the cache for a bay that was not identified again this run
+static void bays_reconciled(void)
+{
+	static struct baycache next;
 
-				nanosleep(&t_blink, NULL);
-			}
+	health_kick();
+	if( cache_dir == NULL )
+		return;
 
-			set_hpex_led(LED_BLUE, ON, mediasmart.blue);
-			set_hpex_led(LED_RED, ON, mediasmart.red);
+	memset(&next, 0, sizeof(next));
+	next.boot = baycache_boot();
+	next.generation = diskstats->generation();
+	next.nbays = baymap.nbays;
+	snprintf(next.map, sizeof(next.map), "%s", baymap.name);
 
-			led_state = 1;
-			nanosleep(&t_blink, NULL);			
-		}
-		else if( mediasmart.b_write != mediasmart.n_write ) {
+	for(size_t i = 0; i < hpbays && next.nent < BAYMAP_MAX_BAYS; i++) {
+		struct baycache_ent *e = &next.ent[next.nent];
+		const char *dev = strrchr(hpex49x[i].path, '/');
 
-			mediasmart.b_write = mediasmart.n_write;
+		if( !hpex49x[i].HDD || dev == NULL )
+			continue;
+		e->bay = hpex49x[i].HDD;
+		e->path_id = hpex49x[i].path_id;
+		e->target_id = hpex49x[i].target_id;
+		snprintf(e->dev, sizeof(e->dev), "%s", dev + 1);
 
-			if(debug)
-				printf("HP HDD is: %i Thread ID is: %d Write I/O is: %li\n", mediasmart.HDD, thID, mediasmart.n_write);
-			
-			if(led_state){
-				set_hpex_led(LED_BLUE, OFF, mediasmart.blue);
-				set_hpex_led(LED_RED, OFF, mediasmart.red);	
+		const struct camperiph *p = ( cam_scanned ) ? camenum_find(e->dev) : NULL;
+		const struct baycache_ent *old = baycache_find(&cache, e->dev);
 
-				nanosleep(&t_blink, NULL);	
-			}
-			
-			set_hpex_led(LED_BLUE, ON, mediasmart.blue);
-			set_hpex_led(LED_RED, OFF, mediasmart.red);
-		
-			led_state = 1;
-			nanosleep(&t_blink, NULL);
+		if( p != NULL && p->path_id == e->path_id && p->target_id == e->target_id ) {
+			snprintf(e->sim, sizeof(e->sim), "%s", p->sim);
+			snprintf(e->ident, sizeof(e->ident), "%s", p->ident);
 		}
-		else {
-			/* turn off the active light */
-			nanosleep(&t_led, NULL);
-
-			if ( led_state ) {
-				set_hpex_led(LED_BLUE, OFF, mediasmart.blue);
-				set_hpex_led(LED_RED, OFF, mediasmart.red);
-				led_state = 0;
-			}
-			continue;
-
+		else if( old != NULL && old->bay == e->bay && old->path_id == e->path_id && old->target_id == e->target_id ) {
+			snprintf(e->sim, sizeof(e->sim), "%s", old->sim);
+			snprintf(e->ident, sizeof(e->ident), "%s", old->ident);
 		}
-
+		else
+			continue; /* no SIM to check it against - discovered again next time */
+		++next.nent;
 	}
-	pthread_exit(NULL);   	
+	if( next.boot < 0 || baycache_save(cache_dir, &next) != 0 ) {
+		logmsg(LOGC_CAM, LOG_NOTICE, "Unable to write the bay cache - %s", ( next.boot < 0 ) ? "no boot time" : baycache_errbuf);
+		return;
+	}
+	cache = next;
+	logmsg(LOGC_CAM, LOG_DEBUG, "Bay cache: %zu bays for generation %ld written in %.3f ms", next.nent, next.generation, baycache_stats.save_ns / 1e6);
 };
-/////////////////////////////////////////////////////////////
-//// run disk monintoring thread for Acer and Lenovo H34x and Atmos
-void* acer_thread_run (void *arg)
+/////////////////////////////////////////////////////////////////////////////
+//// hotplug - identify a disk that appeared while the monitor runs, see bay_identify
+//// the monitor only passes devices the match rules selected - the bay map has the last word.
+//// the CAM buses are scanned again once per device list generation, however many
+//// devices the reconcile hands over
+int cam_bay_identify(const char *dev, int stat_index, struct hpled *bay)
 {
-	struct hpled mediasmart = *(struct hpled *)arg;
-    long double etime = 1.00;
-	int led_state = 0;
-	struct timespec t_led = { .tv_sec = 0, .tv_nsec = LED_DELAY }; /* overall delay before turning off the LEDs */
-	struct timespec t_blink = { .tv_sec = 0, .tv_nsec = BLINK_DELAY}; /* see if we can't get the lights to blink */
-	int thID = pthread_getthreadid_np();
-
-	while(thread_run) {
-
-		if( (pthread_spin_lock(&hpex49x_gpio_lock)) == EDEADLK ){
-
-			syslog(LOG_NOTICE, "Deadlock condition in thread %d for HP disk %d function %s line %d",thID, mediasmart.HDD, __FUNCTION__, __LINE__ );
-			fprintf(stderr, "Deadlock return from pthread_spin_lock from thread %d for HP disk %d in %s line %d",thID, mediasmart.HDD, __FUNCTION__, __LINE__);
-			thread_run = 0;
-			pthread_spin_unlock(&hpex49x_gpio_lock);
-		}
-		/* check to see if a device change occured and was identified in another thread before we acquired the lock */
-		if( cur.dinfo == NULL || thread_run == 0) {
-			fprintf(stderr, "Thread %d terminating due to conditions: cur.dinfo: %d thread_run: %ld in %s line %d\n", thID, (cur.dinfo == NULL) ? 0 : 1, thread_run, __FUNCTION__, __LINE__);
-			thread_run = 0;
-			pthread_spin_unlock(&hpex49x_gpio_lock);
-			break;
-		}
-
-		int retval = devstat_getdevs(kd, &cur);
-
-		if( retval == 1 ) {
-			thread_run = 0; /* end the threads so we can re-initialize */
-			dev_change = 1; /* a device has changed and we must re-initialize */
-			if( (pthread_spin_unlock(&hpex49x_gpio_lock)) != 0)
-				err(1, "invalid return from pthread_spin_unlock from thread %d for HP disk %d in %s line %d",thID, mediasmart.HDD, __FUNCTION__, __LINE__);
-			break;
-		}
-		if (retval == -1 ) {
-			thread_run = 0; /* end the threads - we have a real problem */
-			dev_change = 0; /* not a device change */
-			
-			syslog(LOG_CRIT, "Bad return from devstat_getdevs() in thread %d for HP disk %d function %s line %d", thID, mediasmart.HDD, __FUNCTION__, __LINE__ );
-			err(1, "invalid return from devstat_getdevs() from thread %d for HP disk %d in %s line %d",thID, mediasmart.HDD, __FUNCTION__, __LINE__);
-
-			if( (pthread_spin_unlock(&hpex49x_gpio_lock)) != 0)
-				err(1, "invalid return from pthread_spin_unlock from thread %d for HP disk %d in %s line %d",thID, mediasmart.HDD, __FUNCTION__, __LINE__);
-			break;
-		} 
-        if (devstat_compute_statistics(&cur.dinfo->devices[mediasmart.dev_index], NULL, etime, DSM_TOTAL_BYTES_READ, &mediasmart.n_read,
-        	DSM_TOTAL_BYTES_WRITE, &mediasmart.n_write, DSM_NONE) != 0)
-			err(1, "%s in %s line %d", devstat_errbuf, __FUNCTION__, __LINE__);
-		
-		if( (pthread_spin_unlock(&hpex49x_gpio_lock)) != 0)
-			err(1, "invalid return from pthread_spin_unlock from thread %d for HP disk %d in %s line %d", thID, mediasmart.HDD, __FUNCTION__, __LINE__);
-
-		if( ( mediasmart.b_read != mediasmart.n_read ) && ( mediasmart.b_write != mediasmart.n_write) ) {
-
-			mediasmart.b_read = mediasmart.n_read;
-			mediasmart.b_write = mediasmart.n_write;
-
-			if(debug) 
-				printf("HDD is: %i Thread is: %d Read I/O = %li Write I/O = %li \n", mediasmart.HDD, thID, mediasmart.n_read, mediasmart.n_write);
-
-			if(led_state) {
-				set_hpex_led(LED_BLUE, OFF, mediasmart.blue); 
-				set_hpex_led(LED_RED, OFF, mediasmart.red);	
-
-				nanosleep(&t_blink, NULL);
-			}
-			set_acer_led(LED_BLUE, ON, mediasmart.blue);
-			set_acer_led(LED_RED, OFF, mediasmart.red);
-			led_state = 1;
-			nanosleep(&t_blink, NULL);
-
-		}
-		else if( mediasmart.b_read != mediasmart.n_read ) {
-
-			mediasmart.b_read = mediasmart.n_read;
-
-			if(debug)
-				printf("HDD is: %i Thread ID is: %d Read I/O is: %li\n", mediasmart.HDD, thID, mediasmart.n_read);
-
-			if(led_state) {
-				set_hpex_led(LED_BLUE, OFF, mediasmart.blue); 
-				set_hpex_led(LED_RED, OFF, mediasmart.red);	
-
-				nanosleep(&t_blink, NULL);
-			}
-			set_acer_led(LED_BLUE, ON, mediasmart.blue);
-			set_acer_led(LED_RED, ON, mediasmart.red);
-			led_state = 1;
-			nanosleep(&t_blink, NULL);
-		}
-		else if( mediasmart.b_write != mediasmart.n_write ) {
-
-			mediasmart.b_write = mediasmart.n_write;
-
-			if(debug)
-				printf("HP HDD is: %i Thread ID is: %d Write I/O is: %li\n", mediasmart.HDD, thID, mediasmart.n_write);
-
-			if(led_state) {
-				set_hpex_led(LED_BLUE, OFF, mediasmart.blue); 
-				set_hpex_led(LED_RED, OFF, mediasmart.red);	
-
-				nanosleep(&t_blink, NULL);
-			}
-			set_hpex_led(LED_BLUE, ON, mediasmart.blue);
-			set_hpex_led(LED_RED, OFF, mediasmart.red);
-
-			led_state = 1;
-			nanosleep(&t_blink, NULL);
-		}
-		else {
-			/* turn off the active light */
-			nanosleep(&t_led, NULL);
-
-			if ( led_state != 0 ) {
-				set_acer_led(LED_BLUE, OFF, mediasmart.blue);
-				set_acer_led(LED_RED, OFF, mediasmart.red);
-				led_state = 0;
-			}
-			continue;
-
-		}
+	if( stat_index < 0 || stat_index >= diskstats->count() )
+		return -1;
+	if( diskstats->generation() != cam_generation )
+		cam_scan(diskstats->generation());
 
-	}
-	pthread_exit(NULL);   	
+	return cam_bay(dev, stat_index, bay);
 };
 /////////////////////////////////////////////////////////////////////////////
-//// Run the threads and return if a drive is added/removed
-size_t run_mediasmart(void)
+//// start the LED writer, the monitor and the update watcher - returns once they run
+void run_mediasmart(void)
 {
-	int num_threads = 0;
+	/* the writer owns the GPIO registers while the monitor runs - LED changes from any thread go through it */
+	if( led_writer_start() != 0 )
+		err(1, "Unable to start the LED writer in %s line %d", __FUNCTION__, __LINE__);
 
 	/* System LED function takes from enum { LED_OFF, LED_ON, LED_BLINK } in header */
 	setsystemled( LED_RED, LED_OFF);
 	setsystemled( LED_BLUE, LED_OFF);
 
-	for(int i = 0; i < hpdisks; i++) {
-        if ( (pthread_create(&hpexled_led[i], &attr, &hpex49x_thread_run, &hpex49x[i])) != 0)
-			err(1, "Unable to create thread for hpex47x_thread_run in %s line %d", __FUNCTION__, __LINE__);
-        ++num_threads;
+	if( !monitor_baseline() )
+		err(1, "Unable to find the monitored disks with the %s disk stats provider in %s line %d", diskstats->name, __FUNCTION__, __LINE__);
+	if( discover ) {
+		monitor_discover();
+		discover = 0;
+	}
 
-        if(debug)
-			printf("HP HDD is %i - created thread %i \n", hpex49x[i].HDD, num_threads);
-    }
+	__atomic_store_n(&dev_change, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&thread_run, 1, __ATOMIC_RELEASE);
+	if ( (pthread_create(&monitor, &attr, &monitor_thread_run, NULL)) != 0)
+		err(1, "Unable to create thread for monitor_thread_run in %s line %d", __FUNCTION__, __LINE__);
 
-	syslog(LOG_NOTICE,"Initialized Hard Disk Monitor Threads. Monitoring Disk Activity with %i Threads", num_threads);
+	if(debug)
+		printf("Created the monitor thread for %zu disks\n", hpdisks);
+
+	syslog(LOG_NOTICE,"Initialized Hard Disk Monitor. Monitoring Disk Activity for %zu disks on one thread", hpdisks);
 	syslog(LOG_NOTICE,"Now monitoring for drive activity");
 
-	if(update_monitor) {
-		if(pthread_create(&updatemonitor, &attr, &update_monitor_thread, NULL) != 0)
-			err(1, "Unable to create thread for update monitor");
+	if( health_interval || standby_idle ) {
+		if( health_start(health_interval, standby_idle, health_led) != 0 )
+			errx(1, "Unable to start the health poll in %s line %d", __FUNCTION__, __LINE__);
+		if( health_interval )
+			logmsg(LOGC_MAIN, LOG_NOTICE, "Polling SMART health through %s every %d minutes", health->name, health_interval / 60);
+		if( standby_idle )
+			logmsg(LOGC_MAIN, LOG_NOTICE, "Checking the power mode of disks idle for %d minutes through %s", standby_idle / 60, health->name);
 	}
 
-	for(size_t i = 0; i < hpdisks; i++) {
-        if ( (pthread_join(hpexled_led[i], NULL)) != 0) {
-			/* unsure why thread joining keeps failing on FreeBSD. This works fine on Linux */
-			perror("pthread_join()");
-			syslog(LOG_NOTICE, "Unable to join threads - this is only informational - in %s line %d", __FUNCTION__, __LINE__);
-    	}
+	if(update_monitor) {
+		if(update_start(NULL, update_led) != 0)
+			errx(1, "Unable to start the update monitor in %s line %d", __FUNCTION__, __LINE__);
+		syslog(LOG_NOTICE,"FreeBSD-Updates Monitor Initialized. Now Monitoring for FreeBSD System Updates");
+	}
+};
+/////////////////////////////////////////////////////////////////////////////
+//// stop what run_mediasmart() started and turn the bay LEDs off - the monitor may
+//// already have ended on its own
+void stop_mediasmart(void)
+{
+	monitor_stop();
+	/* a command in progress finishes first - never more than HEALTH_TIMEOUT */
+	health_stop();
+	if ( (pthread_join(monitor, NULL)) != 0) {
+		perror("pthread_join()");
+		syslog(LOG_NOTICE, "Unable to join monitor thread - this is only informational - in %s line %d", __FUNCTION__, __LINE__);
 	}
 
 	if(update_monitor) {
-		if( (pthread_cancel(updatemonitor)) != 0)
-			err(1, "Unable to cancel update monitor thread in %s line %d", __FUNCTION__, __LINE__);
-		if( (pthread_join(updatemonitor, NULL)) != 0)
-			err(1, "Unable to join thread update_monitor_thread in %s line %d before close", __FUNCTION__, __LINE__);
+		/* the watcher only ever waits in poll() - stopping it is immediate */
+		update_stop();
+		setsystemled( LED_RED, LED_OFF);
+		setsystemled( LED_BLUE, LED_OFF);
+		syslog(LOG_NOTICE,"Update Monitor Cleaned Up and Ending");
 	}
 	
-	if(HP) {
-			for(size_t i = 0; i < MAX_HDD_LEDS; i++){
-				set_hpex_led(LED_BLUE, i, OFF);
-				set_hpex_led(LED_RED, i , OFF);
-		}
-	}
-	else {
-		for(size_t i = 0; i< MAX_HDD_LEDS; i++){
-			set_acer_led(LED_BLUE, i, OFF);
-			set_acer_led(LED_RED, i, OFF);
-		}
-	}
-	thread_run = 0;
-	return dev_change;
+	led_bays_off( (HP) ? set_hpex_led : set_acer_led, HP && hw_blink );
+	gpio_flush();
+	led_writer_stop();
+	gpio_report();
+};
+/////////////////////////////////////////////////////////////////////////////
+//// the monitor thread ended - restart it for a device change, anything else is fatal.
+//// the monitor only ever runs in Running, so only a shutdown can be in the way
+static void monitor_ended(int changed)
+{
+	if( !changed || !super_transition(SUPER_RUNNING, SUPER_RECONCILING) )
+		super_shutdown();
 };
 ////////////////////////////////////////////////////////////////////////////////
 //// MAIN Function 
 int main (int argc, char **argv) 
 {
 	int run_as_daemon = 0;
+	const char *bay_map = NULL;
+	const char *listen_address = NULL, *textfile_dir = NULL;
+	const char *query_socket = PERF_SOCKET_DEFAULT;
+	const char *log_file = NULL;
 
 	if (geteuid() !=0 ) {
 		printf("Try running as root to avoid Segfault and core dump \n");
@@ -821,9 +545,21 @@ int main (int argc, char **argv)
 	progname = curdir(argv[0]);
 
   	const struct option long_opts[] = {
+        { "blink",          no_argument,       0, 'b' },
+        { "cache-dir",      required_argument, 0, 'c' },
         { "debug",          no_argument,       0, 'd' },
         { "daemon",         no_argument,       0, 'D' },
+        { "health",         required_argument, 0, 'H' },
         { "help",           no_argument,       0, 'h' },
+        { "idle",           required_argument, 0, 'i' },
+        { "listen",         required_argument, 0, 'l' },
+        { "log-file",       required_argument, 0, 'L' },
+        { "map",            required_argument, 0, 'm' },
+        { "match",          required_argument, 0, 'M' },
+        { "query-socket",   required_argument, 0, 'q' },
+        { "simulate",       no_argument,       0, 'S' },
+        { "standby",        required_argument, 0, 's' },
+        { "textfile-dir",   required_argument, 0, 'T' },
 		{ "update",			no_argument,	   0, 'u' },
         { "version",        no_argument,       0, 'v' },
         { 0, 0, 0, 0 },
@@ -831,10 +567,16 @@ int main (int argc, char **argv)
 
     // pass command line arguments
     while ( 1 ) {
-        const int c = getopt_long( argc, argv, "dDhuv?", long_opts, 0 );
+        const int c = getopt_long( argc, argv, "bc:dDhH:i:l:L:m:M:q:s:ST:uv?", long_opts, 0 );
         if ( -1 == c ) break;
 
         switch ( c ) {
+			case 'b': // hardware blink
+				hw_blink++;
+				break;
+			case 'c': // bay cache directory
+				cache_dir = ( optarg[0] ) ? optarg : NULL;
+				break;
 			case 'D': // daemon
 				run_as_daemon++;
 				break;
@@ -843,6 +585,52 @@ int main (int argc, char **argv)
                 break;
             case 'h': // help!
                 return show_help(argv[0]);
+			case 'H': { // SMART health poll
+				char *end;
+				const long min = strtol(optarg, &end, 10);
+				if( *end != '\0' || min < 0 || min > HEALTH_INTERVAL_MAX / 60 )
+					errx(1, "--health must be between 0 and %d minutes", HEALTH_INTERVAL_MAX / 60);
+				health_interval = min * 60;
+				break;
+			}
+			case 'i': { // idle backoff ceiling
+				char *end;
+				const long ms = strtol(optarg, &end, 10);
+				if( *end != '\0' || ms < LED_DELAY / 1000000 || ms > IDLE_DELAY_LIMIT )
+					errx(1, "--idle must be between %d and %d ms", LED_DELAY / 1000000, IDLE_DELAY_LIMIT);
+				idle_delay_max = ms * 1000000;
+				break;
+			}
+			case 'l': // Prometheus listener
+				listen_address = optarg;
+				break;
+			case 'L': // log file instead of syslog
+				log_file = optarg;
+				break;
+			case 'm': // bay map file
+				bay_map = optarg;
+				break;
+			case 'M': // device match rule
+				if( devmatch_add(optarg) != 0 )
+					errx(1, "Bad --match rule %s", optarg);
+				break;
+			case 'q': // instrumentation query socket
+				query_socket = ( optarg[0] ) ? optarg : NULL;
+				break;
+			case 's': { // power tracker
+				char *end;
+				const long min = strtol(optarg, &end, 10);
+				if( *end != '\0' || min < 0 || min > HEALTH_STANDBY_IDLE_MAX / 60 )
+					errx(1, "--standby must be between 0 and %d minutes", HEALTH_STANDBY_IDLE_MAX / 60);
+				standby_idle = min * 60;
+				break;
+			}
+			case 'S': // simulated port I/O
+				sim_io++;
+				break;
+			case 'T': // node_exporter textfile directory
+				textfile_dir = optarg;
+				break;
 			case 'u': //update
 				update_monitor++;
 				break; 
@@ -855,35 +643,59 @@ int main (int argc, char **argv)
         }
     }
 	
-	if( ( io = open("/dev/io", O_RDWR)) < 0 ) 
+	if( portio_open( sim_io ? &portio_sim : &portio_hw ) != 0 ) 
 		perror("open");
 	
 	openlog("hpex49xled:", LOG_CONS | LOG_PID, LOG_DAEMON );
 
+	if( super_open() != 0 )
+		err(1, "Unable to set up the supervisor in %s line %d", __FUNCTION__, __LINE__);
+
 	signal( SIGTERM, sigterm_handler);
     signal( SIGINT, sigterm_handler);
     signal( SIGQUIT, sigterm_handler);
-    signal( SIGILL, sigterm_handler);
+
+	if( bay_map != NULL && baymap_load(bay_map) != 0 )
+		errx(1, "Unable to load the bay map %s in %s line %d", bay_map, __FUNCTION__, __LINE__);
+
+	/* the LED init installs the platform's built in bay map when none was loaded */
+	if (init_hpex49x_led() != 1 )
+		err(1, "Unknown return from led initialization in %s line %d", __FUNCTION__, __LINE__);
+
+	if( !monitor_bays(baymap.nbays) )
+		err(1, "Unable to allocate %zu bays in %s line %d", baymap.nbays, __FUNCTION__, __LINE__);
+
+	syslog(LOG_NOTICE, "Using the %s bay map - %zu bays", baymap.name, baymap.nbays);
+
+	/* the mapped counters need /dev/devstat - libdevstat copies them through sysctl instead */
+	if( diskstats->open(NULL) != 0 ) {
+		syslog(LOG_NOTICE, "Unable to open the %s disk stats provider - using devstat", diskstats->name);
+		diskstats = &diskstats_devstat;
+		if( diskstats->open(NULL) != 0 )
+			errx(1, "%s in %s line %d", devstat_errbuf, __FUNCTION__, __LINE__);
+	}
 
 	hpdisks = disk_init() ;
 
-	if(hpdisks <= 0)
+	/* with a bay cache no bays is not fatal - the monitor discovers them, or hotplug adds them later */
+	if(hpdisks <= 0 && cache_dir == NULL)
 		err(1, "Unknown return from disk initialization in %s line %d", __FUNCTION__, __LINE__);
 
-	if (init_hpex49x_led() != 1 )
-		err(1, "Unknown return from led initialization in %s line %d", __FUNCTION__, __LINE__);
+	/* disks that come and go are identified one at a time instead of restarting the monitor */
+	bay_identify = cam_bay_identify;
+	monitor_reconciled = bays_reconciled;
 
 	if ( run_as_daemon ) {
 		if (daemon( 0, 0 ) > 0 )
 			err(1, "Unable to daemonize :");
 		syslog(LOG_NOTICE,"Forking to background, running in daemon mode");
 	}
-	if( (pthread_spin_init(&hpex49x_gpio_lock, PTHREAD_PROCESS_PRIVATE)) !=0 )
-		err(1,"Unable to initialize first spin_lock in %s at %d", __FUNCTION__, __LINE__);
-
-	if( (pthread_spin_init(&hpex49x_gpio_lock2, PTHREAD_PROCESS_PRIVATE)) !=0 )
-		err(1,"Unable to initialize second spin_lock in %s at %d", __FUNCTION__, __LINE__);
-
+	/* the kqueue must be created after the fork - a child does not inherit it */
+	if( evloop_open() != 0 )
+		err(1, "Unable to open the monitor event loop in %s line %d", __FUNCTION__, __LINE__);
+	/* from here on the threads log through the flusher and never wait for syslog */
+	if( log_start(log_file) != 0 )
+		errx(1, "Unable to start the log flusher in %s line %d", __FUNCTION__, __LINE__);
 	if ((pthread_attr_init(&attr)) < 0 )
 		err(1, "Unable to execute pthread_attr_init(&attr) in main()");
 	
@@ -896,91 +708,92 @@ int main (int argc, char **argv)
 		err(1, "Unable to set pthread_attr_setscope() in %s line %d", __FUNCTION__, __LINE__);
 	}
 
+	/* the exporter binds while still root and reads only what the monitor publishes */
+	if( export_start(listen_address, textfile_dir) != 0 )
+		errx(1, "Unable to start the metrics exporter in %s line %d", __FUNCTION__, __LINE__);
+	/* a listener that could not bind is off - export_start() logged why */
+	if( export_port() == -1 )
+		listen_address = NULL;
+	if( listen_address || textfile_dir )
+		syslog(LOG_NOTICE, "Exporting metrics%s%s%s%s", ( listen_address ) ? " on " : "", ( listen_address ) ? listen_address : "",
+			( textfile_dir ) ? " to " : "", ( textfile_dir ) ? textfile_dir : "");
+
+	/* the query socket is bound while still root, so only root can connect */
+	if( perf_start(query_socket) != 0 )
+		errx(1, "Unable to start the instrumentation dump thread in %s line %d", __FUNCTION__, __LINE__);
+	if( query_socket )
+		syslog(LOG_NOTICE, "Answering instrumentation queries on %s", query_socket);
+
 	/* Try and drop root priviledges now that we have initialized */
 	drop_priviledges();
 
-	thread_run = 1;
-
-	int run = 1;
-	while (run) {
-		switch (thread_run){
-			case 1: {
-				int retval = run_mediasmart(); /* returns value of dev_change */
-
-				switch(retval) {
-					case 1:
-						free(cur.dinfo);
-						cur.dinfo = NULL;
-						if(dev_select != NULL) free(dev_select); /* found this out the hard way - see man devstat_buildmatch */
-						if(matches != NULL) free(matches); /* same here */
-						syslog(LOG_NOTICE, "New or removed device detected - reinitializing");
-						if(debug)
-							printf("\n\n**** New/Removed Device Detected - re-initializing ****\n\n");
-						hpdisks = disk_init();
-						init_hpex49x_led();
-						if(hpdisks <= 0)
-							err(1, "Unknown return from disk initialization in %s line %d", __FUNCTION__, __LINE__);
-						dev_change = 0;
-						thread_run = 1;
-						break;
-
-					default:
-						break;	
+	/* the supervisor - sleeps until a signal or the monitor asks for a change of state */
+	int running = 0;
+
+	monitor_exited = monitor_ended;
+	for (;;) {
+		const int state = super_state();
+
+		if(debug)
+			printf("Supervisor: %s\n", super_name(state));
+
+		switch (state) {
+			/* Running before the monitor starts, so a monitor that ends at once always finds
+			   Running to leave - a shutdown requested meanwhile means it never starts */
+			case SUPER_INIT:
+				if( super_transition(SUPER_INIT, SUPER_RUNNING) ) {
+					run_mediasmart();
+					running = 1;
 				}
-			}
-			default:
-				printf("In default case in while loop - function %s line %d\n", __FUNCTION__, __LINE__);
 				break;
-		}
 
-	}
+			case SUPER_RUNNING:
+				super_wait(SUPER_RUNNING);
+				break;
+
+			case SUPER_RECONCILING: {
+				syslog(LOG_NOTICE, "New or removed device detected - reinitializing");
+				if(debug)
+					printf("\n\n**** New/Removed Device Detected - re-initializing ****\n\n");
+				stop_mediasmart();
+				running = 0;
+				const u_int64_t t_init = perf_now();
+				hpdisks = disk_init();
+				if(hpdisks <= 0 && cache_dir == NULL)
+					err(1, "Unknown return from disk initialization in %s line %d", __FUNCTION__, __LINE__);
+				perf_record(PERF_HOTPLUG, perf_now() - t_init);
+				perf_thread_cpu(PERF_THREAD_MAIN);
+				if( super_transition(SUPER_RECONCILING, SUPER_RUNNING) ) {
+					run_mediasmart();
+					running = 1;
+				}
+				break;
+			}
 
-	return 1;
+			case SUPER_SHUTTING_DOWN:
+				if( running )
+					stop_mediasmart();
+				setsystemled( LED_RED, LED_OFF);
+				setsystemled( LED_BLUE, LED_OFF);
+				gpio_flush();
+
+				pthread_attr_destroy(&attr);
+
+				export_stop();
+				perf_stop();
+				diskstats->close();
+				logmsg(LOGC_MAIN, LOG_NOTICE, "Signal Received. Exiting");
+				log_stop();
+				closelog();
+				portio_close();
+				return 0;
+		}
+	}
 };
 //////////////////////////////////////////////////////////////////////////
-//// general signal handler
+//// SIGTERM, SIGINT and SIGQUIT - only asks the supervisor to shut down, which it does
+//// on the main thread once it wakes
 void sigterm_handler(int s)
 {
-	thread_run = 0;
-
-	setsystemled( LED_RED, LED_OFF);
-	setsystemled( LED_BLUE, LED_OFF);
-
-	for(size_t i = 0; i < hpdisks; i++) {
-        if ( (pthread_join(hpexled_led[i], NULL)) != 0) {
-			if( pthread_cancel(hpexled_led[i]) != 0) {
-				perror("pthread_cancel()");
-				err(1, "Unable to cancel threads - pthread_cancel in %s line %d", __FUNCTION__, __LINE__);
-			}
-		}
-	}
-	if(HP) {
-		for(size_t i = 0; i < MAX_HDD_LEDS; i++){
-			set_hpex_led(LED_BLUE, i, OFF);
-			set_hpex_led(LED_RED, i , OFF);
-		}
-	}
-	else {
-		for(size_t i = 0; i< MAX_HDD_LEDS; i++){
-			set_acer_led(LED_BLUE, i, OFF);
-			set_acer_led(LED_RED, i, OFF);
-		}
-	}
-
-	if( (pthread_spin_destroy(&hpex49x_gpio_lock)) != 0 )
-		perror("pthread_spin_destroy lock 1");
-	if( (pthread_spin_destroy(&hpex49x_gpio_lock2)) != 0 )
-		perror("pthread_spin_destroy lock 2");
-
-	pthread_attr_destroy(&attr);
-
-	free(cur.dinfo);
-	cur.dinfo = NULL;
-	free(dev_select); /* found this out the hard way - see man devstat_buildmatch */
-	free(matches); /* same here */
-	syslog(LOG_NOTICE,"Signal Received. Exiting");
-	closelog();
-	close(io);
-	errx(0, "\nExiting From Signal Handler\n");
-
+	super_shutdown();
 };
\ No newline at end of file
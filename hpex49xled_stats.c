@@ -0,0 +1,375 @@
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_stats.c
+///////
+/////// Disk statistics providers - Linux /proc/diskstats and trace replay
+/////// (the FreeBSD devstat provider lives in hpex49xled_devstat.c)
+///////
+/////// -------------------------------------------------------------------------
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <err.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+
+#include "hpex49xled_stats.h"
+
+/////////////////////////////////////////////////////////////////////////
+/// guess the kind of a device from its name - Linux names for procfs, FreeBSD
+/// names for traces recorded there
+unsigned diskstats_kind_name( const char *dev )
+{
+	static const struct { const char *prefix; unsigned kind; } names[] = {
+		{ "ada", DISKSTATS_TYPE_DIRECT | DISKSTATS_IF_IDE },
+		{ "da", DISKSTATS_TYPE_DIRECT | DISKSTATS_IF_SCSI },
+		{ "nda", DISKSTATS_TYPE_DIRECT | DISKSTATS_IF_NVME },
+		{ "nvd", DISKSTATS_TYPE_DIRECT | DISKSTATS_IF_NVME },
+		{ "cd", DISKSTATS_TYPE_CDROM | DISKSTATS_IF_SCSI },
+		{ "pass", DISKSTATS_PASS | DISKSTATS_IF_SCSI },
+		{ "sd", DISKSTATS_TYPE_DIRECT | DISKSTATS_IF_SCSI },
+		{ "hd", DISKSTATS_TYPE_DIRECT | DISKSTATS_IF_IDE },
+		{ "nvme", DISKSTATS_TYPE_DIRECT | DISKSTATS_IF_NVME },
+		{ "sr", DISKSTATS_TYPE_CDROM | DISKSTATS_IF_SCSI },
+	};
+
+	for ( size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i )
+		if ( strncmp(dev, names[i].prefix, strlen(names[i].prefix)) == 0 )
+			return names[i].kind;
+	return DISKSTATS_TYPE_DIRECT | DISKSTATS_IF_OTHER;
+};
+/////////////////////////////////////////////////////////////////////////
+/// write one trace line - see hpex49xled_stats.h for the format
+void diskstats_trace_line( FILE *f, u_int64_t msec, const char *dev, const struct diskstat *ds )
+{
+	fprintf(f, "%ju %s %ju %ju %ju %ju %ju\n", (uintmax_t)msec, dev, (uintmax_t)ds->bytes_read, (uintmax_t)ds->bytes_write,
+		(uintmax_t)ds->ops_read, (uintmax_t)ds->ops_write, (uintmax_t)ds->busy_ns);
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// Linux /proc/diskstats
+/// the file stays open and every snapshot is a pread() into a static buffer
+/// parsed in place - nothing is allocated per tick
+///   major minor name reads rmerged rsectors rms writes wmerged wsectors wms inflight io_ms weighted_ms ...
+/// sectors are always 512 bytes in diskstats regardless of the device sector size
+static struct {
+	int fd;
+	int count;
+	long generation;
+	char names[DISKSTATS_MAX][DISKSTATS_NAME_LEN];
+	struct diskstat ds[DISKSTATS_MAX];
+	char buf[65536];
+} procfs = { .fd = -1 };
+
+static int procfs_snapshot(void)
+{
+	ssize_t len = 0, n;
+
+	while ( (n = pread(procfs.fd, procfs.buf + len, sizeof(procfs.buf) - 1 - len, len)) > 0 )
+		len += n;
+	if ( n < 0 )
+		return -1;
+	procfs.buf[len] = '\0';
+
+	int changed = 0, count = 0;
+	char *p = procfs.buf;
+
+	while ( *p && count < DISKSTATS_MAX ) {
+		u_int64_t f[15];
+		char *end;
+
+		strtoul(p, &end, 10); /* major */
+		strtoul(end, &end, 10); /* minor */
+		while ( *end == ' ' ) ++end;
+
+		char *name = end;
+		while ( *end && *end != ' ' && *end != '\n' ) ++end;
+		const size_t nlen = end - name;
+
+		for ( size_t i = 0; i < 11; ++i )
+			f[i] = strtoull(end, &end, 10);
+		/* discards since Linux 4.18 - stop at the end of the line on older kernels */
+		for ( size_t i = 11; i < 15; ++i ) {
+			while ( *end == ' ' ) ++end;
+			f[i] = ( *end >= '0' && *end <= '9' ) ? strtoull(end, &end, 10) : 0;
+		}
+
+		if ( nlen > 0 && nlen < DISKSTATS_NAME_LEN ) {
+			if ( count >= procfs.count || strncmp(procfs.names[count], name, nlen) != 0 || procfs.names[count][nlen] != '\0' ) {
+				memcpy(procfs.names[count], name, nlen);
+				procfs.names[count][nlen] = '\0';
+				changed = 1;
+			}
+			struct diskstat *ds = &procfs.ds[count];
+			ds->ops_read = f[0];
+			ds->bytes_read = f[2] * 512;
+			ds->ops_write = f[4];
+			ds->bytes_write = f[6] * 512;
+			ds->ops_free = f[11];
+			ds->bytes_free = f[13] * 512;
+			ds->busy_ns = f[9] * 1000000;
+			ds->duration_ns = (f[3] + f[7] + f[14]) * 1000000;
+			ds->queue = f[8];
+			++count;
+		}
+		while ( *end && *end != '\n' ) ++end;
+		p = ( *end ) ? end + 1 : end;
+	}
+	if ( count != procfs.count )
+		changed = 1;
+	procfs.count = count;
+
+	if ( changed ) {
+		++procfs.generation;
+		return 1;
+	}
+	return 0;
+};
+
+static int procfs_open( const char *arg )
+{
+	if ( (procfs.fd = open(( arg ) ? arg : "/proc/diskstats", O_RDONLY)) < 0 )
+		return -1;
+	procfs.count = 0;
+	return ( procfs_snapshot() < 0 ) ? -1 : 0;
+};
+
+static void procfs_close(void)
+{
+	if ( procfs.fd >= 0 ) close(procfs.fd);
+	procfs.fd = -1;
+};
+
+static int procfs_find( const char *dev )
+{
+	for ( int i = 0; i < procfs.count; ++i )
+		if ( strcmp(procfs.names[i], dev) == 0 ) return i;
+	return -1;
+};
+
+static int procfs_count(void) { return procfs.count; }
+
+static const char *procfs_device( int idx )
+{
+	return ( idx >= 0 && idx < procfs.count ) ? procfs.names[idx] : NULL;
+};
+
+static unsigned procfs_kind( int idx )
+{
+	return ( idx >= 0 && idx < procfs.count ) ? diskstats_kind_name(procfs.names[idx]) : DISKSTATS_IF_OTHER;
+};
+
+static int procfs_read( int idx, struct diskstat *ds )
+{
+	if ( idx < 0 || idx >= procfs.count ) return -1;
+	*ds = procfs.ds[idx];
+	return 0;
+};
+
+static long procfs_generation(void) { return procfs.generation; }
+
+const struct diskstats_ops diskstats_procfs = {
+	.name = "procfs",
+	.open = procfs_open,
+	.close = procfs_close,
+	.snapshot = procfs_snapshot,
+	.find = procfs_find,
+	.count = procfs_count,
+	.device = procfs_device,
+	.kind = procfs_kind,
+	.read = procfs_read,
+	.generation = procfs_generation,
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// trace replay
+/// the whole trace is loaded at open - each snapshot() applies the next timestamp.
+/// a device that first shows up after the first snapshot, or a "<msec> <device> detach"
+/// line, changes the generation. once the trace runs out the counters stay put
+struct replay_rec {
+	u_int64_t msec;
+	int dev;	///< index into names[], -1 - dev = detach
+	struct diskstat ds;
+};
+
+static struct {
+	struct replay_rec *rec;
+	size_t nrec;
+	size_t pos;
+	int ndev;
+	long generation;
+	u_int64_t msec;
+	char names[DISKSTATS_MAX][DISKSTATS_NAME_LEN];
+	int present[DISKSTATS_MAX];
+	struct diskstat cur[DISKSTATS_MAX];
+} replay;
+
+static int replay_snapshot(void);
+
+static int replay_dev( const char *name )
+{
+	for ( int i = 0; i < replay.ndev; ++i )
+		if ( strcmp(replay.names[i], name) == 0 ) return i;
+	if ( replay.ndev >= DISKSTATS_MAX || strlen(name) >= DISKSTATS_NAME_LEN )
+		return -1;
+	snprintf(replay.names[replay.ndev], DISKSTATS_NAME_LEN, "%s", name);
+	return replay.ndev++;
+};
+
+static int replay_open( const char *arg )
+{
+	FILE *f;
+	char *line = NULL;
+	size_t len = 0, cap = 0;
+
+	if ( arg == NULL || (f = fopen(arg, "r")) == NULL )
+		return -1;
+
+	memset(&replay, 0, sizeof(replay));
+
+	while ( getline(&line, &len, f) != -1 ) {
+		uintmax_t msec, v[5];
+		char name[DISKSTATS_NAME_LEN], what[16];
+		struct replay_rec r = { .msec = 0 };
+		int detach = 0, idx;
+
+		if ( line[0] == '#' || line[0] == '\n' )
+			continue;
+
+		if ( sscanf(line, "%ju %31s %ju %ju %ju %ju %ju", &msec, name, &v[0], &v[1], &v[2], &v[3], &v[4]) == 7 ) {
+			r.ds.bytes_read = v[0];
+			r.ds.bytes_write = v[1];
+			r.ds.ops_read = v[2];
+			r.ds.ops_write = v[3];
+			r.ds.busy_ns = v[4];
+		}
+		else if ( sscanf(line, "%ju %31s %15s", &msec, name, what) == 3 && strcmp(what, "detach") == 0 ) {
+			detach = 1;
+		}
+		else {
+			warnx("ignoring malformed trace line: %s", line);
+			continue;
+		}
+		if ( (idx = replay_dev(name)) < 0 )
+			continue;
+		r.dev = ( detach ) ? -1 - idx : idx;
+		r.msec = msec;
+
+		if ( replay.nrec == cap ) {
+			cap = ( cap ) ? cap * 2 : 1024;
+			if ( (replay.rec = realloc(replay.rec, cap * sizeof(*replay.rec))) == NULL )
+				err(1, "realloc failed in %s line %d", __FUNCTION__, __LINE__);
+		}
+		replay.rec[replay.nrec++] = r;
+	}
+	free(line);
+	fclose(f);
+
+	/* the first timestamp is the starting device list */
+	return ( replay.nrec && replay_snapshot() >= 0 ) ? 0 : -1;
+};
+
+static void replay_close(void)
+{
+	free(replay.rec);
+	replay.rec = NULL;
+	replay.nrec = replay.pos = 0;
+};
+
+static int replay_snapshot(void)
+{
+	int changed = 0;
+
+	if ( replay.pos >= replay.nrec )
+		return 0;
+
+	replay.msec = replay.rec[replay.pos].msec;
+
+	for ( ; replay.pos < replay.nrec && replay.rec[replay.pos].msec == replay.msec; ++replay.pos ) {
+		const struct replay_rec *r = &replay.rec[replay.pos];
+
+		if ( r->dev < 0 ) {
+			changed |= replay.present[-1 - r->dev];
+			replay.present[-1 - r->dev] = 0;
+			continue;
+		}
+		if ( !replay.present[r->dev] ) {
+			replay.present[r->dev] = 1;
+			changed = 1;
+		}
+		replay.cur[r->dev] = r->ds;
+	}
+	if ( changed ) {
+		/* the first snapshot is taken by open and is not a change */
+		if ( replay.generation++ == 0 )
+			return 0;
+		return 1;
+	}
+	return 0;
+};
+
+static int replay_find( const char *dev )
+{
+	for ( int i = 0; i < replay.ndev; ++i )
+		if ( replay.present[i] && strcmp(replay.names[i], dev) == 0 ) return i;
+	return -1;
+};
+
+static int replay_count(void) { return replay.ndev; }
+
+static const char *replay_device( int idx )
+{
+	return ( idx >= 0 && idx < replay.ndev && replay.present[idx] ) ? replay.names[idx] : NULL;
+};
+
+static unsigned replay_kind( int idx )
+{
+	return ( idx >= 0 && idx < replay.ndev ) ? diskstats_kind_name(replay.names[idx]) : DISKSTATS_IF_OTHER;
+};
+
+static int replay_read( int idx, struct diskstat *ds )
+{
+	if ( idx < 0 || idx >= replay.ndev || !replay.present[idx] ) return -1;
+	*ds = replay.cur[idx];
+	return 0;
+};
+
+static long replay_generation(void) { return replay.generation; }
+
+const struct diskstats_ops diskstats_replay = {
+	.name = "replay",
+	.open = replay_open,
+	.close = replay_close,
+	.snapshot = replay_snapshot,
+	.find = replay_find,
+	.count = replay_count,
+	.device = replay_device,
+	.kind = replay_kind,
+	.read = replay_read,
+	.generation = replay_generation,
+};
@@ -0,0 +1,92 @@
+#ifndef INCLUDED_HPEX49XLED_STATS
+#define INCLUDED_HPEX49XLED_STATS
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_stats.h
+///////
+/////// Disk statistics providers - devstat, mapped devstat, Linux /proc/diskstats and trace replay
+///////
+/////// -------------------------------------------------------------------------
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <sys/types.h>
+
+#define DISKSTATS_NAME_LEN 32 // device name including the unit - ada0, sda, nvme0n1
+#define DISKSTATS_MAX 256 // most devices the procfs and replay backends track
+
+/// cumulative counters for one device since it attached
+struct diskstat {
+	u_int64_t bytes_read;
+	u_int64_t bytes_write;
+	u_int64_t ops_read;
+	u_int64_t ops_write;
+	u_int64_t bytes_free;	///< BIO_DELETE / TRIM - 0 where the provider does not report it
+	u_int64_t ops_free;
+	u_int64_t busy_ns;	///< time with at least one transaction outstanding
+	u_int64_t duration_ns;	///< summed time of every completed transaction - 0 where unknown
+	u_int64_t queue;	///< transactions outstanding now - a gauge, not a counter
+};
+
+/// device class from kind() - a type, the interface it attaches through and flags.
+/// the same encoding as devstat's device_type, so the devstat provider passes it through
+enum diskstats_kind {
+	DISKSTATS_TYPE_DIRECT = 0x00,	///< disks - ada, da, nda, nvd, sd, nvme
+	DISKSTATS_TYPE_CDROM = 0x05,
+	DISKSTATS_TYPE_MASK = 0x0f,	///< devstat has more types - tape, changer, enclosure ...
+	DISKSTATS_IF_SCSI = 0x010,	///< devstat's DEVSTAT_TYPE_IF_* - 0 is no interface
+	DISKSTATS_IF_IDE = 0x020,
+	DISKSTATS_IF_OTHER = 0x030,
+	DISKSTATS_IF_NVME = 0x040,
+	DISKSTATS_IF_MASK = 0x0f0,
+	DISKSTATS_PASS = 0x100,	///< passthrough device - pass0
+};
+
+/// a provider - snapshot() once per tick then read() any device from that snapshot
+struct diskstats_ops {
+	const char *name;
+	int (*open)(const char *arg);	///< arg is backend specific (trace file for replay) - returns 0 on success
+	void (*close)(void);
+	int (*snapshot)(void);	///< 0 = ok, 1 = device list changed, -1 = error
+	int (*find)(const char *dev);	///< index of "ada0" style name in the last snapshot, -1 if absent
+	int (*count)(void);	///< indexes in the last snapshot
+	const char *(*device)(int idx);	///< "ada0" style name at idx, NULL for an unused index - valid until the next call
+	unsigned (*kind)(int idx);	///< enum diskstats_kind bits for idx
+	int (*read)(int idx, struct diskstat *ds);	///< 0 on success
+	long (*generation)(void);	///< changes whenever the device list does
+};
+
+extern const struct diskstats_ops diskstats_devstat;	///< FreeBSD libdevstat
+extern const struct diskstats_ops diskstats_devmap;	///< FreeBSD /dev/devstat mapped read only
+extern const struct diskstats_ops diskstats_procfs;	///< Linux /proc/diskstats
+extern const struct diskstats_ops diskstats_replay;	///< recorded trace
+extern const struct diskstats_ops *diskstats;		///< provider the monitor uses - defined by the program
+
+/// trace format, one line per device per snapshot, cumulative values:
+///   <msec> <device> <bytes read> <bytes written> <reads> <writes> <busy nsec>
+/// lines sharing a timestamp form one snapshot
+/// kind for providers that only know a name - sd is SCSI, hd IDE, nvme NVMe, sr a CD
+unsigned diskstats_kind_name( const char *dev );
+void diskstats_trace_line( FILE *f, u_int64_t msec, const char *dev, const struct diskstat *ds );
+
+#endif //INCLUDED_HPEX49XLED_STATS
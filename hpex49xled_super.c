@@ -0,0 +1,104 @@
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_super.c
+///////
+/////// Supervisor state - what the main thread is doing with the monitor, and the
+/////// one place it sleeps until someone wants that changed
+///////
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+/////////////////////////////////////////////////////////////////////////////////
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "hpex49xled_super.h"
+
+/////////////////////////////////////////////////////////////////////////
+/// the state is one int changed only by compare and swap, so two requests can never
+/// both win and nothing leaves SUPER_SHUTTING_DOWN. every change writes a byte into a
+/// pipe the supervisor sleeps on - a pipe rather than a condition variable, because a
+/// signal handler may write to it. the supervisor checks the state before it sleeps
+/// and again on every wakeup, so a change made between the two is never slept through
+static int state = SUPER_INIT;
+static int wake_pipe[2] = { -1, -1 };
+
+static const char *names[] = { "Init", "Running", "Reconciling", "ShuttingDown" };
+
+int super_open(void)
+{
+	if ( pipe(wake_pipe) != 0 )
+		return -1;
+	/* a full pipe already has a wakeup pending - writers never block */
+	fcntl(wake_pipe[0], F_SETFL, fcntl(wake_pipe[0], F_GETFL) | O_NONBLOCK);
+	fcntl(wake_pipe[1], F_SETFL, fcntl(wake_pipe[1], F_GETFL) | O_NONBLOCK);
+	return 0;
+};
+
+int super_state(void)
+{
+	return __atomic_load_n(&state, __ATOMIC_ACQUIRE);
+};
+
+const char *super_name( int s )
+{
+	return ( s >= SUPER_INIT && s <= SUPER_SHUTTING_DOWN ) ? names[s] : "?";
+};
+
+static void super_wake(void)
+{
+	const int saved = errno;
+	if ( wake_pipe[1] != -1 && write(wake_pipe[1], "s", 1) < 0 ) { /* already pending */ }
+	errno = saved;
+};
+
+int super_transition( int from, int to )
+{
+	if ( !__atomic_compare_exchange_n(&state, &from, to, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) )
+		return 0;
+	super_wake();
+	return 1;
+};
+
+void super_shutdown(void)
+{
+	__atomic_store_n(&state, SUPER_SHUTTING_DOWN, __ATOMIC_RELEASE);
+	super_wake();
+};
+
+int super_wait( int s )
+{
+	struct pollfd pfd = { .fd = wake_pipe[0], .events = POLLIN };
+	char buf[64];
+	int now;
+
+	while ( (now = super_state()) == s ) {
+		if ( poll(&pfd, 1, -1) < 0 && errno != EINTR )
+			break;
+		while ( read(wake_pipe[0], buf, sizeof(buf)) > 0 )
+			;
+	}
+	return now;
+};
@@ -0,0 +1,58 @@
+#ifndef INCLUDED_HPEX49XLED_SUPER
+#define INCLUDED_HPEX49XLED_SUPER
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_super.h
+///////
+/////// Supervisor state - what the main thread is doing with the monitor, and the
+/////// one place it sleeps until someone wants that changed
+///////
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+/////////////////////////////////////////////////////////////////////////////////
+
+/// Init -> Running -> Reconciling -> Running ... -> ShuttingDown. shutting down can be
+/// requested from any state and is never left
+enum super_state {
+	SUPER_INIT = 0,	///< bringing the monitor up for the first time
+	SUPER_RUNNING,	///< monitor running - the supervisor sleeps
+	SUPER_RECONCILING,	///< the monitor stopped on a device change - re-initialize and restart it
+	SUPER_SHUTTING_DOWN,	///< stop everything and exit
+};
+
+int super_open(void);	///< returns 0 on success
+int super_state(void);	///< enum super_state as of now
+const char *super_name( int state );
+
+/// move from one state to another and wake the supervisor - returns 1 when the state
+/// was from and is now to, 0 when it was something else and is unchanged
+int super_transition( int from, int to );
+
+/// request the shutdown from any state - async signal safe, so signal handlers call it
+void super_shutdown(void);
+
+/// sleep until the state is no longer state - returns the new one
+int super_wait( int state );
+
+#endif //INCLUDED_HPEX49XLED_SUPER
@@ -0,0 +1,190 @@
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_timer.c
+///////
+/////// Event loop timer - absolute CLOCK_MONOTONIC deadlines on kqueue
+/////// (FreeBSD) or timerfd + epoll (Linux), plus a wakeup for shutdown
+///////
+/////// -------------------------------------------------------------------------
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__FreeBSD__)
+#include <sys/types.h>
+#include <sys/event.h>
+#elif defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#endif
+
+#include "hpex49xled_timer.h"
+
+#if defined(__FreeBSD__)
+/////////////////////////////////////////////////////////////////////////
+/// kqueue - a one shot EVFILT_TIMER per wait and an EVFILT_USER event for the wakeup.
+/// NOTE_ABSTIME timers run on CLOCK_REALTIME, so the monotonic deadline is turned
+/// into a relative timeout when the timer is armed. The deadline itself stays
+/// absolute, so the late wakeups never add up from one tick to the next
+#define EVLOOP_TIMER_ID 1
+#define EVLOOP_WAKE_ID 2
+
+static int kq = -1;
+
+int evloop_open(void)
+{
+	struct kevent kev;
+
+	if ( (kq = kqueue()) < 0 )
+		return -1;
+	EV_SET(&kev, EVLOOP_WAKE_ID, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, NULL);
+	if ( kevent(kq, &kev, 1, NULL, 0, NULL) < 0 ) {
+		close(kq);
+		kq = -1;
+		return -1;
+	}
+	return 0;
+};
+
+void evloop_close(void)
+{
+	if ( kq >= 0 ) close(kq);
+	kq = -1;
+};
+
+int evloop_wait( const struct timespec *deadline )
+{
+	struct timespec now;
+	struct kevent kev;
+	int n;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long long ns = timespec_diff_ns(deadline, &now);
+	if ( ns <= 0 )
+		return 0;
+
+	EV_SET(&kev, EVLOOP_TIMER_ID, EVFILT_TIMER, EV_ADD | EV_ONESHOT, NOTE_NSECONDS, ns, NULL);
+	while ( (n = kevent(kq, &kev, 1, &kev, 1, NULL)) < 0 && errno == EINTR )
+		;
+	if ( n < 0 )
+		return -1;
+	return ( kev.filter == EVFILT_USER ) ? 1 : 0;
+};
+
+void evloop_wake(void)
+{
+	struct kevent kev;
+
+	if ( kq < 0 )
+		return;
+	EV_SET(&kev, EVLOOP_WAKE_ID, EVFILT_USER, 0, NOTE_TRIGGER, 0, NULL);
+	kevent(kq, &kev, 1, NULL, 0, NULL);
+};
+
+#elif defined(__linux__)
+/////////////////////////////////////////////////////////////////////////
+/// timerfd armed with TFD_TIMER_ABSTIME on CLOCK_MONOTONIC and an eventfd for the
+/// wakeup, both in one epoll set
+static int ep = -1, tfd = -1, efd = -1;
+
+int evloop_open(void)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+
+	if ( (ep = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+		(tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)) < 0 ||
+		(efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0 ) {
+		evloop_close();
+		return -1;
+	}
+	ev.data.fd = tfd;
+	if ( epoll_ctl(ep, EPOLL_CTL_ADD, tfd, &ev) < 0 ) {
+		evloop_close();
+		return -1;
+	}
+	ev.data.fd = efd;
+	if ( epoll_ctl(ep, EPOLL_CTL_ADD, efd, &ev) < 0 ) {
+		evloop_close();
+		return -1;
+	}
+	return 0;
+};
+
+void evloop_close(void)
+{
+	if ( efd >= 0 ) close(efd);
+	if ( tfd >= 0 ) close(tfd);
+	if ( ep >= 0 ) close(ep);
+	ep = tfd = efd = -1;
+};
+
+int evloop_wait( const struct timespec *deadline )
+{
+	struct itimerspec its = { .it_value = *deadline };
+	struct epoll_event ev;
+	uint64_t count;
+	int n;
+
+	if ( timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL) < 0 )
+		return -1;
+	while ( (n = epoll_wait(ep, &ev, 1, -1)) < 0 && errno == EINTR )
+		;
+	if ( n < 0 )
+		return -1;
+	if ( ev.data.fd == efd ) {
+		if ( read(efd, &count, sizeof(count)) < 0 ) { /* drained - nothing to do */ }
+		return 1;
+	}
+	if ( read(tfd, &count, sizeof(count)) < 0 ) { /* spurious - the deadline is checked by the caller */ }
+	return 0;
+};
+
+void evloop_wake(void)
+{
+	const uint64_t one = 1;
+
+	if ( efd >= 0 && write(efd, &one, sizeof(one)) < 0 ) { /* already signalled */ }
+};
+
+#else
+/////////////////////////////////////////////////////////////////////////
+/// anything else - an absolute clock_nanosleep(), woken only by a signal
+int evloop_open(void) { return 0; }
+void evloop_close(void) { }
+
+int evloop_wait( const struct timespec *deadline )
+{
+	int e = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL);
+	if ( e == EINTR ) return 1;
+	return ( e ) ? -1 : 0;
+};
+
+void evloop_wake(void) { }
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef INCLUDED_HPEX49XLED_TIMER
+#define INCLUDED_HPEX49XLED_TIMER
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_timer.h
+///////
+/////// Event loop timer - absolute CLOCK_MONOTONIC deadlines on kqueue
+/////// (FreeBSD) or timerfd + epoll (Linux), plus a wakeup for shutdown
+///////
+/////// -------------------------------------------------------------------------
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////
+#include <time.h>
+
+int evloop_open(void);	///< returns 0 on success
+void evloop_close(void);
+int evloop_wait( const struct timespec *deadline );	///< sleep until deadline (CLOCK_MONOTONIC) - 0 = deadline, 1 = evloop_wake(), -1 = error
+void evloop_wake(void);	///< end the current or next evloop_wait() early - safe from a signal handler
+
+/// t += ns, normalized
+static inline void timespec_add_ns( struct timespec *t, long ns )
+{
+	t->tv_sec += ns / 1000000000L;
+	t->tv_nsec += ns % 1000000000L;
+	if ( t->tv_nsec >= 1000000000L ) {
+		t->tv_nsec -= 1000000000L;
+		++t->tv_sec;
+	}
+}
+
+/// a - b in nanoseconds
+static inline long long timespec_diff_ns( const struct timespec *a, const struct timespec *b )
+{
+	return (long long)(a->tv_sec - b->tv_sec) * 1000000000LL + (a->tv_nsec - b->tv_nsec);
+}
+
+#endif //INCLUDED_HPEX49XLED_TIMER
@@ -0,0 +1,272 @@
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_update.c
+///////
+/////// freebsd-update watcher - tells whether fetched updates are waiting to be
+/////// installed from freebsd-update's work directory, without running it
+///////
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+/////////////////////////////////////////////////////////////////////////////////
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#if defined(__FreeBSD__)
+#include <sys/event.h>
+#elif defined(__linux__)
+#include <sys/inotify.h>
+#endif
+
+#include "hpex49xled_perf.h"
+#include "hpex49xled_log.h"
+#include "hpex49xled_update.h"
+
+struct update_counters update_stats;
+
+static pthread_t watcher;
+static int update_running = 0;
+static int wake_pipe[2] = { -1, -1 };
+static char workdir[1024];
+static void (*update_changed)( int ready ) = NULL;
+
+int update_workdir( const char *conf, char *dir, size_t len )
+{
+	FILE *f = fopen(conf, "r");
+	char *line = NULL, *p, *end;
+	size_t cap = 0;
+	const char *found = UPDATE_WORKDIR;
+
+	while ( f != NULL && getline(&line, &cap, f) > 0 ) {
+		for ( p = line; isspace((unsigned char)*p); p++ )
+			;
+		if ( strncmp(p, "WorkDir", 7) != 0 || !isspace((unsigned char)p[7]) )
+			continue;
+		for ( p += 7; isspace((unsigned char)*p); p++ )
+			;
+		for ( end = p + strlen(p); end > p && isspace((unsigned char)end[-1]); end-- )
+			;
+		*end = '\0';
+		if ( *p ) {
+			found = p;
+			break;
+		}
+	}
+	const int ok = ( snprintf(dir, len, "%s", found) < (int)len ) ? 0 : -1;
+
+	free(line);
+	if ( f != NULL )
+		fclose(f);
+	return ok;
+};
+
+int updates_ready( const char *dir )
+{
+	char path[1100];
+	struct stat sb;
+
+	if ( stat(dir, &sb) != 0 || !S_ISDIR(sb.st_mode) )
+		return -1;
+	snprintf(path, sizeof(path), "%s/%s-install", dir, UPDATE_BDHASH);
+	return ( lstat(path, &sb) == 0 && S_ISLNK(sb.st_mode) ) ? 1 : 0;
+};
+
+#if defined(__FreeBSD__)
+/////////////////////////////////////////////////////////////////////////
+/// kqueue - EVFILT_VNODE on the work directory. NOTE_WRITE covers entries being
+/// added, removed and renamed, the rest the directory itself going away. the kqueue
+/// is pollable, so the watcher waits on it next to its wake pipe
+static int watch_open( const char *dir, int *dfd )
+{
+	struct kevent kev;
+	int kq, fd;
+
+	if ( (fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1 )
+		return -1;
+	if ( (kq = kqueue()) == -1 ) {
+		close(fd);
+		return -1;
+	}
+	EV_SET(&kev, fd, EVFILT_VNODE, EV_ADD | EV_CLEAR, NOTE_WRITE | NOTE_DELETE | NOTE_RENAME | NOTE_REVOKE, 0, NULL);
+	if ( kevent(kq, &kev, 1, NULL, 0, NULL) == -1 ) {
+		close(kq);
+		close(fd);
+		return -1;
+	}
+	*dfd = fd;
+	return kq;
+};
+
+/// 1 = something in the directory changed, 2 = the directory itself is gone
+static int watch_read( int kq )
+{
+	const struct timespec zero = { 0, 0 };
+	struct kevent kev[8];
+	int n, gone = 0;
+
+	if ( (n = kevent(kq, NULL, 0, kev, 8, &zero)) <= 0 )
+		return 0;
+	for ( int i = 0; i < n; i++ )
+		if ( kev[i].fflags & (NOTE_DELETE | NOTE_RENAME | NOTE_REVOKE) )
+			gone = 1;
+	return ( gone ) ? 2 : 1;
+};
+
+#elif defined(__linux__)
+/////////////////////////////////////////////////////////////////////////
+/// inotify - the same events for the directory's entries and the directory itself
+static int watch_open( const char *dir, int *dfd )
+{
+	const int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+	if ( fd == -1 )
+		return -1;
+	if ( inotify_add_watch(fd, dir, IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR) == -1 ) {
+		close(fd);
+		return -1;
+	}
+	*dfd = -1;
+	return fd;
+};
+
+static int watch_read( int fd )
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	ssize_t n;
+	int r = 0;
+
+	while ( (n = read(fd, buf, sizeof(buf))) > 0 ) {
+		for ( char *p = buf; p < buf + n; p += sizeof(*ev) + ev->len ) {
+			ev = (const struct inotify_event *)p;
+			r |= ( ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED) ) ? 2 : 1;
+		}
+	}
+	return ( r & 2 ) ? 2 : r;
+};
+
+#else
+/////////////////////////////////////////////////////////////////////////
+/// anything else - no watch, the work directory is looked at every UPDATE_RECHECK
+static int watch_open( const char *dir, int *dfd ) { return -1; }
+static int watch_read( int fd ) { return 0; }
+
+#endif
+
+static void watch_close( int fd, int dfd )
+{
+	if ( fd != -1 )
+		close(fd);
+	if ( dfd != -1 )
+		close(dfd);
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// the watch goes up before each check, so a change between the two is never missed.
+/// while the directory can not be watched - freebsd-update has not run yet - it is
+/// looked at again every UPDATE_RECHECK instead
+static void* update_thread( void *arg )
+{
+	struct pollfd pfd[2] = { { .fd = wake_pipe[0], .events = POLLIN }, { .fd = -1, .events = POLLIN } };
+	int ready = -1, warned = 0, dfd = -1;
+
+	for (;;) {
+		if ( pfd[1].fd == -1 && (pfd[1].fd = watch_open(workdir, &dfd)) != -1 )
+			++update_stats.rewatches;
+		if ( pfd[1].fd == -1 && !warned++ )
+			logmsg(LOGC_UPDATE, LOG_NOTICE, "Unable to watch the freebsd-update work directory %s - looking at it every %d minutes", workdir, UPDATE_RECHECK / 60);
+		if ( pfd[1].fd != -1 )
+			warned = 0;
+
+		const int now = ( updates_ready(workdir) == 1 );
+		++update_stats.checks;
+		if ( now != ready )
+			update_changed(now);
+		ready = now;
+		perf_thread_cpu(PERF_THREAD_UPDATE);
+
+		if ( poll(pfd, 2, ( pfd[1].fd == -1 ) ? UPDATE_RECHECK * 1000 : -1) < 0 && errno != EINTR )
+			break;
+		if ( pfd[0].revents )
+			break;
+		if ( pfd[1].revents ) {
+			++update_stats.events;
+			if ( watch_read(pfd[1].fd) == 2 ) {
+				watch_close(pfd[1].fd, dfd);
+				pfd[1].fd = dfd = -1;
+			}
+		}
+	}
+	watch_close(pfd[1].fd, dfd);
+	return NULL;
+};
+
+int update_start( const char *dir, void (*changed)( int ready ) )
+{
+	if ( update_running )
+		return 0;
+	if ( dir == NULL && update_workdir(UPDATE_CONF, workdir, sizeof(workdir)) != 0 ) {
+		fprintf(stderr, "freebsd-update WorkDir in %s is too long\n", UPDATE_CONF);
+		return -1;
+	}
+	if ( dir != NULL && snprintf(workdir, sizeof(workdir), "%s", dir) >= (int)sizeof(workdir) ) {
+		fprintf(stderr, "freebsd-update work directory %s is too long\n", dir);
+		return -1;
+	}
+	update_changed = changed;
+	if ( pipe(wake_pipe) != 0 )
+		goto fail;
+	if ( pthread_create(&watcher, NULL, update_thread, NULL) != 0 ) {
+		close(wake_pipe[0]);
+		close(wake_pipe[1]);
+		goto fail;
+	}
+	update_running = 1;
+	return 0;
+
+fail:
+	fprintf(stderr, "Unable to start the update watcher: %s\n", strerror(errno));
+	return -1;
+};
+
+void update_stop(void)
+{
+	if ( !update_running )
+		return;
+	while ( write(wake_pipe[1], "x", 1) < 0 && errno == EINTR )
+		;
+	pthread_join(watcher, NULL);
+	close(wake_pipe[0]);
+	close(wake_pipe[1]);
+	update_running = 0;
+};
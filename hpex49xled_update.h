@@ -0,0 +1,65 @@
+#ifndef INCLUDED_HPEX49XLED_UPDATE
+#define INCLUDED_HPEX49XLED_UPDATE
+/////////////////////////////////////////////////////////////////////////////
+/////// @file hpex49xled_update.h
+///////
+/////// freebsd-update watcher - tells whether fetched updates are waiting to be
+/////// installed from freebsd-update's work directory, without running it
+///////
+///////
+/////// Copyright (c) 2022 Robert Schmaling
+///////
+/////// This software is provided 'as-is', without any express or implied
+/////// warranty. In no event will the authors be held liable for any damages
+/////// arising from the use of this software.
+///////
+/////// Permission is granted to anyone to use this software for any purpose,
+/////// including commercial applications, and to alter it and redistribute it
+/////// freely, subject to the following restrictions:
+///////
+/////// 1. The origin of this software must not be misrepresented; you must not
+/////// claim that you wrote the original software. If you use this software
+/////// in a product, an acknowledgment in the product documentation would be
+/////// appreciated but is not required.
+///////
+/////// 2. Altered source versions must be plainly marked as such, and must not
+/////// be misrepresented as being the original software.
+///////
+/////// 3. This notice may not be removed or altered from any source
+/////// distribution.
+///////
+/////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+/////////////////////////////////////////////////////////////////////////////////
+#include <sys/types.h>
+
+#define UPDATE_CONF "/etc/freebsd-update.conf" // WorkDir comes from here
+#define UPDATE_WORKDIR "/var/db/freebsd-update" // freebsd-update's WorkDir when the conf sets none
+#define UPDATE_BDHASH "f465c3739385890c221dff1a05e578c6cae0d0430e46996d319db7439f884336" // echo / | sha256 -q
+#define UPDATE_RECHECK 3600 // seconds between checks while the work directory can not be watched
+
+/// what the watcher did - written by the watcher thread only
+struct update_counters {
+	u_int64_t checks;	///< times the work directory was looked at
+	u_int64_t events;	///< directory change notifications
+	u_int64_t rewatches;	///< times the watch was set up again - the directory went or came back
+};
+extern struct update_counters update_stats;
+
+/// WorkDir from the freebsd-update conf file, UPDATE_WORKDIR when it sets none or can
+/// not be read. returns 0 on success, -1 when the result does not fit in len
+int update_workdir( const char *conf, char *dir, size_t len );
+
+/// freebsd-update updatesready without freebsd-update - installable updates are the
+/// <UPDATE_BDHASH>-install link in the work directory, which fetch creates and install
+/// and rollback remove. 1 = ready, 0 = none, -1 = the work directory is not there
+int updates_ready( const char *workdir );
+
+/// start the watcher thread - changed(ready) runs on it once with the state at start and
+/// then whenever the state changes. the work directory is watched with kqueue
+/// EVFILT_VNODE (inotify on Linux) and only looked at again when it changes. workdir NULL
+/// reads UPDATE_CONF. returns 0 on success, -1 with the reason on stderr
+int update_start( const char *workdir, void (*changed)( int ready ) );
+void update_stop(void);	///< never waits on anything but the watcher's own return
+
+#endif //INCLUDED_HPEX49XLED_UPDATE
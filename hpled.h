@@ -49,13 +49,38 @@ struct hpled
 	size_t blue;
 	size_t red;
 	size_t dev_index;
+	int stat_index; /* device index in the disk stats provider */
 	int HDD;
-	char path[12];
+	char path[16];
+};
+
+/* one per bay - published by the monitor thread once per tick */
+struct hpsample
+{
+	u_int64_t tick; /* monitor tick this sample came from */
+	u_int64_t n_read; /* cumulative bytes read at the last tick */
+	u_int64_t n_write; /* cumulative bytes written at the last tick */
+	u_int64_t d_read; /* bytes read since the previous tick */
+	u_int64_t d_write; /* bytes written since the previous tick */
+	u_int64_t ops_read; /* cumulative read transfers */
+	u_int64_t ops_write; /* cumulative write transfers */
+	u_int64_t busy_ns; /* cumulative time with a transaction outstanding */
+	int led; /* LED_BLUE | LED_RED lit once this tick's LED pass ran */
+	int power; /* enum powerstate - what the monitor last knew of the disk */
+	u_int64_t active_ns; /* CLOCK_MONOTONIC nanoseconds of the last tick with activity */
+	u_int64_t standby_ns; /* time spent in standby since the bay came up, the current spell included */
 };
 
 #define LED_DELAY 50000000 // for nanosleep() struct timespec - delay for turning off LEDs in nanoseconds
 #define BLINK_DELAY 8500000 // for nanosleep() struct timespec - blink delay to indicate activity
-#define MAX_HDD_LEDS 4 // Maximum number of Drives to work on - four bays in the HPEX49x and HPEX48x
+#define IDLE_DELAY_MAX 400000000 // default ceiling in nanoseconds for the monitor's idle backoff - see monitor_thread_run()
+#define IDLE_DELAY_LIMIT 5000 // largest --idle in milliseconds
+#define IDLE_BACKOFF_TICKS 3 // idle ticks at LED_DELAY before the monitor starts backing off
+#define HOTPLUG_SETTLE 250000000 // nanoseconds without a device list change before new disks are identified
+#define HOTPLUG_SETTLE_MAX 2000000000 // identify new disks this long after the first change even if the list keeps changing
+#define STANDBY_PULSE 4000000000LL // nanoseconds between the short blue flashes of a bay whose disk is spun down
+#define STANDBY_DELAY_MAX 2000000000 // idle backoff ceiling in nanoseconds while every monitored disk is spun down
+#define CACHE_LINE 64 // keep data written by different threads on separate cache lines
 
 /////////////////////////////////////////////////////////////////////////
 // LED definitions
@@ -70,6 +95,14 @@ enum ledstate {
 	LED_BLINK	= 1 << 2,
 };
 
+/// what a bay's disk is doing - from ATA CHECK POWER MODE, and ACTIVE again on any I/O
+enum powerstate {
+	POWER_UNKNOWN	= 0,	///< not checked since the bay came up
+	POWER_ACTIVE	= 1,
+	POWER_IDLE	= 2,	///< spinning, heads unloaded or in a low power idle mode
+	POWER_STANDBY	= 3,	///< spun down
+};
+
 enum bstate { 
 	OFF = 0,
 	ON = 1,